@@ -10,9 +10,6 @@
 
 #include "a2dp-audio.h"
 
-//#define FHG_BS_STREAM_DEBUG
-
-#include <ctype.h>
 #include <endian.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -24,11 +21,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
+#include <sys/timerfd.h>
 #include <unistd.h>
 
 #include <sbc/sbc.h>
-#if ENABLE_AAC
+#if ENABLE_AAC || ENABLE_USAC
 # include <fdk-aac/aacdecoder_lib.h>
 # include <fdk-aac/aacenc_lib.h>
 # define AACENCODER_LIB_VERSION LIB_VERSION( \
@@ -49,10 +48,18 @@
 #endif
 
 #include "a2dp.h"
+#include "a2dp-bitstream.h"
 #include "a2dp-codecs.h"
+#include "a2dp-jbuf.h"
 #include "a2dp-rtp.h"
+#include "a2dp-sender.h"
+#include "aac.h"
 #include "audio.h"
 #include "bluealsa.h"
+#include "bluealsa-dbus.h"
+#include "io-engine.h"
+#include "plc.h"
+#include "resampler.h"
 #include "sbc.h"
 #include "utils.h"
 #include "shared/defs.h"
@@ -60,19 +67,6 @@
 #include "shared/log.h"
 #include "shared/rt.h"
 
-#ifdef FHG_BS_STREAM_DEBUG
-#define BYTE_TO_BINARY_PATTERN "%c%c%c%c%c%c%c%c"
-#define BYTE_TO_BINARY(byte)  \
-  (byte & 0x80 ? '1' : '0'), \
-  (byte & 0x40 ? '1' : '0'), \
-  (byte & 0x20 ? '1' : '0'), \
-  (byte & 0x10 ? '1' : '0'), \
-  (byte & 0x08 ? '1' : '0'), \
-  (byte & 0x04 ? '1' : '0'), \
-  (byte & 0x02 ? '1' : '0'), \
-  (byte & 0x01 ? '1' : '0')
-#endif // FHG_BS_STREAM_DEBUG
-
 /**
  * Common IO thread data. */
 struct io_thread_data {
@@ -82,57 +76,47 @@ struct io_thread_data {
 	struct asrsync asrs;
 	/* history of BT socket COUTQ bytes */
 	struct { int v[16]; size_t i; } coutq;
+	/* codec algorithmic delay in PCM frames */
+	unsigned int codec_delay;
+	/* the last PCM delay reported to D-Bus clients */
+	unsigned int delay_reported;
 	/* determine whether transport is locked */
 	bool t_locked;
 	/* determine whether audio is paused */
 	bool t_paused;
+	/* optional handler of the data received via the BT socket while
+	 * waiting for the PCM signal (bidirectional codecs only), which
+	 * returns -1 if the BT socket shall not be polled anymore */
+	int (*bt_recv)(void *data);
+	void *bt_recv_data;
 };
 
 /**
- * Scale PCM signal according to the volume configuration. */
+ * Scale PCM signal according to the volume configuration.
+ *
+ * The gain is precomputed by the ba_transport_pcm_volume_update_gain()
+ * function, so this hot path uses integer arithmetic only. */
 static void ba_transport_pcm_scale(
-		const struct ba_transport_pcm *pcm,
+		struct ba_transport_pcm *pcm,
 		void *buffer,
 		size_t samples) {
 
-	size_t frames = samples / pcm->channels;
-
-	if (!pcm->soft_volume) {
-		/* In case of hardware volume control we will perform mute operation,
-		 * because hardware muting is an equivalent of gain=0 which with some
-		 * headsets does not entirely silence audio. */
-		switch (pcm->format) {
-		case BA_TRANSPORT_PCM_FORMAT_S16_2LE:
-			audio_silence_s16_2le(buffer, pcm->channels, frames,
-					pcm->volume[0].muted, pcm->volume[1].muted);
-			break;
-		case BA_TRANSPORT_PCM_FORMAT_S24_4LE:
-		case BA_TRANSPORT_PCM_FORMAT_S32_4LE:
-			audio_silence_s32_4le(buffer, pcm->channels, frames,
-					pcm->volume[0].muted, pcm->volume[1].muted);
-			break;
-		default:
-			g_assert_not_reached();
-		}
-		return;
-	}
-
-	double ch1_scale = 0;
-	double ch2_scale = 0;
-
-	/* scaling based on the decibel formula pow(10, dB / 20) */
-	if (!pcm->volume[0].muted)
-		ch1_scale = pow(10, (0.01 * pcm->volume[0].level) / 20);
-	if (!pcm->volume[1].muted)
-		ch2_scale = pow(10, (0.01 * pcm->volume[1].level) / 20);
+	const size_t frames = samples / pcm->channels;
+	/* gain transition time is 5 ms */
+	const unsigned int ramp = pcm->sampling / 200;
 
 	switch (pcm->format) {
 	case BA_TRANSPORT_PCM_FORMAT_S16_2LE:
-		audio_scale_s16_2le(buffer, pcm->channels, frames, ch1_scale, ch2_scale);
+		audio_gain_scale_s16_2le(buffer, pcm->channels, frames,
+				&pcm->volume[0].gain, &pcm->volume[1].gain, ramp);
 		break;
 	case BA_TRANSPORT_PCM_FORMAT_S24_4LE:
 	case BA_TRANSPORT_PCM_FORMAT_S32_4LE:
-		audio_scale_s32_4le(buffer, pcm->channels, frames, ch1_scale, ch2_scale);
+		audio_gain_scale_s32_4le(buffer, pcm->channels, frames,
+				&pcm->volume[0].gain, &pcm->volume[1].gain, ramp);
+		break;
+	case BA_TRANSPORT_PCM_FORMAT_ENCODED:
+		/* volume of the encoded bitstream can not be changed */
 		break;
 	default:
 		g_assert_not_reached();
@@ -140,9 +124,136 @@ static void ba_transport_pcm_scale(
 
 }
 
+/**
+ * Read PCM signal from the shared memory ring buffer.
+ *
+ * @return On success this function returns the number of bytes read. If
+ *   the ring has been closed or it is corrupted, 0 is returned. If there is
+ *   no data to read, -1 is returned and errno is set to EAGAIN. */
+static ssize_t transport_pcm_shm_read(
+		struct ba_transport_pcm *pcm,
+		void *buffer,
+		size_t len) {
+
+	const size_t sample_size = BA_TRANSPORT_PCM_FORMAT_BYTES(pcm->format);
+	ssize_t ret = 0;
+
+	pthread_mutex_lock(&pcm->shm_mtx);
+
+	if (pcm->shm == NULL)
+		goto final;
+
+	ssize_t avail;
+	if ((avail = shm_ring_avail_read(pcm->shm)) == -1)
+		goto corrupted;
+
+	avail -= avail % sample_size;
+	if (len > (size_t)avail)
+		len = avail;
+
+	if ((ret = shm_ring_read(pcm->shm, buffer, len)) == -1)
+		goto corrupted;
+
+	/* The producer signals the notification only when the ring becomes
+	 * non-empty, but our poll() is level-triggered. Hence, the notification
+	 * is consumed only when the ring has been drained. Then, the ring has to
+	 * be checked once more, so the wake-up generated by the producer in the
+	 * meantime will not be lost. */
+	if (shm_ring_avail_read(pcm->shm) < (ssize_t)sample_size) {
+		eventfd_t tmp;
+		eventfd_read(pcm->shm->fd_data, &tmp);
+		if (shm_ring_avail_read(pcm->shm) >= (ssize_t)sample_size)
+			eventfd_write(pcm->shm->fd_data, 1);
+	}
+
+	if (ret == 0 && !shm_ring_is_closed(pcm->shm)) {
+		errno = EAGAIN;
+		ret = -1;
+	}
+
+final:
+	pthread_mutex_unlock(&pcm->shm_mtx);
+	return ret;
+
+corrupted:
+	error("PCM shared memory ring corrupted: %s", strerror(errno));
+	ret = 0;
+	goto final;
+}
+
+/**
+ * Write PCM signal to the shared memory ring buffer.
+ *
+ * This function blocks until all data is written or the ring is closed.
+ *
+ * @return On success this function returns the number of bytes written.
+ *   If the ring has been closed or it is corrupted, 0 is returned. */
+static ssize_t transport_pcm_shm_write(
+		struct ba_transport_pcm *pcm,
+		const void *buffer,
+		size_t len) {
+
+	const uint8_t *head = buffer;
+	const size_t total = len;
+
+	for (;;) {
+
+		pthread_mutex_lock(&pcm->shm_mtx);
+
+		if (pcm->shm == NULL || shm_ring_is_closed(pcm->shm)) {
+			pthread_mutex_unlock(&pcm->shm_mtx);
+			return 0;
+		}
+
+		ssize_t written = shm_ring_write(pcm->shm, head, len);
+		struct pollfd pfd = { pcm->shm->fd_space, POLLIN, 0 };
+
+		/* The consumer signals the notification only when the ring becomes
+		 * non-full. Consume pending notification and try once more, so the
+		 * wake-up generated in the meantime will not be lost. */
+		if (written != -1 && (size_t)written < len) {
+			eventfd_t tmp;
+			eventfd_read(pcm->shm->fd_space, &tmp);
+			ssize_t ret;
+			if ((ret = shm_ring_write(pcm->shm, head + written, len - written)) == -1)
+				written = -1;
+			else
+				written += ret;
+		}
+
+		pthread_mutex_unlock(&pcm->shm_mtx);
+
+		if (written == -1) {
+			error("PCM shared memory ring corrupted: %s", strerror(errno));
+			return 0;
+		}
+
+		head += written;
+		if ((len -= written) == 0)
+			break;
+
+		/* wait for the consumer to make some space */
+		poll(&pfd, 1, -1);
+
+	}
+
+	return total;
+}
+
 /**
  * Flush read buffer of the transport PCM FIFO. */
 ssize_t ba_transport_pcm_flush(struct ba_transport_pcm *pcm) {
+
+	if (pcm->shm != NULL) {
+		ssize_t rv = 0;
+		pthread_mutex_lock(&pcm->shm_mtx);
+		/* corrupted ring will be closed by the next read */
+		if (pcm->shm != NULL && (rv = shm_ring_drop(pcm->shm)) == -1)
+			rv = 0;
+		pthread_mutex_unlock(&pcm->shm_mtx);
+		return rv / BA_TRANSPORT_PCM_FORMAT_BYTES(pcm->format);
+	}
+
 	ssize_t rv = splice(pcm->fd, NULL, config.null_fd, NULL, 1024 * 32, SPLICE_F_NONBLOCK);
 	if (rv > 0)
 		rv /= BA_TRANSPORT_PCM_FORMAT_BYTES(pcm->format);
@@ -166,9 +277,15 @@ ssize_t ba_transport_pcm_read(
 	 * closed during this call, we will still read correct data, because Linux
 	 * kernel does not decrement file descriptor reference counter until the
 	 * read returns. */
-	while ((ret = read(pcm->fd, buffer, samples * sample_size)) == -1 &&
-			errno == EINTR)
-		continue;
+	if (pcm->shm != NULL) {
+		if ((ret = transport_pcm_shm_read(pcm, buffer, samples * sample_size)) == -1 &&
+				errno == EAGAIN)
+			return -1;
+	}
+	else
+		while ((ret = read(pcm->fd, buffer, samples * sample_size)) == -1 &&
+				errno == EINTR)
+			continue;
 
 	if (ret > 0) {
 		samples = ret / sample_size;
@@ -209,7 +326,16 @@ ssize_t ba_transport_pcm_write(
 	 * to temporally re-enable thread cancellation. */
 	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &oldstate);
 
-	do {
+	if (pcm->shm != NULL) {
+		if ((ret = transport_pcm_shm_write(pcm, head, len)) == 0) {
+			debug("PCM has been closed: %d", pcm->fd);
+			ba_transport_pcm_release(pcm);
+			goto final;
+		}
+		len = 0;
+	}
+
+	while (len != 0) {
 		if ((ret = write(pcm->fd, head, len)) == -1)
 			switch (errno) {
 			case EINTR:
@@ -229,7 +355,7 @@ ssize_t ba_transport_pcm_write(
 			}
 		head += ret;
 		len -= ret;
-	} while (len != 0);
+	}
 
 	/* It is guaranteed, that this function will write data atomically. */
 	ret = samples;
@@ -240,56 +366,77 @@ final:
 }
 
 /**
- * Write data to the BT SEQPACKET socket.
+ * Write PCM signal to the transport PCM FIFO without blocking.
  *
- * Note:
- * This function temporally re-enables thread cancellation! */
-static ssize_t io_thread_write_bt(int fd, const uint8_t *buffer,
-		size_t len, int *coutq, int coutq_init) {
+ * If there is not enough space in the FIFO for the whole PCM signal, the
+ * signal is discarded, so the partial frame will never be written. This
+ * function shall be used by the IO engine tasks, which can not wait for
+ * the PCM client, because the worker thread is shared with other tasks.
+ *
+ * @return On success this function returns the number of written samples.
+ *   If the signal was discarded, -1 is returned and errno is set to EAGAIN.
+ *   If the PCM has been closed (or its shared memory ring is corrupted),
+ *   0 is returned. */
+ssize_t ba_transport_pcm_write_nowait(
+		struct ba_transport_pcm *pcm,
+		void *buffer,
+		size_t samples) {
 
-	struct pollfd pfd = { fd, POLLOUT, 0 };
-	int oldstate;
-	ssize_t ret;
+	const size_t len = samples * BA_TRANSPORT_PCM_FORMAT_BYTES(pcm->format);
+	ssize_t space = len;
+
+	if (pcm->shm != NULL) {
+		pthread_mutex_lock(&pcm->shm_mtx);
+		if (pcm->shm != NULL && !shm_ring_is_closed(pcm->shm))
+			space = shm_ring_avail_write(pcm->shm);
+		pthread_mutex_unlock(&pcm->shm_mtx);
+		if (space == -1) {
+			error("PCM shared memory ring corrupted: %s", strerror(errno));
+			ba_transport_pcm_release(pcm);
+			return 0;
+		}
+	}
+	else {
+		/* if the FIFO capacity is not known, fall back to the regular write */
+		int size, queued;
+		if ((size = fcntl(pcm->fd, F_GETPIPE_SZ)) != -1 &&
+				ioctl(pcm->fd, FIONREAD, &queued) != -1)
+			space = size - queued;
+	}
 
-	/* BT socket is opened in the non-blocking mode. However, this function
-	 * forcefully operates in a blocking mode - it uses poll() when writing
-	 * to the BT socket would block. Hence, it is required to provide a way
-	 * of escaping from the poll() when the IO thread termination request
-	 * has been made by re-enabling thread cancellation. */
-	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &oldstate);
+	if ((size_t)space < len)
+		return errno = EAGAIN, -1;
 
-	if (ioctl(pfd.fd, TIOCOUTQ, coutq) == -1)
-		warn("Couldn't get BT queued bytes: %s", strerror(errno));
-	else
-		*coutq = abs(coutq_init - *coutq);
-
-retry:
-	if ((ret = write(pfd.fd, buffer, len)) == -1)
-		switch (errno) {
-		case EINTR:
-			goto retry;
-		case EAGAIN:
-			poll(&pfd, 1, -1);
-			/* set coutq to some arbitrary big value */
-			*coutq = 1024 * 16;
-			goto retry;
-		}
+	return ba_transport_pcm_write(pcm, buffer, samples);
+}
 
-	pthread_setcancelstate(oldstate, NULL);
-	return ret;
+/**
+ * Check whether the back-channel PCM keeps the IO thread alive.
+ *
+ * For bidirectional codecs, the IO thread has to be running as long as
+ * any of the transport PCMs is opened, not only the main one. */
+static bool a2dp_backchannel_active(struct ba_transport *t,
+		const struct io_thread_data *io) {
+	return io->bt_recv != NULL && t->a2dp.pcm_bc.fd != -1;
 }
 
 /**
  * Poll and read PCM signal from the transport PCM FIFO.
  *
+ * If the IO thread data has the BT receive handler set, the BT socket is
+ * polled as well and the handler is called (with the thread cancellation
+ * disabled) whenever there is data to read.
+ *
  * Note:
  * This function temporally re-enables thread cancellation! */
 static ssize_t a2dp_poll_and_read_pcm(struct ba_transport_pcm *pcm,
 		struct io_thread_data *io, ffb_t *buffer) {
 
 	struct ba_transport *t = pcm->t;
-	struct pollfd fds[2] = {
+	struct pollfd fds[4] = {
 		{ t->sig_fd[0], POLLIN, 0 },
+		{ -1, POLLIN, 0 },
+		{ -1, POLLIN, 0 },
 		{ -1, POLLIN, 0 }};
 
 	/* Allow escaping from the poll() by thread cancellation. */
@@ -297,8 +444,12 @@ static ssize_t a2dp_poll_and_read_pcm(struct ba_transport_pcm *pcm,
 
 repoll:
 
-	/* Add PCM socket to the poll if transport is active. */
-	fds[1].fd = io->t_paused ? -1 : pcm->fd;
+	/* Add PCM socket to the poll if transport is active. However, if we are
+	 * ahead of time, wait for the pacing timer instead. In such case we will
+	 * still be able to dispatch incoming events. */
+	fds[1].fd = io->t_paused || io->asrs.timer_armed ? -1 : pcm->fd;
+	fds[2].fd = io->asrs.timer_armed ? io->asrs.timer_fd : -1;
+	fds[3].fd = io->bt_recv != NULL ? t->bt_fd : -1;
 
 	/* Poll for reading with keep-alive and sync timeout. */
 	switch (poll(fds, ARRAYSIZE(fds), io->timeout)) {
@@ -306,7 +457,7 @@ repoll:
 		pthread_cond_signal(&pcm->synced);
 		io->timeout = -1;
 		io->t_locked = !ba_transport_pthread_cleanup_lock(t);
-		if (pcm->fd == -1)
+		if (pcm->fd == -1 && !a2dp_backchannel_active(t, io))
 			return 0;
 		ba_transport_pthread_cleanup_unlock(t);
 		io->t_locked = false;
@@ -317,6 +468,20 @@ repoll:
 		return -1;
 	}
 
+	if (fds[2].revents & POLLIN) {
+		asrsync_timer_ack(&io->asrs);
+		goto repoll;
+	}
+
+	if (fds[3].revents) {
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+		/* BT socket disconnection will be handled by the sender */
+		if (io->bt_recv(io->bt_recv_data) == -1)
+			io->bt_recv = NULL;
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+		goto repoll;
+	}
+
 	if (fds[0].revents & POLLIN) {
 		/* dispatch incoming event */
 		switch (ba_transport_recv_signal(t)) {
@@ -327,6 +492,8 @@ repoll:
 			io->timeout = -1;
 			goto repoll;
 		case BA_TRANSPORT_SIGNAL_PCM_CLOSE:
+			if (pcm->fd == -1 && a2dp_backchannel_active(t, io))
+				goto repoll;
 			/* reuse PCM read disconnection logic */
 			break;
 		case BA_TRANSPORT_SIGNAL_PCM_PAUSE:
@@ -346,6 +513,9 @@ repoll:
 	ssize_t samples;
 	switch (samples = ba_transport_pcm_read(pcm, buffer->tail, ffb_len_in(buffer))) {
 	case 0:
+		debug("Pacing lateness: avg: %u us, max: %u us, missed: %u/%u",
+				asrsync_get_lateness_avg_usec(&io->asrs), asrsync_get_lateness_max_usec(&io->asrs),
+				io->asrs.lateness.missed, io->asrs.lateness.cycles);
 		io->timeout = config.a2dp.keep_alive * 1000;
 		debug("Keep-alive polling: %d", io->timeout);
 		goto repoll;
@@ -371,6 +541,43 @@ repoll:
 	return ffb_len_out(buffer);
 }
 
+/**
+ * Update A2DP source PCM delay.
+ *
+ * The delay is a sum of the encoding overhead, the codec algorithmic delay
+ * and the time required to transmit data queued for the BT link. The queued
+ * data is converted to time with the ratio of the last encoded chunk size
+ * to the number of PCM frames carried by it. If the delay has changed
+ * noticeably, D-Bus clients are notified.
+ *
+ * @param t Transport structure.
+ * @param io IO thread data structure.
+ * @param coutq The number of bytes waiting for the BT transmission.
+ * @param len The size of the last encoded data chunk.
+ * @param frames The number of PCM frames encoded in the last chunk. */
+static void a2dp_source_update_delay(struct ba_transport *t,
+		struct io_thread_data *io, int coutq, size_t len, size_t frames) {
+
+	/* nothing has been sent, so the estimation would be incomplete */
+	if (len == 0)
+		return;
+
+	struct ba_transport_pcm *pcm = &t->a2dp.pcm;
+	unsigned int delay = asrsync_get_busy_usec(&io->asrs) / 100;
+
+	delay += (uint64_t)io->codec_delay * 10000 / pcm->sampling;
+	delay += (uint64_t)coutq * frames * 10000 / len / pcm->sampling;
+
+	pcm->delay = delay;
+
+	/* notify clients when the delay has changed by more than 10 ms */
+	if (abs((int)(delay - io->delay_reported)) > 100) {
+		io->delay_reported = delay;
+		bluealsa_dbus_pcm_update(pcm, BA_DBUS_PCM_UPDATE_DELAY);
+	}
+
+}
+
 /**
  * Validate BT socket for reading. */
 static int a2dp_validate_bt_sink(struct ba_transport *t) {
@@ -412,13 +619,20 @@ repoll:
 	/* Add BT socket to the poll if transport is active. */
 	fds[1].fd = io->t_paused ? -1 : t->bt_fd;
 
-	if (poll(fds, ARRAYSIZE(fds), -1) == -1) {
+	int ret;
+	if ((ret = poll(fds, ARRAYSIZE(fds), io->timeout)) == -1) {
 		if (errno == EINTR)
 			goto repoll;
 		error("Transport poll error: %s", strerror(errno));
 		return -1;
 	}
 
+	if (ret == 0) {
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+		errno = ETIMEDOUT;
+		return -1;
+	}
+
 	if (fds[0].revents & POLLIN) {
 		/* dispatch incoming event */
 		switch (ba_transport_recv_signal(t)) {
@@ -455,6 +669,93 @@ repoll:
 	return len;
 }
 
+/**
+ * Get the RTP packet due for playout from the jitter buffer.
+ *
+ * The jitter buffer fill level is reported as the PCM delay. If the delay
+ * has changed noticeably, D-Bus clients are notified.
+ *
+ * @return If there is a packet due for playout, this function returns its
+ *   length. Otherwise, 0 is returned. */
+static ssize_t a2dp_jbuf_get_due(struct ba_transport *t, struct io_thread_data *io,
+		struct a2dp_jbuf *jb, const struct timespec *now, const void **packet) {
+
+	unsigned int lost;
+	ssize_t len;
+
+	if ((len = a2dp_jbuf_get(jb, now, packet, &lost)) > 0) {
+
+		if (lost > 0)
+			warn("Missing RTP packets: %u", lost);
+
+		struct ba_transport_pcm *pcm = &t->a2dp.pcm;
+		const unsigned int delay = a2dp_jbuf_get_fill_usec(jb) / 100;
+
+		pcm->delay = delay;
+
+		/* notify clients when the delay has changed by more than 10 ms */
+		if (abs((int)(delay - io->delay_reported)) > 100) {
+			io->delay_reported = delay;
+			bluealsa_dbus_pcm_update(pcm, BA_DBUS_PCM_UPDATE_DELAY);
+		}
+
+	}
+
+	return len;
+}
+
+/**
+ * Discard all packets stored in the jitter buffer. */
+static void a2dp_jbuf_discard(struct a2dp_jbuf *jb) {
+	if (jb->stats.received > 0) {
+		debug("RTP jitter buffer: received: %u, late: %u, lost: %u, resyncs: %u",
+				jb->stats.received, jb->stats.late, jb->stats.lost, jb->stats.resyncs);
+		memset(&jb->stats, 0, sizeof(jb->stats));
+	}
+	a2dp_jbuf_reset(jb);
+}
+
+/**
+ * Poll and read BT signal through the RTP jitter buffer.
+ *
+ * Received RTP packets are stored in the jitter buffer, and this function
+ * returns only when there is a packet due for playout. If the PCM is not
+ * opened, all incoming packets are discarded.
+ *
+ * Note:
+ * This function temporally re-enables thread cancellation! */
+static ssize_t a2dp_poll_and_read_bt_jbuf(struct ba_transport *t,
+		struct io_thread_data *io, ffb_t *buffer, struct a2dp_jbuf *jb,
+		const void **packet) {
+
+	struct timespec now;
+	ssize_t len;
+
+	for (;;) {
+
+		gettimestamp(&now);
+		if ((len = a2dp_jbuf_get_due(t, io, jb, &now, packet)) > 0)
+			return len;
+
+		io->timeout = a2dp_jbuf_timeout(jb, &now);
+		if ((len = a2dp_poll_and_read_bt(t, io, buffer)) == -1 && errno == ETIMEDOUT)
+			continue;
+		if (len <= 0)
+			return len;
+
+		if (t->a2dp.pcm.fd == -1) {
+			a2dp_jbuf_discard(jb);
+			continue;
+		}
+
+		gettimestamp(&now);
+		if (a2dp_jbuf_put(jb, &now, buffer->data, len) == -1)
+			warn("Couldn't buffer RTP packet: %s", strerror(errno));
+
+	}
+
+}
+
 /**
  * Initialize RTP headers.
  *
@@ -482,301 +783,1533 @@ static uint8_t *a2dp_init_rtp(void *s, rtp_header_t **hdr,
 	return data + phdr_size;
 }
 
-static void *a2dp_sink_sbc(struct ba_transport *t) {
+/**
+ * A2DP sink PCM writer.
+ *
+ * If the clock drift compensation is enabled, decoded PCM signal is resampled
+ * according to the drift estimated by the RTP jitter buffer, so the PCM FIFO
+ * is fed at the rate of the local clock. */
+struct a2dp_sink_writer {
+	struct ba_transport_pcm *pcm;
+	const struct a2dp_jbuf *jb;
+	struct resampler rs;
+	ffb_t buffer;
+	/* if true, PCM signal is discarded when the FIFO is full */
+	bool nowait;
+	/* the number of discarded PCM chunks */
+	unsigned int overruns;
+	/* the last PCM chunk has been discarded */
+	bool overrun;
+};
 
-	/* Cancellation should be possible only in the carefully selected place
-	 * in order to prevent memory leaks and resources not being released. */
-	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-	pthread_cleanup_push(PTHREAD_CLEANUP(ba_transport_pthread_cleanup), t);
+/**
+ * Initialize A2DP sink PCM writer.
+ *
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+static int a2dp_sink_writer_init(struct a2dp_sink_writer *w,
+		struct ba_transport_pcm *pcm, const struct a2dp_jbuf *jb) {
+
+	memset(w, 0, sizeof(*w));
+	w->pcm = pcm;
+	w->jb = jb;
+
+	/* resampler supports 16-bit PCM only */
+	if (!config.a2dp.drift_compensation ||
+			pcm->format != BA_TRANSPORT_PCM_FORMAT_S16_2LE)
+		return 0;
 
-	struct io_thread_data io = {
-		/* Lock transport during initialization stage. This lock will ensure,
-		 * that no one will modify critical section until thread state can be
-		 * known - initialization has failed or succeeded. */
-		.t_locked = !ba_transport_pthread_cleanup_lock(t),
-	};
+	/* The conversion ratio is close to 1, so twice the size of the
+	 * resampler input block is more than enough for the output. */
+	if (resampler_init(&w->rs, pcm->channels) == -1 ||
+			ffb_init_int16_t(&w->buffer, RESAMPLER_BLOCK * 2 * pcm->channels) == -1)
+		return -1;
 
-	if (a2dp_validate_bt_sink(t) != 0)
-		goto fail_init;
+	return 0;
+}
 
-	sbc_t sbc;
+/**
+ * Release resources allocated by the A2DP sink PCM writer. */
+static void a2dp_sink_writer_free(struct a2dp_sink_writer *w) {
+	if (w->overruns > 0)
+		debug("PCM FIFO overruns: %u", w->overruns);
+	resampler_free(&w->rs);
+	ffb_free(&w->buffer);
+}
 
-	if ((errno = -sbc_init_a2dp(&sbc, 0, t->a2dp.configuration,
-					t->a2dp.codec->capabilities_size)) != 0) {
-		error("Couldn't initialize SBC codec: %s", strerror(errno));
-		goto fail_init;
-	}
+/**
+ * Write PCM chunk to the FIFO according to the writer blocking mode. */
+static void a2dp_sink_write_fifo(struct a2dp_sink_writer *w, void *buffer, size_t samples) {
 
-	ffb_t bt = { 0 };
-	ffb_t pcm = { 0 };
-	pthread_cleanup_push(PTHREAD_CLEANUP(sbc_finish), &sbc);
-	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &bt);
-	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &pcm);
+	ssize_t ret;
+	if (w->nowait)
+		ret = ba_transport_pcm_write_nowait(w->pcm, buffer, samples);
+	else
+		ret = ba_transport_pcm_write(w->pcm, buffer, samples);
 
-	if (ffb_init_int16_t(&pcm, sbc_get_codesize(&sbc)) == -1 ||
-			ffb_init_uint8_t(&bt, t->mtu_read) == -1) {
-		error("Couldn't create data buffers: %s", strerror(errno));
-		goto fail_ffb;
+	if (ret != -1) {
+		w->overrun = false;
+		return;
 	}
 
-	/* Lock transport during thread cancellation. This handler shall be at
-	 * the top of the cleanup stack - lastly pushed. */
-	pthread_cleanup_push(PTHREAD_CLEANUP(ba_transport_pthread_cleanup_lock), t);
+	if (errno != EAGAIN) {
+		error("FIFO write error: %s", strerror(errno));
+		return;
+	}
 
-	uint16_t seq_number = -1;
-#if DEBUG
-	uint16_t sbc_bitpool = 0;
-#endif
+	/* report only the beginning of every overrun period */
+	if (!w->overrun)
+		warn("PCM FIFO overrun: Discarding decoded audio");
+	w->overrun = true;
+	w->overruns++;
 
-	ba_transport_pthread_cleanup_unlock(t);
-	io.t_locked = false;
+}
 
-	debug("Starting IO loop: %s", ba_transport_type_to_string(t->type));
-	for (;;) {
+/**
+ * Write decoded PCM signal to the transport PCM FIFO. */
+static void a2dp_sink_write(struct a2dp_sink_writer *w, void *buffer, size_t samples) {
 
-		ssize_t len;
-		if ((len = a2dp_poll_and_read_bt(t, &io, &bt)) <= 0) {
-			if (len == -1)
-				error("BT poll and read error: %s", strerror(errno));
-			goto fail;
-		}
+	struct ba_transport_pcm *pcm = w->pcm;
 
-		if (t->a2dp.pcm.fd == -1) {
-			seq_number = -1;
-			continue;
-		}
+	if (w->buffer.data == NULL) {
+		a2dp_sink_write_fifo(w, buffer, samples);
+		return;
+	}
 
-		const rtp_header_t *rtp_header = (rtp_header_t *)bt.data;
-		const rtp_media_header_t *rtp_media_header = (rtp_media_header_t *)&rtp_header->csrc[rtp_header->cc];
-		const uint8_t *rtp_payload = (uint8_t *)(rtp_media_header + 1);
-		size_t rtp_payload_len = len - (rtp_payload - (uint8_t *)rtp_header);
+	const size_t channels = pcm->channels;
+	const int16_t *input = buffer;
+	size_t frames = samples / channels;
 
-#if ENABLE_PAYLOADCHECK
-		if (rtp_header->paytype < 96) {
-			warn("Unsupported RTP payload type: %u", rtp_header->paytype);
-			continue;
-		}
-#endif
+	resampler_set_ratio(&w->rs, 1.0 / a2dp_jbuf_get_drift(w->jb));
 
-		uint16_t _seq_number = be16toh(rtp_header->seq_number);
-		if (++seq_number != _seq_number) {
-			if (seq_number != 0)
-				warn("Missing RTP packet: %u != %u", _seq_number, seq_number);
-			seq_number = _seq_number;
-		}
+	while (frames > 0) {
+		const size_t len = MIN(frames, RESAMPLER_BLOCK);
+		const size_t n = resampler_process(&w->rs, input, len,
+				w->buffer.data, w->buffer.nmemb / channels);
+		a2dp_sink_write_fifo(w, w->buffer.data, n * channels);
+		input += len * channels;
+		frames -= len;
+	}
 
-		/* decode retrieved SBC frames */
-		size_t frames = rtp_media_header->frame_count;
-		while (frames--) {
+}
 
-			ssize_t len;
-			size_t decoded;
+struct a2dp_source;
+struct a2dp_sink;
 
-			if ((len = sbc_decode(&sbc, rtp_payload, rtp_payload_len,
-							pcm.data, ffb_blen_in(&pcm), &decoded)) < 0) {
-				error("SBC decoding error: %s", strerror(-len));
-				break;
-			}
+/**
+ * A2DP source codec interface.
+ *
+ * The codec is responsible for the PCM to bitstream conversion only. The
+ * PCM buffering, RTP packetization, pacing and BT transmission is done by
+ * the generic source pipeline - see a2dp_source_pipeline(). */
+struct a2dp_source_codec {
+
+	/* the size of the codec private data */
+	size_t priv_size;
+	/* if true, payload is encapsulated in the RTP packet */
+	bool rtp;
+	/* the size of the RTP payload header */
+	size_t rtp_phdr_size;
+	/* if true, payload exceeding the writing MTU can be fragmented */
+	bool fragmentation;
+	/* if true, input is a pre-encoded bitstream and the encode() callback
+	 * shall account transmitted PCM frames in the frames field */
+	bool passthrough;
+
+	/**
+	 * Initialize the encoder and set up the frame geometry, i.e. the
+	 * pcm_samples, pcm_buffer_samples and optionally the payload_size
+	 * fields of the source structure.
+	 *
+	 * @return On success this function returns 0. Otherwise, -1 is
+	 *   returned. Upon error, the codec shall log the reason. */
+	int (*init)(struct a2dp_source *s);
+
+	/**
+	 * Release resources allocated by the encoder. This function is
+	 * called even if the initialization has failed. */
+	void (*free)(struct a2dp_source *s);
+
+	/**
+	 * Encode PCM samples into the RTP payload.
+	 *
+	 * @param pcm Interleaved PCM samples in the transport PCM format.
+	 * @param samples The number of available PCM samples.
+	 * @param consumed The address where the number of consumed PCM samples
+	 *   shall be stored.
+	 * @param payload The payload buffer located right after the RTP payload
+	 *   header (if any), which shall be updated by this function.
+	 * @param len The capacity of the payload buffer.
+	 * @return This function returns the length of the payload ready for
+	 *   transmission or 0 if encoder needs more data. Upon error, -1 is
+	 *   returned and the PCM data is discarded. */
+	ssize_t (*encode)(struct a2dp_source *s, const void *pcm, size_t samples,
+			size_t *consumed, uint8_t *payload, size_t len);
+
+	/**
+	 * Update the RTP payload header for the payload fragment starting at
+	 * the given offset. This callback is optional. */
+	void (*fragment)(struct a2dp_source *s, size_t offset);
+
+	/**
+	 * Adapt the encoder bit rate to the BT link state. It is called after
+	 * every encode() call with the length of the transmitted payload. This
+	 * callback is optional. */
+	void (*abr)(struct a2dp_source *s, size_t len);
+
+	/**
+	 * Process data received via the BT socket, e.g. decode the audio of
+	 * the back-channel. This callback is optional.
+	 *
+	 * @return This function returns -1 if the BT socket can not be read
+	 *   anymore. Otherwise, 0 is returned. */
+	int (*backchannel)(struct a2dp_source *s);
 
-#if DEBUG
-			if (sbc_bitpool != sbc.bitpool) {
-				sbc_bitpool = sbc.bitpool;
-				sbc_print_internals(&sbc);
-			}
-#endif
+};
 
-			rtp_payload += len;
-			rtp_payload_len -= len;
+/* the tolerance of the playback synchronization in 1/10 of millisecond */
+#define A2DP_SOURCE_SYNC_TOLERANCE 20
 
-			const size_t samples = decoded / sizeof(int16_t);
-			if (ba_transport_pcm_write(&t->a2dp.pcm, pcm.data, samples) == -1)
-				error("FIFO write error: %s", strerror(errno));
+/**
+ * Playback synchronization state of a single BT link. */
+struct a2dp_source_sync {
+	/* smoothed time of data waiting in the BT socket */
+	unsigned int bt_delay;
+	/* overall playback latency of the link */
+	unsigned int latency;
+	/* currently applied compensating delay */
+	unsigned int hold;
+	/* the smoothed BT delay has been seeded */
+	bool initialized;
+};
 
-		}
+/**
+ * A2DP source pipeline state. */
+struct a2dp_source {
 
-	}
+	struct ba_transport *t;
+	const struct a2dp_source_codec *codec;
+	struct io_thread_data io;
+	struct a2dp_sender sender;
 
-fail:
-	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-	pthread_cleanup_pop(!io.t_locked);
-fail_ffb:
-	pthread_cleanup_pop(1);
-	pthread_cleanup_pop(1);
-	pthread_cleanup_pop(1);
-fail_init:
-	pthread_cleanup_pop(1);
-	return NULL;
-}
+	/* codec private data */
+	void *priv;
 
-static void *a2dp_source_sbc(struct ba_transport *t) {
+	/* the minimal number of PCM samples required by the encoder */
+	size_t pcm_samples;
+	/* the capacity of the PCM buffer in samples */
+	size_t pcm_buffer_samples;
+	/* the capacity of the payload buffer in bytes */
+	size_t payload_size;
 
-	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-	pthread_cleanup_push(PTHREAD_CLEANUP(ba_transport_pthread_cleanup), t);
+	ffb_t pcm;
+	ffb_t bt;
 
-	struct io_thread_data io = {
-		.timeout = -1,
-		/* Lock transport during initialization stage. This lock will ensure,
-		 * that no one will modify critical section until thread state can be
-		 * known - initialization has failed or succeeded. */
-		.t_locked = !ba_transport_pthread_cleanup_lock(t),
-	};
+	/* RTP headers and the payload anchor */
+	rtp_header_t *rtp_header;
+	void *rtp_phdr;
+	uint8_t *payload;
+
+	uint16_t seq_number;
+	uint32_t timestamp;
+	uint32_t timestamp_base;
+	/* PCM frames transmitted since the stream start */
+	uint64_t frames_sent;
+	/* PCM frames encoded since the last transmission */
+	size_t frames;
+
+	/* playback synchronization state of the leader link */
+	struct a2dp_source_sync sync;
+
+	/* BT links of the broadcast group members */
+	struct {
+		struct ba_transport *t;
+		struct a2dp_sender sender;
+		struct a2dp_source_sync sync;
+		int bt_fd;
+		bool disconnected;
+	} bcast[BA_TRANSPORT_BROADCAST_MEMBERS_MAX];
+	size_t bcast_len;
+	/* broadcast group version of the links above */
+	unsigned int bcast_version;
+	/* the last playback skew reported via D-Bus */
+	unsigned int bcast_skew_reported;
 
-	sbc_t sbc;
+};
 
-	if ((errno = -sbc_init_a2dp(&sbc, 0, t->a2dp.configuration,
-					t->a2dp.codec->capabilities_size)) != 0) {
-		error("Couldn't initialize SBC codec: %s", strerror(errno));
-		goto fail_init;
+/**
+ * Release BT links of the broadcast group members. */
+static void a2dp_source_broadcast_free(struct a2dp_source *s) {
+	size_t i;
+	for (i = 0; i < s->bcast_len; i++) {
+		a2dp_sender_free(&s->bcast[i].sender);
+		ba_transport_unref(s->bcast[i].t);
+		close(s->bcast[i].bt_fd);
 	}
+	s->bcast_len = 0;
+}
 
-	ffb_t bt = { 0 };
-	ffb_t pcm = { 0 };
-	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &bt);
-	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &pcm);
-	pthread_cleanup_push(PTHREAD_CLEANUP(sbc_finish), &sbc);
+/**
+ * Update the playback skew of the broadcast group. */
+static void a2dp_source_broadcast_set_skew(struct a2dp_source *s, unsigned int skew) {
 
-	const a2dp_sbc_t *configuration = (a2dp_sbc_t *)t->a2dp.configuration;
-	const size_t sbc_pcm_samples = sbc_get_codesize(&sbc) / sizeof(int16_t);
-	const unsigned int channels = t->a2dp.pcm.channels;
-	const unsigned int samplerate = t->a2dp.pcm.sampling;
+	struct ba_transport *t = s->t;
+	__atomic_store_n(&t->a2dp.broadcast.skew, skew, __ATOMIC_RELAXED);
 
-	/* initialize SBC encoder bit-pool */
-	sbc.bitpool = sbc_a2dp_get_bitpool(configuration, config.sbc_quality);
+	/* notify clients when the skew has changed by more than 1 ms */
+	if (abs((int)(skew - s->bcast_skew_reported)) > 10) {
+		s->bcast_skew_reported = skew;
+		bluealsa_dbus_pcm_update(&t->a2dp.pcm, BA_DBUS_PCM_UPDATE_SYNC_SKEW);
+	}
 
-#if DEBUG
-	sbc_print_internals(&sbc);
-#endif
+}
 
-	/* Writing MTU should be big enough to contain RTP header, SBC payload
-	 * header and at least one SBC frame. In general, there is no constraint
-	 * for the MTU value, but the speed might suffer significantly. */
-	const size_t mtu_write_payload = t->mtu_write - RTP_HEADER_LEN - sizeof(rtp_media_header_t);
-	const size_t sbc_frame_len = sbc_get_frame_length(&sbc);
+/**
+ * Synchronize BT links with the broadcast group members.
+ *
+ * Every member gets its own BT sender, so the congestion of one link will
+ * neither stall the encoder nor other links - packets which can not be sent
+ * on time are dropped for the congested member only. */
+static void a2dp_source_broadcast_update(struct a2dp_source *s) {
 
-	if (mtu_write_payload < sbc_frame_len)
-		warn("Writing MTU too small for one single SBC frame: %zu < %zu",
-				t->mtu_write, RTP_HEADER_LEN + sizeof(rtp_media_header_t) + sbc_frame_len);
+	struct ba_transport *t = s->t;
+	struct ba_transport_broadcast_link links[BA_TRANSPORT_BROADCAST_MEMBERS_MAX];
+	size_t i, len;
+
+	if (__atomic_load_n(&t->a2dp.broadcast.version, __ATOMIC_RELAXED) == s->bcast_version)
+		return;
+
+	a2dp_source_broadcast_free(s);
+	len = ba_transport_broadcast_get_links(t, links, &s->bcast_version);
+
+	/* start synchronization from scratch */
+	memset(&s->sync, 0, sizeof(s->sync));
+	a2dp_sender_set_delay(&s->sender, 0);
+	a2dp_source_broadcast_set_skew(s, 0);
+
+	for (i = 0; i < len; i++) {
+
+		if (links[i].mtu_write < t->mtu_write) {
+			warn("Broadcast member MTU too small: %zu < %zu", links[i].mtu_write, t->mtu_write);
+			goto skip;
+		}
+
+		if (a2dp_sender_init(&s->bcast[s->bcast_len].sender, links[i].bt_fd,
+					links[i].bt_fd_coutq_init, t->mtu_write) == -1) {
+			error("Couldn't create BT sender: %s", strerror(errno));
+			goto skip;
+		}
+
+		s->bcast[s->bcast_len].t = links[i].t;
+		s->bcast[s->bcast_len].bt_fd = links[i].bt_fd;
+		memset(&s->bcast[s->bcast_len].sync, 0, sizeof(s->bcast[s->bcast_len].sync));
+		s->bcast[s->bcast_len].disconnected = false;
+		s->bcast_len++;
+		continue;
+
+skip:
+		ba_transport_unref(links[i].t);
+		close(links[i].bt_fd);
+	}
+
+	debug("Broadcast group links: %zu", s->bcast_len);
+
+}
+
+/**
+ * Replicate RTP packet to all broadcast group members. */
+static void a2dp_source_broadcast_send(struct a2dp_source *s,
+		const void *packet, size_t len) {
+
+	size_t i;
+	for (i = 0; i < s->bcast_len; i++) {
+
+		if (s->bcast[i].disconnected)
+			continue;
+
+		if (a2dp_sender_send(&s->bcast[i].sender, packet, len, NULL) == -1) {
+			if (errno == ECONNRESET || errno == ENOTCONN) {
+				/* disconnected member shall not terminate the group */
+				debug("Broadcast member BT socket disconnected: %d", s->bcast[i].bt_fd);
+				s->bcast[i].disconnected = true;
+				continue;
+			}
+			error("Broadcast member BT socket write error: %s", strerror(errno));
+		}
+
+	}
+
+}
+
+/**
+ * Update the playback latency estimation of a single BT link.
+ *
+ * The latency consists of the delay reported by the remote device via the
+ * AVDTP and the time of data waiting in the BT socket. The latter one is
+ * smoothed, because it fluctuates by the whole packet on every write.
+ *
+ * @return This function returns the latency in 1/10 of millisecond. */
+static unsigned int a2dp_source_sync_latency(struct a2dp_source_sync *sync,
+		const struct ba_transport *t, const struct a2dp_sender *sender,
+		size_t len, size_t frames, unsigned int sampling) {
+
+	const unsigned int delay = (uint64_t)a2dp_sender_get_coutq(sender) *
+		frames * 10000 / len / sampling;
+
+	if (!sync->initialized)
+		sync->bt_delay = delay;
+	sync->bt_delay += ((int)delay - (int)sync->bt_delay) / 16;
+	sync->initialized = true;
+
+	return sync->latency = __atomic_load_n(&t->a2dp.delay, __ATOMIC_RELAXED) + sync->bt_delay;
+}
+
+/**
+ * Apply the compensating delay to a single BT link.
+ *
+ * In order not to disturb the playback with constant small adjustments,
+ * the delay is changed only if the difference exceeds the tolerance. */
+static void a2dp_source_sync_hold(struct a2dp_source_sync *sync,
+		struct a2dp_sender *sender, unsigned int target, unsigned int hold_max) {
+
+	unsigned int hold = MIN(target - sync->latency, hold_max);
+	if (abs((int)(hold - sync->hold)) > A2DP_SOURCE_SYNC_TOLERANCE) {
+		debug("Playback sync hold: %u.%u ms", hold / 10, hold % 10);
+		a2dp_sender_set_delay(sender, hold * 100);
+		sync->hold = hold;
+	}
+
+}
+
+/**
+ * Equalize playback latency of all broadcast group links.
+ *
+ * Every link is held back by the difference between the latency of the
+ * slowest link and its own latency, so all devices shall play the given
+ * sample at the same time. The hold time is limited by the capacity of
+ * the BT sender queue - packets are held in that queue.
+ *
+ * @param s The A2DP source pipeline.
+ * @param len The size of the last encoded payload.
+ * @param packets The number of RTP packets used for the last payload. */
+static void a2dp_source_broadcast_sync(struct a2dp_source *s,
+		size_t len, size_t packets) {
+
+	const struct ba_transport *t = s->t;
+	const unsigned int sampling = t->a2dp.pcm.sampling;
+	unsigned int target, lo, hi;
+	size_t i;
+
+	if (s->bcast_len == 0 || s->frames == 0)
+		return;
+
+	target = a2dp_source_sync_latency(&s->sync, t, &s->sender, len, s->frames, sampling);
+	for (i = 0; i < s->bcast_len; i++)
+		if (!s->bcast[i].disconnected)
+			target = MAX(target, a2dp_source_sync_latency(&s->bcast[i].sync,
+						s->bcast[i].t, &s->bcast[i].sender, len, s->frames, sampling));
+
+	/* keep half of the queue for the congestion handling */
+	const unsigned int hold_max = (uint64_t)s->frames * 10000 / sampling *
+		(A2DP_SENDER_QUEUE_SIZE / 2) / packets;
+
+	a2dp_source_sync_hold(&s->sync, &s->sender, target, hold_max);
+	lo = hi = s->sync.latency + s->sync.hold;
+
+	for (i = 0; i < s->bcast_len; i++) {
+		if (s->bcast[i].disconnected)
+			continue;
+		a2dp_source_sync_hold(&s->bcast[i].sync, &s->bcast[i].sender, target, hold_max);
+		const unsigned int latency = s->bcast[i].sync.latency + s->bcast[i].sync.hold;
+		lo = MIN(lo, latency);
+		hi = MAX(hi, latency);
+	}
+
+	a2dp_source_broadcast_set_skew(s, hi - lo);
+
+}
+
+/**
+ * Release resources allocated by the A2DP source pipeline. */
+static void a2dp_source_free(struct a2dp_source *s) {
+	if (s->priv != NULL)
+		s->codec->free(s);
+	free(s->priv);
+	asrsync_timer_free(&s->io.asrs);
+	a2dp_sender_free(&s->sender);
+	a2dp_source_broadcast_free(s);
+	ffb_free(&s->pcm);
+	ffb_free(&s->bt);
+}
+
+/**
+ * Dispatch data received via the BT socket to the source codec. */
+static int a2dp_source_bt_recv(void *data) {
+	struct a2dp_source *s = data;
+	return s->codec->backchannel(s);
+}
+
+/**
+ * Transmit encoded payload via the BT socket.
+ *
+ * If the payload does not fit into the writing MTU and the codec allows the
+ * fragmentation, the payload is spread across multiple RTP packets. In order
+ * not to move the payload data, headers of every subsequent fragment are
+ * written in place of the already transmitted part of the payload.
+ *
+ * @return On success this function returns 0. If the BT socket has been
+ *   disconnected, -1 is returned. */
+static int a2dp_source_send(struct a2dp_source *s, size_t len) {
+
+	struct ba_transport *t = s->t;
+	const struct a2dp_source_codec *codec = s->codec;
+	const size_t headers_len = s->payload - (uint8_t *)s->bt.data;
+	const size_t fragment_len_max = codec->fragmentation ?
+		t->mtu_write - headers_len : len;
+	uint8_t *packet = s->bt.data;
+	size_t offset = 0;
+	size_t packets = 0;
+
+	if (codec->rtp)
+		s->rtp_header->timestamp = htobe32(s->timestamp);
+
+	for (;;) {
+
+		const size_t fragment_len = MIN(len - offset, fragment_len_max);
+
+		if (codec->rtp) {
+			s->rtp_header->seq_number = htobe16(++s->seq_number);
+			if (codec->fragmentation)
+				s->rtp_header->markbit = offset + fragment_len == len;
+		}
+
+		if (codec->fragment != NULL)
+			codec->fragment(s, offset);
+
+		if (offset > 0) {
+			packet = s->payload + offset - headers_len;
+			memcpy(packet, s->bt.data, headers_len);
+		}
+
+		s->io.coutq.i = (s->io.coutq.i + 1) % ARRAYSIZE(s->io.coutq.v);
+		if (a2dp_sender_send(&s->sender, packet, headers_len + fragment_len,
+					&s->io.coutq.v[s->io.coutq.i]) == -1) {
+			if (errno == ECONNRESET || errno == ENOTCONN) {
+				/* exit thread upon BT socket disconnection */
+				debug("BT socket disconnected: %d", t->bt_fd);
+				return -1;
+			}
+			error("BT socket write error: %s", strerror(errno));
+			break;
+		}
+
+		a2dp_source_broadcast_send(s, packet, headers_len + fragment_len);
+		packets++;
+
+		if ((offset += fragment_len) == len)
+			break;
+
+		debug("Payload fragmentation: extra %zu bytes", len - offset);
+
+	}
+
+	a2dp_source_update_delay(t, &s->io, s->io.coutq.v[s->io.coutq.i], len, s->frames);
+	if (packets > 0)
+		a2dp_source_broadcast_sync(s, len, packets);
+
+	/* Get a timestamp for the next RTP packet. The timestamp is derived from
+	 * the total number of frames, so the rounding error will not build up. */
+	s->frames_sent += s->frames;
+	s->timestamp = s->timestamp_base + s->frames_sent * 10000 / t->a2dp.pcm.sampling;
+	s->frames = 0;
+
+	return 0;
+}
+
+/**
+ * Generic A2DP source IO thread.
+ *
+ * @param t Transport structure.
+ * @param codec Source codec used for encoding.
+ * @return This function always returns NULL. */
+static void *a2dp_source_pipeline(struct ba_transport *t,
+		const struct a2dp_source_codec *codec) {
+
+	/* Cancellation should be possible only in the carefully selected place
+	 * in order to prevent memory leaks and resources not being released. */
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	pthread_cleanup_push(PTHREAD_CLEANUP(ba_transport_pthread_cleanup), t);
+
+	struct a2dp_source s = {
+		.t = t,
+		.codec = codec,
+		.io = {
+			.timeout = -1,
+			/* Lock transport during initialization stage. This lock will ensure,
+			 * that no one will modify critical section until thread state can be
+			 * known - initialization has failed or succeeded. */
+			.t_locked = !ba_transport_pthread_cleanup_lock(t),
+			.asrs.timer_fd = -1,
+		},
+	};
 
-	if (ffb_init_int16_t(&pcm, sbc_pcm_samples * (mtu_write_payload / sbc_frame_len)) == -1 ||
-			ffb_init_uint8_t(&bt, t->mtu_write) == -1) {
+	pthread_cleanup_push(PTHREAD_CLEANUP(a2dp_source_free), &s);
+
+	const size_t headers_len = codec->rtp ? RTP_HEADER_LEN + codec->rtp_phdr_size : 0;
+	const size_t sample_size = BA_TRANSPORT_PCM_FORMAT_BYTES(t->a2dp.pcm.format);
+
+	/* Headers of the payload fragment are written in place of the already
+	 * transmitted payload, so the fragment has to be longer than headers. */
+	if (t->mtu_write < headers_len * 2) {
+		error("Writing MTU too small: %zu", t->mtu_write);
+		goto fail_init;
+	}
+
+	/* by default, the payload shall fit into the writing MTU */
+	s.payload_size = t->mtu_write - headers_len;
+
+	if ((s.priv = calloc(1, codec->priv_size)) == NULL) {
+		error("Couldn't create codec data: %s", strerror(errno));
+		goto fail_init;
+	}
+
+	if (codec->init(&s) == -1)
+		goto fail_init;
+
+	if (ffb_init_ring(&s.pcm, s.pcm_buffer_samples, sample_size) == -1 ||
+			ffb_init_uint8_t(&s.bt, headers_len + s.payload_size) == -1) {
 		error("Couldn't create data buffers: %s", strerror(errno));
-		goto fail_ffb;
+		goto fail_init;
 	}
 
+	if (a2dp_sender_init(&s.sender, t->bt_fd, t->a2dp.bt_fd_coutq_init, t->mtu_write) == -1) {
+		error("Couldn't create BT sender: %s", strerror(errno));
+		goto fail_init;
+	}
+
+	if (asrsync_timer_create(&s.io.asrs) == -1) {
+		error("Couldn't create pacing timer: %s", strerror(errno));
+		goto fail_init;
+	}
+
+	/* Lock transport during thread cancellation. This handler shall be at
+	 * the top of the cleanup stack - lastly pushed. */
 	pthread_cleanup_push(PTHREAD_CLEANUP(ba_transport_pthread_cleanup_lock), t);
 
-	rtp_header_t *rtp_header;
-	rtp_media_header_t *rtp_media_header;
+	s.payload = s.bt.data;
+	if (codec->rtp) {
+		/* initialize RTP headers and get anchor for payload */
+		s.payload = a2dp_init_rtp(s.bt.data, &s.rtp_header,
+				&s.rtp_phdr, codec->rtp_phdr_size);
+		s.seq_number = be16toh(s.rtp_header->seq_number);
+		s.timestamp = s.timestamp_base = be32toh(s.rtp_header->timestamp);
+	}
 
-	/* initialize RTP headers and get anchor for payload */
-	uint8_t *rtp_payload = a2dp_init_rtp(bt.data, &rtp_header,
-			(void **)&rtp_media_header, sizeof(*rtp_media_header));
-	uint16_t seq_number = be16toh(rtp_header->seq_number);
-	uint32_t timestamp = be32toh(rtp_header->timestamp);
+	if (codec->backchannel != NULL) {
+		s.io.bt_recv = a2dp_source_bt_recv;
+		s.io.bt_recv_data = &s;
+	}
 
 	ba_transport_pthread_cleanup_unlock(t);
-	io.t_locked = false;
+	s.io.t_locked = false;
 
 	debug("Starting IO loop: %s", ba_transport_type_to_string(t->type));
 	for (;;) {
 
 		ssize_t samples;
-		if ((samples = a2dp_poll_and_read_pcm(&t->a2dp.pcm, &io, &pcm)) <= 0) {
+		if ((samples = a2dp_poll_and_read_pcm(&t->a2dp.pcm, &s.io, &s.pcm)) <= 0) {
 			if (samples == -1)
 				error("PCM poll and read error: %s", strerror(errno));
 			goto fail;
 		}
 
-		/* anchor for RTP payload */
-		bt.tail = rtp_payload;
+		a2dp_source_broadcast_update(&s);
 
-		const int16_t *input = pcm.data;
+		const uint8_t *input = s.pcm.data;
 		size_t input_len = samples;
-		size_t output_len = ffb_len_in(&bt);
 		size_t pcm_frames = 0;
-		size_t sbc_frames = 0;
 
-		/* Generate as many SBC frames as possible, but less than a 4-bit media
-		 * header frame counter can contain. The size of the output buffer is
-		 * based on the socket MTU, so such transfer should be most efficient. */
-		while (input_len >= sbc_pcm_samples &&
-				output_len >= sbc_frame_len &&
-				sbc_frames < ((1 << 4) - 1)) {
+		/* encode and transfer obtained data */
+		while (input_len >= s.pcm_samples) {
 
+			const size_t frames = s.frames;
+			size_t consumed = 0;
 			ssize_t len;
-			ssize_t encoded;
 
-			if ((len = sbc_encode(&sbc, input, input_len * sizeof(int16_t),
-							bt.tail, output_len, &encoded)) < 0) {
-				error("SBC encoding error: %s", strerror(-len));
+			if ((len = codec->encode(&s, input, input_len, &consumed,
+							s.payload, s.payload_size)) == -1) {
+				input_len = 0;
 				break;
 			}
 
-			len = len / sizeof(int16_t);
-			input += len;
-			input_len -= len;
-			ffb_seek(&bt, encoded);
-			output_len -= encoded;
-			pcm_frames += len / channels;
-			sbc_frames++;
+			input += consumed * sample_size;
+			input_len -= consumed;
+			if (!codec->passthrough)
+				s.frames += consumed / t->a2dp.pcm.channels;
+			pcm_frames += s.frames - frames;
+
+			if (len > 0 && a2dp_source_send(&s, len) == -1)
+				goto fail;
+
+			if (codec->abr != NULL)
+				codec->abr(&s, len);
+
+			/* encoder is waiting for more data */
+			if (len == 0 && consumed == 0)
+				break;
+
+		}
+
+		/* keep data transfer at a constant bit rate */
+		if (pcm_frames > 0)
+			asrsync_timer_arm(&s.io.asrs, pcm_frames);
+
+		/* If the input buffer was not consumed (due to codesize limit), we
+		 * have to append new data to the existing one. Since we are using
+		 * the ring buffer, this operation does not move any data. */
+		ffb_shift(&s.pcm, samples - input_len);
+
+	}
+
+fail:
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	pthread_cleanup_pop(!s.io.t_locked);
+fail_init:
+	pthread_cleanup_pop(1);
+	pthread_cleanup_pop(1);
+	return NULL;
+}
+
+/**
+ * A2DP sink codec interface.
+ *
+ * The codec is responsible for the bitstream to PCM conversion only. The
+ * RTP depacketization, jitter buffering, loss concealment and PCM output is
+ * done by the generic sink pipeline - see a2dp_sink_pipeline(). */
+struct a2dp_sink_codec {
+
+	/* the size of the codec private data */
+	size_t priv_size;
+	/* if true, payload is encapsulated in the RTP packet */
+	bool rtp;
+	/* the size of the RTP payload header */
+	size_t rtp_phdr_size;
+	/* if true, payload fragments are reassembled based on the RTP mark bit */
+	bool fragmentation;
+
+	/**
+	 * Initialize the decoder and set the pcm_samples field of the sink
+	 * structure to the size of the decoded PCM buffer.
+	 *
+	 * @return On success this function returns 0. Otherwise, -1 is
+	 *   returned. Upon error, the codec shall log the reason. */
+	int (*init)(struct a2dp_sink *s);
+
+	/**
+	 * Release resources allocated by the decoder. This function is
+	 * called even if the initialization has failed. */
+	void (*free)(struct a2dp_sink *s);
+
+	/**
+	 * Decode the RTP payload. Decoded PCM signal shall be passed to the
+	 * a2dp_sink_output() function.
+	 *
+	 * @param phdr The RTP payload header or NULL if rtp is not set.
+	 * @param payload The RTP payload (reassembled if fragmentation is set).
+	 * @param len The length of the payload. */
+	void (*decode)(struct a2dp_sink *s, const void *phdr,
+			const uint8_t *payload, size_t len);
+
+	/**
+	 * Synthesize PCM signal in place of the lost frames. This callback is
+	 * optional - by default the generic packet loss concealment is used.
+	 * It shall return the number of PCM frames actually written. */
+	unsigned int (*conceal)(struct a2dp_sink *s, unsigned int frames);
+
+};
+
+/**
+ * A2DP sink pipeline state. */
+struct a2dp_sink {
+
+	struct ba_transport *t;
+	const struct a2dp_sink_codec *codec;
+	struct io_thread_data io;
+	struct a2dp_jbuf jb;
+	struct a2dp_sink_writer writer;
+	struct plc plc;
+
+	/* codec private data */
+	void *priv;
+
+	/* the capacity of the decoded PCM buffer in samples */
+	size_t pcm_samples;
+
+	ffb_t bt;
+	ffb_t pcm;
+	/* reassembly buffer for fragmented payload */
+	ffb_t payload;
+
+	/* RTP mark bit quirk detection counter */
+	int markbit_quirk;
+	/* the last seen value of the lost packets counter */
+	unsigned int lost;
+	/* RTP timestamp of the payload being decoded */
+	uint32_t timestamp;
+
+};
+
+/**
+ * Release resources allocated by the A2DP sink pipeline. */
+static void a2dp_sink_free(struct a2dp_sink *s) {
+	if (s->priv != NULL)
+		s->codec->free(s);
+	free(s->priv);
+	plc_free(&s->plc);
+	a2dp_sink_writer_free(&s->writer);
+	a2dp_jbuf_free(&s->jb);
+	ffb_free(&s->payload);
+	ffb_free(&s->pcm);
+	ffb_free(&s->bt);
+}
+
+/**
+ * Pass decoded PCM signal to the sink output.
+ *
+ * @param s The A2DP sink structure.
+ * @param buffer Interleaved PCM samples, which might be modified in place.
+ * @param samples The number of PCM samples. */
+static void a2dp_sink_output(struct a2dp_sink *s, void *buffer, size_t samples) {
+
+	const size_t frames = samples / s->t->a2dp.pcm.channels;
+
+	if (s->plc.hist != NULL)
+		plc_good(&s->plc, buffer, frames);
+
+	a2dp_sink_write(&s->writer, buffer, samples);
+	a2dp_jbuf_played(&s->jb, frames);
+
+}
+
+/**
+ * Write concealment signal to the sink output.
+ *
+ * @param s The A2DP sink structure.
+ * @param frames The number of PCM frames to synthesize.
+ * @return This function returns the number of PCM frames written, which
+ *   might differ from the requested one, e.g. if the codec can conceal
+ *   whole codec frames only. */
+static unsigned int a2dp_sink_conceal(struct a2dp_sink *s, unsigned int frames) {
+
+	if (s->codec->conceal != NULL)
+		return s->codec->conceal(s, frames);
+
+	/* encoded stream can not be concealed */
+	if (s->t->a2dp.pcm.format == BA_TRANSPORT_PCM_FORMAT_ENCODED)
+		return 0;
+
+	const size_t channels = s->t->a2dp.pcm.channels;
+	const unsigned int total = frames;
+
+	while (frames > 0) {
+		const size_t len = MIN(frames, s->pcm.nmemb / channels);
+		/* Generic PLC supports 16-bit PCM only. For other formats the gap
+		 * is filled with silence, so the PCM clock will be preserved. */
+		if (s->plc.hist != NULL)
+			plc_conceal(&s->plc, s->pcm.data, len);
+		else
+			memset(s->pcm.data, 0, len * channels * s->pcm.size);
+		a2dp_sink_write(&s->writer, s->pcm.data, len * channels);
+		frames -= len;
+	}
+
+	return total;
+}
+
+/**
+ * Append RTP payload fragment to the reassembly buffer.
+ *
+ * @return If the payload is complete, this function returns true. */
+static bool a2dp_sink_reassemble(struct a2dp_sink *s,
+		const rtp_header_t *rtp_header, const uint8_t *payload, size_t len) {
+
+	/* If in the first N packets mark bit is not set, it might mean, that
+	 * the mark bit will not be set at all. In such a case, activate mark
+	 * bit quirk workaround. */
+	if (s->markbit_quirk < 0) {
+		if (rtp_header->markbit)
+			s->markbit_quirk = 0;
+		else if (++s->markbit_quirk == 0) {
+			warn("Activating RTP mark bit quirk workaround");
+			s->markbit_quirk = 1;
+		}
+	}
+
+	/* Fragments of the payload preceding lost packet are useless, so
+	 * discard them in order not to feed the decoder with garbage. */
+	if (s->jb.stats.lost != s->lost) {
+		s->lost = s->jb.stats.lost;
+		ffb_rewind(&s->payload);
+	}
+
+	if (ffb_len_in(&s->payload) < len) {
+		const size_t size = s->payload.nmemb + s->t->mtu_read;
+		const size_t prev_len = ffb_len_out(&s->payload);
+		debug("Resizing payload buffer: %zu -> %zu", s->payload.nmemb, size);
+		if (ffb_init_uint8_t(&s->payload, size) == -1) {
+			error("Couldn't resize payload buffer: %s", strerror(errno));
+			return false;
+		}
+		ffb_seek(&s->payload, prev_len);
+	}
+
+	memcpy(s->payload.tail, payload, len);
+	ffb_seek(&s->payload, len);
+
+	if (s->markbit_quirk != 1 && !rtp_header->markbit) {
+		debug("Fragmented RTP packet [%u]: payload len: %zu",
+				be16toh(rtp_header->seq_number), len);
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Initialize A2DP sink decoder and data buffers.
+ *
+ * @return On success this function returns 0. Otherwise, -1 is returned. */
+static int a2dp_sink_init(struct a2dp_sink *s) {
+
+	struct ba_transport *t = s->t;
+	const struct a2dp_sink_codec *codec = s->codec;
+
+	if (a2dp_validate_bt_sink(t) != 0)
+		return -1;
+
+	if ((s->priv = calloc(1, codec->priv_size)) == NULL) {
+		error("Couldn't create codec data: %s", strerror(errno));
+		return -1;
+	}
+
+	if (codec->init(s) == -1)
+		return -1;
+
+	struct ba_transport_pcm *pcm = &t->a2dp.pcm;
+	const size_t sample_size = BA_TRANSPORT_PCM_FORMAT_BYTES(pcm->format);
+	/* codec specific concealment takes precedence over the generic one */
+	const bool plc = codec->conceal == NULL &&
+		pcm->format == BA_TRANSPORT_PCM_FORMAT_S16_2LE;
+
+	if (ffb_init(&s->pcm, s->pcm_samples, sample_size) == -1 ||
+			ffb_init_uint8_t(&s->bt, t->mtu_read) == -1 ||
+			(codec->fragmentation && ffb_init_uint8_t(&s->payload, t->mtu_read) == -1) ||
+			a2dp_jbuf_init(&s->jb, t->mtu_read, pcm->sampling, config.a2dp.jitter_buffer) == -1 ||
+			a2dp_sink_writer_init(&s->writer, pcm, &s->jb) == -1 ||
+			(plc && plc_init(&s->plc, pcm->channels, pcm->sampling) == -1)) {
+		error("Couldn't create data buffers: %s", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Decode received packet.
+ *
+ * @param s The A2DP sink structure.
+ * @param packet The RTP packet or the bare payload if rtp is not set.
+ * @param len The length of the packet. */
+static void a2dp_sink_process(struct a2dp_sink *s, const void *packet, size_t len) {
+
+	const struct a2dp_sink_codec *codec = s->codec;
+
+	/* Payload which is not encapsulated in RTP can not be buffered nor
+	 * reordered, so it is decoded right away. */
+	if (!codec->rtp) {
+		if (s->t->a2dp.pcm.fd != -1)
+			codec->decode(s, NULL, packet, len);
+		return;
+	}
+
+	const rtp_header_t *rtp_header = packet;
+	const uint8_t *rtp_phdr = (uint8_t *)&rtp_header->csrc[rtp_header->cc];
+	const uint8_t *rtp_payload = rtp_phdr + codec->rtp_phdr_size;
+
+	if (rtp_payload > (uint8_t *)packet + len) {
+		warn("Invalid RTP packet length: %zu", len);
+		return;
+	}
+
+	size_t rtp_payload_len = len - (rtp_payload - (uint8_t *)packet);
+
+#if ENABLE_PAYLOADCHECK
+	if (rtp_header->paytype < 96) {
+		warn("Unsupported RTP payload type: %u", rtp_header->paytype);
+		return;
+	}
+#endif
+
+	/* Fill the gap left by the lost packets, so the PCM clock will
+	 * not run ahead of the remote device clock. */
+	const unsigned int lost_frames = a2dp_jbuf_get_lost_frames(&s->jb);
+	if (lost_frames > 0)
+		a2dp_sink_conceal(s, lost_frames);
+
+	if (codec->fragmentation) {
+		if (!a2dp_sink_reassemble(s, rtp_header, rtp_payload, rtp_payload_len))
+			return;
+		rtp_payload = s->payload.data;
+		rtp_payload_len = ffb_len_out(&s->payload);
+	}
+
+	s->timestamp = be32toh(rtp_header->timestamp);
+	codec->decode(s, rtp_phdr, rtp_payload, rtp_payload_len);
+
+	/* make room for new payload */
+	if (codec->fragmentation)
+		ffb_rewind(&s->payload);
+
+}
+
+/**
+ * Generic A2DP sink IO thread.
+ *
+ * @param t Transport structure.
+ * @param codec Sink codec used for decoding.
+ * @return This function always returns NULL. */
+static void *a2dp_sink_pipeline(struct ba_transport *t,
+		const struct a2dp_sink_codec *codec) {
+
+	/* Cancellation should be possible only in the carefully selected place
+	 * in order to prevent memory leaks and resources not being released. */
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	pthread_cleanup_push(PTHREAD_CLEANUP(ba_transport_pthread_cleanup), t);
+
+	struct a2dp_sink s = {
+		.t = t,
+		.codec = codec,
+		.io = {
+			.timeout = -1,
+			/* Lock transport during initialization stage. This lock will ensure,
+			 * that no one will modify critical section until thread state can be
+			 * known - initialization has failed or succeeded. */
+			.t_locked = !ba_transport_pthread_cleanup_lock(t),
+		},
+		.markbit_quirk = -3,
+	};
+
+	pthread_cleanup_push(PTHREAD_CLEANUP(a2dp_sink_free), &s);
+
+	if (a2dp_sink_init(&s) == -1)
+		goto fail_init;
+
+	/* Lock transport during thread cancellation. This handler shall be at
+	 * the top of the cleanup stack - lastly pushed. */
+	pthread_cleanup_push(PTHREAD_CLEANUP(ba_transport_pthread_cleanup_lock), t);
+
+	ba_transport_pthread_cleanup_unlock(t);
+	s.io.t_locked = false;
+
+	debug("Starting IO loop: %s", ba_transport_type_to_string(t->type));
+	for (;;) {
+
+		const void *packet = s.bt.data;
+		ssize_t len;
+		if ((len = codec->rtp ?
+					a2dp_poll_and_read_bt_jbuf(t, &s.io, &s.bt, &s.jb, &packet) :
+					a2dp_poll_and_read_bt(t, &s.io, &s.bt)) <= 0) {
+			if (len == -1)
+				error("BT poll and read error: %s", strerror(errno));
+			goto fail;
+		}
+
+		a2dp_sink_process(&s, packet, len);
+
+	}
+
+fail:
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	pthread_cleanup_pop(!s.io.t_locked);
+fail_init:
+	pthread_cleanup_pop(1);
+	pthread_cleanup_pop(1);
+	return NULL;
+}
+
+/**
+ * A2DP sink pipeline hosted by the IO engine worker.
+ *
+ * Instead of blocking in the poll() call, the pipeline is driven by the
+ * events signaled on the transport signal pipe, the BT socket and the
+ * jitter buffer playout timer. */
+struct a2dp_sink_task {
+	struct a2dp_sink s;
+	struct io_engine_source sig;
+	struct io_engine_source bt;
+	struct io_engine_source timer;
+};
+
+/**
+ * Decode all packets due for playout and re-arm the playout timer. */
+static void a2dp_sink_task_playout(struct a2dp_sink_task *st) {
+
+	struct a2dp_sink *s = &st->s;
+	struct itimerspec timeout = { 0 };
+	struct timespec now;
+	const void *packet;
+	ssize_t len;
+
+	for (;;) {
+		gettimestamp(&now);
+		if ((len = a2dp_jbuf_get_due(s->t, &s->io, &s->jb, &now, &packet)) <= 0)
+			break;
+		a2dp_sink_process(s, packet, len);
+	}
+
+	int ms;
+	if ((ms = a2dp_jbuf_timeout(&s->jb, &now)) != -1) {
+		/* zero value would disarm the timer */
+		timeout.it_value.tv_sec = ms / 1000;
+		timeout.it_value.tv_nsec = ms % 1000 * 1000000 + 1;
+	}
+
+	timerfd_settime(st->timer.fd, 0, &timeout, NULL);
+
+}
+
+static void a2dp_sink_task_signal(struct io_engine_source *src, uint32_t revents) {
+	(void)revents;
+
+	struct a2dp_sink_task *st = (void *)((uint8_t *)src - offsetof(struct a2dp_sink_task, sig));
+	struct a2dp_sink *s = &st->s;
+
+	switch (ba_transport_recv_signal(s->t)) {
+	case BA_TRANSPORT_SIGNAL_PCM_OPEN:
+	case BA_TRANSPORT_SIGNAL_PCM_RESUME:
+		s->io.t_paused = false;
+		break;
+	case BA_TRANSPORT_SIGNAL_PCM_PAUSE:
+		s->io.t_paused = true;
+		break;
+	default:
+		return;
+	}
+
+	io_engine_source_modify(&st->bt, s->io.t_paused ? 0 : EPOLLIN);
+
+}
+
+static void a2dp_sink_task_bt(struct io_engine_source *src, uint32_t revents) {
+
+	struct a2dp_sink_task *st = (void *)((uint8_t *)src - offsetof(struct a2dp_sink_task, bt));
+	struct a2dp_sink *s = &st->s;
+	struct ba_transport *t = s->t;
+	struct timespec now;
+	ssize_t len;
+
+	if ((len = read(src->fd, s->bt.data, ffb_blen_in(&s->bt))) == -1) {
+		debug("BT read error: %s", strerror(errno));
+		/* level-triggered error condition would be reported forever */
+		if (revents & (EPOLLERR | EPOLLHUP))
+			io_engine_task_finish(src->task);
+		return;
+	}
+
+	if (len == 0) {
+		debug("BT socket has been closed: %d", src->fd);
+		/* Prevent sending the release request to the BlueZ. If the socket has
+		 * been closed, it means that BlueZ has already closed the connection. */
+		close(src->fd);
+		t->bt_fd = -1;
+		io_engine_task_finish(src->task);
+		return;
+	}
+
+	if (!s->codec->rtp) {
+		a2dp_sink_process(s, s->bt.data, len);
+		return;
+	}
+
+	if (t->a2dp.pcm.fd == -1) {
+		a2dp_jbuf_discard(&s->jb);
+		return;
+	}
+
+	gettimestamp(&now);
+	if (a2dp_jbuf_put(&s->jb, &now, s->bt.data, len) == -1)
+		warn("Couldn't buffer RTP packet: %s", strerror(errno));
+
+	a2dp_sink_task_playout(st);
+
+}
+
+static void a2dp_sink_task_timer(struct io_engine_source *src, uint32_t revents) {
+	(void)revents;
+
+	struct a2dp_sink_task *st = (void *)((uint8_t *)src - offsetof(struct a2dp_sink_task, timer));
+	uint64_t expirations;
+
+	if (read(src->fd, &expirations, sizeof(expirations)) == -1 &&
+			errno != EAGAIN)
+		debug("Timer read error: %s", strerror(errno));
+
+	a2dp_sink_task_playout(st);
+
+}
+
+static int a2dp_sink_task_init(struct io_engine_task *task) {
+
+	struct a2dp_sink_task *st = task->data;
+	struct ba_transport *t = st->s.t;
+	int ret = -1;
+
+	/* Lock transport during initialization stage. This lock will ensure,
+	 * that no one will modify critical section until task state can be
+	 * known - initialization has failed or succeeded. */
+	ba_transport_pthread_cleanup_lock(t);
+
+	if (a2dp_sink_init(&st->s) == -1)
+		goto final;
+
+	st->s.writer.nowait = true;
+
+	if ((st->timer.fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK)) == -1) {
+		error("Couldn't create playout timer: %s", strerror(errno));
+		goto final;
+	}
+
+	st->sig.fd = t->sig_fd[0];
+	st->bt.fd = t->bt_fd;
+
+	if (io_engine_source_add(task, &st->sig) == -1 ||
+			io_engine_source_add(task, &st->bt) == -1 ||
+			io_engine_source_add(task, &st->timer) == -1) {
+		error("Couldn't add IO engine source: %s", strerror(errno));
+		goto final;
+	}
+
+	debug("Starting IO task: %s", ba_transport_type_to_string(t->type));
+	ret = 0;
+
+final:
+	ba_transport_pthread_cleanup_unlock(t);
+	return ret;
+}
+
+static void a2dp_sink_task_cleanup(struct io_engine_task *task) {
+
+	struct a2dp_sink_task *st = task->data;
+	struct ba_transport *t = st->s.t;
+
+	ba_transport_pthread_cleanup_lock(t);
+
+	if (st->timer.fd != -1)
+		close(st->timer.fd);
+	a2dp_sink_free(&st->s);
+	free(st);
+
+	ba_transport_io_task_cleanup(t);
+
+}
+
+/**
+ * Create A2DP sink IO task on the IO engine worker. */
+static int a2dp_sink_task_create(struct ba_transport *t,
+		const struct a2dp_sink_codec *codec, const char *name) {
+
+	struct a2dp_sink_task *st;
+	if ((st = calloc(1, sizeof(*st))) == NULL) {
+		error("Couldn't create IO task: %s", strerror(errno));
+		return -1;
+	}
+
+	st->s.t = t;
+	st->s.codec = codec;
+	st->s.io.timeout = -1;
+	st->s.markbit_quirk = -3;
+	st->sig = (struct io_engine_source){
+		.fd = -1, .events = EPOLLIN, .callback = a2dp_sink_task_signal };
+	st->bt = (struct io_engine_source){
+		.fd = -1, .events = EPOLLIN, .callback = a2dp_sink_task_bt };
+	st->timer = (struct io_engine_source){
+		.fd = -1, .events = EPOLLIN, .callback = a2dp_sink_task_timer };
+
+	if (ba_transport_io_task_create(t, a2dp_sink_task_init,
+				a2dp_sink_task_cleanup, st, name) == -1) {
+		free(st);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Create A2DP sink IO thread or IO task, depending on the IO engine mode.
+ *
+ * Note, that the PCM overrun policy depends on the mode. The IO thread waits
+ * for the PCM client to read the decoded audio, while the IO task discards
+ * the audio when the PCM FIFO is full, because the worker thread is shared
+ * with other transports. */
+static int a2dp_sink_create(struct ba_transport *t,
+		void *(*routine)(struct ba_transport *),
+		const struct a2dp_sink_codec *codec, const char *name) {
+	if (io_engine_enabled())
+		return a2dp_sink_task_create(t, codec, name);
+	return ba_transport_pthread_create(t, routine, name);
+}
+
+/**
+ * SBC decoder private data. */
+struct a2dp_sink_sbc_data {
+	sbc_t sbc;
+#if DEBUG
+	uint8_t bitpool;
+#endif
+};
+
+static int a2dp_sink_sbc_init(struct a2dp_sink *s) {
+
+	struct a2dp_sink_sbc_data *priv = s->priv;
+	struct ba_transport *t = s->t;
+
+	if ((errno = -sbc_init_a2dp(&priv->sbc, 0, t->a2dp.configuration,
+					t->a2dp.codec->capabilities_size)) != 0) {
+		error("Couldn't initialize SBC codec: %s", strerror(errno));
+		return -1;
+	}
+
+	s->pcm_samples = sbc_get_codesize(&priv->sbc) / sizeof(int16_t);
+	return 0;
+}
+
+static void a2dp_sink_sbc_free(struct a2dp_sink *s) {
+	struct a2dp_sink_sbc_data *priv = s->priv;
+	sbc_finish(&priv->sbc);
+}
+
+static void a2dp_sink_sbc_decode(struct a2dp_sink *s, const void *phdr,
+		const uint8_t *payload, size_t len) {
+
+	struct a2dp_sink_sbc_data *priv = s->priv;
+	const rtp_media_header_t *rtp_media_header = phdr;
+	const unsigned int channels = s->t->a2dp.pcm.channels;
+
+	/* decode retrieved SBC frames */
+	size_t frames = rtp_media_header->frame_count;
+	while (frames--) {
+
+		ssize_t ret;
+		size_t decoded;
+
+		if ((ret = sbc_decode(&priv->sbc, payload, len,
+						s->pcm.data, ffb_blen_in(&s->pcm), &decoded)) < 0) {
+			error("SBC decoding error: %s", strerror(-ret));
+			/* conceal the remaining part of the corrupted packet */
+			const size_t frames_len = s->pcm_samples / channels * (frames + 1);
+			a2dp_jbuf_played(&s->jb, a2dp_sink_conceal(s, frames_len));
+			break;
+		}
+
+#if DEBUG
+		if (priv->bitpool != priv->sbc.bitpool) {
+			priv->bitpool = priv->sbc.bitpool;
+			sbc_print_internals(&priv->sbc);
+		}
+#endif
+
+		payload += ret;
+		len -= ret;
+
+		a2dp_sink_output(s, s->pcm.data, decoded / sizeof(int16_t));
+
+	}
+
+}
+
+static const struct a2dp_sink_codec a2dp_sink_sbc_codec = {
+	.priv_size = sizeof(struct a2dp_sink_sbc_data),
+	.rtp = true,
+	.rtp_phdr_size = sizeof(rtp_media_header_t),
+	.init = a2dp_sink_sbc_init,
+	.free = a2dp_sink_sbc_free,
+	.decode = a2dp_sink_sbc_decode,
+};
+
+static void *a2dp_sink_sbc(struct ba_transport *t) {
+	return a2dp_sink_pipeline(t, &a2dp_sink_sbc_codec);
+}
+
+/**
+ * SBC encoder private data. */
+struct a2dp_source_sbc_data {
+	sbc_t sbc;
+	struct sbc_abr abr;
+	/* the length of the SBC frame for the current bit-pool */
+	size_t frame_len;
+};
+
+static int a2dp_source_sbc_init(struct a2dp_source *s) {
+
+	struct a2dp_source_sbc_data *priv = s->priv;
+	struct ba_transport *t = s->t;
+	sbc_t *sbc = &priv->sbc;
+
+	if ((errno = -sbc_init_a2dp(sbc, 0, t->a2dp.configuration,
+					t->a2dp.codec->capabilities_size)) != 0) {
+		error("Couldn't initialize SBC codec: %s", strerror(errno));
+		return -1;
+	}
+
+	const a2dp_sbc_t *configuration = (a2dp_sbc_t *)t->a2dp.configuration;
+	const size_t sbc_pcm_samples = sbc_get_codesize(sbc) / sizeof(int16_t);
+
+	/* The encoder needs a whole frame of input, and its analysis filter bank
+	 * (10 blocks of sub-band samples long) delays the signal by half of its
+	 * length. */
+	s->io.codec_delay = sbc_pcm_samples / t->a2dp.pcm.channels +
+		5 * (sbc->subbands == SBC_SB_8 ? 8 : 4);
+
+	/* initialize SBC encoder bit-pool */
+	sbc->bitpool = sbc_a2dp_get_bitpool(configuration, config.sbc_quality);
+
+	uint8_t abr_bitpool_min = config.sbc_abr_min_bitpool;
+	if (abr_bitpool_min == 0)
+		abr_bitpool_min = sbc_a2dp_get_bitpool(configuration, SBC_QUALITY_LOW);
+	sbc_abr_init(&priv->abr, MAX(abr_bitpool_min, configuration->min_bitpool), sbc->bitpool);
+
+#if DEBUG
+	sbc_print_internals(sbc);
+#endif
+
+	/* Writing MTU should be big enough to contain RTP header, SBC payload
+	 * header and at least one SBC frame. In general, there is no constraint
+	 * for the MTU value, but the speed might suffer significantly. */
+	priv->frame_len = sbc_get_frame_length(sbc);
+	if (s->payload_size < priv->frame_len)
+		warn("Writing MTU too small for one single SBC frame: %zu < %zu",
+				t->mtu_write, RTP_HEADER_LEN + sizeof(rtp_media_header_t) + priv->frame_len);
+
+	/* With the adaptive bit rate enabled, the PCM buffer has to be big enough
+	 * to fill the whole MTU with the shortest SBC frames we might produce. */
+	size_t sbc_frames_max = s->payload_size / priv->frame_len;
+	if (config.sbc_abr) {
+		sbc->bitpool = priv->abr.bitpool_min;
+		sbc_frames_max = s->payload_size / sbc_get_frame_length(sbc);
+		sbc->bitpool = priv->abr.bitpool;
+	}
+
+	s->pcm_samples = sbc_pcm_samples;
+	s->pcm_buffer_samples = sbc_pcm_samples * sbc_frames_max;
+	return 0;
+}
+
+static void a2dp_source_sbc_free(struct a2dp_source *s) {
+	struct a2dp_source_sbc_data *priv = s->priv;
+	sbc_finish(&priv->sbc);
+}
+
+static ssize_t a2dp_source_sbc_encode(struct a2dp_source *s, const void *pcm,
+		size_t samples, size_t *consumed, uint8_t *payload, size_t len) {
+
+	struct a2dp_source_sbc_data *priv = s->priv;
+	rtp_media_header_t *rtp_media_header = s->rtp_phdr;
+
+	const int16_t *input = pcm;
+	size_t input_len = samples;
+	uint8_t *output = payload;
+	size_t output_len = len;
+	size_t frames = 0;
+
+	/* Generate as many SBC frames as possible, but less than a 4-bit media
+	 * header frame counter can contain. The size of the output buffer is
+	 * based on the socket MTU, so such transfer should be most efficient. */
+	while (input_len >= s->pcm_samples &&
+			output_len >= priv->frame_len &&
+			frames < ((1 << 4) - 1)) {
+
+		ssize_t ret;
+		ssize_t encoded;
+
+		if ((ret = sbc_encode(&priv->sbc, input, input_len * sizeof(int16_t),
+						output, output_len, &encoded)) < 0) {
+			error("SBC encoding error: %s", strerror(-ret));
+			if (frames == 0)
+				return -1;
+			break;
+		}
+
+		ret = ret / sizeof(int16_t);
+		input += ret;
+		input_len -= ret;
+		output += encoded;
+		output_len -= encoded;
+		frames++;
 
-		}
+	}
 
-		rtp_header->seq_number = htobe16(++seq_number);
-		rtp_header->timestamp = htobe32(timestamp);
-		rtp_media_header->frame_count = sbc_frames;
+	rtp_media_header->frame_count = frames;
 
-		io.coutq.i = (io.coutq.i + 1) % ARRAYSIZE(io.coutq.v);
-		if (io_thread_write_bt(t->bt_fd, bt.data, ffb_len_out(&bt),
-					&io.coutq.v[io.coutq.i], t->a2dp.bt_fd_coutq_init) == -1) {
-			if (errno == ECONNRESET || errno == ENOTCONN) {
-				/* exit thread upon BT socket disconnection */
-				debug("BT socket disconnected: %d", t->bt_fd);
-				goto fail;
-			}
-			error("BT socket write error: %s", strerror(errno));
-		}
+	*consumed = samples - input_len;
+	return output - payload;
+}
 
-		/* keep data transfer at a constant bit rate, also
-		 * get a timestamp for the next RTP frame */
-		asrsync_sync(&io.asrs, pcm_frames);
-		timestamp += pcm_frames * 10000 / samplerate;
+static void a2dp_source_sbc_abr(struct a2dp_source *s, size_t len) {
 
-		/* update busy delay (encoding overhead) */
-		t->a2dp.pcm.delay = asrsync_get_busy_usec(&io.asrs) / 100;
+	struct a2dp_source_sbc_data *priv = s->priv;
 
-		/* If the input buffer was not consumed (due to codesize limit), we
-		 * have to append new data to the existing one. Since we do not use
-		 * ring buffer, we will simply move unprocessed data to the front
-		 * of our linear buffer. */
-		ffb_shift(&pcm, samples - input_len);
+	if (len == 0 || !config.sbc_abr)
+		return;
 
+	if (sbc_abr_update(&priv->abr, s->io.coutq.v, ARRAYSIZE(s->io.coutq.v), s->t->mtu_write)) {
+		/* SBC encoder picks up new bit-pool with the next frame */
+		priv->sbc.bitpool = priv->abr.bitpool;
+		priv->frame_len = sbc_get_frame_length(&priv->sbc);
 	}
 
-fail:
-	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-	pthread_cleanup_pop(!io.t_locked);
-fail_ffb:
-	pthread_cleanup_pop(1);
-	pthread_cleanup_pop(1);
-	pthread_cleanup_pop(1);
-fail_init:
-	pthread_cleanup_pop(1);
-	return NULL;
+}
+
+static const struct a2dp_source_codec a2dp_source_sbc_codec = {
+	.priv_size = sizeof(struct a2dp_source_sbc_data),
+	.rtp = true,
+	.rtp_phdr_size = sizeof(rtp_media_header_t),
+	.init = a2dp_source_sbc_init,
+	.free = a2dp_source_sbc_free,
+	.encode = a2dp_source_sbc_encode,
+	.abr = a2dp_source_sbc_abr,
+};
+
+static void *a2dp_source_sbc(struct ba_transport *t) {
+	return a2dp_source_pipeline(t, &a2dp_source_sbc_codec);
 }
 
 #if ENABLE_MP3LAME || ENABLE_MPG123
-static void *a2dp_sink_mpeg(struct ba_transport *t) {
 
-	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-	pthread_cleanup_push(PTHREAD_CLEANUP(ba_transport_pthread_cleanup), t);
+#if ENABLE_MPG123
+# define MPEG_PCM_DECODE_SAMPLES 4096
+#else
+/* NOTE: Size of the output buffer is "hard-coded" in hip_decode(). What is
+ *       even worse, the boundary check is so fucked-up that the hard-coded
+ *       limit can very easily overflow. In order to mitigate crash, we are
+ *       going to provide very big buffer - let's hope it will be enough. */
+# define MPEG_PCM_DECODE_SAMPLES 4096 * 100
+#endif
 
-	struct io_thread_data io = {
-		.t_locked = !ba_transport_pthread_cleanup_lock(t),
-	};
+/**
+ * MPEG decoder private data. */
+struct a2dp_sink_mpeg_data {
+#if ENABLE_MPG123
+	mpg123_handle *handle;
+#else
+	hip_t handle;
+	int16_t pcm_l[MPEG_PCM_DECODE_SAMPLES];
+	int16_t pcm_r[MPEG_PCM_DECODE_SAMPLES];
+#endif
+};
 
-	if (a2dp_validate_bt_sink(t) != 0)
-		goto fail_init;
+static int a2dp_sink_mpeg_init(struct a2dp_sink *s) {
+
+	struct a2dp_sink_mpeg_data *priv = s->priv;
 
 #if ENABLE_MPG123
 
@@ -784,196 +2317,149 @@ static void *a2dp_sink_mpeg(struct ba_transport *t) {
 	pthread_once(&once, (void (*)(void))mpg123_init);
 
 	int err;
-	mpg123_handle *handle;
-	if ((handle = mpg123_new(NULL, &err)) == NULL) {
+	if ((priv->handle = mpg123_new(NULL, &err)) == NULL) {
 		error("Couldn't initialize MPG123 decoder: %s", mpg123_plain_strerror(err));
-		goto fail_init;
+		return -1;
 	}
 
-	pthread_cleanup_push(PTHREAD_CLEANUP(mpg123_delete), handle);
-
-	if (mpg123_open_feed(handle) != MPG123_OK) {
-		error("Couldn't open MPG123 feed: %s", mpg123_strerror(handle));
-		goto fail_open;
+	if (mpg123_open_feed(priv->handle) != MPG123_OK) {
+		error("Couldn't open MPG123 feed: %s", mpg123_strerror(priv->handle));
+		return -1;
 	}
 
-	#define MPEG_PCM_DECODE_SAMPLES 4096
+	s->pcm_samples = MPEG_PCM_DECODE_SAMPLES;
 
 #else
 
-	hip_t handle;
-	if ((handle = hip_decode_init()) == NULL) {
+	if ((priv->handle = hip_decode_init()) == NULL) {
 		error("Couldn't initialize LAME decoder: %s", strerror(errno));
-		goto fail_init;
+		return -1;
 	}
 
-	const unsigned int channels = t->a2dp.pcm.channels;
-	pthread_cleanup_push(PTHREAD_CLEANUP(hip_decode_exit), handle);
-
-	/* NOTE: Size of the output buffer is "hard-coded" in hip_decode(). What is
-	 *       even worse, the boundary check is so fucked-up that the hard-coded
-	 *       limit can very easily overflow. In order to mitigate crash, we are
-	 *       going to provide very big buffer - let's hope it will be enough. */
-	#define MPEG_PCM_DECODE_SAMPLES 4096 * 100
+	s->pcm_samples = MPEG_PCM_DECODE_SAMPLES * s->t->a2dp.pcm.channels;
 
 #endif
 
-	ffb_t bt = { 0 };
-	ffb_t pcm = { 0 };
-	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &bt);
-	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &pcm);
-
-	if (ffb_init_int16_t(&pcm, MPEG_PCM_DECODE_SAMPLES) == -1 ||
-			ffb_init_uint8_t(&bt, t->mtu_read) == -1) {
-		error("Couldn't create data buffers: %s", strerror(errno));
-		goto fail_ffb;
-	}
-
-	pthread_cleanup_push(PTHREAD_CLEANUP(ba_transport_pthread_cleanup_lock), t);
-
-	uint16_t seq_number = -1;
-
-	ba_transport_pthread_cleanup_unlock(t);
-	io.t_locked = false;
-
-	debug("Starting IO loop: %s", ba_transport_type_to_string(t->type));
-	for (;;) {
-
-		ssize_t len;
-		if ((len = a2dp_poll_and_read_bt(t, &io, &bt)) <= 0) {
-			if (len == -1)
-				error("BT poll and read error: %s", strerror(errno));
-			goto fail;
-		}
-
-		if (t->a2dp.pcm.fd == -1) {
-			seq_number = -1;
-			continue;
-		}
-
-		const rtp_header_t *rtp_header = (rtp_header_t *)bt.data;
-		uint8_t *rtp_mpeg = (uint8_t *)&rtp_header->csrc[rtp_header->cc] + sizeof(rtp_mpeg_audio_header_t);
-		size_t rtp_mpeg_len = len - (rtp_mpeg - (uint8_t *)rtp_header);
+	return 0;
+}
 
-#if ENABLE_PAYLOADCHECK
-		if (rtp_header->paytype < 96) {
-			warn("Unsupported RTP payload type: %u", rtp_header->paytype);
-			continue;
-		}
+static void a2dp_sink_mpeg_free(struct a2dp_sink *s) {
+	struct a2dp_sink_mpeg_data *priv = s->priv;
+	if (priv->handle == NULL)
+		return;
+#if ENABLE_MPG123
+	mpg123_delete(priv->handle);
+#else
+	hip_decode_exit(priv->handle);
 #endif
+}
 
-		uint16_t _seq_number = be16toh(rtp_header->seq_number);
-		if (++seq_number != _seq_number) {
-			if (seq_number != 0)
-				warn("Missing RTP packet: %u != %u", _seq_number, seq_number);
-			seq_number = _seq_number;
-		}
+static void a2dp_sink_mpeg_decode(struct a2dp_sink *s, const void *phdr,
+		const uint8_t *payload, size_t len) {
+
+	struct a2dp_sink_mpeg_data *priv = s->priv;
+	(void)phdr;
 
 #if ENABLE_MPG123
 
-		long rate;
-		int channels;
-		int encoding;
+	long rate;
+	int channels;
+	int encoding;
+	size_t decoded;
+
+	do {
 
-decode:
-		switch (mpg123_decode(handle, rtp_mpeg, rtp_mpeg_len,
-					(uint8_t *)pcm.data, ffb_blen_in(&pcm), (size_t *)&len)) {
+		switch (mpg123_decode(priv->handle, payload, len,
+					s->pcm.data, ffb_blen_in(&s->pcm), &decoded)) {
 		case MPG123_DONE:
 		case MPG123_NEED_MORE:
 		case MPG123_OK:
 			break;
 		case MPG123_NEW_FORMAT:
-			mpg123_getformat(handle, &rate, &channels, &encoding);
+			mpg123_getformat(priv->handle, &rate, &channels, &encoding);
 			debug("MPG123 new format detected: r:%ld, ch:%d, enc:%#x", rate, channels, encoding);
 			break;
 		default:
-			error("MPG123 decoding error: %s", mpg123_strerror(handle));
-			continue;
+			error("MPG123 decoding error: %s", mpg123_strerror(priv->handle));
+			return;
 		}
 
-		const size_t samples = len / sizeof(int16_t);
-		if (ba_transport_pcm_write(&t->a2dp.pcm, pcm.data, samples) == -1)
-			error("FIFO write error: %s", strerror(errno));
+		a2dp_sink_output(s, s->pcm.data, decoded / sizeof(int16_t));
 
-		if (len > 0) {
-			rtp_mpeg_len = 0;
-			goto decode;
-		}
+		/* drain frames buffered by the decoder */
+		len = 0;
 
-#else
+	} while (decoded > 0);
 
-		int16_t pcm_l[MPEG_PCM_DECODE_SAMPLES];
-		int16_t pcm_r[MPEG_PCM_DECODE_SAMPLES];
-		ssize_t samples;
+#else
 
-		if ((samples = hip_decode(handle, rtp_mpeg, rtp_mpeg_len, pcm_l, pcm_r)) < 0) {
-			error("LAME decoding error: %zd", samples);
-			continue;
-		}
+	const unsigned int channels = s->t->a2dp.pcm.channels;
+	ssize_t samples;
 
-		if (channels == 1) {
-			if (ba_transport_pcm_write(&t->a2dp.pcm, pcm_l, samples) == -1)
-				error("FIFO write error: %s", strerror(errno));
-		}
-		else {
+	if ((samples = hip_decode(priv->handle, (uint8_t *)payload, len,
+					priv->pcm_l, priv->pcm_r)) < 0) {
+		error("LAME decoding error: %zd", samples);
+		return;
+	}
 
-			ssize_t i;
-			for (i = 0; i < samples; i++) {
-				((int16_t *)pcm.data)[i * 2 + 0] = pcm_l[i];
-				((int16_t *)pcm.data)[i * 2 + 1] = pcm_r[i];
-			}
+	if (channels == 1)
+		a2dp_sink_output(s, priv->pcm_l, samples);
+	else {
 
-			if (ba_transport_pcm_write(&t->a2dp.pcm, pcm.data, samples) == -1)
-				error("FIFO write error: %s", strerror(errno));
+		int16_t *pcm = s->pcm.data;
+		ssize_t i;
 
+		for (i = 0; i < samples; i++) {
+			pcm[i * 2 + 0] = priv->pcm_l[i];
+			pcm[i * 2 + 1] = priv->pcm_r[i];
 		}
 
-#endif
+		a2dp_sink_output(s, pcm, samples * 2);
 
 	}
 
-fail:
-	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-	pthread_cleanup_pop(!io.t_locked);
-fail_ffb:
-	pthread_cleanup_pop(1);
-	pthread_cleanup_pop(1);
-#if ENABLE_MPG123
-fail_open:
 #endif
-	pthread_cleanup_pop(1);
-fail_init:
-	pthread_cleanup_pop(1);
-	return NULL;
+
+}
+
+static const struct a2dp_sink_codec a2dp_sink_mpeg_codec = {
+	.priv_size = sizeof(struct a2dp_sink_mpeg_data),
+	.rtp = true,
+	.rtp_phdr_size = sizeof(rtp_mpeg_audio_header_t),
+	.init = a2dp_sink_mpeg_init,
+	.free = a2dp_sink_mpeg_free,
+	.decode = a2dp_sink_mpeg_decode,
+};
+
+static void *a2dp_sink_mpeg(struct ba_transport *t) {
+	return a2dp_sink_pipeline(t, &a2dp_sink_mpeg_codec);
 }
 #endif
 
 #if ENABLE_MP3LAME
-static void *a2dp_source_mp3(struct ba_transport *t) {
-
-	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-	pthread_cleanup_push(PTHREAD_CLEANUP(ba_transport_pthread_cleanup), t);
+/**
+ * MP3 encoder private data. */
+struct a2dp_source_mp3_data {
+	lame_t handle;
+};
 
-	struct io_thread_data io = {
-		.timeout = -1,
-		.t_locked = !ba_transport_pthread_cleanup_lock(t),
-	};
+static int a2dp_source_mp3_init(struct a2dp_source *s) {
 
+	struct a2dp_source_mp3_data *priv = s->priv;
+	struct ba_transport *t = s->t;
 	lame_t handle;
-	if ((handle = lame_init()) == NULL) {
+
+	if ((handle = priv->handle = lame_init()) == NULL) {
 		error("Couldn't initialize LAME encoder: %s", strerror(errno));
-		goto fail_init;
+		return -1;
 	}
 
-	pthread_cleanup_push(PTHREAD_CLEANUP(lame_close), handle);
-
 	const a2dp_mpeg_t *configuration = (a2dp_mpeg_t *)t->a2dp.configuration;
 	const unsigned int channels = t->a2dp.pcm.channels;
-	const unsigned int samplerate = t->a2dp.pcm.sampling;
 	MPEG_mode mode = NOT_SET;
 
 	lame_set_num_channels(handle, channels);
-	lame_set_in_samplerate(handle, samplerate);
+	lame_set_in_samplerate(handle, t->a2dp.pcm.sampling);
 
 	switch (configuration->channel_mode) {
 	case MPEG_CHANNEL_MODE_MONO:
@@ -992,400 +2478,330 @@ static void *a2dp_source_mp3(struct ba_transport *t) {
 
 	if (lame_set_mode(handle, mode) != 0) {
 		error("LAME: Couldn't set mode: %d", mode);
-		goto fail_setup;
+		return -1;
 	}
 	if (lame_set_bWriteVbrTag(handle, 0) != 0) {
 		error("LAME: Couldn't disable VBR header");
-		goto fail_setup;
+		return -1;
 	}
 	if (lame_set_error_protection(handle, configuration->crc) != 0) {
 		error("LAME: Couldn't set CRC mode: %d", configuration->crc);
-		goto fail_setup;
+		return -1;
 	}
 	if (configuration->vbr) {
 		if (lame_set_VBR(handle, vbr_default) != 0) {
 			error("LAME: Couldn't set VBR mode: %d", vbr_default);
-			goto fail_setup;
+			return -1;
 		}
 		if (lame_set_VBR_q(handle, config.lame_vbr_quality) != 0) {
 			error("LAME: Couldn't set VBR quality: %d", config.lame_vbr_quality);
-			goto fail_setup;
+			return -1;
 		}
 	}
 	else {
 		if (lame_set_VBR(handle, vbr_off) != 0) {
 			error("LAME: Couldn't set CBR mode");
-			goto fail_setup;
+			return -1;
 		}
 		int mpeg_bitrate = MPEG_GET_BITRATE(*configuration);
 		int bitrate = a2dp_mpeg1_mp3_get_max_bitrate(mpeg_bitrate);
 		if (lame_set_brate(handle, bitrate) != 0) {
 			error("LAME: Couldn't set CBR bitrate: %d", bitrate);
-			goto fail_setup;
+			return -1;
 		}
 		if (mpeg_bitrate & MPEG_BIT_RATE_FREE &&
 				lame_set_free_format(handle, 1) != 0) {
 			error("LAME: Couldn't enable free format");
-			goto fail_setup;
+			return -1;
 		}
 	}
 	if (lame_set_quality(handle, config.lame_quality) != 0) {
 		error("LAME: Couldn't set quality: %d", config.lame_quality);
-		goto fail_setup;
+		return -1;
 	}
 
 	if (lame_init_params(handle) != 0) {
 		error("LAME: Couldn't setup encoder");
-		goto fail_setup;
+		return -1;
 	}
 
-	ffb_t bt = { 0 };
-	ffb_t pcm = { 0 };
-	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &bt);
-	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &pcm);
+	s->io.codec_delay = lame_get_framesize(handle) + lame_get_encoder_delay(handle);
 
-	const size_t mpeg_pcm_samples = lame_get_framesize(handle);
-	const size_t rtp_headers_len = RTP_HEADER_LEN + sizeof(rtp_mpeg_audio_header_t);
+	/* LAME accepts any number of PCM frames */
+	s->pcm_samples = channels;
+	s->pcm_buffer_samples = lame_get_framesize(handle);
 	/* It is hard to tell the size of the buffer required, but
 	 * empirical test shows that 2KB should be sufficient. */
-	const size_t mpeg_frame_len = 2048;
-
-	if (ffb_init_int16_t(&pcm, mpeg_pcm_samples) == -1 ||
-			ffb_init_uint8_t(&bt, rtp_headers_len + mpeg_frame_len) == -1) {
-		error("Couldn't create data buffers: %s", strerror(errno));
-		goto fail_ffb;
-	}
-
-	pthread_cleanup_push(PTHREAD_CLEANUP(ba_transport_pthread_cleanup_lock), t);
-
-	rtp_header_t *rtp_header;
-	rtp_mpeg_audio_header_t *rtp_mpeg_audio_header;
-
-	/* initialize RTP headers and get anchor for payload */
-	uint8_t *rtp_payload = a2dp_init_rtp(bt.data, &rtp_header,
-			(void **)&rtp_mpeg_audio_header, sizeof(*rtp_mpeg_audio_header));
-	uint16_t seq_number = be16toh(rtp_header->seq_number);
-	uint32_t timestamp = be32toh(rtp_header->timestamp);
-
-	ba_transport_pthread_cleanup_unlock(t);
-	io.t_locked = false;
-
-	debug("Starting IO loop: %s", ba_transport_type_to_string(t->type));
-	for (;;) {
-
-		ssize_t samples;
-		if ((samples = a2dp_poll_and_read_pcm(&t->a2dp.pcm, &io, &pcm)) <= 0) {
-			if (samples == -1)
-				error("PCM poll and read error: %s", strerror(errno));
-			goto fail;
-		}
-
-		/* anchor for RTP payload */
-		bt.tail = rtp_payload;
-
-		size_t pcm_frames = samples / channels;
-		ssize_t len;
-
-		if ((len = channels == 1 ?
-					lame_encode_buffer(handle, pcm.data, NULL, pcm_frames, bt.tail, ffb_len_in(&bt)) :
-					lame_encode_buffer_interleaved(handle, pcm.data, pcm_frames, bt.tail, ffb_len_in(&bt))) < 0) {
-			error("LAME encoding error: %s", lame_encode_strerror(len));
-			continue;
-		}
-
-		if (len > 0) {
-
-			size_t payload_len_max = t->mtu_write - RTP_HEADER_LEN - sizeof(*rtp_mpeg_audio_header);
-			size_t payload_len_total = len;
-			size_t payload_len = len;
-			rtp_header->timestamp = htobe32(timestamp);
-
-			for (;;) {
-
-				ssize_t ret;
-				size_t len;
-
-				len = payload_len > payload_len_max ? payload_len_max : payload_len;
-				rtp_header->markbit = payload_len <= payload_len_max;
-				rtp_header->seq_number = htobe16(++seq_number);
-				rtp_mpeg_audio_header->offset = payload_len_total - payload_len;
-
-				io.coutq.i = (io.coutq.i + 1) % ARRAYSIZE(io.coutq.v);
-				if ((ret = io_thread_write_bt(t->bt_fd, bt.data, RTP_HEADER_LEN +
-								sizeof(*rtp_mpeg_audio_header) + len, &io.coutq.v[io.coutq.i],
-								t->a2dp.bt_fd_coutq_init)) == -1) {
-					if (errno == ECONNRESET || errno == ENOTCONN) {
-						/* exit thread upon BT socket disconnection */
-						debug("BT socket disconnected: %d", t->bt_fd);
-						goto fail;
-					}
-					error("BT socket write error: %s", strerror(errno));
-					break;
-				}
+	s->payload_size = 2048;
 
-				/* account written payload only */
-				ret -= RTP_HEADER_LEN + sizeof(*rtp_mpeg_audio_header);
-
-				/* break if the last part of the payload has been written */
-				if ((payload_len -= ret) == 0)
-					break;
+	return 0;
+}
 
-				/* move rest of data to the beginning of the payload */
-				debug("Payload fragmentation: extra %zd bytes", payload_len);
-				memmove(rtp_payload, rtp_payload + ret, payload_len);
+static void a2dp_source_mp3_free(struct a2dp_source *s) {
+	struct a2dp_source_mp3_data *priv = s->priv;
+	if (priv->handle != NULL)
+		lame_close(priv->handle);
+}
 
-			}
+static ssize_t a2dp_source_mp3_encode(struct a2dp_source *s, const void *pcm,
+		size_t samples, size_t *consumed, uint8_t *payload, size_t len) {
 
-		}
+	struct a2dp_source_mp3_data *priv = s->priv;
+	const unsigned int channels = s->t->a2dp.pcm.channels;
+	const size_t pcm_frames = samples / channels;
+	int ret;
 
-		/* keep data transfer at a constant bit rate, also
-		 * get a timestamp for the next RTP frame */
-		asrsync_sync(&io.asrs, pcm_frames);
-		timestamp += pcm_frames * 10000 / samplerate;
+	if ((ret = channels == 1 ?
+				lame_encode_buffer(priv->handle, pcm, NULL, pcm_frames, payload, len) :
+				lame_encode_buffer_interleaved(priv->handle, (int16_t *)pcm, pcm_frames, payload, len)) < 0) {
+		error("LAME encoding error: %s", lame_encode_strerror(ret));
+		return -1;
+	}
 
-		/* update busy delay (encoding overhead) */
-		t->a2dp.pcm.delay = asrsync_get_busy_usec(&io.asrs) / 100;
+	*consumed = pcm_frames * channels;
+	return ret;
+}
 
-		/* If the input buffer was not consumed (due to frame alignment), we
-		 * have to append new data to the existing one. Since we do not use
-		 * ring buffer, we will simply move unprocessed data to the front
-		 * of our linear buffer. */
-		ffb_shift(&pcm, pcm_frames * channels);
+static void a2dp_source_mp3_fragment(struct a2dp_source *s, size_t offset) {
+	rtp_mpeg_audio_header_t *rtp_mpeg_audio_header = s->rtp_phdr;
+	rtp_mpeg_audio_header->offset = htobe16(offset);
+}
 
-	}
+static const struct a2dp_source_codec a2dp_source_mp3_codec = {
+	.priv_size = sizeof(struct a2dp_source_mp3_data),
+	.rtp = true,
+	.rtp_phdr_size = sizeof(rtp_mpeg_audio_header_t),
+	.fragmentation = true,
+	.init = a2dp_source_mp3_init,
+	.free = a2dp_source_mp3_free,
+	.encode = a2dp_source_mp3_encode,
+	.fragment = a2dp_source_mp3_fragment,
+};
 
-fail:
-	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-	pthread_cleanup_pop(!io.t_locked);
-fail_ffb:
-	pthread_cleanup_pop(1);
-	pthread_cleanup_pop(1);
-fail_setup:
-	pthread_cleanup_pop(1);
-fail_init:
-	pthread_cleanup_pop(1);
-	return NULL;
+static void *a2dp_source_mp3(struct ba_transport *t) {
+	return a2dp_source_pipeline(t, &a2dp_source_mp3_codec);
 }
 #endif
 
-#if ENABLE_AAC
-static void *a2dp_sink_aac(struct ba_transport *t) {
-
-	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-	pthread_cleanup_push(PTHREAD_CLEANUP(ba_transport_pthread_cleanup), t);
-
-	struct io_thread_data io = {
-		.t_locked = !ba_transport_pthread_cleanup_lock(t),
-	};
+#if ENABLE_AAC || ENABLE_USAC
+/**
+ * FDK AAC decoder private data. */
+struct a2dp_sink_aac_data {
+	HANDLE_AACDECODER handle;
+	/* PCM frames per AAC frame, known after the first decoded frame */
+	unsigned int frame_size;
+	/* concealed PCM frames not yet accounted for (might be negative) */
+	int conceal_remainder;
+};
 
-	if (a2dp_validate_bt_sink(t) != 0)
-		goto fail_open;
+static int a2dp_sink_aac_init(struct a2dp_sink *s) {
 
-	HANDLE_AACDECODER handle;
+	struct a2dp_sink_aac_data *priv = s->priv;
+	const unsigned int channels = s->t->a2dp.pcm.channels;
 	AAC_DECODER_ERROR err;
 
-	if ((handle = aacDecoder_Open(TT_MP4_LATM_MCP1, 1)) == NULL) {
+	if ((priv->handle = aacDecoder_Open(TT_MP4_LATM_MCP1, 1)) == NULL) {
 		error("Couldn't open AAC decoder");
-		goto fail_open;
+		return -1;
 	}
 
-	pthread_cleanup_push(PTHREAD_CLEANUP(aacDecoder_Close), handle);
-
-	const unsigned int channels = t->a2dp.pcm.channels;
 #ifdef AACDECODER_LIB_VL0
-	if ((err = aacDecoder_SetParam(handle, AAC_PCM_MIN_OUTPUT_CHANNELS, channels)) != AAC_DEC_OK) {
+	if ((err = aacDecoder_SetParam(priv->handle, AAC_PCM_MIN_OUTPUT_CHANNELS, channels)) != AAC_DEC_OK) {
 		error("Couldn't set min output channels: %s", aacdec_strerror(err));
-		goto fail_init;
+		return -1;
 	}
-	if ((err = aacDecoder_SetParam(handle, AAC_PCM_MAX_OUTPUT_CHANNELS, channels)) != AAC_DEC_OK) {
+	if ((err = aacDecoder_SetParam(priv->handle, AAC_PCM_MAX_OUTPUT_CHANNELS, channels)) != AAC_DEC_OK) {
 		error("Couldn't set max output channels: %s", aacdec_strerror(err));
-		goto fail_init;
+		return -1;
 	}
 #else
-	if ((err = aacDecoder_SetParam(handle, AAC_PCM_OUTPUT_CHANNELS, channels)) != AAC_DEC_OK) {
+	if ((err = aacDecoder_SetParam(priv->handle, AAC_PCM_OUTPUT_CHANNELS, channels)) != AAC_DEC_OK) {
 		error("Couldn't set output channels: %s", aacdec_strerror(err));
-		goto fail_init;
+		return -1;
 	}
 #endif
 
-	ffb_t bt = { 0 };
-	ffb_t latm = { 0 };
-	ffb_t pcm = { 0 };
-	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &bt);
-	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &latm);
-	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &pcm);
-
-	if (ffb_init_int16_t(&pcm, 2048 * channels) == -1 ||
-			ffb_init_uint8_t(&latm, t->mtu_read) == -1 ||
-			ffb_init_uint8_t(&bt, t->mtu_read) == -1) {
-		error("Couldn't create data buffers: %s", strerror(errno));
-		goto fail_ffb;
-	}
-
-	pthread_cleanup_push(PTHREAD_CLEANUP(ba_transport_pthread_cleanup_lock), t);
-
-	uint16_t seq_number = -1;
-	int markbit_quirk = -3;
+	s->pcm_samples = 2048 * channels;
+	return 0;
+}
 
-	ba_transport_pthread_cleanup_unlock(t);
-	io.t_locked = false;
+static void a2dp_sink_aac_free(struct a2dp_sink *s) {
+	struct a2dp_sink_aac_data *priv = s->priv;
+	if (priv->handle != NULL)
+		aacDecoder_Close(priv->handle);
+}
 
-	debug("Starting IO loop: %s", ba_transport_type_to_string(t->type));
-	for (;;) {
+/**
+ * Conceal lost AAC frames with the FDK AAC decoder built-in concealment. */
+static unsigned int a2dp_sink_aac_conceal(struct a2dp_sink *s, unsigned int frames) {
 
-		ssize_t len;
-		if ((len = a2dp_poll_and_read_bt(t, &io, &bt)) <= 0) {
-			if (len == -1)
-				error("BT poll and read error: %s", strerror(errno));
-			goto fail;
-		}
+	struct a2dp_sink_aac_data *priv = s->priv;
+	const unsigned int frame_size = priv->frame_size;
+	unsigned int written = 0;
 
-		debug("RIIC Boop 1");
+	/* frame size is not known until the first frame is decoded */
+	if (frame_size == 0)
+		return 0;
 
-		if (t->a2dp.pcm.fd == -1) {
-			debug("RIIC Boop 111");
-			seq_number = -1;
-			continue;
-		}
+	/* AAC can be concealed in whole frames only, so the difference between
+	 * the requested and the concealed duration is carried over to the next
+	 * call - otherwise the playout timeline would drift after every loss */
+	const int total = priv->conceal_remainder + (int)frames;
+	unsigned int i = total > 0 ? (total + frame_size / 2) / frame_size : 0;
+	priv->conceal_remainder = total - (int)(i * frame_size);
 
-		const rtp_header_t *rtp_header = (rtp_header_t *)bt.data;
-		uint8_t *rtp_latm = (uint8_t *)&rtp_header->csrc[rtp_header->cc];
-		size_t rtp_latm_len = len - (rtp_latm - (uint8_t *)rtp_header);
+	while (i-- > 0) {
 
-#if ENABLE_PAYLOADCHECK
-		if (rtp_header->paytype < 96) {
-			warn("Unsupported RTP payload type: %u", rtp_header->paytype);
-			continue;
+		AAC_DECODER_ERROR err;
+		if ((err = aacDecoder_DecodeFrame(priv->handle, s->pcm.data,
+						ffb_blen_in(&s->pcm), AACDEC_CONCEAL)) != AAC_DEC_OK) {
+			error("AAC concealment error: %s", aacdec_strerror(err));
+			break;
 		}
-#endif
 
-		/* If in the first N packets mark bit is not set, it might mean, that
-		 * the mark bit will not be set at all. In such a case, activate mark
-		 * bit quirk workaround. */
-		if (markbit_quirk < 0) {
-			if (rtp_header->markbit)
-				markbit_quirk = 0;
-			else if (++markbit_quirk == 0) {
-				warn("Activating RTP mark bit quirk workaround");
-				markbit_quirk = 1;
-			}
-		}
+		a2dp_sink_write(&s->writer, s->pcm.data, frame_size * s->t->a2dp.pcm.channels);
+		written += frame_size;
 
-		uint16_t _seq_number = be16toh(rtp_header->seq_number);
-		if (++seq_number != _seq_number) {
-			if (seq_number != 0)
-				warn("Missing RTP packet: %u != %u", _seq_number, seq_number);
-			seq_number = _seq_number;
-		}
+	}
 
-		if (ffb_len_in(&latm) < rtp_latm_len) {
-			debug("Resizing LATM buffer: %zd -> %zd", latm.size, latm.size + t->mtu_read);
-			size_t prev_len = ffb_len_out(&latm);
-			ffb_init_uint8_t(&latm, latm.nmemb + t->mtu_read);
-			ffb_seek(&latm, prev_len);
-		}
+	return written;
+}
 
-		debug("RIIC Boop 2");
+static void a2dp_sink_aac_decode(struct a2dp_sink *s, const void *phdr,
+		const uint8_t *payload, size_t len) {
 
-		memcpy(latm.tail, rtp_latm, rtp_latm_len);
-		ffb_seek(&latm, rtp_latm_len);
+	struct a2dp_sink_aac_data *priv = s->priv;
+	uint8_t *data = (uint8_t *)payload;
+	unsigned int data_len = len;
+	unsigned int valid = len;
+	AAC_DECODER_ERROR err;
+	CStreamInfo *aacinf;
+	(void)phdr;
+
+	if ((err = aacDecoder_Fill(priv->handle, &data, &data_len, &valid)) != AAC_DEC_OK)
+		error("AAC buffer fill error: %s", aacdec_strerror(err));
+	else if ((err = aacDecoder_DecodeFrame(priv->handle, s->pcm.data,
+					ffb_blen_in(&s->pcm), 0)) != AAC_DEC_OK) {
+		error("AAC decode frame error: %s", aacdec_strerror(err));
+		/* replace corrupted frame with the concealment signal */
+		a2dp_jbuf_played(&s->jb, a2dp_sink_aac_conceal(s, priv->frame_size));
+	}
+	else if ((aacinf = aacDecoder_GetStreamInfo(priv->handle)) == NULL)
+		error("Couldn't get AAC stream info");
+	else {
+		priv->frame_size = aacinf->frameSize;
+		a2dp_sink_output(s, s->pcm.data, aacinf->frameSize * aacinf->numChannels);
+	}
 
-		debug("RIIC Boop 3");
+}
 
-		if (markbit_quirk != 1 && !rtp_header->markbit) {
-			debug("Fragmented RTP packet [%u]: LATM len: %zd", seq_number, rtp_latm_len);
-			continue;
-		}
+#if ENABLE_AAC
+static const struct a2dp_sink_codec a2dp_sink_aac_codec = {
+	.priv_size = sizeof(struct a2dp_sink_aac_data),
+	.rtp = true,
+	.fragmentation = true,
+	.init = a2dp_sink_aac_init,
+	.free = a2dp_sink_aac_free,
+	.decode = a2dp_sink_aac_decode,
+	.conceal = a2dp_sink_aac_conceal,
+};
 
-		unsigned int data_len = ffb_len_out(&latm);
-		unsigned int valid = ffb_len_out(&latm);
-		CStreamInfo *aacinf;
+static void *a2dp_sink_aac(struct ba_transport *t) {
+	return a2dp_sink_pipeline(t, &a2dp_sink_aac_codec);
+}
+#endif
 
-		debug("RIIC Boop 4");
+#if ENABLE_USAC
+static int a2dp_sink_usac_init(struct a2dp_sink *s) {
+	if (a2dp_sink_aac_init(s) == -1)
+		return -1;
+	/* with the 4:1 SBR, USAC frame is decoded into 4096 PCM frames */
+	s->pcm_samples = 4096 * s->t->a2dp.pcm.channels;
+	return 0;
+}
 
+static const struct a2dp_sink_codec a2dp_sink_usac_codec = {
+	.priv_size = sizeof(struct a2dp_sink_aac_data),
+	.rtp = true,
+	.fragmentation = true,
+	.init = a2dp_sink_usac_init,
+	.free = a2dp_sink_aac_free,
+	.decode = a2dp_sink_aac_decode,
+	.conceal = a2dp_sink_aac_conceal,
+};
 
-#if 0
-		// IDEA: Print decoder input bytes
-		// IDEA: Check input chunk size
-		// IDEA: Check what the aacDecoder expects in terms of input data size
-		err = aacDecoder_Fill(handle, (uint8_t **)&latm.data, &data_len, &valid);
-		debug("RIIC Boop 41");
+static void *a2dp_sink_usac(struct ba_transport *t) {
+	return a2dp_sink_pipeline(t, &a2dp_sink_usac_codec);
+}
+#endif
 
-		if (err == AAC_DEC_OK) {
-			debug("RIIC Boop 42");
-			err = aacDecoder_DecodeFrame(handle, pcm.tail, ffb_blen_in(&pcm), 0);
-		} else {
-			error("AAC buffer fill error: %s", aacdec_strerror(err));
-		}
-		debug("RIIC Boop 43");
-		if (err == AAC_DEC_OK) {
-			debug("RIIC Boop 44");
-			aacinf = aacDecoder_GetStreamInfo(handle);
-		} else {
-			error("AAC decode frame error: %s", aacdec_strerror(err));
-		}
-		debug("RIIC Boop 45");
-		if (err == AAC_DEC_OK && aacinf != NULL) {
-			debug("RIIC Boop 46");
-			const size_t samples = aacinf->frameSize * aacinf->numChannels;
-			if (ba_transport_pcm_write(&t->a2dp.pcm, pcm.data, samples) == -1)
-				error("FIFO write error: %s", strerror(errno));
-		} else {
-			error("Couldn't get AAC stream info");
-		}
-#else
-		if ((err = aacDecoder_Fill(handle, (uint8_t **)&latm.data, &data_len, &valid)) != AAC_DEC_OK)
-			error("AAC buffer fill error: %s", aacdec_strerror(err));
-		else if ((err = aacDecoder_DecodeFrame(handle, pcm.tail, ffb_blen_in(&pcm), 0)) != AAC_DEC_OK)
-			error("AAC decode frame error: %s", aacdec_strerror(err));
-		else if ((aacinf = aacDecoder_GetStreamInfo(handle)) == NULL)
-			error("Couldn't get AAC stream info");
-		else {
-			const size_t samples = aacinf->frameSize * aacinf->numChannels;
-			if (ba_transport_pcm_write(&t->a2dp.pcm, pcm.data, samples) == -1)
-				error("FIFO write error: %s", strerror(errno));
-		}
 #endif
 
-		debug("RIIC Boop 5");
+#if ENABLE_AAC
+/**
+ * FDK AAC encoder private data. */
+struct a2dp_source_aac_data {
+	HANDLE_AACENCODER handle;
+	/* adaptive bit rate (CBR mode only) */
+	struct aac_abr abr;
+	bool abr_enabled;
+};
 
-		/* make room for new LATM frame */
-		ffb_rewind(&latm);
+/**
+ * Finalize FDK AAC encoder configuration.
+ *
+ * This function shall be called when all encoder parameters are set. It
+ * initializes the encoder, the adaptive bit rate controller and the frame
+ * geometry of the source pipeline.
+ *
+ * @param s The A2DP source structure.
+ * @param bitrate The configured CBR bit rate.
+ * @param vbr If true, the encoder runs in the VBR mode.
+ * @return On success this function returns 0. Otherwise, -1 is returned. */
+static int a2dp_source_aac_init_encoder(struct a2dp_source *s,
+		unsigned int bitrate, bool vbr) {
+
+	struct a2dp_source_aac_data *priv = s->priv;
+	HANDLE_AACENCODER handle = priv->handle;
+	AACENC_InfoStruct aacinf;
+	AACENC_ERROR err;
 
+	if ((err = aacEncEncode(handle, NULL, NULL, NULL, NULL)) != AACENC_OK) {
+		error("Couldn't initialize AAC encoder: %s", aacenc_strerror(err));
+		return -1;
+	}
+	if ((err = aacEncInfo(handle, &aacinf)) != AACENC_OK) {
+		error("Couldn't get encoder info: %s", aacenc_strerror(err));
+		return -1;
 	}
 
-fail:
-	debug("RIIC Boop 6");
-	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-	pthread_cleanup_pop(!io.t_locked);
-fail_ffb:
-	debug("RIIC Boop 7");
-	pthread_cleanup_pop(1);
-	pthread_cleanup_pop(1);
-	pthread_cleanup_pop(1);
-fail_init:
-	debug("RIIC Boop 8");
-	pthread_cleanup_pop(1);
-fail_open:
-	debug("RIIC Boop 9");
-	pthread_cleanup_pop(1);
-	return NULL;
-}
+#if AACENCODER_LIB_VERSION >= 0x04000000 /* 4.0.0 */
+	s->io.codec_delay = aacinf.frameLength + aacinf.nDelay;
+#else
+	s->io.codec_delay = aacinf.frameLength + aacinf.encoderDelay;
 #endif
 
-#if ENABLE_AAC
-static void *a2dp_source_aac(struct ba_transport *t) {
+	/* Changing the bit rate resets the encoder rate control only, but the
+	 * change of the VBR mode makes the FDK AAC encoder re-initialize itself
+	 * completely, which results in an audible glitch. Hence, the adaptive
+	 * bit rate is available in the CBR mode only. */
+	aac_abr_init(&priv->abr, AACENC_BITRATE, config.aac_abr_min_bitrate,
+			bitrate, MAX(bitrate / 8, 8000));
+	if ((priv->abr_enabled = config.aac_abr && !vbr) != config.aac_abr)
+		warn("AAC adaptive bit rate is not supported in the VBR mode");
 
-	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-	pthread_cleanup_push(PTHREAD_CLEANUP(ba_transport_pthread_cleanup), t);
+	/* FDK AAC buffers incomplete frames internally */
+	s->pcm_samples = s->t->a2dp.pcm.channels;
+	s->pcm_buffer_samples = aacinf.inputChannels * aacinf.frameLength;
+	s->payload_size = aacinf.maxOutBufBytes;
 
-	struct io_thread_data io = {
-		.timeout = -1,
-		.t_locked = !ba_transport_pthread_cleanup_lock(t),
-	};
+	return 0;
+}
 
-	HANDLE_AACENCODER handle;
-	AACENC_InfoStruct aacinf;
+static int a2dp_source_aac_init(struct a2dp_source *s) {
+
+	struct a2dp_source_aac_data *priv = s->priv;
+	struct ba_transport *t = s->t;
 	AACENC_ERROR err;
 
 	const a2dp_aac_t *configuration = (a2dp_aac_t *)t->a2dp.configuration;
@@ -1394,934 +2810,1279 @@ static void *a2dp_source_aac(struct ba_transport *t) {
 	const unsigned int samplerate = t->a2dp.pcm.sampling;
 
 	/* create AAC encoder without the Meta Data module */
-	if ((err = aacEncOpen(&handle, 0x07, channels)) != AACENC_OK) {
+	if ((err = aacEncOpen(&priv->handle, 0x07, channels)) != AACENC_OK) {
 		error("Couldn't open AAC encoder: %s", aacenc_strerror(err));
-		goto fail_open;
+		return -1;
 	}
 
-	pthread_cleanup_push(PTHREAD_CLEANUP(aacEncClose), &handle);
+	HANDLE_AACENCODER handle = priv->handle;
+	unsigned int aot = AOT_NONE;
+	unsigned int channelmode = channels == 1 ? MODE_1 : MODE_2;
 
-	//if (config.a2dp.skip_encoding == false || true) {
-		unsigned int aot = AOT_NONE;
-		unsigned int channelmode = channels == 1 ? MODE_1 : MODE_2;
-
-		switch (configuration->object_type) {
-		case AAC_OBJECT_TYPE_MPEG2_AAC_LC:
+	switch (configuration->object_type) {
+	case AAC_OBJECT_TYPE_MPEG2_AAC_LC:
 #if AACENCODER_LIB_VERSION <= 0x03040C00 /* 3.4.12 */ || \
 		AACENCODER_LIB_VERSION >= 0x04000000 /* 4.0.0 */
-			aot = AOT_MP2_AAC_LC;
-			break;
+		aot = AOT_MP2_AAC_LC;
+		break;
 #endif
-		case AAC_OBJECT_TYPE_MPEG4_AAC_LC:
-			aot = AOT_AAC_LC;
-			break;
-		case AAC_OBJECT_TYPE_MPEG4_AAC_LTP:
-			aot = AOT_AAC_LTP;
-			break;
-		case AAC_OBJECT_TYPE_MPEG4_AAC_SCA:
-			aot = AOT_AAC_SCAL;
-			break;
-		}
+	case AAC_OBJECT_TYPE_MPEG4_AAC_LC:
+		aot = AOT_AAC_LC;
+		break;
+	case AAC_OBJECT_TYPE_MPEG4_AAC_LTP:
+		aot = AOT_AAC_LTP;
+		break;
+	case AAC_OBJECT_TYPE_MPEG4_AAC_SCA:
+		aot = AOT_AAC_SCAL;
+		break;
+	}
 
-		if ((err = aacEncoder_SetParam(handle, AACENC_AOT, aot)) != AACENC_OK) {
-			error("Couldn't set audio object type: %s", aacenc_strerror(err));
-			goto fail_init;
-		}
-		if ((err = aacEncoder_SetParam(handle, AACENC_BITRATE, bitrate)) != AACENC_OK) {
-			error("Couldn't set bitrate: %s", aacenc_strerror(err));
-			goto fail_init;
-		}
-		if ((err = aacEncoder_SetParam(handle, AACENC_SAMPLERATE, samplerate)) != AACENC_OK) {
-			error("Couldn't set sampling rate: %s", aacenc_strerror(err));
-			goto fail_init;
-		}
-		if ((err = aacEncoder_SetParam(handle, AACENC_CHANNELMODE, channelmode)) != AACENC_OK) {
-			error("Couldn't set channel mode: %s", aacenc_strerror(err));
-			goto fail_init;
-		}
-		if (configuration->vbr) {
-			if ((err = aacEncoder_SetParam(handle, AACENC_BITRATEMODE, config.aac_vbr_mode)) != AACENC_OK) {
-				error("Couldn't set VBR bitrate mode %u: %s", config.aac_vbr_mode, aacenc_strerror(err));
-				goto fail_init;
-			}
-		}
-		if ((err = aacEncoder_SetParam(handle, AACENC_AFTERBURNER, config.aac_afterburner)) != AACENC_OK) {
-			error("Couldn't enable afterburner: %s", aacenc_strerror(err));
-			goto fail_init;
-		}
-		if ((err = aacEncoder_SetParam(handle, AACENC_TRANSMUX, TT_MP4_LATM_MCP1)) != AACENC_OK) {
-			error("Couldn't enable LATM transport type: %s", aacenc_strerror(err));
-			goto fail_init;
-		}
-		if ((err = aacEncoder_SetParam(handle, AACENC_HEADER_PERIOD, 1)) != AACENC_OK) {
-			error("Couldn't set LATM header period: %s", aacenc_strerror(err));
-			goto fail_init;
+	if ((err = aacEncoder_SetParam(handle, AACENC_AOT, aot)) != AACENC_OK) {
+		error("Couldn't set audio object type: %s", aacenc_strerror(err));
+		return -1;
+	}
+	if ((err = aacEncoder_SetParam(handle, AACENC_BITRATE, bitrate)) != AACENC_OK) {
+		error("Couldn't set bitrate: %s", aacenc_strerror(err));
+		return -1;
+	}
+	if ((err = aacEncoder_SetParam(handle, AACENC_SAMPLERATE, samplerate)) != AACENC_OK) {
+		error("Couldn't set sampling rate: %s", aacenc_strerror(err));
+		return -1;
+	}
+	if ((err = aacEncoder_SetParam(handle, AACENC_CHANNELMODE, channelmode)) != AACENC_OK) {
+		error("Couldn't set channel mode: %s", aacenc_strerror(err));
+		return -1;
+	}
+	if (configuration->vbr) {
+		if ((err = aacEncoder_SetParam(handle, AACENC_BITRATEMODE, config.aac_vbr_mode)) != AACENC_OK) {
+			error("Couldn't set VBR bitrate mode %u: %s", config.aac_vbr_mode, aacenc_strerror(err));
+			return -1;
 		}
+	}
+	if ((err = aacEncoder_SetParam(handle, AACENC_AFTERBURNER, config.aac_afterburner)) != AACENC_OK) {
+		error("Couldn't enable afterburner: %s", aacenc_strerror(err));
+		return -1;
+	}
+	if ((err = aacEncoder_SetParam(handle, AACENC_TRANSMUX, TT_MP4_LATM_MCP1)) != AACENC_OK) {
+		error("Couldn't enable LATM transport type: %s", aacenc_strerror(err));
+		return -1;
+	}
+	if ((err = aacEncoder_SetParam(handle, AACENC_HEADER_PERIOD, 1)) != AACENC_OK) {
+		error("Couldn't set LATM header period: %s", aacenc_strerror(err));
+		return -1;
+	}
 #if AACENCODER_LIB_VERSION >= 0x03041600 /* 3.4.22 */
-		if ((err = aacEncoder_SetParam(handle, AACENC_AUDIOMUXVER, config.aac_latm_version)) != AACENC_OK) {
-			error("Couldn't set LATM version: %s", aacenc_strerror(err));
-			goto fail_init;
-		}
+	if ((err = aacEncoder_SetParam(handle, AACENC_AUDIOMUXVER, config.aac_latm_version)) != AACENC_OK) {
+		error("Couldn't set LATM version: %s", aacenc_strerror(err));
+		return -1;
+	}
 #endif
 
-		if ((err = aacEncEncode(handle, NULL, NULL, NULL, NULL)) != AACENC_OK) {
-			error("Couldn't initialize AAC encoder: %s", aacenc_strerror(err));
-			goto fail_init;
-		}
-		if ((err = aacEncInfo(handle, &aacinf)) != AACENC_OK) {
-			error("Couldn't get encoder info: %s", aacenc_strerror(err));
-			goto fail_init;
-		}
-	//}
-
-	ffb_t bt = { 0 };
-	ffb_t pcm = { 0 };
-	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &bt);
-	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &pcm);
-
-	const size_t sample_size = BA_TRANSPORT_PCM_FORMAT_BYTES(t->a2dp.pcm.format);
-	if (ffb_init(&pcm, aacinf.inputChannels * aacinf.frameLength, sample_size) == -1 ||
-			ffb_init_uint8_t(&bt, RTP_HEADER_LEN + aacinf.maxOutBufBytes) == -1) {
-		error("Couldn't create data buffers: %s", strerror(errno));
-		goto fail_ffb;
-	}
-
-#ifdef FHG_BS_STREAM_DEBUG
-	// IDEA: print t->a2dp.pcm.format / sample_size (expected: uint8_t ?), aacinf.inputChannels, aacinf.frameLength and aacinf.maxOutBufBytes
-	debug("RIC t->a2dp.pcm.format = %u", t->a2dp.pcm.format);
-	debug("RIC sample_size           = %u bytes", sample_size);
-	debug("RIC t->a2dp.pcm.channels  = %u", t->a2dp.pcm.channels);
-	debug("RIC t->a2dp.pcm.sampling  = %u", t->a2dp.pcm.sampling);
-	debug("RIC num inPcmBuf elements (aacinf.inputChannels * aacinf.frameLength)  = %u", aacinf.inputChannels * aacinf.frameLength);
-	debug("RIC sizeof(uint8_t)       = %u bytes", sizeof(uint8_t));
-	debug("RIC aacinf.inputChannels  = %u", aacinf.inputChannels);
-	debug("RIC aacinf.frameLength    = %u", aacinf.frameLength);
-	debug("RIC aacinf.maxOutBufBytes = %u", aacinf.maxOutBufBytes);
-	debug("RIC RTP_HEADER_LEN = %u", (unsigned int)RTP_HEADER_LEN);
-	debug("RIC num outPcmBuf elements (RTP_HEADER_LEN + aacinf.maxOutBufBytes) = %u", RTP_HEADER_LEN + aacinf.maxOutBufBytes);
-	debug("RIC pcm.nmemb = %u (number of elements)", pcm.nmemb);
-	debug("RIC pcm.size  = %u (size of each element in bytes)", pcm.size);
-#endif
+	return a2dp_source_aac_init_encoder(s, bitrate,
+			configuration->vbr && config.aac_vbr_mode > 0);
+}
 
-	pthread_cleanup_push(PTHREAD_CLEANUP(ba_transport_pthread_cleanup_lock), t);
+static void a2dp_source_aac_free(struct a2dp_source *s) {
+	struct a2dp_source_aac_data *priv = s->priv;
+	aacEncClose(&priv->handle);
+}
 
-	rtp_header_t *rtp_header;
+static ssize_t a2dp_source_aac_encode(struct a2dp_source *s, const void *pcm,
+		size_t samples, size_t *consumed, uint8_t *payload, size_t len) {
 
-	/* initialize RTP header and get anchor for payload */
-	uint8_t *rtp_payload = a2dp_init_rtp(bt.data, &rtp_header, NULL, 0);
-	uint16_t seq_number = be16toh(rtp_header->seq_number);
-	uint32_t timestamp = be32toh(rtp_header->timestamp);
+	struct a2dp_source_aac_data *priv = s->priv;
+	const int sample_size = BA_TRANSPORT_PCM_FORMAT_BYTES(s->t->a2dp.pcm.format);
+	AACENC_ERROR err;
 
-	int in_bufferIdentifiers[] = { IN_AUDIO_DATA }; // IDEA: make sure buffer identifiers are set correctly
+	void *in_bufs[] = { (void *)pcm };
+	void *out_bufs[] = { payload };
+	int in_bufferIdentifiers[] = { IN_AUDIO_DATA };
 	int out_bufferIdentifiers[] = { OUT_BITSTREAM_DATA };
-	int in_bufSizes[] = { pcm.nmemb * pcm.size };
-	int out_bufSizes[] = { aacinf.maxOutBufBytes };
-	int in_bufElSizes[] = { pcm.size };
-	int out_bufElSizes[] = { bt.size };
+	int in_bufSizes[] = { samples * sample_size };
+	int out_bufSizes[] = { len };
+	int in_bufElSizes[] = { sample_size };
+	int out_bufElSizes[] = { sizeof(uint8_t) };
 
 	AACENC_BufDesc in_buf = {
 		.numBufs = 1,
-		.bufs = (void **)&pcm.data,
+		.bufs = in_bufs,
 		.bufferIdentifiers = in_bufferIdentifiers,
 		.bufSizes = in_bufSizes,
 		.bufElSizes = in_bufElSizes,
 	};
 	AACENC_BufDesc out_buf = {
 		.numBufs = 1,
-		.bufs = (void **)&rtp_payload,
+		.bufs = out_bufs,
 		.bufferIdentifiers = out_bufferIdentifiers,
 		.bufSizes = out_bufSizes,
 		.bufElSizes = out_bufElSizes,
 	};
-	AACENC_InArgs in_args = { 0 };
+	AACENC_InArgs in_args = { .numInSamples = samples };
 	AACENC_OutArgs out_args = { 0 };
 
-	ba_transport_pthread_cleanup_unlock(t);
-	io.t_locked = false;
-
-#ifdef FHG_BS_STREAM_DEBUG
-//##########################################################################################
-#if 0
-  {
-    FILE *fp;
-    size_t returnBytes;
-    int numBytes = 512;
-    uint8_t testBuffer[numBytes];
-
-    debug("RIIC BOOP 1");
-    // fp = fopen("/home/pi/Music/IOP/bs/48000_stereo__Aot-42_Vbr-4_DrcMode-1.mp4", "r");
-    fp = fopen("/media/IOP/bs/48000_stereo__Mpeg2_Aot-2_Br-128000_noLou.mp4", "r");
-    // fp = fopen("/home/pi/Documents/test.txt", "r");
-    debug("RIIC BOOP 2");
-
-    if(fp == NULL)
-    {
-      error("RIIC Error! Opened file pointer is NULL");
-      goto fail;
-    }
-    debug("RIIC BOOP 3");
-    returnBytes = fread( testBuffer, sizeof( uint8_t ), numBytes, fp );
-    debug("RIIC BOOP 4");
-    debug("RIIC BOOP 5");
-    debug("RIIC returnBytes = %u", returnBytes);
-
-    printf("RIIC The read string contains:");
-    for (int i = 0; i < returnBytes; i+=16) {
-      debug("RIIC %x %x %x %x %x %x %x %x %x %x %x %x %x %x %x %x", testBuffer[i], testBuffer[i+1], testBuffer[i+2], testBuffer[i+3], testBuffer[i+4], testBuffer[i+5], testBuffer[i+6], testBuffer[i+7], testBuffer[i+8], testBuffer[i+9], testBuffer[i+10], testBuffer[i+11], testBuffer[i+12], testBuffer[i+13], testBuffer[i+14], testBuffer[i+15]);
-    }
-
-    fclose(fp);
-  }
-#endif
+	if ((err = aacEncEncode(priv->handle, &in_buf, &out_buf, &in_args, &out_args)) != AACENC_OK) {
+		error("AAC encoding error: %s", aacenc_strerror(err));
+		return -1;
+	}
 
-#if 1
-  {
-    FILE *fp;
-    fp = fopen("/media/IOP/bs/48000_stereo__Mpeg2_Aot-2_Br-128000_noLou.mp4", "r");
-    debug("RIC");
-
-    if(fp == NULL)
-    {
-      error("RIC Error! Opened file pointer is NULL");
-      goto fail;
-    }
-
-    int numBytes = 512;
-    uint8_t bitstreamData[numBytes];
-
-    /* initialize RTP header and get anchor for payload */
-    rtp_header_t *rtp_header_2;
-    uint8_t *rtp_payload_2 = a2dp_init_rtp(bitstreamData, &rtp_header_2, NULL, 0);
-    uint16_t seq_number = be16toh(rtp_header_2->seq_number);
-    uint32_t timestamp = be32toh(rtp_header_2->timestamp);
-
-    size_t returnBytes;
-
-    do {
-      returnBytes = fread( bitstreamData, sizeof( uint8_t ), numBytes, fp );
-      debug("RIC returnBytes = %u", returnBytes);
-
-      if (returnBytes > 0) {
-
-				size_t payload_len_max = t->mtu_write - RTP_HEADER_LEN;
-				size_t payload_len = returnBytes;
-				rtp_header_2->timestamp = htobe32(timestamp);
-
-        debug("RIC RTP packet creation:");
-        debug("RIC     t->mtu_write = %u", t->mtu_write);
-        debug("RIC     payload_len_max = %u", payload_len_max);
-        debug("RIC     payload_len = %u", payload_len);
-
-				/* If the size of the RTP packet exceeds writing MTU, the RTP payload
-				 * should be fragmented. According to the RFC 3016, fragmentation of
-				 * the audioMuxElement requires no extra header - the payload should
-				 * be fragmented and spread across multiple RTP packets. */
-				for (;;) {
-
-					ssize_t ret;
-					size_t len;
-
-					len = payload_len > payload_len_max ? payload_len_max : payload_len;
-					rtp_header_2->markbit = payload_len <= payload_len_max;
-					rtp_header_2->seq_number = htobe16(++seq_number);
-
-					io.coutq.i = (io.coutq.i + 1) % ARRAYSIZE(io.coutq.v);
-					if ((ret = io_thread_write_bt(t->bt_fd, bitstreamData, RTP_HEADER_LEN + len, // IDEA: Maybe directly feed data from t->a2dp.pcm.fd
-									&io.coutq.v[io.coutq.i], t->a2dp.bt_fd_coutq_init)) == -1) {
-						if (errno == ECONNRESET || errno == ENOTCONN) {
-							/* exit thread upon BT socket disconnection */
-							debug("BT socket disconnected: %d", t->bt_fd);
-							goto fail;
-						}
-						error("BT socket write error: %s", strerror(errno));
-						break;
-					}
-
-					/* account written payload only */
-					ret -= RTP_HEADER_LEN;
-
-					/* break if the last part of the payload has been written */
-					if ((payload_len -= ret) == 0)
-						break;
-
-					/* move rest of data to the beginning of the payload */
-					debug("Payload fragmentation: extra %zd bytes", payload_len);
-					memmove(rtp_payload_2, rtp_payload_2 + ret, payload_len);
-				}
-			}
+	*consumed = out_args.numInSamples;
+	return out_args.numOutBytes;
+}
+
+static void a2dp_source_aac_abr(struct a2dp_source *s, size_t len) {
+
+	struct a2dp_source_aac_data *priv = s->priv;
+	AACENC_ERROR err;
+
+	if (len == 0 || !priv->abr_enabled)
+		return;
 
-			/* keep data transfer at a constant bit rate, also
-			 * get a timestamp for the next RTP frame */
-			// unsigned int pcm_frames = out_args.numInSamples / channels;
-			// asrsync_sync(&io.asrs, pcm_frames);
-			timestamp += 1 * 10000 / samplerate;
+	if (aac_abr_update(&priv->abr, s->io.coutq.v, ARRAYSIZE(s->io.coutq.v),
+				s->t->mtu_write, a2dp_sender_get_stalls(&s->sender)) &&
+			(err = aacEncoder_SetParam(priv->handle, priv->abr.param, priv->abr.value)) != AACENC_OK)
+		error("Couldn't update AAC bit rate: %s", aacenc_strerror(err));
 
+}
 
-    } while (returnBytes > 0);
+/* If the size of the RTP packet exceeds writing MTU, the RTP payload should
+ * be fragmented. According to the RFC 3016, fragmentation of the
+ * audioMuxElement requires no extra header - the payload should be
+ * fragmented and spread across multiple RTP packets. */
+static const struct a2dp_source_codec a2dp_source_aac_codec = {
+	.priv_size = sizeof(struct a2dp_source_aac_data),
+	.rtp = true,
+	.fragmentation = true,
+	.init = a2dp_source_aac_init,
+	.free = a2dp_source_aac_free,
+	.encode = a2dp_source_aac_encode,
+	.abr = a2dp_source_aac_abr,
+};
 
-    fclose(fp);
-    goto fail;
-  }
+static void *a2dp_source_aac(struct ba_transport *t) {
+	return a2dp_source_pipeline(t, &a2dp_source_aac_codec);
+}
 #endif
-//##########################################################################################
-#endif // FHG_BS_STREAM_DEBUG
 
-#ifdef FHG_BS_STREAM_DEBUG
-	debug("RIC Starting IO loop: %s", ba_transport_type_to_string(t->type));
-	if (config.a2dp.skip_encoding == true) {
-		debug("RIC Skipping the encoding step");
-	} else if (config.a2dp.skip_encoding == false) {
-		debug("RIC Doing the encoding step");
-	} else {
-		debug("RIC config.a2dp.skip_encoding not available");
+#if HAVE_APTX_DECODE || HAVE_APTX_HD_DECODE
+/**
+ * Update apt-X stream synchronization state.
+ *
+ * The decoder validates the synchronization parity carried by the code
+ * words, so a decoding error means, that the code word boundary has been
+ * lost (e.g. due to a corrupted or truncated packet). In such a case, the
+ * stream is shifted byte by byte until the decoder accepts the code word.
+ * The signal of skipped code words is concealed once the synchronization
+ * has been recovered.
+ *
+ * @return This function returns true if the decoder is synchronized. */
+static bool a2dp_sink_aptx_sync(struct a2dp_sink *s, bool *synced,
+		size_t *skipped, bool decoded, size_t code_len) {
+
+	if (!decoded) {
+		if (*synced)
+			warn("Apt-X stream synchronization lost");
+		*synced = false;
+		*skipped += 1;
+		return false;
+	}
+
+	if (!*synced) {
+		debug("Apt-X stream synchronized: skipped %zu bytes", *skipped);
+		/* every code word carries 4 PCM frames */
+		a2dp_jbuf_played(&s->jb, a2dp_sink_conceal(s, *skipped / code_len * 4));
+		*synced = true;
+		*skipped = 0;
 	}
 
-	int loopCounter1 = 0;
-#endif // FHG_BS_STREAM_DEBUG
+	return true;
+}
+#endif
 
-	for (;;) {
-#ifdef FHG_BS_STREAM_DEBUG
-		int loopCounter2 = 0;
+#if ENABLE_APTX
+/**
+ * Apt-X encoder private data. */
+struct a2dp_source_aptx_data {
+	APTXENC handle;
+	/* deinterleaved PCM signal */
+	ffb_t pcm_l;
+	ffb_t pcm_r;
+};
 
-		if (loopCounter1 < 10) {
-			debug("RIC ########## for (;;) #%d", loopCounter1);
-		}
-		loopCounter1++;
+static int a2dp_source_aptx_init(struct a2dp_source *s) {
 
-		// IDEA: print read samples of AAC bitstream into file and compare with orig bitstream
-		// IDEA: bt.data should contain the final data tor transmit
-#endif // FHG_BS_STREAM_DEBUG
+	struct a2dp_source_aptx_data *priv = s->priv;
+	const unsigned int channels = s->t->a2dp.pcm.channels;
 
-		ssize_t samples;
-		if ((samples = a2dp_poll_and_read_pcm(&t->a2dp.pcm, &io, &pcm)) <= 0) { // IDEA: use &bt instead of &pcm here, to write directly to the out buffer
-			if (samples == -1)
-				error("PCM poll and read error: %s", strerror(errno));
-			goto fail;
-		}
+	if ((priv->handle = malloc(SizeofAptxbtenc())) == NULL ||
+			aptxbtenc_init(priv->handle, __BYTE_ORDER == __LITTLE_ENDIAN) != 0) {
+		error("Couldn't initialize apt-X encoder: %s", strerror(errno));
+		return -1;
+	}
+
+	/* latency of the QMF analysis filter bank */
+	s->io.codec_delay = 90;
+
+	/* apt-X stream is not encapsulated in RTP, so every
+	 * 4 PCM frames are encoded into 4 bytes of payload */
+	const size_t frames = 4 * (s->payload_size / (2 * sizeof(uint16_t)));
+	s->pcm_samples = 4 * channels;
+	s->pcm_buffer_samples = frames * channels;
+
+	if (ffb_init_int32_t(&priv->pcm_l, frames) == -1 ||
+			ffb_init_int32_t(&priv->pcm_r, frames) == -1) {
+		error("Couldn't create apt-X encoder buffers: %s", strerror(errno));
+		return -1;
+	}
 
-#ifdef FHG_BS_STREAM_DEBUG
-		if (loopCounter1 < 10) {
-			debug("RIC num samples = %d (after a2dp_poll_and_read_pcm)", samples);
-			debug("RIC initial ffb_len_out(&pcm) = %u (after a2dp_poll_and_read_pcm)", ffb_len_out(&pcm));
+	return 0;
+}
+
+static void a2dp_source_aptx_free(struct a2dp_source *s) {
+	struct a2dp_source_aptx_data *priv = s->priv;
+	if (priv->handle != NULL)
+		aptxbtenc_destroy_free(priv->handle);
+	ffb_free(&priv->pcm_l);
+	ffb_free(&priv->pcm_r);
+}
+
+static ssize_t a2dp_source_aptx_encode(struct a2dp_source *s, const void *pcm,
+		size_t samples, size_t *consumed, uint8_t *payload, size_t len) {
+
+	struct a2dp_source_aptx_data *priv = s->priv;
+	const size_t aptx_code_len = 2 * sizeof(uint16_t);
+	const int32_t *pcm_l = priv->pcm_l.data;
+	const int32_t *pcm_r = priv->pcm_r.data;
+	uint8_t *output = payload;
+	size_t i;
+
+	/* Generate as many apt-X frames as possible to fill the output buffer
+	 * without overflowing it. The size of the output buffer is based on
+	 * the socket MTU, so such a transfer should be most efficient. The
+	 * whole block of PCM signal is deinterleaved at once. */
+	const size_t blocks = MIN(MIN(samples / s->pcm_samples, len / aptx_code_len),
+			priv->pcm_l.nmemb / 4);
+	audio_deinterleave_s16_2le(pcm, blocks * 4, priv->pcm_l.data, priv->pcm_r.data);
+
+	for (i = 0; i < blocks; i++) {
+
+		if (aptxbtenc_encodestereo(priv->handle, &pcm_l[i * 4], &pcm_r[i * 4],
+					(uint16_t *)output) != 0) {
+			error("Apt-X encoding error: %s", strerror(errno));
+			if (i == 0)
+				return -1;
+			break;
 		}
-#endif
 
-		while ((in_args.numInSamples = ffb_len_out(&pcm)) > 0) {
+		output += aptx_code_len;
 
-#ifdef FHG_BS_STREAM_DEBUG
-			if (loopCounter1 < 10) {
-				debug("RIC ##### while ((in_args.numInSamples = ffb_len_out(&pcm)) > 0) #%d", loopCounter2);
-			}
-			loopCounter2++;
-#endif
+	}
 
-			if ((err = aacEncEncode(handle, &in_buf, &out_buf, &in_args, &out_args)) != AACENC_OK)
-				error("AAC encoding error: %s", aacenc_strerror(err));
-
-#ifdef FHG_BS_STREAM_DEBUG
-			if (loopCounter1 < 10) {
-				debug("RIC   Input buffer:");
-				debug("RIC       in_buf.bufferIdentifiers[0] = %d", in_buf.bufferIdentifiers[0]);
-				debug("RIC       input buffer total sizes:");
-				debug("RIC           pcm.nmemb * pcm.size = %d", pcm.nmemb * pcm.size);
-				debug("RIC           in_bufSizes[0]       = %d", in_bufSizes[0]);
-				debug("RIC           in_buf.bufSizes[0]   = %d", in_buf.bufSizes[0]);
-				debug("RIC       input buffer element sizes:");
-				debug("RIC           pcm.size             = %d", pcm.size);
-				debug("RIC           in_bufElSizes[0]     = %d", in_bufElSizes[0]);
-				debug("RIC           in_buf.bufElSizes[0] = %d", in_buf.bufElSizes[0]);
-
-				debug("RIC   Output buffer:");
-				debug("RIC       out_buf.bufferIdentifiers[0] = %d", out_buf.bufferIdentifiers[0]);
-				debug("RIC       input buffer total sizes:");
-				debug("RIC           aacinf.maxOutBufBytes = %d", aacinf.maxOutBufBytes);
-				debug("RIC           out_bufSizes[0]       = %d", out_bufSizes[0]);
-				debug("RIC           out_buf.bufSizes[0]   = %d", out_buf.bufSizes[0]);
-				debug("RIC       output buffer element sizes:");
-				debug("RIC           bt.size               = %d", bt.size);
-				debug("RIC           out_bufElSizes[0]     = %d", out_bufElSizes[0]);
-				debug("RIC           out_buf.bufElSizes[0] = %d", out_buf.bufElSizes[0]);
-				
-				debug("RIC   Encoder input/output arguments:");
-				debug("RIC       in_args.numInSamples  = %d", in_args.numInSamples);
-				debug("RIC       out_args.numInSamples = %d", out_args.numInSamples);
-				debug("RIC       out_args.numOutBytes  = %d", out_args.numOutBytes);
-			}
-#endif // FHG_BS_STREAM_DEBUG
-			
-			if (out_args.numOutBytes > 0) {
-
-				size_t payload_len_max = t->mtu_write - RTP_HEADER_LEN;
-				size_t payload_len = out_args.numOutBytes; // IDEA: set out_args.numOutBytes to total bitstream size
-				rtp_header->timestamp = htobe32(timestamp);
-
-#ifdef FHG_BS_STREAM_DEBUG
-				if (loopCounter1 < 10) {
-					debug("RIC   RTP packet creation:");
-					debug("RIC       t->mtu_write = %u", t->mtu_write);
-					debug("RIC       payload_len_max = %u", payload_len_max);
-					debug("RIC       payload_len = %u", payload_len);
-				}
-#endif
+	*consumed = i * s->pcm_samples;
+	return output - payload;
+}
+
+static const struct a2dp_source_codec a2dp_source_aptx_codec = {
+	.priv_size = sizeof(struct a2dp_source_aptx_data),
+	.init = a2dp_source_aptx_init,
+	.free = a2dp_source_aptx_free,
+	.encode = a2dp_source_aptx_encode,
+};
+
+static void *a2dp_source_aptx(struct ba_transport *t) {
+	return a2dp_source_pipeline(t, &a2dp_source_aptx_codec);
+}
+
+#if HAVE_APTX_DECODE
+/**
+ * Apt-X decoder private data. */
+struct a2dp_sink_aptx_data {
+	APTXDEC handle;
+	/* the decoder is synchronized with the code word boundary */
+	bool synced;
+	/* the number of bytes skipped while looking for the synchronization */
+	size_t skipped;
+};
+
+static int a2dp_sink_aptx_init(struct a2dp_sink *s) {
 
-				/* If the size of the RTP packet exceeds writing MTU, the RTP payload
-				 * should be fragmented. According to the RFC 3016, fragmentation of
-				 * the audioMuxElement requires no extra header - the payload should
-				 * be fragmented and spread across multiple RTP packets. */
-				for (;;) {
+	struct a2dp_sink_aptx_data *priv = s->priv;
 
-					ssize_t ret;
-					size_t len;
+	if ((priv->handle = malloc(SizeofAptxbtdec())) == NULL ||
+			aptxbtdec_init(priv->handle, __BYTE_ORDER == __LITTLE_ENDIAN) != 0) {
+		error("Couldn't initialize apt-X decoder: %s", strerror(errno));
+		return -1;
+	}
 
-					len = payload_len > payload_len_max ? payload_len_max : payload_len;
-					rtp_header->markbit = payload_len <= payload_len_max;
-					rtp_header->seq_number = htobe16(++seq_number);
+	priv->synced = true;
 
-					io.coutq.i = (io.coutq.i + 1) % ARRAYSIZE(io.coutq.v);
-					if ((ret = io_thread_write_bt(t->bt_fd, bt.data, RTP_HEADER_LEN + len, // IDEA: Maybe directly feed data from t->a2dp.pcm.fd
-									&io.coutq.v[io.coutq.i], t->a2dp.bt_fd_coutq_init)) == -1) {
-						if (errno == ECONNRESET || errno == ENOTCONN) {
-							/* exit thread upon BT socket disconnection */
-							debug("BT socket disconnected: %d", t->bt_fd);
-							goto fail;
-						}
-						error("BT socket write error: %s", strerror(errno));
-						break;
-					}
+	/* every 4 bytes of payload are decoded into 4 PCM frames */
+	s->pcm_samples = 4 * s->t->a2dp.pcm.channels * (s->t->mtu_read / (2 * sizeof(uint16_t)));
+	return 0;
+}
 
-					/* account written payload only */
-					ret -= RTP_HEADER_LEN;
+static void a2dp_sink_aptx_free(struct a2dp_sink *s) {
+	struct a2dp_sink_aptx_data *priv = s->priv;
+	if (priv->handle != NULL)
+		aptxbtdec_destroy_free(priv->handle);
+}
 
-					/* break if the last part of the payload has been written */
-					if ((payload_len -= ret) == 0)
-						break;
+static void a2dp_sink_aptx_decode(struct a2dp_sink *s, const void *phdr,
+		const uint8_t *payload, size_t len) {
 
-					/* move rest of data to the beginning of the payload */
-					debug("Payload fragmentation: extra %zd bytes", payload_len);
-					memmove(rtp_payload, rtp_payload + ret, payload_len);
+	struct a2dp_sink_aptx_data *priv = s->priv;
+	const size_t aptx_code_len = 2 * sizeof(uint16_t);
+	int16_t *output = s->pcm.data;
+	(void)phdr;
 
-				}
+	if (len % aptx_code_len != 0)
+		debug("Apt-X payload not aligned to the code word: %zu", len);
 
-			}
+	while (len >= aptx_code_len) {
 
-			/* keep data transfer at a constant bit rate, also
-			 * get a timestamp for the next RTP frame */
-			unsigned int pcm_frames = out_args.numInSamples / channels;
-			asrsync_sync(&io.asrs, pcm_frames);
-			timestamp += pcm_frames * 10000 / samplerate;
+		int32_t pcm_l[4], pcm_r[4];
+		const bool decoded = aptxbtdec_decodestereo(priv->handle,
+				pcm_l, pcm_r, (const uint16_t *)payload) == 0;
 
-			/* update busy delay (encoding overhead) */
-			t->a2dp.pcm.delay = asrsync_get_busy_usec(&io.asrs) / 100;
+		if (!a2dp_sink_aptx_sync(s, &priv->synced, &priv->skipped, decoded, aptx_code_len)) {
+			/* flush decoded signal, so it will not be overwritten by
+			 * the concealment once the synchronization is recovered */
+			if (output != s->pcm.data) {
+				a2dp_sink_output(s, s->pcm.data, output - (int16_t *)s->pcm.data);
+				output = s->pcm.data;
+			}
+			payload += 1;
+			len -= 1;
+			continue;
+		}
 
-			/* If the input buffer was not consumed, we have to append new data to
-			 * the existing one. Since we do not use ring buffer, we will simply
-			 * move unprocessed data to the front of our linear buffer. */
-			ffb_shift(&pcm, out_args.numInSamples);
+		if ((size_t)(output - (int16_t *)s->pcm.data) + 8 > s->pcm.nmemb) {
+			a2dp_sink_output(s, s->pcm.data, output - (int16_t *)s->pcm.data);
+			output = s->pcm.data;
+		}
 
+		for (size_t i = 0; i < 4; i++) {
+			*output++ = pcm_l[i];
+			*output++ = pcm_r[i];
 		}
 
+		payload += aptx_code_len;
+		len -= aptx_code_len;
+
 	}
 
-fail:
-	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-	pthread_cleanup_pop(!io.t_locked);
-fail_ffb:
-	pthread_cleanup_pop(1);
-	pthread_cleanup_pop(1);
-fail_init:
-	pthread_cleanup_pop(1);
-fail_open:
-	pthread_cleanup_pop(1);
-	return NULL;
+	if (output != s->pcm.data)
+		a2dp_sink_output(s, s->pcm.data, output - (int16_t *)s->pcm.data);
+
 }
-#endif
 
-#if ENABLE_APTX
-static void *a2dp_source_aptx(struct ba_transport *t) {
+static const struct a2dp_sink_codec a2dp_sink_aptx_codec = {
+	.priv_size = sizeof(struct a2dp_sink_aptx_data),
+	.init = a2dp_sink_aptx_init,
+	.free = a2dp_sink_aptx_free,
+	.decode = a2dp_sink_aptx_decode,
+};
 
-	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-	pthread_cleanup_push(PTHREAD_CLEANUP(ba_transport_pthread_cleanup), t);
+static void *a2dp_sink_aptx(struct ba_transport *t) {
+	return a2dp_sink_pipeline(t, &a2dp_sink_aptx_codec);
+}
+#endif
+#endif
 
-	struct io_thread_data io = {
-		.timeout = -1,
-		.t_locked = !ba_transport_pthread_cleanup_lock(t),
-	};
+#if ENABLE_APTX_HD
+/**
+ * Apt-X HD encoder private data. */
+struct a2dp_source_aptx_hd_data {
+	APTXENC handle;
+	/* deinterleaved PCM signal */
+	ffb_t pcm_l;
+	ffb_t pcm_r;
+	/* code words before packing */
+	ffb_t code;
+};
 
-	APTXENC handle = malloc(SizeofAptxbtenc());
-	pthread_cleanup_push(PTHREAD_CLEANUP(aptxbtenc_destroy_free), handle);
+static int a2dp_source_aptx_hd_init(struct a2dp_source *s) {
 
-	if (handle == NULL || aptxbtenc_init(handle, __BYTE_ORDER == __LITTLE_ENDIAN) != 0) {
-		error("Couldn't initialize apt-X encoder: %s", strerror(errno));
-		goto fail_init;
+	struct a2dp_source_aptx_hd_data *priv = s->priv;
+	const unsigned int channels = s->t->a2dp.pcm.channels;
+
+	if ((priv->handle = malloc(SizeofAptxhdbtenc())) == NULL ||
+			aptxhdbtenc_init(priv->handle, false) != 0) {
+		error("Couldn't initialize apt-X HD encoder: %s", strerror(errno));
+		return -1;
 	}
 
-	ffb_t bt = { 0 };
-	ffb_t pcm = { 0 };
-	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &bt);
-	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &pcm);
+	/* latency of the QMF analysis filter bank */
+	s->io.codec_delay = 90;
 
-	const unsigned int channels = t->a2dp.pcm.channels;
-	const size_t aptx_pcm_samples = 4 * channels;
-	const size_t aptx_code_len = 2 * sizeof(uint16_t);
-	const size_t mtu_write = t->mtu_write;
+	/* every 4 PCM frames are encoded into 6 bytes of payload */
+	const size_t blocks = s->payload_size / (2 * 3 * sizeof(uint8_t));
+	s->pcm_samples = 4 * channels;
+	s->pcm_buffer_samples = 4 * channels * blocks;
 
-	if (ffb_init_int16_t(&pcm, aptx_pcm_samples * (mtu_write / aptx_code_len)) == -1 ||
-			ffb_init_uint8_t(&bt, mtu_write) == -1) {
-		error("Couldn't create data buffers: %s", strerror(errno));
-		goto fail_ffb;
+	if (ffb_init_int32_t(&priv->pcm_l, 4 * blocks) == -1 ||
+			ffb_init_int32_t(&priv->pcm_r, 4 * blocks) == -1 ||
+			ffb_init(&priv->code, 2 * blocks, sizeof(uint32_t)) == -1) {
+		error("Couldn't create apt-X HD encoder buffers: %s", strerror(errno));
+		return -1;
 	}
 
-	pthread_cleanup_push(PTHREAD_CLEANUP(ba_transport_pthread_cleanup_lock), t);
+	return 0;
+}
 
-	ba_transport_pthread_cleanup_unlock(t);
-	io.t_locked = false;
+static void a2dp_source_aptx_hd_free(struct a2dp_source *s) {
+	struct a2dp_source_aptx_hd_data *priv = s->priv;
+	if (priv->handle != NULL)
+		aptxhdbtenc_destroy_free(priv->handle);
+	ffb_free(&priv->pcm_l);
+	ffb_free(&priv->pcm_r);
+	ffb_free(&priv->code);
+}
 
-	debug("Starting IO loop: %s", ba_transport_type_to_string(t->type));
-	for (;;) {
+static ssize_t a2dp_source_aptx_hd_encode(struct a2dp_source *s, const void *pcm,
+		size_t samples, size_t *consumed, uint8_t *payload, size_t len) {
 
-		ssize_t samples;
-		if ((samples = a2dp_poll_and_read_pcm(&t->a2dp.pcm, &io, &pcm)) <= 0) {
-			if (samples == -1)
-				error("PCM poll and read error: %s", strerror(errno));
-			goto fail;
+	struct a2dp_source_aptx_hd_data *priv = s->priv;
+	const size_t aptx_code_len = 2 * 3 * sizeof(uint8_t);
+	const int32_t *pcm_l = priv->pcm_l.data;
+	const int32_t *pcm_r = priv->pcm_r.data;
+	uint32_t *code = priv->code.data;
+	size_t i;
+
+	/* Generate as many apt-X frames as possible to fill the output buffer
+	 * without overflowing it. The size of the output buffer is based on
+	 * the socket MTU, so such a transfer should be most efficient. The
+	 * whole block of PCM signal is deinterleaved at once, and all 24-bit
+	 * code words are packed into the payload afterwards. */
+	const size_t blocks = MIN(MIN(samples / s->pcm_samples, len / aptx_code_len),
+			priv->code.nmemb / 2);
+	audio_deinterleave_s24_4le(pcm, blocks * 4, priv->pcm_l.data, priv->pcm_r.data);
+
+	for (i = 0; i < blocks; i++)
+		if (aptxhdbtenc_encodestereo(priv->handle, &pcm_l[i * 4], &pcm_r[i * 4],
+					&code[i * 2]) != 0) {
+			error("Apt-X HD encoding error: %s", strerror(errno));
+			if (i == 0)
+				return -1;
+			break;
 		}
 
-		int16_t *input = pcm.data;
-		size_t input_len = samples;
+	audio_pack_u24be(code, i * 2, payload);
 
-		/* encode and transfer obtained data */
-		while (input_len >= aptx_pcm_samples) {
+	*consumed = i * s->pcm_samples;
+	return i * aptx_code_len;
+}
+
+static const struct a2dp_source_codec a2dp_source_aptx_hd_codec = {
+	.priv_size = sizeof(struct a2dp_source_aptx_hd_data),
+	.rtp = true,
+	.init = a2dp_source_aptx_hd_init,
+	.free = a2dp_source_aptx_hd_free,
+	.encode = a2dp_source_aptx_hd_encode,
+};
+
+static void *a2dp_source_aptx_hd(struct ba_transport *t) {
+	return a2dp_source_pipeline(t, &a2dp_source_aptx_hd_codec);
+}
 
-			size_t output_len = ffb_len_in(&bt);
-			size_t pcm_frames = 0;
+#if HAVE_APTX_HD_DECODE
+/**
+ * Apt-X HD decoder private data. */
+struct a2dp_sink_aptx_hd_data {
+	APTXDEC handle;
+	bool synced;
+	size_t skipped;
+};
 
-			/* Generate as many apt-X frames as possible to fill the output buffer
-			 * without overflowing it. The size of the output buffer is based on
-			 * the socket MTU, so such a transfer should be most efficient. */
-			while (input_len >= aptx_pcm_samples && output_len >= aptx_code_len) {
+static int a2dp_sink_aptx_hd_init(struct a2dp_sink *s) {
 
-				int32_t pcm_l[4] = { input[0], input[2], input[4], input[6] };
-				int32_t pcm_r[4] = { input[1], input[3], input[5], input[7] };
+	struct a2dp_sink_aptx_hd_data *priv = s->priv;
 
-				if (aptxbtenc_encodestereo(handle, pcm_l, pcm_r, (uint16_t *)bt.tail) != 0) {
-					error("Apt-X encoding error: %s", strerror(errno));
-					break;
-				}
+	if ((priv->handle = malloc(SizeofAptxhdbtdec())) == NULL ||
+			aptxhdbtdec_init(priv->handle, false) != 0) {
+		error("Couldn't initialize apt-X HD decoder: %s", strerror(errno));
+		return -1;
+	}
 
-				input += 4 * channels;
-				input_len -= 4 * channels;
-				ffb_seek(&bt, aptx_code_len);
-				output_len -= aptx_code_len;
-				pcm_frames += 4;
+	priv->synced = true;
 
-			}
+	/* every 6 bytes of payload are decoded into 4 PCM frames */
+	s->pcm_samples = 4 * s->t->a2dp.pcm.channels * (s->t->mtu_read / (2 * 3 * sizeof(uint8_t)));
+	return 0;
+}
 
-			io.coutq.i = (io.coutq.i + 1) % ARRAYSIZE(io.coutq.v);
-			if (io_thread_write_bt(t->bt_fd, bt.data, ffb_len_out(&bt),
-						&io.coutq.v[io.coutq.i], t->a2dp.bt_fd_coutq_init) == -1) {
-				if (errno == ECONNRESET || errno == ENOTCONN) {
-					/* exit thread upon BT socket disconnection */
-					debug("BT socket disconnected: %d", t->bt_fd);
-					goto fail;
-				}
-				error("BT socket write error: %s", strerror(errno));
-			}
+static void a2dp_sink_aptx_hd_free(struct a2dp_sink *s) {
+	struct a2dp_sink_aptx_hd_data *priv = s->priv;
+	if (priv->handle != NULL)
+		aptxhdbtdec_destroy_free(priv->handle);
+}
 
-			/* keep data transfer at a constant bit rate */
-			asrsync_sync(&io.asrs, pcm_frames);
+static void a2dp_sink_aptx_hd_decode(struct a2dp_sink *s, const void *phdr,
+		const uint8_t *payload, size_t len) {
 
-			/* update busy delay (encoding overhead) */
-			t->a2dp.pcm.delay = asrsync_get_busy_usec(&io.asrs) / 100;
+	struct a2dp_sink_aptx_hd_data *priv = s->priv;
+	const size_t aptx_code_len = 2 * 3 * sizeof(uint8_t);
+	int32_t *output = s->pcm.data;
+	(void)phdr;
+
+	if (len % aptx_code_len != 0)
+		debug("Apt-X HD payload not aligned to the code word: %zu", len);
+
+	while (len >= aptx_code_len) {
+
+		const uint32_t code[2] = {
+			payload[0] << 16 | payload[1] << 8 | payload[2],
+			payload[3] << 16 | payload[4] << 8 | payload[5] };
+		int32_t pcm_l[4], pcm_r[4];
+		const bool decoded = aptxhdbtdec_decodestereo(priv->handle,
+				pcm_l, pcm_r, code) == 0;
+
+		if (!a2dp_sink_aptx_sync(s, &priv->synced, &priv->skipped, decoded, aptx_code_len)) {
+			/* flush decoded signal, so it will not be overwritten by
+			 * the concealment once the synchronization is recovered */
+			if (output != s->pcm.data) {
+				a2dp_sink_output(s, s->pcm.data, output - (int32_t *)s->pcm.data);
+				output = s->pcm.data;
+			}
+			payload += 1;
+			len -= 1;
+			continue;
+		}
 
-			/* reinitialize output buffer */
-			ffb_rewind(&bt);
+		if ((size_t)(output - (int32_t *)s->pcm.data) + 8 > s->pcm.nmemb) {
+			a2dp_sink_output(s, s->pcm.data, output - (int32_t *)s->pcm.data);
+			output = s->pcm.data;
+		}
 
+		for (size_t i = 0; i < 4; i++) {
+			*output++ = pcm_l[i];
+			*output++ = pcm_r[i];
 		}
 
-		/* If the input buffer was not consumed (due to codesize limit), we
-		 * have to append new data to the existing one. Since we do not use
-		 * ring buffer, we will simply move unprocessed data to the front
-		 * of our linear buffer. */
-		ffb_shift(&pcm, samples - input_len);
+		payload += aptx_code_len;
+		len -= aptx_code_len;
+
+	}
+
+	if (output != s->pcm.data)
+		a2dp_sink_output(s, s->pcm.data, output - (int32_t *)s->pcm.data);
+
+}
+
+static const struct a2dp_sink_codec a2dp_sink_aptx_hd_codec = {
+	.priv_size = sizeof(struct a2dp_sink_aptx_hd_data),
+	.rtp = true,
+	.init = a2dp_sink_aptx_hd_init,
+	.free = a2dp_sink_aptx_hd_free,
+	.decode = a2dp_sink_aptx_hd_decode,
+};
+
+static void *a2dp_sink_aptx_hd(struct ba_transport *t) {
+	return a2dp_sink_pipeline(t, &a2dp_sink_aptx_hd_codec);
+}
+#endif
+#endif
+
+#if ENABLE_FASTSTREAM
+/**
+ * FastStream codec private data.
+ *
+ * FastStream is a bidirectional SBC based codec. The music direction is a
+ * stereo SBC stream with fixed parameters, and the voice back-channel is a
+ * 16 kHz mono SBC stream received via the same BT socket. */
+struct a2dp_source_faststream_data {
+	/* music direction encoder */
+	sbc_t sbc;
+	/* the length of the padded SBC frame */
+	size_t frame_len;
+	/* voice back-channel decoder */
+	sbc_t sbc_voice;
+	ffb_t bt_voice;
+	ffb_t pcm_voice;
+	/* the number of discarded voice chunks */
+	unsigned int voice_overruns;
+};
+
+static int a2dp_source_faststream_init(struct a2dp_source *s) {
+
+	struct a2dp_source_faststream_data *priv = s->priv;
+	struct ba_transport *t = s->t;
+	const a2dp_faststream_t *configuration = (a2dp_faststream_t *)t->a2dp.configuration;
+	sbc_t *sbc = &priv->sbc;
 
+	if ((errno = -sbc_init(sbc, 0)) != 0 ||
+			(errno = -sbc_init(&priv->sbc_voice, 0)) != 0) {
+		error("Couldn't initialize FastStream codec: %s", strerror(errno));
+		return -1;
 	}
 
-fail:
-	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-	pthread_cleanup_pop(!io.t_locked);
-fail_ffb:
-	pthread_cleanup_pop(1);
-	pthread_cleanup_pop(1);
-fail_init:
-	pthread_cleanup_pop(1);
-	pthread_cleanup_pop(1);
-	return NULL;
-}
-#endif
-
-#if ENABLE_APTX_HD
-static void *a2dp_source_aptx_hd(struct ba_transport *t) {
+	/* FastStream does not negotiate the SBC parameters */
+	sbc->frequency = configuration->frequency_music == FASTSTREAM_SAMPLING_FREQ_MUSIC_48000 ?
+		SBC_FREQ_48000 : SBC_FREQ_44100;
+	sbc->mode = SBC_MODE_JOINT_STEREO;
+	sbc->subbands = SBC_SB_8;
+	sbc->blocks = SBC_BLK_16;
+	sbc->allocation = SBC_AM_LOUDNESS;
+	sbc->bitpool = 29;
 
-	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-	pthread_cleanup_push(PTHREAD_CLEANUP(ba_transport_pthread_cleanup), t);
+#if DEBUG
+	sbc_print_internals(sbc);
+#endif
 
-	struct io_thread_data io = {
-		.timeout = -1,
-		.t_locked = !ba_transport_pthread_cleanup_lock(t),
-	};
+	/* SBC frames are padded to the even length */
+	priv->frame_len = sbc_get_frame_length(sbc);
+	priv->frame_len += priv->frame_len % 2;
 
-	APTXENC handle = malloc(SizeofAptxhdbtenc());
-	pthread_cleanup_push(PTHREAD_CLEANUP(aptxhdbtenc_destroy_free), handle);
+	const size_t sbc_pcm_samples = sbc_get_codesize(sbc) / sizeof(int16_t);
+	const size_t sbc_frames_max = s->payload_size / priv->frame_len;
 
-	if (handle == NULL || aptxhdbtenc_init(handle, false) != 0) {
-		error("Couldn't initialize apt-X HD encoder: %s", strerror(errno));
-		goto fail_init;
+	if (sbc_frames_max == 0) {
+		error("Writing MTU too small for one single FastStream frame: %zu < %zu",
+				t->mtu_write, priv->frame_len);
+		return -1;
 	}
 
-	ffb_t bt = { 0 };
-	ffb_t pcm = { 0 };
-	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &bt);
-	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &pcm);
+	s->io.codec_delay = sbc_pcm_samples / t->a2dp.pcm.channels + 5 * 8;
 
-	const unsigned int channels = t->a2dp.pcm.channels;
-	const unsigned int samplerate = t->a2dp.pcm.sampling;
-	const size_t aptx_pcm_samples = 4 * channels;
-	const size_t aptx_code_len = 2 * 3 * sizeof(uint8_t);
-	const size_t mtu_write = t->mtu_write;
+	s->pcm_samples = sbc_pcm_samples;
+	s->pcm_buffer_samples = sbc_pcm_samples * sbc_frames_max;
 
-	if (ffb_init_int32_t(&pcm, aptx_pcm_samples * ((mtu_write - RTP_HEADER_LEN) / aptx_code_len)) == -1 ||
-			ffb_init_uint8_t(&bt, mtu_write) == -1) {
-		error("Couldn't create data buffers: %s", strerror(errno));
-		goto fail_ffb;
+	/* The voice decoder takes SBC parameters from the frame header. Its
+	 * output buffer is as big as the music frame codesize (the biggest
+	 * possible one), so it can handle any valid back-channel frame. */
+	if (a2dp_validate_bt_sink(t) == -1 ||
+			ffb_init_uint8_t(&priv->bt_voice, t->mtu_read) == -1 ||
+			ffb_init_int16_t(&priv->pcm_voice, sbc_pcm_samples) == -1) {
+		error("Couldn't create back-channel buffers: %s", strerror(errno));
+		return -1;
 	}
 
-	pthread_cleanup_push(PTHREAD_CLEANUP(ba_transport_pthread_cleanup_lock), t);
-
-	rtp_header_t *rtp_header;
+	return 0;
+}
 
-	/* initialize RTP header and get anchor for payload */
-	uint8_t *rtp_payload = a2dp_init_rtp(bt.data, &rtp_header, NULL, 0);
-	uint16_t seq_number = be16toh(rtp_header->seq_number);
-	uint32_t timestamp = be32toh(rtp_header->timestamp);
+static void a2dp_source_faststream_free(struct a2dp_source *s) {
+	struct a2dp_source_faststream_data *priv = s->priv;
+	if (priv->voice_overruns > 0)
+		debug("FastStream voice FIFO overruns: %u", priv->voice_overruns);
+	sbc_finish(&priv->sbc);
+	sbc_finish(&priv->sbc_voice);
+	ffb_free(&priv->bt_voice);
+	ffb_free(&priv->pcm_voice);
+}
 
-	ba_transport_pthread_cleanup_unlock(t);
-	io.t_locked = false;
+static ssize_t a2dp_source_faststream_encode(struct a2dp_source *s, const void *pcm,
+		size_t samples, size_t *consumed, uint8_t *payload, size_t len) {
 
-	debug("Starting IO loop: %s", ba_transport_type_to_string(t->type));
-	for (;;) {
+	struct a2dp_source_faststream_data *priv = s->priv;
 
-		ssize_t samples;
-		if ((samples = a2dp_poll_and_read_pcm(&t->a2dp.pcm, &io, &pcm)) <= 0) {
-			if (samples == -1)
-				error("PCM poll and read error: %s", strerror(errno));
-			goto fail;
-		}
+	const int16_t *input = pcm;
+	size_t input_len = samples;
+	uint8_t *output = payload;
+	size_t output_len = len;
 
-		int32_t *input = pcm.data;
-		size_t input_len = samples;
+	/* FastStream stream is not encapsulated in RTP, so the payload is
+	 * just a sequence of SBC frames filling the writing MTU. */
+	while (input_len >= s->pcm_samples && output_len >= priv->frame_len) {
 
-		/* encode and transfer obtained data */
-		while (input_len >= aptx_pcm_samples) {
+		ssize_t ret;
+		ssize_t encoded;
 
-			/* anchor for RTP payload */
-			bt.tail = rtp_payload;
+		if ((ret = sbc_encode(&priv->sbc, input, input_len * sizeof(int16_t),
+						output, output_len, &encoded)) < 0) {
+			error("FastStream encoding error: %s", strerror(-ret));
+			if (output == payload)
+				return -1;
+			break;
+		}
 
-			size_t output_len = ffb_len_in(&bt);
-			size_t pcm_frames = 0;
+		if (encoded % 2)
+			output[encoded++] = 0;
 
-			/* Generate as many apt-X frames as possible to fill the output buffer
-			 * without overflowing it. The size of the output buffer is based on
-			 * the socket MTU, so such a transfer should be most efficient. */
-			while (input_len >= aptx_pcm_samples && output_len >= aptx_code_len) {
+		ret = ret / sizeof(int16_t);
+		input += ret;
+		input_len -= ret;
+		output += encoded;
+		output_len -= encoded;
 
-				int32_t pcm_l[4] = { input[0], input[2], input[4], input[6] };
-				int32_t pcm_r[4] = { input[1], input[3], input[5], input[7] };
-				uint32_t code[2];
+	}
 
-				if (aptxhdbtenc_encodestereo(handle, pcm_l, pcm_r, code) != 0) {
-					error("Apt-X HD encoding error: %s", strerror(errno));
-					break;
-				}
+	*consumed = samples - input_len;
+	return output - payload;
+}
 
-				((uint8_t *)bt.tail)[0] = code[0] >> 16;
-				((uint8_t *)bt.tail)[1] = code[0] >> 8;
-				((uint8_t *)bt.tail)[2] = code[0];
-				((uint8_t *)bt.tail)[3] = code[1] >> 16;
-				((uint8_t *)bt.tail)[4] = code[1] >> 8;
-				((uint8_t *)bt.tail)[5] = code[1];
+static int a2dp_source_faststream_backchannel(struct a2dp_source *s) {
 
-				input += 4 * channels;
-				input_len -= 4 * channels;
-				ffb_seek(&bt, aptx_code_len);
-				output_len -= aptx_code_len;
-				pcm_frames += 4;
+	struct a2dp_source_faststream_data *priv = s->priv;
+	struct ba_transport *t = s->t;
+	struct ba_transport_pcm *pcm = &t->a2dp.pcm_bc;
+	ssize_t len;
 
-			}
+	if ((len = read(t->bt_fd, priv->bt_voice.data, priv->bt_voice.nmemb)) <= 0) {
+		if (len == -1 && (errno == EAGAIN || errno == EINTR))
+			return 0;
+		if (len == -1)
+			debug("BT read error: %s", strerror(errno));
+		return -1;
+	}
 
-			io.coutq.i = (io.coutq.i + 1) % ARRAYSIZE(io.coutq.v);
-			if (io_thread_write_bt(t->bt_fd, bt.data, ffb_len_out(&bt),
-						&io.coutq.v[io.coutq.i], t->a2dp.bt_fd_coutq_init) == -1) {
-				if (errno == ECONNRESET || errno == ENOTCONN) {
-					/* exit thread upon BT socket disconnection */
-					debug("BT socket disconnected: %d", t->bt_fd);
-					goto fail;
-				}
-				error("BT socket write error: %s", strerror(errno));
-			}
+	/* drop voice data if back-channel PCM is not opened */
+	if (pcm->fd == -1)
+		return 0;
 
-			/* keep data transfer at a constant bit rate */
-			asrsync_sync(&io.asrs, pcm_frames);
-			timestamp += pcm_frames * 10000 / samplerate;
+	const uint8_t *input = priv->bt_voice.data;
+	size_t input_len = len;
 
-			/* update busy delay (encoding overhead) */
-			t->a2dp.pcm.delay = asrsync_get_busy_usec(&io.asrs) / 100;
+	while (input_len > 0) {
 
-			rtp_header->seq_number = htobe16(++seq_number);
-			rtp_header->timestamp = htobe32(timestamp);
+		ssize_t ret;
+		size_t decoded;
 
-			/* reinitialize output buffer */
-			ffb_rewind(&bt);
+		/* skip padding byte of the odd-length SBC frame */
+		if (input[0] != 0x9C) {
+			input++;
+			input_len--;
+			continue;
+		}
 
+		if ((ret = sbc_decode(&priv->sbc_voice, input, input_len,
+						priv->pcm_voice.data, ffb_blen_in(&priv->pcm_voice), &decoded)) < 0) {
+			error("FastStream voice decoding error: %s", strerror(-ret));
+			break;
 		}
 
-		/* If the input buffer was not consumed (due to codesize limit), we
-		 * have to append new data to the existing one. Since we do not use
-		 * ring buffer, we will simply move unprocessed data to the front
-		 * of our linear buffer. */
-		ffb_shift(&pcm, samples - input_len);
+		input += ret;
+		input_len -= ret;
+
+		/* Voice is written from the music IO thread, so do not block on
+		 * the back-channel FIFO - discard the chunk if the client lags. */
+		if (ba_transport_pcm_write_nowait(pcm, priv->pcm_voice.data,
+					decoded / sizeof(int16_t)) == -1) {
+			if (errno == EAGAIN)
+				priv->voice_overruns++;
+			else
+				error("FIFO write error: %s", strerror(errno));
+		}
 
 	}
 
-fail:
-	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-	pthread_cleanup_pop(!io.t_locked);
-fail_ffb:
-	pthread_cleanup_pop(1);
-	pthread_cleanup_pop(1);
-fail_init:
-	pthread_cleanup_pop(1);
-	pthread_cleanup_pop(1);
-	return NULL;
+	return 0;
 }
-#endif
 
-#if ENABLE_LDAC
-static void *a2dp_source_ldac(struct ba_transport *t) {
-
-	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-	pthread_cleanup_push(PTHREAD_CLEANUP(ba_transport_pthread_cleanup), t);
+static const struct a2dp_source_codec a2dp_source_faststream_codec = {
+	.priv_size = sizeof(struct a2dp_source_faststream_data),
+	.init = a2dp_source_faststream_init,
+	.free = a2dp_source_faststream_free,
+	.encode = a2dp_source_faststream_encode,
+	.backchannel = a2dp_source_faststream_backchannel,
+};
 
-	struct io_thread_data io = {
-		.timeout = -1,
-		.t_locked = !ba_transport_pthread_cleanup_lock(t),
-	};
+static void *a2dp_source_faststream(struct ba_transport *t) {
+	return a2dp_source_pipeline(t, &a2dp_source_faststream_codec);
+}
+#endif
 
+#if ENABLE_LDAC
+/**
+ * LDAC encoder private data. */
+struct a2dp_source_ldac_data {
 	HANDLE_LDAC_BT handle;
 	HANDLE_LDAC_ABR handle_abr;
+};
 
-	if ((handle = ldacBT_get_handle()) == NULL) {
+static int a2dp_source_ldac_init(struct a2dp_source *s) {
+
+	struct a2dp_source_ldac_data *priv = s->priv;
+	struct ba_transport *t = s->t;
+
+	if ((priv->handle = ldacBT_get_handle()) == NULL) {
 		error("Couldn't open LDAC encoder: %s", strerror(errno));
-		goto fail_open_ldac;
+		return -1;
 	}
 
-	pthread_cleanup_push(PTHREAD_CLEANUP(ldacBT_free_handle), handle);
-
-	if ((handle_abr = ldac_ABR_get_handle()) == NULL) {
+	if ((priv->handle_abr = ldac_ABR_get_handle()) == NULL) {
 		error("Couldn't open LDAC ABR: %s", strerror(errno));
-		goto fail_open_ldac_abr;
+		return -1;
 	}
 
-	pthread_cleanup_push(PTHREAD_CLEANUP(ldac_ABR_free_handle), handle_abr);
-
 	const a2dp_ldac_t *configuration = (a2dp_ldac_t *)t->a2dp.configuration;
-	const size_t sample_size = BA_TRANSPORT_PCM_FORMAT_BYTES(t->a2dp.pcm.format);
 	const unsigned int channels = t->a2dp.pcm.channels;
 	const unsigned int samplerate = t->a2dp.pcm.sampling;
 	const size_t ldac_pcm_samples = LDACBT_ENC_LSU * channels;
 
-	if (ldacBT_init_handle_encode(handle, t->mtu_write - RTP_HEADER_LEN - sizeof(rtp_media_header_t),
-				config.ldac_eqmid, configuration->channel_mode, LDACBT_SMPL_FMT_S32, samplerate) == -1) {
-		error("Couldn't initialize LDAC encoder: %s", ldacBT_strerror(ldacBT_get_error_code(handle)));
-		goto fail_init;
+	/* one encoding unit plus the MDCT overlap */
+	s->io.codec_delay = 2 * LDACBT_ENC_LSU;
+
+	if (ldacBT_init_handle_encode(priv->handle, s->payload_size, config.ldac_eqmid,
+				configuration->channel_mode, LDACBT_SMPL_FMT_S32, samplerate) == -1) {
+		error("Couldn't initialize LDAC encoder: %s",
+				ldacBT_strerror(ldacBT_get_error_code(priv->handle)));
+		return -1;
 	}
 
-	if (ldac_ABR_Init(handle_abr, 1000 * ldac_pcm_samples / channels / samplerate) == -1) {
+	if (ldac_ABR_Init(priv->handle_abr, 1000 * ldac_pcm_samples / channels / samplerate) == -1) {
 		error("Couldn't initialize LDAC ABR");
-		goto fail_init;
+		return -1;
 	}
-	if (ldac_ABR_set_thresholds(handle_abr, 6, 4, 2) == -1) {
+	if (ldac_ABR_set_thresholds(priv->handle_abr, 6, 4, 2) == -1) {
 		error("Couldn't set LDAC ABR thresholds");
-		goto fail_init;
+		return -1;
 	}
 
-	ffb_t bt = { 0 };
-	ffb_t pcm = { 0 };
-	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &bt);
-	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &pcm);
+	s->pcm_samples = ldac_pcm_samples;
+	s->pcm_buffer_samples = ldac_pcm_samples;
 
-	if (ffb_init_int32_t(&pcm, ldac_pcm_samples) == -1 ||
-			ffb_init_uint8_t(&bt, t->mtu_write) == -1) {
-		error("Couldn't create data buffers: %s", strerror(errno));
-		goto fail_ffb;
+	return 0;
+}
+
+static void a2dp_source_ldac_free(struct a2dp_source *s) {
+	struct a2dp_source_ldac_data *priv = s->priv;
+	if (priv->handle_abr != NULL)
+		ldac_ABR_free_handle(priv->handle_abr);
+	if (priv->handle != NULL)
+		ldacBT_free_handle(priv->handle);
+}
+
+static ssize_t a2dp_source_ldac_encode(struct a2dp_source *s, const void *pcm,
+		size_t samples, size_t *consumed, uint8_t *payload, size_t len) {
+
+	struct a2dp_source_ldac_data *priv = s->priv;
+	rtp_media_header_t *rtp_media_header = s->rtp_phdr;
+	const size_t sample_size = BA_TRANSPORT_PCM_FORMAT_BYTES(s->t->a2dp.pcm.format);
+	int used;
+	int encoded;
+	int frames;
+
+	(void)samples;
+	(void)len;
+
+	if (ldacBT_encode(priv->handle, (void *)pcm, &used, payload, &encoded, &frames) != 0) {
+		error("LDAC encoding error: %s", ldacBT_strerror(ldacBT_get_error_code(priv->handle)));
+		return -1;
 	}
 
-	pthread_cleanup_push(PTHREAD_CLEANUP(ba_transport_pthread_cleanup_lock), t);
+	rtp_media_header->frame_count = frames;
 
-	rtp_header_t *rtp_header;
-	rtp_media_header_t *rtp_media_header;
+	*consumed = used / sample_size;
+	return encoded;
+}
 
-	/* initialize RTP headers and get anchor for payload */
-	bt.tail = a2dp_init_rtp(bt.data, &rtp_header,
-			(void **)&rtp_media_header, sizeof(*rtp_media_header));
-	uint16_t seq_number = be16toh(rtp_header->seq_number);
-	uint32_t timestamp = be32toh(rtp_header->timestamp);
-	size_t ts_frames = 0;
+static void a2dp_source_ldac_abr(struct a2dp_source *s, size_t len) {
+	struct a2dp_source_ldac_data *priv = s->priv;
+	(void)len;
+	if (config.ldac_abr)
+		ldac_ABR_Proc(priv->handle, priv->handle_abr,
+				s->io.coutq.v[s->io.coutq.i] / s->t->mtu_write, 1);
+}
 
-	ba_transport_pthread_cleanup_unlock(t);
-	io.t_locked = false;
+static const struct a2dp_source_codec a2dp_source_ldac_codec = {
+	.priv_size = sizeof(struct a2dp_source_ldac_data),
+	.rtp = true,
+	.rtp_phdr_size = sizeof(rtp_media_header_t),
+	.init = a2dp_source_ldac_init,
+	.free = a2dp_source_ldac_free,
+	.encode = a2dp_source_ldac_encode,
+	.abr = a2dp_source_ldac_abr,
+};
 
-	debug("Starting IO loop: %s", ba_transport_type_to_string(t->type));
-	for (;;) {
+static void *a2dp_source_ldac(struct ba_transport *t) {
+	return a2dp_source_pipeline(t, &a2dp_source_ldac_codec);
+}
+#endif
 
-		ssize_t samples;
-		if ((samples = a2dp_poll_and_read_pcm(&t->a2dp.pcm, &io, &pcm)) <= 0) {
-			if (samples == -1)
-				error("PCM poll and read error: %s", strerror(errno));
-			goto fail;
-		}
+/**
+ * Pre-encoded bitstream passthrough private data. */
+struct a2dp_source_passthrough_data {
+	struct a2dp_bitstream bs;
+};
 
-		int16_t *input = pcm.data;
-		size_t input_len = samples;
+static int a2dp_source_passthrough_init(struct a2dp_source *s) {
 
-		/* encode and transfer obtained data */
-		while (input_len >= ldac_pcm_samples) {
+	struct a2dp_source_passthrough_data *priv = s->priv;
 
-			int len;
-			int encoded;
-			int frames;
+	switch (s->t->type.codec) {
+	case A2DP_CODEC_SBC:
+		a2dp_bitstream_init(&priv->bs, A2DP_BITSTREAM_SBC);
+		break;
+	case A2DP_CODEC_MPEG12:
+		a2dp_bitstream_init(&priv->bs, A2DP_BITSTREAM_MPEG);
+		/* the longest MPEG-1/2 audio frame is 1728 bytes */
+		s->payload_size = 2048;
+		break;
+	default:
+		a2dp_bitstream_init(&priv->bs, A2DP_BITSTREAM_LATM);
+		/* the longest LOAS frame with some space for the ADTS to LATM
+		 * conversion overhead - the in-band stream mux configuration */
+		s->payload_size = 8192 + 64;
+		break;
+	}
 
-			if (ldacBT_encode(handle, input, &len, bt.tail, &encoded, &frames) != 0) {
-				error("LDAC encoding error: %s", ldacBT_strerror(ldacBT_get_error_code(handle)));
-				break;
-			}
+	/* The input buffer has to be able to hold the longest frame, otherwise
+	 * the bitstream parser would wait for more data forever. */
+	s->pcm_samples = 1;
+	s->pcm_buffer_samples = 16384;
+	return 0;
+}
 
-			rtp_media_header->frame_count = frames;
-
-			frames = len / sample_size;
-			input += frames;
-			input_len -= frames;
-
-			if (encoded &&
-					io_thread_write_bt(t->bt_fd, bt.data, ffb_len_out(&bt) + encoded,
-						&io.coutq.v[0], t->a2dp.bt_fd_coutq_init) == -1) {
-				if (errno == ECONNRESET || errno == ENOTCONN) {
-					/* exit thread upon BT socket disconnection */
-					debug("BT socket disconnected: %d", t->bt_fd);
-					goto fail;
-				}
-				error("BT socket write error: %s", strerror(errno));
-			}
+static void a2dp_source_passthrough_free(struct a2dp_source *s) {
+	(void)s;
+}
 
-			if (config.ldac_abr)
-				ldac_ABR_Proc(handle, handle_abr, io.coutq.v[0] / t->mtu_write, 1);
+static ssize_t a2dp_source_passthrough_encode(struct a2dp_source *s, const void *pcm,
+		size_t samples, size_t *consumed, uint8_t *payload, size_t len) {
 
-			/* keep data transfer at a constant bit rate */
-			asrsync_sync(&io.asrs, frames / channels);
-			ts_frames += frames;
+	struct a2dp_source_passthrough_data *priv = s->priv;
+	const uint8_t *input = pcm;
+	size_t input_len = samples;
+	uint8_t *output = payload;
+	size_t output_len = len;
+	unsigned int frames = 0;
 
-			/* update busy delay (encoding overhead) */
-			t->a2dp.pcm.delay = asrsync_get_busy_usec(&io.asrs) / 100;
+	/* SBC frames are packed into the payload as many as the MTU and 4-bit
+	 * media header frame counter allow. Other frames are transmitted one
+	 * per RTP payload, which is fragmented if needed. */
+	while (input_len > 0) {
 
-			if (encoded) {
-				timestamp += ts_frames / channels * 10000 / samplerate;
-				rtp_header->seq_number = htobe16(++seq_number);
-				rtp_header->timestamp = htobe32(timestamp);
-				ts_frames = 0;
-			}
+		struct a2dp_bitstream_frame frame;
+		const size_t skip = a2dp_bitstream_parse(&priv->bs, input, input_len, &frame);
 
+		if (frame.len == 0) {
+			input += skip;
+			input_len -= skip;
+			break;
 		}
 
-		/* If the input buffer was not consumed (due to codesize limit), we
-		 * have to append new data to the existing one. Since we do not use
-		 * ring buffer, we will simply move unprocessed data to the front
-		 * of our linear buffer. */
-		ffb_shift(&pcm, samples - input_len);
+		ssize_t ret;
+		if ((ret = a2dp_bitstream_payload(&frame, output, output_len)) == -1) {
+			/* send already packed frames first */
+			if (frames > 0)
+				break;
+			warn("Encoded frame too big for RTP payload: %zu > %zu", frame.len, len);
+			input += skip;
+			input_len -= skip;
+			break;
+		}
+
+		input += skip;
+		input_len -= skip;
+		output += ret;
+		output_len -= ret;
+		s->frames += frame.pcm_frames;
+
+		if (priv->bs.type != A2DP_BITSTREAM_SBC ||
+				++frames == ((1 << 4) - 1))
+			break;
 
 	}
 
-fail:
-	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-	pthread_cleanup_pop(!io.t_locked);
-fail_ffb:
-	pthread_cleanup_pop(1);
-	pthread_cleanup_pop(1);
-fail_init:
-	pthread_cleanup_pop(1);
-fail_open_ldac_abr:
-	pthread_cleanup_pop(1);
-fail_open_ldac:
-	pthread_cleanup_pop(1);
-	return NULL;
+	if (priv->bs.type == A2DP_BITSTREAM_SBC) {
+		rtp_media_header_t *rtp_media_header = s->rtp_phdr;
+		rtp_media_header->frame_count = frames;
+	}
+
+	*consumed = samples - input_len;
+	return output - payload;
 }
-#endif
+
+static void a2dp_source_passthrough_fragment(struct a2dp_source *s, size_t offset) {
+	rtp_mpeg_audio_header_t *rtp_mpeg_audio_header = s->rtp_phdr;
+	rtp_mpeg_audio_header->offset = htobe16(offset);
+}
+
+static const struct a2dp_source_codec a2dp_source_passthrough_sbc_codec = {
+	.priv_size = sizeof(struct a2dp_source_passthrough_data),
+	.rtp = true,
+	.rtp_phdr_size = sizeof(rtp_media_header_t),
+	.passthrough = true,
+	.init = a2dp_source_passthrough_init,
+	.free = a2dp_source_passthrough_free,
+	.encode = a2dp_source_passthrough_encode,
+};
+
+static const struct a2dp_source_codec a2dp_source_passthrough_mpeg_codec = {
+	.priv_size = sizeof(struct a2dp_source_passthrough_data),
+	.rtp = true,
+	.rtp_phdr_size = sizeof(rtp_mpeg_audio_header_t),
+	.fragmentation = true,
+	.passthrough = true,
+	.init = a2dp_source_passthrough_init,
+	.free = a2dp_source_passthrough_free,
+	.encode = a2dp_source_passthrough_encode,
+	.fragment = a2dp_source_passthrough_fragment,
+};
+
+static const struct a2dp_source_codec a2dp_source_passthrough_latm_codec = {
+	.priv_size = sizeof(struct a2dp_source_passthrough_data),
+	.rtp = true,
+	.fragmentation = true,
+	.passthrough = true,
+	.init = a2dp_source_passthrough_init,
+	.free = a2dp_source_passthrough_free,
+	.encode = a2dp_source_passthrough_encode,
+};
 
 /**
- * Dump incoming BT data to a file. */
-static void *a2dp_sink_dump(struct ba_transport *t) {
+ * A2DP source IO thread for pre-encoded bitstreams.
+ *
+ * PCM client writes already encoded frames (SBC, MPEG audio, or AAC and USAC
+ * in LOAS or ADTS framing), which are only packetized into RTP payloads. */
+static void *a2dp_source_passthrough(struct ba_transport *t) {
+	switch (t->type.codec) {
+	case A2DP_CODEC_SBC:
+		return a2dp_source_pipeline(t, &a2dp_source_passthrough_sbc_codec);
+	case A2DP_CODEC_MPEG12:
+		return a2dp_source_pipeline(t, &a2dp_source_passthrough_mpeg_codec);
+	default:
+		return a2dp_source_pipeline(t, &a2dp_source_passthrough_latm_codec);
+	}
+}
 
-	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-	pthread_cleanup_push(PTHREAD_CLEANUP(ba_transport_pthread_cleanup), t);
+/**
+ * Encoded bitstream tap private data. */
+struct a2dp_sink_tap_data {
+	struct a2dp_bitstream bs;
+	/* MPEG audio frame reassembly buffer */
+	ffb_t frame;
+	/* RTP timestamp of the first buffered fragment */
+	uint32_t frame_timestamp;
+	/* PCM frames delivered since the first buffered fragment */
+	unsigned int frame_pcm_frames;
+	/* fragment offset expected in the next RTP packet */
+	size_t frame_offset;
+	/* the number of lost packets seen by the reassembly */
+	unsigned int frame_lost;
+};
 
-	struct io_thread_data io = { 0 };
-	ffb_t bt = { 0 };
-	FILE *f = NULL;
-	char fname[64];
-	char *ptr;
+static int a2dp_sink_tap_init(struct a2dp_sink *s) {
 
-	sprintf(fname, "/tmp/ba-%s.dump", ba_transport_type_to_string(t->type));
-	for (ptr = fname; *ptr != '\0'; ptr++) {
-		*ptr = tolower(*ptr);
-		if (*ptr == ' ' || *ptr == '(' || *ptr == ')')
-			*ptr = '-';
+	struct a2dp_sink_tap_data *priv = s->priv;
+
+	switch (s->t->type.codec) {
+	case A2DP_CODEC_SBC:
+		a2dp_bitstream_init(&priv->bs, A2DP_BITSTREAM_SBC);
+		break;
+	case A2DP_CODEC_MPEG12:
+		a2dp_bitstream_init(&priv->bs, A2DP_BITSTREAM_MPEG);
+		if (ffb_init_uint8_t(&priv->frame, s->t->mtu_read) == -1) {
+			error("Couldn't create reassembly buffer: %s", strerror(errno));
+			return -1;
+		}
+		break;
+	default:
+		a2dp_bitstream_init(&priv->bs, A2DP_BITSTREAM_LATM);
+		break;
+	}
+
+	/* frame header and the whole RTP payload - it will be resized if the
+	 * reassembled payload does not fit */
+	s->pcm_samples = sizeof(struct ba_transport_pcm_frame_header) + s->t->mtu_read;
+	return 0;
+}
+
+static void a2dp_sink_tap_free(struct a2dp_sink *s) {
+	struct a2dp_sink_tap_data *priv = s->priv;
+	ffb_free(&priv->frame);
+}
+
+/**
+ * Write encoded frame preceded by the frame header to the PCM FIFO. */
+static void a2dp_sink_tap_write(struct a2dp_sink *s, uint32_t timestamp,
+		const uint8_t *data, size_t len) {
+
+	const size_t size = sizeof(struct ba_transport_pcm_frame_header) + len;
+	if (s->pcm.nmemb < size) {
+		debug("Resizing frame buffer: %zu -> %zu", s->pcm.nmemb, size);
+		if (ffb_init_uint8_t(&s->pcm, size) == -1) {
+			error("Couldn't resize frame buffer: %s", strerror(errno));
+			return;
+		}
 	}
 
-	debug("Opening BT dump file: %s", fname);
-	if ((f = fopen(fname, "wb")) == NULL) {
-		error("Couldn't create dump file: %s", strerror(errno));
-		goto fail_open;
+	struct ba_transport_pcm_frame_header *header = s->pcm.data;
+	header->timestamp = htole32(timestamp);
+	header->length = htole32(len);
+	memcpy(header + 1, data, len);
+
+	a2dp_sink_write(&s->writer, s->pcm.data, size);
+
+}
+
+/**
+ * Split the bitstream into separate frames and deliver them to the client.
+ *
+ * Timestamps of the subsequent frames are derived from the given timestamp
+ * of the first frame in the buffer.
+ *
+ * @return This function returns the number of bytes consumed. The data
+ *   which does not constitute a complete frame is left in the buffer. */
+static size_t a2dp_sink_tap_split(struct a2dp_sink *s, uint32_t timestamp,
+		const uint8_t *data, size_t len, unsigned int *frames) {
+
+	struct a2dp_sink_tap_data *priv = s->priv;
+	struct a2dp_bitstream_frame frame;
+	const size_t total = len;
+	size_t ret;
+
+	while ((ret = a2dp_bitstream_parse(&priv->bs, data, len, &frame)) > 0) {
+		if (frame.len > 0) {
+			a2dp_sink_tap_write(s, timestamp +
+					(uint64_t)*frames * s->jb.ts_rate / s->jb.samplerate,
+					frame.data, frame.len);
+			*frames += frame.pcm_frames;
+		}
+		data += ret;
+		len -= ret;
 	}
 
-	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &bt);
-	pthread_cleanup_push(PTHREAD_CLEANUP(fclose), f);
+	return total - len;
+}
 
-	if (ffb_init_uint8_t(&bt, t->mtu_read) == -1) {
-		error("Couldn't create data buffer: %s", strerror(errno));
-		goto fail_ffb;
+/**
+ * Reassemble MPEG audio frames fragmented according to RFC 2250.
+ *
+ * Fragments are joined based on the offset field of the MPEG audio specific
+ * header, so the reassembly does not depend on the RTP mark bit. The packet
+ * with the zero offset starts a new frame, every other packet has to carry
+ * the continuation of the buffered data. */
+static void a2dp_sink_tap_decode_mpeg(struct a2dp_sink *s, const void *phdr,
+		const uint8_t *payload, size_t len) {
+
+	struct a2dp_sink_tap_data *priv = s->priv;
+	const rtp_mpeg_audio_header_t *rtp_mpeg_audio_header = phdr;
+	const size_t offset = be16toh(rtp_mpeg_audio_header->offset);
+
+	/* Fragments of the frame preceding lost packet are useless, so
+	 * discard them in order not to deliver garbage to the client. */
+	if (s->jb.stats.lost != priv->frame_lost) {
+		priv->frame_lost = s->jb.stats.lost;
+		ffb_rewind(&priv->frame);
+		priv->frame_offset = 0;
 	}
 
-	for (;;) {
-		ssize_t len;
-		if ((len = a2dp_poll_and_read_bt(t, &io, &bt)) <= 0) {
-			if (len == -1)
-				error("BT poll and read error: %s", strerror(errno));
-			goto fail;
+	if (offset == 0) {
+		if (ffb_len_out(&priv->frame) > 0)
+			warn("Incomplete MPEG audio frame: %zu", ffb_len_out(&priv->frame));
+		ffb_rewind(&priv->frame);
+		priv->frame_timestamp = s->timestamp;
+		priv->frame_pcm_frames = 0;
+	}
+	else if (offset != priv->frame_offset) {
+		debug("Unexpected MPEG audio fragment offset: %zu != %zu",
+				offset, priv->frame_offset);
+		ffb_rewind(&priv->frame);
+		priv->frame_offset = 0;
+		return;
+	}
+
+	if (ffb_len_in(&priv->frame) < len) {
+		const size_t size = ffb_len_out(&priv->frame) + len;
+		const size_t prev_len = ffb_len_out(&priv->frame);
+		debug("Resizing reassembly buffer: %zu -> %zu", priv->frame.nmemb, size);
+		if (ffb_init_uint8_t(&priv->frame, size) == -1) {
+			error("Couldn't resize reassembly buffer: %s", strerror(errno));
+			return;
 		}
-		debug("BT read: %zd", len);
-		fwrite(bt.data, 1, len, f);
+		ffb_seek(&priv->frame, prev_len);
 	}
 
-fail:
-	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-fail_ffb:
-	pthread_cleanup_pop(1);
-	pthread_cleanup_pop(1);
-fail_open:
-	pthread_cleanup_pop(1);
-	return NULL;
+	memcpy(priv->frame.tail, payload, len);
+	ffb_seek(&priv->frame, len);
+	priv->frame_offset = offset + len;
+
+	const unsigned int frames = priv->frame_pcm_frames;
+	ffb_shift(&priv->frame, a2dp_sink_tap_split(s, priv->frame_timestamp,
+				priv->frame.data, ffb_len_out(&priv->frame), &priv->frame_pcm_frames));
+
+	a2dp_jbuf_played(&s->jb, priv->frame_pcm_frames - frames);
+
+}
+
+static void a2dp_sink_tap_decode(struct a2dp_sink *s, const void *phdr,
+		const uint8_t *payload, size_t len) {
+
+	struct a2dp_sink_tap_data *priv = s->priv;
+	unsigned int frames = 0;
+	size_t ret;
+
+	switch (priv->bs.type) {
+	case A2DP_BITSTREAM_SBC:
+		break;
+	case A2DP_BITSTREAM_MPEG:
+		a2dp_sink_tap_decode_mpeg(s, phdr, payload, len);
+		return;
+	case A2DP_BITSTREAM_LATM:
+		/* LATM payload is a single access unit, which is delivered as it is,
+		 * i.e. with the in-band stream mux configuration (if present). */
+		a2dp_sink_tap_write(s, s->timestamp, payload, len);
+		frames = a2dp_bitstream_latm_pcm_frames(&priv->bs, payload, len);
+		a2dp_jbuf_played(&s->jb, frames);
+		return;
+	}
+
+	if ((ret = a2dp_sink_tap_split(s, s->timestamp, payload, len, &frames)) < len)
+		warn("Incomplete frame in RTP payload: %zu", len - ret);
+
+	a2dp_jbuf_played(&s->jb, frames);
+
+}
+
+static const struct a2dp_sink_codec a2dp_sink_tap_sbc_codec = {
+	.priv_size = sizeof(struct a2dp_sink_tap_data),
+	.rtp = true,
+	.rtp_phdr_size = sizeof(rtp_media_header_t),
+	.init = a2dp_sink_tap_init,
+	.free = a2dp_sink_tap_free,
+	.decode = a2dp_sink_tap_decode,
+};
+
+static const struct a2dp_sink_codec a2dp_sink_tap_mpeg_codec = {
+	.priv_size = sizeof(struct a2dp_sink_tap_data),
+	.rtp = true,
+	.rtp_phdr_size = sizeof(rtp_mpeg_audio_header_t),
+	.init = a2dp_sink_tap_init,
+	.free = a2dp_sink_tap_free,
+	.decode = a2dp_sink_tap_decode,
+};
+
+static const struct a2dp_sink_codec a2dp_sink_tap_latm_codec = {
+	.priv_size = sizeof(struct a2dp_sink_tap_data),
+	.rtp = true,
+	.fragmentation = true,
+	.init = a2dp_sink_tap_init,
+	.free = a2dp_sink_tap_free,
+	.decode = a2dp_sink_tap_decode,
+};
+
+/**
+ * Get the bitstream tap matching the transport codec. */
+static const struct a2dp_sink_codec *a2dp_sink_tap_codec(const struct ba_transport *t) {
+	switch (t->type.codec) {
+	case A2DP_CODEC_SBC:
+		return &a2dp_sink_tap_sbc_codec;
+	case A2DP_CODEC_MPEG12:
+		return &a2dp_sink_tap_mpeg_codec;
+	default:
+		return &a2dp_sink_tap_latm_codec;
+	}
+}
+
+/**
+ * A2DP sink IO thread for the encoded bitstream tap.
+ *
+ * Received frames (de-packetized and reassembled) are delivered to the PCM
+ * client without decoding. Every frame is preceded by the frame header with
+ * the RTP timestamp and the length of the frame. */
+static void *a2dp_sink_tap(struct ba_transport *t) {
+	return a2dp_sink_pipeline(t, a2dp_sink_tap_codec(t));
 }
 
 int a2dp_audio_thread_create(struct ba_transport *t) {
 
+	if (t->type.profile & BA_TRANSPORT_PROFILE_A2DP_SOURCE &&
+			t->a2dp.pcm.format == BA_TRANSPORT_PCM_FORMAT_ENCODED)
+		return ba_transport_pthread_create(t, a2dp_source_passthrough, "ba-a2dp-bs");
+	if (t->type.profile & BA_TRANSPORT_PROFILE_A2DP_SINK &&
+			t->a2dp.pcm.format == BA_TRANSPORT_PCM_FORMAT_ENCODED)
+		return a2dp_sink_create(t, a2dp_sink_tap, a2dp_sink_tap_codec(t), "ba-a2dp-tap");
+
 	if (t->type.profile & BA_TRANSPORT_PROFILE_A2DP_SOURCE)
 		switch (t->type.codec) {
 		case A2DP_CODEC_SBC:
@@ -2338,6 +4099,13 @@ int a2dp_audio_thread_create(struct ba_transport *t) {
 		case A2DP_CODEC_MPEG24:
 			return ba_transport_pthread_create(t, a2dp_source_aac, "ba-a2dp-aac");
 #endif
+#if ENABLE_USAC
+		case A2DP_CODEC_MPEGD:
+			/* There is no USAC encoder, so the USAC source endpoint is
+			 * registered only if the encoding is skipped, in which case
+			 * the stream is served by the passthrough IO thread. */
+			break;
+#endif
 #if ENABLE_APTX
 		case A2DP_CODEC_VENDOR_APTX:
 			return ba_transport_pthread_create(t, a2dp_source_aptx, "ba-a2dp-aptx");
@@ -2346,6 +4114,10 @@ int a2dp_audio_thread_create(struct ba_transport *t) {
 		case A2DP_CODEC_VENDOR_APTX_HD:
 			return ba_transport_pthread_create(t, a2dp_source_aptx_hd, "ba-a2dp-aptx-hd");
 #endif
+#if ENABLE_FASTSTREAM
+		case A2DP_CODEC_VENDOR_FASTSTREAM:
+			return ba_transport_pthread_create(t, a2dp_source_faststream, "ba-a2dp-fs");
+#endif
 #if ENABLE_LDAC
 		case A2DP_CODEC_VENDOR_LDAC:
 			return ba_transport_pthread_create(t, a2dp_source_ldac, "ba-a2dp-ldac");
@@ -2354,20 +4126,32 @@ int a2dp_audio_thread_create(struct ba_transport *t) {
 	else if (t->type.profile & BA_TRANSPORT_PROFILE_A2DP_SINK)
 		switch (t->type.codec) {
 		case A2DP_CODEC_SBC:
-			return ba_transport_pthread_create(t, a2dp_sink_sbc, "ba-a2dp-sbc");
+			return a2dp_sink_create(t, a2dp_sink_sbc, &a2dp_sink_sbc_codec, "ba-a2dp-sbc");
 #if ENABLE_MPEG
 		case A2DP_CODEC_MPEG12:
 #if ENABLE_MPG123
-			return ba_transport_pthread_create(t, a2dp_sink_mpeg, "ba-a2dp-mpeg");
+			return a2dp_sink_create(t, a2dp_sink_mpeg, &a2dp_sink_mpeg_codec, "ba-a2dp-mpeg");
 #elif ENABLE_MP3LAME
 			if (((a2dp_mpeg_t *)t->a2dp.configuration)->layer == MPEG_LAYER_MP3)
-				return ba_transport_pthread_create(t, a2dp_sink_mpeg, "ba-a2dp-mp3");
+				return a2dp_sink_create(t, a2dp_sink_mpeg, &a2dp_sink_mpeg_codec, "ba-a2dp-mp3");
 #endif
 			break;
 #endif
 #if ENABLE_AAC
 		case A2DP_CODEC_MPEG24:
-			return ba_transport_pthread_create(t, a2dp_sink_aac, "ba-a2dp-aac");
+			return a2dp_sink_create(t, a2dp_sink_aac, &a2dp_sink_aac_codec, "ba-a2dp-aac");
+#endif
+#if ENABLE_USAC
+		case A2DP_CODEC_MPEGD:
+			return a2dp_sink_create(t, a2dp_sink_usac, &a2dp_sink_usac_codec, "ba-a2dp-usac");
+#endif
+#if HAVE_APTX_DECODE
+		case A2DP_CODEC_VENDOR_APTX:
+			return a2dp_sink_create(t, a2dp_sink_aptx, &a2dp_sink_aptx_codec, "ba-a2dp-aptx");
+#endif
+#if HAVE_APTX_HD_DECODE
+		case A2DP_CODEC_VENDOR_APTX_HD:
+			return a2dp_sink_create(t, a2dp_sink_aptx_hd, &a2dp_sink_aptx_hd_codec, "ba-a2dp-aptx-hd");
 #endif
 		}
 
@@ -32,6 +32,11 @@ ssize_t ba_transport_pcm_write(
 		void *buffer,
 		size_t samples);
 
+ssize_t ba_transport_pcm_write_nowait(
+		struct ba_transport_pcm *pcm,
+		void *buffer,
+		size_t samples);
+
 int a2dp_audio_thread_create(struct ba_transport *t);
 
 #endif
@@ -0,0 +1,469 @@
+/*
+ * BlueALSA - a2dp-bitstream.c
+ * Copyright (c) 2016-2020 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#include "a2dp-bitstream.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "shared/log.h"
+
+/* the size of the LOAS AudioSyncStream header */
+#define LOAS_HEADER_LEN 3
+/* the size of the ADTS fixed and variable header */
+#define ADTS_HEADER_LEN 7
+
+/**
+ * MSB-first bit reader. */
+struct bit_reader {
+	const uint8_t *data;
+	size_t len;
+	size_t pos;
+	bool overrun;
+};
+
+static uint32_t bit_reader_get(struct bit_reader *br, unsigned int bits) {
+	uint32_t value = 0;
+	if (br->pos + bits > br->len * 8) {
+		br->overrun = true;
+		return 0;
+	}
+	while (bits--) {
+		value = value << 1 | ((br->data[br->pos / 8] >> (7 - br->pos % 8)) & 1);
+		br->pos++;
+	}
+	return value;
+}
+
+/**
+ * MSB-first bit writer. */
+struct bit_writer {
+	uint8_t *data;
+	size_t len;
+	size_t pos;
+	bool overrun;
+};
+
+static void bit_writer_put(struct bit_writer *bw, uint32_t value, unsigned int bits) {
+	if (bw->pos + bits > bw->len * 8) {
+		bw->overrun = true;
+		return;
+	}
+	while (bits--) {
+		uint8_t *byte = &bw->data[bw->pos / 8];
+		const unsigned int shift = 7 - bw->pos % 8;
+		*byte = (*byte & ~(1 << shift)) | ((value >> bits) & 1) << shift;
+		bw->pos++;
+	}
+}
+
+/**
+ * Parse SBC frame header.
+ *
+ * @return On success this function returns the length of the SBC frame.
+ *   If the header is not valid, 0 is returned. */
+static size_t sbc_parse_header(const uint8_t *data, unsigned int *pcm_frames) {
+
+	if (data[0] != 0x9C)
+		return 0;
+
+	const unsigned int blocks = ((data[1] >> 4) & 0x03) * 4 + 4;
+	const unsigned int mode = (data[1] >> 2) & 0x03;
+	const unsigned int subbands = data[1] & 0x01 ? 8 : 4;
+	const unsigned int bitpool = data[2];
+	const unsigned int channels = mode == 0 ? 1 : 2;
+
+	if (bitpool < 2)
+		return 0;
+
+	size_t len = 4 + (4 * subbands * channels) / 8;
+	switch (mode) {
+	case 0 /* mono */ :
+	case 1 /* dual channel */ :
+		len += (blocks * channels * bitpool + 7) / 8;
+		break;
+	case 2 /* stereo */ :
+		len += (blocks * bitpool + 7) / 8;
+		break;
+	case 3 /* joint stereo */ :
+		len += (subbands + blocks * bitpool + 7) / 8;
+		break;
+	}
+
+	*pcm_frames = blocks * subbands;
+	return len;
+}
+
+/**
+ * Parse MPEG-1/2 audio frame header.
+ *
+ * @return On success this function returns the length of the MPEG frame.
+ *   If the header is not valid, 0 is returned. */
+static size_t mpeg_parse_header(const uint8_t *data, unsigned int *pcm_frames) {
+
+	static const uint16_t bitrates[2][3][15] = {
+		{ /* MPEG-1 */
+			{ 0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448 },
+			{ 0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384 },
+			{ 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320 } },
+		{ /* MPEG-2 and MPEG-2.5 */
+			{ 0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256 },
+			{ 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 },
+			{ 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 } },
+	};
+	static const uint16_t samplings[3] = { 44100, 48000, 32000 };
+
+	if (data[0] != 0xFF || (data[1] & 0xE0) != 0xE0)
+		return 0;
+
+	const unsigned int version = (data[1] >> 3) & 0x03;
+	const unsigned int layer = 3 - ((data[1] >> 1) & 0x03);
+	const unsigned int bitrate_index = (data[2] >> 4) & 0x0F;
+	const unsigned int sampling_index = (data[2] >> 2) & 0x03;
+	const unsigned int padding = (data[2] >> 1) & 0x01;
+
+	/* Reject reserved values. Free format is not supported, because
+	 * the frame length can not be derived from the header. */
+	if (version == 0x01 || layer == 3 ||
+			bitrate_index == 0 || bitrate_index == 0x0F || sampling_index == 0x03)
+		return 0;
+
+	const bool mpeg1 = version == 0x03;
+	const unsigned int bitrate = bitrates[mpeg1 ? 0 : 1][layer][bitrate_index] * 1000;
+	unsigned int sampling = samplings[sampling_index];
+	if (!mpeg1)
+		sampling /= version == 0x02 ? 2 : 4;
+
+	switch (layer) {
+	case 0 /* Layer I */ :
+		*pcm_frames = 384;
+		return (12 * bitrate / sampling + padding) * 4;
+	case 1 /* Layer II */ :
+		*pcm_frames = 1152;
+		return 144 * bitrate / sampling + padding;
+	default /* Layer III */ :
+		*pcm_frames = mpeg1 ? 1152 : 576;
+		return (mpeg1 ? 144 : 72) * bitrate / sampling + padding;
+	}
+
+}
+
+/**
+ * Get LATM variable length value. */
+static uint32_t latm_get_value(struct bit_reader *br) {
+	const unsigned int bytes = bit_reader_get(br, 2) + 1;
+	return bit_reader_get(br, 8 * bytes);
+}
+
+/**
+ * Get audio object type from the audio specific config. */
+static unsigned int asc_get_object_type(struct bit_reader *br) {
+	unsigned int aot = bit_reader_get(br, 5);
+	if (aot == 31)
+		aot = 32 + bit_reader_get(br, 6);
+	return aot;
+}
+
+/**
+ * Skip sampling frequency from the audio specific config. */
+static void asc_skip_sampling(struct bit_reader *br, unsigned int escape) {
+	if (bit_reader_get(br, escape == 0x1F ? 5 : 4) == escape)
+		bit_reader_get(br, 24);
+}
+
+/**
+ * Get the number of PCM frames per access unit from the audio specific
+ * config. If the object type is not recognized, 0 is returned. */
+static unsigned int asc_get_pcm_frames(struct bit_reader *br) {
+
+	/* output frame length for the USAC core SBR frame length index */
+	static const uint16_t usac_frame_lengths[] = { 768, 1024, 2048, 2048, 4096 };
+
+	unsigned int aot = asc_get_object_type(br);
+	unsigned int sbr = 1;
+
+	asc_skip_sampling(br, 0x0F);
+	bit_reader_get(br, 4 /* channel configuration */);
+
+	/* explicit SBR or PS signaling */
+	if (aot == 5 || aot == 29) {
+		sbr = 2;
+		asc_skip_sampling(br, 0x0F);
+		aot = asc_get_object_type(br);
+	}
+
+	switch (aot) {
+	case 1: case 2: case 3: case 4: case 6: case 7:
+	case 17: case 19: case 20: case 21: case 22:
+		/* GASpecificConfig: frameLengthFlag */
+		return (bit_reader_get(br, 1) ? 960 : 1024) * sbr;
+	case 23 /* ER AAC LD */ :
+		return bit_reader_get(br, 1) ? 480 : 512;
+	case 42 /* USAC */ : {
+		asc_skip_sampling(br, 0x1F);
+		const unsigned int index = bit_reader_get(br, 3);
+		if (index < sizeof(usac_frame_lengths) / sizeof(*usac_frame_lengths))
+			return usac_frame_lengths[index];
+		return 0;
+	}
+	default:
+		return 0;
+	}
+
+}
+
+/**
+ * Update the LATM access unit duration with the stream mux configuration
+ * from the audioMuxElement, if present. */
+static void latm_parse_mux_config(struct a2dp_bitstream *bs,
+		const uint8_t *data, size_t len) {
+
+	struct bit_reader br = { .data = data, .len = len };
+
+	/* useSameStreamMux */
+	if (bit_reader_get(&br, 1))
+		return;
+
+	const unsigned int version = bit_reader_get(&br, 1);
+	if (version == 1 && bit_reader_get(&br, 1 /* audioMuxVersionA */))
+		return;
+	if (version == 1)
+		latm_get_value(&br /* taraBufferFullness */);
+
+	bit_reader_get(&br, 1 /* allStreamsSameTimeFraming */);
+	bit_reader_get(&br, 6 /* numSubFrames */);
+	if (bit_reader_get(&br, 4 /* numProgram */) != 0 ||
+			bit_reader_get(&br, 3 /* numLayer */) != 0) {
+		debug("Unsupported LATM multiplex configuration");
+		return;
+	}
+
+	if (version == 1)
+		latm_get_value(&br /* ascLen */);
+
+	const unsigned int pcm_frames = asc_get_pcm_frames(&br);
+	if (br.overrun || pcm_frames == 0)
+		return;
+
+	if (bs->latm_pcm_frames != pcm_frames)
+		debug("LATM access unit length: %u", pcm_frames);
+	bs->latm_pcm_frames = pcm_frames;
+
+}
+
+/**
+ * Parse LOAS or ADTS frame header.
+ *
+ * @return On success this function returns the length of the frame. If
+ *   the header is not valid, 0 is returned. */
+static size_t latm_parse_header(struct a2dp_bitstream *bs,
+		const uint8_t *data, size_t len, struct a2dp_bitstream_frame *frame) {
+
+	/* LOAS AudioSyncStream */
+	if (data[0] == 0x56 && (data[1] & 0xE0) == 0xE0) {
+		const size_t frame_len = LOAS_HEADER_LEN + (((data[1] & 0x1F) << 8) | data[2]);
+		if (frame_len <= len)
+			latm_parse_mux_config(bs, data + LOAS_HEADER_LEN, frame_len - LOAS_HEADER_LEN);
+		frame->pcm_frames = bs->latm_pcm_frames;
+		frame->adts = false;
+		return frame_len;
+	}
+
+	/* ADTS with the MPEG-4 or MPEG-2 ID and layer 0 */
+	if (len >= ADTS_HEADER_LEN && data[0] == 0xFF && (data[1] & 0xF6) == 0xF0) {
+		const size_t frame_len = ((data[3] & 0x03) << 11) | (data[4] << 3) | (data[5] >> 5);
+		if (frame_len < ADTS_HEADER_LEN + (data[1] & 0x01 ? 0 : 2))
+			return 0;
+		frame->pcm_frames = 1024 * ((data[6] & 0x03) + 1);
+		frame->adts = true;
+		return frame_len;
+	}
+
+	return 0;
+}
+
+/**
+ * Initialize bitstream framer. */
+void a2dp_bitstream_init(
+		struct a2dp_bitstream *bs,
+		enum a2dp_bitstream_type type) {
+	memset(bs, 0, sizeof(*bs));
+	bs->type = type;
+	/* assume AAC-LC until the stream mux configuration is known */
+	bs->latm_pcm_frames = 1024;
+}
+
+/**
+ * Find the next complete frame in the bitstream.
+ *
+ * Data preceding the frame which can not be recognized as a valid frame
+ * header is skipped.
+ *
+ * @param bs The bitstream framer.
+ * @param buffer Buffer with the bitstream data.
+ * @param len The length of the bitstream data.
+ * @param frame The address where the frame description will be stored. If
+ *   the complete frame was not found, the length of the frame is set to 0.
+ * @return This function returns the number of bytes which shall be removed
+ *   from the beginning of the buffer, i.e. the skipped data and the frame
+ *   itself. If more data is required, 0 is returned. */
+size_t a2dp_bitstream_parse(
+		struct a2dp_bitstream *bs,
+		const void *buffer,
+		size_t len,
+		struct a2dp_bitstream_frame *frame) {
+
+	/* the minimal number of bytes required to parse any header */
+	const size_t header_len = 4;
+	const uint8_t *data = buffer;
+	size_t i;
+
+	memset(frame, 0, sizeof(*frame));
+
+	for (i = 0; i + header_len <= len; i++) {
+
+		size_t frame_len = 0;
+		switch (bs->type) {
+		case A2DP_BITSTREAM_SBC:
+			frame_len = sbc_parse_header(&data[i], &frame->pcm_frames);
+			break;
+		case A2DP_BITSTREAM_MPEG:
+			frame_len = mpeg_parse_header(&data[i], &frame->pcm_frames);
+			break;
+		case A2DP_BITSTREAM_LATM:
+			frame_len = latm_parse_header(bs, &data[i], len - i, frame);
+			break;
+		}
+
+		if (frame_len == 0)
+			continue;
+
+		if (i > 0)
+			debug("Bitstream resync: skipped %zu bytes", i);
+
+		/* wait for the rest of the frame */
+		if (i + frame_len > len)
+			return i;
+
+		/* ADTS frames with multiple raw data blocks require
+		 * the block position table, which is not supported */
+		if (frame->adts && frame->pcm_frames != 1024) {
+			warn("Unsupported ADTS frame: raw data blocks: %u", frame->pcm_frames / 1024);
+			return i + frame_len;
+		}
+
+		frame->data = &data[i];
+		frame->len = frame_len;
+		return i + frame_len;
+	}
+
+	return i;
+}
+
+/**
+ * Get the number of PCM frames carried by the LATM access unit.
+ *
+ * @param bs The bitstream framer.
+ * @param payload The audioMuxElement, i.e. the LATM RTP payload.
+ * @param len The length of the payload.
+ * @return This function returns the number of PCM frames derived from the
+ *   in-band stream mux configuration, or the last known value if the mux
+ *   configuration is not present. */
+unsigned int a2dp_bitstream_latm_pcm_frames(
+		struct a2dp_bitstream *bs,
+		const void *payload,
+		size_t len) {
+	latm_parse_mux_config(bs, payload, len);
+	return bs->latm_pcm_frames;
+}
+
+/**
+ * Write frame as the RTP payload.
+ *
+ * SBC and MPEG frames are copied as they are. For AAC and USAC, the RTP
+ * payload is the audioMuxElement with the in-band stream mux configuration
+ * (RFC 3016), so the LOAS header is stripped and ADTS frames are converted
+ * into the LATM syntax.
+ *
+ * @param frame The frame found with the a2dp_bitstream_parse().
+ * @param payload The RTP payload buffer.
+ * @param len The capacity of the RTP payload buffer.
+ * @return On success this function returns the length of the payload. If
+ *   the payload buffer is too small, -1 is returned. */
+ssize_t a2dp_bitstream_payload(
+		const struct a2dp_bitstream_frame *frame,
+		void *payload,
+		size_t len) {
+
+	const uint8_t *data = frame->data;
+	size_t data_len = frame->len;
+
+	if (!frame->adts) {
+		/* LOAS sync word is never mistaken for other frame types */
+		if (data[0] == 0x56) {
+			data += LOAS_HEADER_LEN;
+			data_len -= LOAS_HEADER_LEN;
+		}
+		if (data_len > len)
+			return -1;
+		memcpy(payload, data, data_len);
+		return data_len;
+	}
+
+	const size_t header_len = ADTS_HEADER_LEN + (data[1] & 0x01 ? 0 : 2);
+	const unsigned int profile = data[2] >> 6;
+	const unsigned int sampling_index = (data[2] >> 2) & 0x0F;
+	const unsigned int channel_config = ((data[2] & 0x01) << 2) | (data[3] >> 6);
+
+	data += header_len;
+	data_len -= header_len;
+
+	struct bit_writer bw = { .data = payload, .len = len };
+
+	bit_writer_put(&bw, 0, 1 /* useSameStreamMux */);
+	/* StreamMuxConfig */
+	bit_writer_put(&bw, 0, 1 /* audioMuxVersion */);
+	bit_writer_put(&bw, 1, 1 /* allStreamsSameTimeFraming */);
+	bit_writer_put(&bw, 0, 6 /* numSubFrames */);
+	bit_writer_put(&bw, 0, 4 /* numProgram */);
+	bit_writer_put(&bw, 0, 3 /* numLayer */);
+	/* AudioSpecificConfig */
+	bit_writer_put(&bw, profile + 1, 5);
+	bit_writer_put(&bw, sampling_index, 4);
+	bit_writer_put(&bw, channel_config, 4);
+	bit_writer_put(&bw, 0, 1 /* frameLengthFlag */);
+	bit_writer_put(&bw, 0, 1 /* dependsOnCoreCoder */);
+	bit_writer_put(&bw, 0, 1 /* extensionFlag */);
+	bit_writer_put(&bw, 0, 3 /* frameLengthType */);
+	bit_writer_put(&bw, 0xFF, 8 /* latmBufferFullness */);
+	bit_writer_put(&bw, 0, 1 /* otherDataPresent */);
+	bit_writer_put(&bw, 0, 1 /* crcCheckPresent */);
+
+	/* PayloadLengthInfo */
+	size_t tmp;
+	for (tmp = data_len; tmp >= 255; tmp -= 255)
+		bit_writer_put(&bw, 255, 8);
+	bit_writer_put(&bw, tmp, 8);
+
+	/* PayloadMux */
+	size_t i;
+	for (i = 0; i < data_len; i++)
+		bit_writer_put(&bw, data[i], 8);
+
+	/* byte alignment */
+	if (bw.pos % 8)
+		bit_writer_put(&bw, 0, 8 - bw.pos % 8);
+
+	if (bw.overrun)
+		return -1;
+
+	return bw.pos / 8;
+}
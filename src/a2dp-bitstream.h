@@ -0,0 +1,78 @@
+/*
+ * BlueALSA - a2dp-bitstream.h
+ * Copyright (c) 2016-2020 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#ifndef BLUEALSA_A2DPBITSTREAM_H_
+#define BLUEALSA_A2DPBITSTREAM_H_
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+enum a2dp_bitstream_type {
+	/* SBC frames */
+	A2DP_BITSTREAM_SBC,
+	/* MPEG-1/2 audio frames */
+	A2DP_BITSTREAM_MPEG,
+	/* AAC or USAC in LOAS or ADTS framing */
+	A2DP_BITSTREAM_LATM,
+};
+
+/**
+ * Encoded audio frame found in the bitstream. */
+struct a2dp_bitstream_frame {
+	/* beginning of the frame (including framing headers) */
+	const uint8_t *data;
+	/* the size of the frame (including framing headers) */
+	size_t len;
+	/* the number of PCM frames carried by the frame */
+	unsigned int pcm_frames;
+	/* the frame is an ADTS frame which has to be converted to LATM */
+	bool adts;
+};
+
+/**
+ * Pre-encoded bitstream framer.
+ *
+ * The framer splits the stream of bytes written by the PCM client into the
+ * encoded audio frames, which can be put into the RTP payload as they are,
+ * without decoding and re-encoding. */
+struct a2dp_bitstream {
+	enum a2dp_bitstream_type type;
+	/* PCM frames per LATM access unit, taken from the last seen
+	 * stream mux configuration */
+	unsigned int latm_pcm_frames;
+};
+
+void a2dp_bitstream_init(
+		struct a2dp_bitstream *bs,
+		enum a2dp_bitstream_type type);
+
+size_t a2dp_bitstream_parse(
+		struct a2dp_bitstream *bs,
+		const void *buffer,
+		size_t len,
+		struct a2dp_bitstream_frame *frame);
+
+unsigned int a2dp_bitstream_latm_pcm_frames(
+		struct a2dp_bitstream *bs,
+		const void *payload,
+		size_t len);
+
+ssize_t a2dp_bitstream_payload(
+		const struct a2dp_bitstream_frame *frame,
+		void *payload,
+		size_t len);
+
+#endif
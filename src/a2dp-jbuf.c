@@ -0,0 +1,422 @@
+/*
+ * BlueALSA - a2dp-jbuf.c
+ * Copyright (c) 2016-2020 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#include "a2dp-jbuf.h"
+
+#include <endian.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "a2dp-rtp.h"
+#include "shared/log.h"
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+/* Maximal lateness of the packet, which is not considered as an underrun.
+ * It shall cover the inaccuracy of the poll() timeout. */
+#define A2DP_JBUF_LATE_TOLERANCE_USEC 5000
+
+/* The clock drift estimation window. It shall be long enough to catch at
+ * least one packet which was not delayed by the BT link. */
+#define A2DP_JBUF_DRIFT_WINDOW_USEC 1000000
+/* Time constant of the buffer depth correction, in seconds. */
+#define A2DP_JBUF_DRIFT_CORRECTION_SEC 30
+/* Maximal supported clock frequency offset (1000 ppm). */
+#define A2DP_JBUF_DRIFT_MAX 0.001
+
+static int64_t timespec2usec(const struct timespec *ts) {
+	return (int64_t)ts->tv_sec * 1000000 + ts->tv_nsec / 1000;
+}
+
+/**
+ * Set playout reference point. */
+static void a2dp_jbuf_sync(struct a2dp_jbuf *jb, uint32_t ts, int64_t time) {
+	jb->synced = true;
+	jb->ref_ts = ts;
+	jb->ref_time = time;
+}
+
+/**
+ * Get the playout time of the packet with given RTP timestamp. */
+static int64_t a2dp_jbuf_due(const struct a2dp_jbuf *jb, uint32_t ts) {
+	return jb->ref_time + (int64_t)(int32_t)(ts - jb->ref_ts) * 1000000 / (jb->ts_rate * jb->drift);
+}
+
+/**
+ * Restart the clock drift estimation.
+ *
+ * This function shall be called whenever the playout reference point has
+ * been moved, so the buffering delay is not continuous anymore. The drift
+ * estimated so far is preserved, though. */
+static void a2dp_jbuf_drift_restart(struct a2dp_jbuf *jb) {
+	jb->de.started = false;
+	jb->de.windows = 0;
+}
+
+/**
+ * Update the clock drift estimation with the newly arrived packet.
+ *
+ * The time which packets spend in the buffer is constant, as long as the
+ * remote clock runs at the same rate as our clock. Otherwise, it increases
+ * or decreases linearly. In order to get rid of the BT link jitter, only the
+ * lowest buffering delay within the estimation window is taken into account.
+ * The slope of the delay gives the residual frequency offset, while the
+ * delay deviation from its initial value is used for the buffer depth
+ * correction. */
+static void a2dp_jbuf_drift_update(struct a2dp_jbuf *jb, uint32_t ts, int64_t time) {
+
+	const int64_t delay = a2dp_jbuf_due(jb, ts) - time;
+
+	if (!jb->de.started) {
+		jb->de.started = true;
+		jb->de.start = time;
+		jb->de.delay_min = delay;
+		return;
+	}
+
+	if (delay < jb->de.delay_min)
+		jb->de.delay_min = delay;
+
+	const int64_t elapsed = time - jb->de.start;
+	if (elapsed < A2DP_JBUF_DRIFT_WINDOW_USEC)
+		return;
+
+	if (jb->de.windows++ == 0)
+		jb->de.delay_ref = jb->de.delay_min;
+	else {
+
+		/* The measured slope is the residual error of the currently applied
+		 * drift, so the actual frequency offset is the sum of both. */
+		const double slope = (double)(jb->de.delay_min - jb->de.delay_prev) / elapsed;
+		jb->drift_freq += (jb->drift - 1.0 + slope - jb->drift_freq) / 8;
+
+		double drift = jb->drift_freq + (double)(jb->de.delay_min - jb->de.delay_ref) /
+			(A2DP_JBUF_DRIFT_CORRECTION_SEC * 1000000);
+		if (drift > A2DP_JBUF_DRIFT_MAX)
+			drift = A2DP_JBUF_DRIFT_MAX;
+		if (drift < -A2DP_JBUF_DRIFT_MAX)
+			drift = -A2DP_JBUF_DRIFT_MAX;
+
+		/* move the reference point, so the playout time is continuous */
+		a2dp_jbuf_sync(jb, ts, a2dp_jbuf_due(jb, ts));
+		jb->drift = 1.0 + drift;
+
+	}
+
+	jb->de.delay_prev = jb->de.delay_min;
+	jb->de.delay_min = INT64_MAX;
+	jb->de.start = time;
+
+}
+
+/**
+ * Find the first buffered packet.
+ *
+ * @return The distance between the expected sequence number and the first
+ *   buffered packet, or -1 if the buffer is empty. */
+static int a2dp_jbuf_find(const struct a2dp_jbuf *jb) {
+
+	if (jb->count == 0)
+		return -1;
+
+	for (unsigned int d = 0; d < A2DP_JBUF_SLOTS; d++) {
+		const uint16_t seq = jb->seq + d;
+		const size_t i = seq % A2DP_JBUF_SLOTS;
+		if (jb->packet_len[i] != 0 && jb->packet_seq[i] == seq)
+			return d;
+	}
+
+	return -1;
+}
+
+/**
+ * Initialize RTP jitter buffer.
+ *
+ * @param jb Pointer to the jitter buffer structure.
+ * @param packet_size The maximal size of a single RTP packet.
+ * @param samplerate The PCM sampling frequency.
+ * @param target_ms Target buffer depth in milliseconds.
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int a2dp_jbuf_init(
+		struct a2dp_jbuf *jb,
+		size_t packet_size,
+		unsigned int samplerate,
+		unsigned int target_ms) {
+
+	memset(jb, 0, sizeof(*jb));
+	jb->packet_size = packet_size;
+	jb->samplerate = samplerate;
+	jb->ts_rate = samplerate;
+	jb->target = target_ms * 1000;
+	jb->drift = 1.0;
+
+	if ((jb->buffer = malloc(A2DP_JBUF_SLOTS * packet_size)) == NULL)
+		return -1;
+
+	return 0;
+}
+
+/**
+ * Release resources allocated by the jitter buffer.
+ *
+ * It is safe to call this function on a zero-initialized structure. */
+void a2dp_jbuf_free(
+		struct a2dp_jbuf *jb) {
+	free(jb->buffer);
+	jb->buffer = NULL;
+}
+
+/**
+ * Drop all buffered packets and the playout reference point. */
+void a2dp_jbuf_reset(
+		struct a2dp_jbuf *jb) {
+	memset(jb->packet_len, 0, sizeof(jb->packet_len));
+	jb->count = 0;
+	jb->synced = false;
+	jb->last_valid = false;
+	a2dp_jbuf_drift_restart(jb);
+}
+
+/**
+ * Put received RTP packet into the jitter buffer.
+ *
+ * @param jb Pointer to the initialized jitter buffer structure.
+ * @param now The arrival time of the packet.
+ * @param packet Address of the RTP packet.
+ * @param len The length of the RTP packet.
+ * @return If the packet has been buffered, this function returns 1. If the
+ *   packet has been dropped because it is a duplicate or its sequence number
+ *   precedes the current playout position, 0 is returned. On error, -1 is
+ *   returned and errno is set to indicate the error. */
+int a2dp_jbuf_put(
+		struct a2dp_jbuf *jb,
+		const struct timespec *now,
+		const void *packet,
+		size_t len) {
+
+	if (len < RTP_HEADER_LEN || len > jb->packet_size) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+
+	const rtp_header_t *rtp_header = packet;
+	const uint16_t seq = be16toh(rtp_header->seq_number);
+	const uint32_t ts = be32toh(rtp_header->timestamp);
+
+	jb->stats.received++;
+
+	if (!jb->synced) {
+		a2dp_jbuf_sync(jb, ts, timespec2usec(now) + jb->target);
+		jb->seq = seq;
+	}
+
+	const int16_t d = seq - jb->seq;
+
+	if (d < -A2DP_JBUF_SLOTS || d >= A2DP_JBUF_SLOTS) {
+		/* The sender has been restarted (sequence number jumped in either
+		 * direction) or we have lost so many packets, that it is not possible
+		 * to track them anymore. */
+		debug("RTP jitter buffer resync: %u != %u", seq, jb->seq);
+		a2dp_jbuf_reset(jb);
+		a2dp_jbuf_sync(jb, ts, timespec2usec(now) + jb->target);
+		jb->seq = seq;
+		jb->stats.resyncs++;
+	}
+	else if (d < 0) {
+		/* packet which precedes the playout position */
+		jb->stats.late++;
+		return 0;
+	}
+
+	a2dp_jbuf_drift_update(jb, ts, timespec2usec(now));
+
+	const size_t i = seq % A2DP_JBUF_SLOTS;
+	if (jb->packet_len[i] != 0)
+		/* the only possibility is a duplicated packet */
+		return 0;
+
+	memcpy(jb->buffer + i * jb->packet_size, packet, len);
+	jb->packet_len[i] = len;
+	jb->packet_seq[i] = seq;
+	jb->packet_ts[i] = ts;
+	jb->count++;
+
+	return 1;
+}
+
+/**
+ * Get the next RTP packet due for playout.
+ *
+ * If the expected packet is missing, but the playout time of some later
+ * packet has come, the missing packets are considered lost. If the packet
+ * is released after its playout time (buffer underrun), the playout point
+ * is moved, so the target buffer depth can be rebuilt.
+ *
+ * @param jb Pointer to the initialized jitter buffer structure.
+ * @param now The current time.
+ * @param packet Address where the pointer to the RTP packet will be stored.
+ *   The packet data is valid until the next call to a2dp_jbuf_put().
+ * @param lost Address where the number of lost packets preceding returned
+ *   packet will be stored.
+ * @return If there is a packet due for playout, this function returns its
+ *   length. Otherwise, 0 is returned. */
+ssize_t a2dp_jbuf_get(
+		struct a2dp_jbuf *jb,
+		const struct timespec *now,
+		const void **packet,
+		unsigned int *lost) {
+
+	*lost = 0;
+
+	int d;
+	if ((d = a2dp_jbuf_find(jb)) == -1)
+		return 0;
+
+	const uint16_t seq = jb->seq + d;
+	const size_t i = seq % A2DP_JBUF_SLOTS;
+	const uint32_t ts = jb->packet_ts[i];
+	const int64_t time = timespec2usec(now);
+	int64_t due = a2dp_jbuf_due(jb, ts);
+
+	if (time < due)
+		return 0;
+
+	if (time - due > A2DP_JBUF_LATE_TOLERANCE_USEC) {
+		debug("RTP jitter buffer underrun: %lld us", (long long)(time - due));
+		a2dp_jbuf_sync(jb, ts, time + jb->target);
+		a2dp_jbuf_drift_restart(jb);
+		jb->last_valid = false;
+		jb->stats.resyncs++;
+		if ((due = a2dp_jbuf_due(jb, ts)) > time)
+			return 0;
+	}
+
+	/* Calibrate RTP timestamp clock rate, so the playout will not drift
+	 * regardless of the timestamp units used by the remote device. */
+	if (d == 0 && jb->last_valid && jb->last_frames > 0) {
+		const unsigned int rate = (uint64_t)(uint32_t)(ts - jb->last_ts) *
+			jb->samplerate / jb->last_frames;
+		if (rate > 0 && (unsigned int)abs((int)(rate - jb->ts_rate)) > jb->ts_rate / 20) {
+			debug("RTP timestamp clock rate: %u -> %u", jb->ts_rate, rate);
+			a2dp_jbuf_sync(jb, ts, due);
+			a2dp_jbuf_drift_restart(jb);
+			jb->ts_rate = rate;
+		}
+	}
+
+	/* Estimate the duration of lost packets, so the decoder can fill the
+	 * gap and the playback timing will be preserved. */
+	jb->lost_frames = 0;
+	if (d > 0 && jb->last_valid) {
+		const uint64_t gap = (uint64_t)(uint32_t)(ts - jb->last_ts) *
+			jb->samplerate / jb->ts_rate;
+		if (gap > jb->last_frames)
+			jb->lost_frames = MIN(gap - jb->last_frames, jb->samplerate);
+	}
+
+	*packet = jb->buffer + i * jb->packet_size;
+	const size_t len = jb->packet_len[i];
+
+	jb->packet_len[i] = 0;
+	jb->count--;
+	jb->seq = seq + 1;
+
+	jb->last_valid = true;
+	jb->last_ts = ts;
+	jb->last_frames = 0;
+
+	jb->stats.lost += d;
+	*lost = d;
+
+	return len;
+}
+
+/**
+ * Report the number of PCM frames decoded from the last released packet.
+ *
+ * This information is used for the RTP timestamp clock rate calibration. */
+void a2dp_jbuf_played(
+		struct a2dp_jbuf *jb,
+		unsigned int frames) {
+	jb->last_frames += frames;
+}
+
+/**
+ * Get the number of PCM frames lost before the last released packet.
+ *
+ * The value is estimated from the RTP timestamps, so it is available only
+ * if the packet preceding the gap has been released and the number of its
+ * PCM frames has been reported. The estimation is limited to one second. */
+unsigned int a2dp_jbuf_get_lost_frames(
+		const struct a2dp_jbuf *jb) {
+	return jb->lost_frames;
+}
+
+/**
+ * Get the estimated remote clock rate relative to the local clock.
+ *
+ * @return The ratio of the remote clock rate to the local monotonic clock
+ *   rate, e.g. 1.0001 if the remote clock is 100 ppm faster. */
+double a2dp_jbuf_get_drift(
+		const struct a2dp_jbuf *jb) {
+	return jb->drift;
+}
+
+/**
+ * Get the time until the next packet is due for playout.
+ *
+ * @return The timeout in milliseconds suitable for the poll() call. If the
+ *   buffer is empty, -1 is returned. */
+int a2dp_jbuf_timeout(
+		const struct a2dp_jbuf *jb,
+		const struct timespec *now) {
+
+	int d;
+	if ((d = a2dp_jbuf_find(jb)) == -1)
+		return -1;
+
+	const uint16_t seq = jb->seq + d;
+	const int64_t due = a2dp_jbuf_due(jb, jb->packet_ts[seq % A2DP_JBUF_SLOTS]);
+	const int64_t time = timespec2usec(now);
+
+	if (due <= time)
+		return 0;
+	return (due - time + 999) / 1000;
+}
+
+/**
+ * Get the jitter buffer fill level.
+ *
+ * @return The duration of the buffered audio in microseconds. */
+unsigned int a2dp_jbuf_get_fill_usec(
+		const struct a2dp_jbuf *jb) {
+
+	int d;
+	if ((d = a2dp_jbuf_find(jb)) == -1)
+		return 0;
+
+	const uint32_t ts_first = jb->packet_ts[(uint16_t)(jb->seq + d) % A2DP_JBUF_SLOTS];
+	uint32_t ts_last = ts_first;
+
+	for (unsigned int i = d + 1; i < A2DP_JBUF_SLOTS; i++) {
+		const uint16_t seq = jb->seq + i;
+		const size_t ii = seq % A2DP_JBUF_SLOTS;
+		if (jb->packet_len[ii] != 0 && jb->packet_seq[ii] == seq)
+			ts_last = jb->packet_ts[ii];
+	}
+
+	/* account the duration of the last packet as well */
+	const uint64_t frames = (uint64_t)(uint32_t)(ts_last - ts_first) *
+		jb->samplerate / jb->ts_rate + jb->last_frames;
+	return frames * 1000000 / jb->samplerate;
+}
@@ -0,0 +1,138 @@
+/*
+ * BlueALSA - a2dp-jbuf.h
+ * Copyright (c) 2016-2020 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#ifndef BLUEALSA_A2DPJBUF_H_
+#define BLUEALSA_A2DPJBUF_H_
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+/* number of RTP packets which can be buffered */
+#define A2DP_JBUF_SLOTS 256
+
+/**
+ * RTP jitter buffer of the A2DP sink IO thread.
+ *
+ * Received RTP packets are ordered by the sequence number and released for
+ * decoding when their playout time - derived from the RTP timestamp and the
+ * target buffer depth - has come. */
+struct a2dp_jbuf {
+
+	/* packet slots indexed by the sequence number */
+	uint8_t *buffer;
+	size_t packet_size;
+	size_t packet_len[A2DP_JBUF_SLOTS];
+	uint16_t packet_seq[A2DP_JBUF_SLOTS];
+	uint32_t packet_ts[A2DP_JBUF_SLOTS];
+	/* the number of buffered packets */
+	unsigned int count;
+
+	/* PCM sampling frequency */
+	unsigned int samplerate;
+	/* target buffer depth in microseconds */
+	unsigned int target;
+
+	/* The RTP timestamp clock rate. Initially it is assumed that timestamps
+	 * are incremented by the number of PCM frames, but the rate is updated
+	 * based on the number of frames reported by the decoder. */
+	unsigned int ts_rate;
+
+	/* playout reference point */
+	bool synced;
+	uint16_t seq;
+	uint32_t ref_ts;
+	int64_t ref_time;
+
+	/* the last released packet used for the clock rate calibration */
+	bool last_valid;
+	uint32_t last_ts;
+	unsigned int last_frames;
+	/* duration of the gap preceding the last released packet */
+	unsigned int lost_frames;
+
+	/* The remote clock rate relative to the local monotonic clock. It is
+	 * estimated from the time which packets spend in the buffer, and used
+	 * for the playout time calculation. */
+	double drift;
+	/* the remote clock frequency offset estimation */
+	double drift_freq;
+
+	struct {
+		bool started;
+		/* number of completed estimation windows */
+		unsigned int windows;
+		/* start time of the current window */
+		int64_t start;
+		/* the lowest buffering delay within the current window */
+		int64_t delay_min;
+		/* the lowest buffering delay within the previous window */
+		int64_t delay_prev;
+		/* the lowest buffering delay within the first window */
+		int64_t delay_ref;
+	} de;
+
+	struct {
+		unsigned int received;
+		unsigned int late;
+		unsigned int lost;
+		unsigned int resyncs;
+	} stats;
+
+};
+
+int a2dp_jbuf_init(
+		struct a2dp_jbuf *jb,
+		size_t packet_size,
+		unsigned int samplerate,
+		unsigned int target_ms);
+
+void a2dp_jbuf_free(
+		struct a2dp_jbuf *jb);
+
+void a2dp_jbuf_reset(
+		struct a2dp_jbuf *jb);
+
+int a2dp_jbuf_put(
+		struct a2dp_jbuf *jb,
+		const struct timespec *now,
+		const void *packet,
+		size_t len);
+
+ssize_t a2dp_jbuf_get(
+		struct a2dp_jbuf *jb,
+		const struct timespec *now,
+		const void **packet,
+		unsigned int *lost);
+
+void a2dp_jbuf_played(
+		struct a2dp_jbuf *jb,
+		unsigned int frames);
+
+int a2dp_jbuf_timeout(
+		const struct a2dp_jbuf *jb,
+		const struct timespec *now);
+
+unsigned int a2dp_jbuf_get_fill_usec(
+		const struct a2dp_jbuf *jb);
+
+unsigned int a2dp_jbuf_get_lost_frames(
+		const struct a2dp_jbuf *jb);
+
+double a2dp_jbuf_get_drift(
+		const struct a2dp_jbuf *jb);
+
+#endif
@@ -0,0 +1,493 @@
+/*
+ * BlueALSA - a2dp-sender.c
+ * Copyright (c) 2016-2020 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#include "a2dp-sender.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "shared/defs.h"
+#include "shared/log.h"
+#include "shared/rt.h"
+
+/**
+ * Remove the oldest packet from the queue. */
+static void a2dp_sender_pop(struct a2dp_sender *sender) {
+	const size_t len = sender->packet_len[sender->tail % A2DP_SENDER_QUEUE_SIZE];
+	__atomic_fetch_sub(&sender->queued, len, __ATOMIC_RELAXED);
+	__atomic_store_n(&sender->tail, sender->tail + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Wait for an event with thread cancellation enabled. */
+static void a2dp_sender_poll(struct pollfd *pfd) {
+	int oldstate;
+	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &oldstate);
+	poll(pfd, 1, -1);
+	pthread_setcancelstate(oldstate, NULL);
+}
+
+/**
+ * Get the time at which the queued packet shall be written.
+ *
+ * @param sender Pointer to the sender structure.
+ * @param n The free-running counter of the queued packet.
+ * @param delay Packet holding time in microseconds.
+ * @param ts Address where the due time will be stored. */
+static void a2dp_sender_packet_due(const struct a2dp_sender *sender,
+		unsigned int n, unsigned int delay, struct timespec *ts) {
+	*ts = sender->packet_ts[n % A2DP_SENDER_QUEUE_SIZE];
+	ts->tv_sec += delay / 1000000;
+	ts->tv_nsec += (delay % 1000000) * 1000;
+	if (ts->tv_nsec >= 1000000000) {
+		ts->tv_nsec -= 1000000000;
+		ts->tv_sec++;
+	}
+}
+
+/**
+ * Hold the oldest packet in the queue until it is due.
+ *
+ * The clock_nanosleep() is a cancellation point, so the thread can be
+ * cancelled while waiting. */
+static void a2dp_sender_hold(struct a2dp_sender *sender) {
+
+	const unsigned int delay = __atomic_load_n(&sender->delay, __ATOMIC_RELAXED);
+	if (delay == 0)
+		return;
+
+	struct timespec ts;
+	a2dp_sender_packet_due(sender, sender->tail, delay, &ts);
+
+	int oldstate;
+	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &oldstate);
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		continue;
+	pthread_setcancelstate(oldstate, NULL);
+
+}
+
+/**
+ * BT sender thread.
+ *
+ * This thread writes queued packets to the BT socket. It is paced by the
+ * socket writability, so it is the only place which blocks when the BT
+ * link is congested. If the congestion persists, the oldest packets are
+ * dropped in order to keep the audio latency bounded. */
+static void *a2dp_sender_thread(struct a2dp_sender *sender) {
+
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+	struct pollfd pfd_event = { sender->event_fd, POLLIN, 0 };
+	struct pollfd pfd_bt = { sender->bt_fd, POLLOUT, 0 };
+	bool congested = false;
+
+	for (;;) {
+
+		const unsigned int head = __atomic_load_n(&sender->head, __ATOMIC_ACQUIRE);
+		unsigned int queued = head - sender->tail;
+
+		if (queued == 0) {
+			eventfd_t tmp;
+			a2dp_sender_poll(&pfd_event);
+			eventfd_read(sender->event_fd, &tmp);
+			continue;
+		}
+
+		if (congested && queued > A2DP_SENDER_QUEUE_SIZE / 2) {
+			warn("BT socket congested: Dropping %u packets",
+					queued - A2DP_SENDER_QUEUE_SIZE / 4);
+			for (; queued > A2DP_SENDER_QUEUE_SIZE / 4; queued--)
+				a2dp_sender_pop(sender);
+			__atomic_fetch_add(&sender->stalls, 1, __ATOMIC_RELAXED);
+		}
+
+		a2dp_sender_hold(sender);
+
+		const size_t i = sender->tail % A2DP_SENDER_QUEUE_SIZE;
+		const uint8_t *packet = sender->buffer + i * sender->packet_size;
+		int coutq;
+
+		if (ioctl(sender->bt_fd, TIOCOUTQ, &coutq) == -1)
+			warn("Couldn't get BT queued bytes: %s", strerror(errno));
+		else
+			__atomic_store_n(&sender->coutq,
+					abs(sender->bt_fd_coutq_init - coutq), __ATOMIC_RELAXED);
+
+		if (write(sender->bt_fd, packet, sender->packet_len[i]) == -1)
+			switch (errno) {
+			case EINTR:
+				continue;
+			case EAGAIN:
+				/* set coutq to some arbitrary big value */
+				__atomic_store_n(&sender->coutq, 1024 * 16, __ATOMIC_RELAXED);
+				__atomic_fetch_add(&sender->stalls, 1, __ATOMIC_RELAXED);
+				congested = true;
+				a2dp_sender_poll(&pfd_bt);
+				continue;
+			case ECONNRESET:
+			case ENOTCONN:
+				/* Report disconnection to the encoder and exit. Our job is done,
+				 * since there is no one to send packets to. */
+				__atomic_store_n(&sender->error, errno, __ATOMIC_RELEASE);
+				return NULL;
+			default:
+				error("BT socket write error: %s", strerror(errno));
+			}
+
+		congested = false;
+		a2dp_sender_pop(sender);
+
+	}
+
+	return NULL;
+}
+
+#if ENABLE_LIBURING
+/**
+ * BT sender thread based on the io_uring.
+ *
+ * The logic is the same as in the a2dp_sender_thread(), however all queued
+ * packets are submitted at once as a chain of linked writes from the
+ * registered queue buffer. Hence, when the encoder runs ahead of the BT
+ * link, a batch of packets costs a single system call instead of the ioctl
+ * and write pair per packet. */
+static void *a2dp_sender_thread_uring(struct a2dp_sender *sender) {
+
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+	struct pollfd pfd_event = { sender->event_fd, POLLIN, 0 };
+	struct pollfd pfd_ring = { sender->ring.ring_fd, POLLIN, 0 };
+	struct pollfd pfd_bt = { sender->bt_fd, POLLOUT, 0 };
+	bool congested = false;
+
+	for (;;) {
+
+		const unsigned int head = __atomic_load_n(&sender->head, __ATOMIC_ACQUIRE);
+		unsigned int queued = head - sender->tail;
+
+		if (queued == 0) {
+			eventfd_t tmp;
+			a2dp_sender_poll(&pfd_event);
+			eventfd_read(sender->event_fd, &tmp);
+			continue;
+		}
+
+		if (congested && queued > A2DP_SENDER_QUEUE_SIZE / 2) {
+			warn("BT socket congested: Dropping %u packets",
+					queued - A2DP_SENDER_QUEUE_SIZE / 4);
+			for (; queued > A2DP_SENDER_QUEUE_SIZE / 4; queued--)
+				a2dp_sender_pop(sender);
+			__atomic_fetch_add(&sender->stalls, 1, __ATOMIC_RELAXED);
+		}
+
+		a2dp_sender_hold(sender);
+
+		int coutq;
+		if (ioctl(sender->bt_fd, TIOCOUTQ, &coutq) == -1)
+			warn("Couldn't get BT queued bytes: %s", strerror(errno));
+		else
+			__atomic_store_n(&sender->coutq,
+					abs(sender->bt_fd_coutq_init - coutq), __ATOMIC_RELAXED);
+
+		const unsigned int delay = __atomic_load_n(&sender->delay, __ATOMIC_RELAXED);
+		struct io_uring_sqe *sqe = NULL;
+		struct timespec now, due, tmp;
+		unsigned int n;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		for (n = 0; n < queued; n++) {
+			/* submit only packets which are already due */
+			if (delay > 0 && n > 0) {
+				a2dp_sender_packet_due(sender, sender->tail + n, delay, &due);
+				if (difftimespec(&now, &due, &tmp) > 0)
+					break;
+			}
+			const size_t i = (sender->tail + n) % A2DP_SENDER_QUEUE_SIZE;
+			sqe = io_uring_get_sqe(&sender->ring);
+			io_uring_prep_write_fixed(sqe, sender->bt_fd,
+					sender->buffer + i * sender->packet_size, sender->packet_len[i], 0, 0);
+			/* keep packets in order */
+			sqe->flags |= IOSQE_IO_LINK;
+		}
+
+		sqe->flags &= ~IOSQE_IO_LINK;
+
+		int ret;
+		if ((ret = io_uring_submit(&sender->ring)) < 0) {
+			error("Couldn't submit BT socket writes: %s", strerror(-ret));
+			__atomic_store_n(&sender->error, -ret, __ATOMIC_RELEASE);
+			return NULL;
+		}
+
+		/* Reap completions of the whole batch. Linked writes are completed
+		 * in the submission order, and once one of them fails, the remaining
+		 * ones are cancelled - they will be resubmitted in the next round. */
+		bool stalled = false;
+		while (n > 0) {
+
+			struct io_uring_cqe *cqe;
+			if (io_uring_peek_cqe(&sender->ring, &cqe) != 0) {
+				a2dp_sender_poll(&pfd_ring);
+				continue;
+			}
+
+			const int res = cqe->res;
+			io_uring_cqe_seen(&sender->ring, cqe);
+			n--;
+
+			if (res >= 0) {
+				congested = false;
+				a2dp_sender_pop(sender);
+				continue;
+			}
+
+			switch (-res) {
+			case ECANCELED:
+			case EINTR:
+				break;
+			case EAGAIN:
+				stalled = true;
+				break;
+			case ECONNRESET:
+			case ENOTCONN:
+				__atomic_store_n(&sender->error, -res, __ATOMIC_RELEASE);
+				return NULL;
+			default:
+				error("BT socket write error: %s", strerror(-res));
+				a2dp_sender_pop(sender);
+			}
+
+		}
+
+		if (stalled) {
+			/* set coutq to some arbitrary big value */
+			__atomic_store_n(&sender->coutq, 1024 * 16, __ATOMIC_RELAXED);
+			__atomic_fetch_add(&sender->stalls, 1, __ATOMIC_RELAXED);
+			congested = true;
+			a2dp_sender_poll(&pfd_bt);
+		}
+
+	}
+
+	return NULL;
+}
+
+/**
+ * Setup io_uring for the BT sender thread.
+ *
+ * @return On success this function returns 0. Otherwise, -1 is returned,
+ *   in which case the regular sender thread shall be used. */
+static int a2dp_sender_uring_init(struct a2dp_sender *sender) {
+
+	struct iovec iov = {
+		.iov_base = sender->buffer,
+		.iov_len = A2DP_SENDER_QUEUE_SIZE * sender->packet_size };
+	int ret;
+
+	if ((ret = io_uring_queue_init(A2DP_SENDER_QUEUE_SIZE, &sender->ring, 0)) < 0)
+		goto fail;
+
+	/* Registering the queue buffer saves page pinning on every write, but
+	 * it is subject to the RLIMIT_MEMLOCK limit. */
+	if ((ret = io_uring_register_buffers(&sender->ring, &iov, 1)) < 0) {
+		io_uring_queue_exit(&sender->ring);
+		goto fail;
+	}
+
+	sender->uring = true;
+	return 0;
+
+fail:
+	debug("Couldn't setup io_uring: %s", strerror(-ret));
+	return -1;
+}
+#endif
+
+/**
+ * Initialize A2DP sender and start the sender thread.
+ *
+ * @param sender Pointer to the sender structure.
+ * @param bt_fd BT socket file descriptor.
+ * @param bt_fd_coutq_init The initial COUTQ value of the BT socket.
+ * @param packet_size The maximal size of a single packet.
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int a2dp_sender_init(
+		struct a2dp_sender *sender,
+		int bt_fd,
+		int bt_fd_coutq_init,
+		size_t packet_size) {
+
+	int err;
+
+	memset(sender, 0, sizeof(*sender));
+	sender->bt_fd = bt_fd;
+	sender->bt_fd_coutq_init = bt_fd_coutq_init;
+	sender->packet_size = packet_size;
+	sender->event_fd = -1;
+
+	if ((sender->buffer = malloc(A2DP_SENDER_QUEUE_SIZE * packet_size)) == NULL)
+		goto fail;
+	if ((sender->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) == -1)
+		goto fail;
+
+	void *(*routine)(struct a2dp_sender *) = a2dp_sender_thread;
+#if ENABLE_LIBURING
+	if (a2dp_sender_uring_init(sender) == 0)
+		routine = a2dp_sender_thread_uring;
+#endif
+
+	if ((err = pthread_create(&sender->thread, NULL,
+					PTHREAD_ROUTINE(routine), sender)) != 0) {
+		errno = err;
+		goto fail;
+	}
+
+	pthread_setname_np(sender->thread, "ba-a2dp-send");
+	return 0;
+
+fail:
+	err = errno;
+#if ENABLE_LIBURING
+	if (sender->uring)
+		io_uring_queue_exit(&sender->ring);
+	sender->uring = false;
+#endif
+	if (sender->event_fd != -1)
+		close(sender->event_fd);
+	free(sender->buffer);
+	sender->buffer = NULL;
+	errno = err;
+	return -1;
+}
+
+/**
+ * Stop the sender thread and release resources.
+ *
+ * Packets which are still in the queue are discarded. It is safe to call
+ * this function on a zero-initialized or already freed structure. */
+void a2dp_sender_free(
+		struct a2dp_sender *sender) {
+
+	if (sender->buffer == NULL)
+		return;
+
+	pthread_cancel(sender->thread);
+	pthread_join(sender->thread, NULL);
+
+#if ENABLE_LIBURING
+	/* tear down the ring before releasing the registered buffer */
+	if (sender->uring)
+		io_uring_queue_exit(&sender->ring);
+	sender->uring = false;
+#endif
+
+	close(sender->event_fd);
+	free(sender->buffer);
+	sender->buffer = NULL;
+
+}
+
+/**
+ * Queue packet for sending via the BT socket.
+ *
+ * This function never blocks. If the queue is full, given packet is
+ * dropped - in such case the BT link is congested anyway.
+ *
+ * @param sender Pointer to the initialized sender structure.
+ * @param buffer Address of the packet data.
+ * @param len The length of the packet.
+ * @param coutq Address where the number of bytes waiting for the
+ *   transmission will be stored. This value accounts both the BT socket
+ *   queue and our own packet queue. This parameter might be NULL.
+ * @return On success this function returns the number of queued bytes.
+ *   Otherwise, -1 is returned and errno is set to indicate the error. If
+ *   the BT socket has been disconnected, errno is set accordingly. */
+ssize_t a2dp_sender_send(
+		struct a2dp_sender *sender,
+		const void *buffer,
+		size_t len,
+		int *coutq) {
+
+	int err;
+	if ((err = __atomic_load_n(&sender->error, __ATOMIC_ACQUIRE)) != 0) {
+		errno = err;
+		return -1;
+	}
+
+	if (len > sender->packet_size) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+
+	const unsigned int head = sender->head;
+	if (head - __atomic_load_n(&sender->tail, __ATOMIC_ACQUIRE) >= A2DP_SENDER_QUEUE_SIZE) {
+		debug("BT sender queue overflow: Dropping packet: %zu", len);
+		__atomic_fetch_add(&sender->stalls, 1, __ATOMIC_RELAXED);
+		goto final;
+	}
+
+	const size_t i = head % A2DP_SENDER_QUEUE_SIZE;
+	memcpy(sender->buffer + i * sender->packet_size, buffer, len);
+	sender->packet_len[i] = len;
+	clock_gettime(CLOCK_MONOTONIC, &sender->packet_ts[i]);
+
+	__atomic_fetch_add(&sender->queued, len, __ATOMIC_RELAXED);
+	__atomic_store_n(&sender->head, head + 1, __ATOMIC_RELEASE);
+	eventfd_write(sender->event_fd, 1);
+
+final:
+	if (coutq != NULL)
+		*coutq = __atomic_load_n(&sender->coutq, __ATOMIC_RELAXED) +
+			__atomic_load_n(&sender->queued, __ATOMIC_RELAXED);
+	return len;
+}
+
+/**
+ * Set the packet holding time.
+ *
+ * The new holding time applies to all packets which are still in the
+ * queue, so the change takes effect immediately.
+ *
+ * @param sender Pointer to the initialized sender structure.
+ * @param delay The holding time in microseconds. */
+void a2dp_sender_set_delay(
+		struct a2dp_sender *sender,
+		unsigned int delay) {
+	__atomic_store_n(&sender->delay, delay, __ATOMIC_RELAXED);
+}
+
+/**
+ * Get the number of bytes waiting in the BT socket.
+ *
+ * Contrary to the value returned by the a2dp_sender_send(), this value
+ * does not account packets held in our own queue. */
+int a2dp_sender_get_coutq(
+		const struct a2dp_sender *sender) {
+	return __atomic_load_n(&sender->coutq, __ATOMIC_RELAXED);
+}
+
+/**
+ * Get the number of BT write stalls.
+ *
+ * The returned value is a free-running counter, which is incremented every
+ * time the BT socket write would block or a packet has to be dropped. In
+ * order to detect new stalls, compare it with the previously read value. */
+unsigned int a2dp_sender_get_stalls(
+		const struct a2dp_sender *sender) {
+	return __atomic_load_n(&sender->stalls, __ATOMIC_RELAXED);
+}
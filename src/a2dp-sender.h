@@ -0,0 +1,108 @@
+/*
+ * BlueALSA - a2dp-sender.h
+ * Copyright (c) 2016-2020 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#ifndef BLUEALSA_A2DPSENDER_H_
+#define BLUEALSA_A2DPSENDER_H_
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+#if ENABLE_LIBURING
+# include <liburing.h>
+#endif
+
+/* number of packets which can be queued */
+#define A2DP_SENDER_QUEUE_SIZE 32
+
+/**
+ * BT sender stage of the A2DP source IO thread.
+ *
+ * Encoded RTP packets are passed from the encoder to the sender thread via
+ * the single-producer/single-consumer queue, so the BT socket congestion
+ * will not stall the PCM reading. */
+struct a2dp_sender {
+
+	/* BT socket and its initial COUTQ value */
+	int bt_fd;
+	int bt_fd_coutq_init;
+
+	/* packet slots of the queue */
+	uint8_t *buffer;
+	size_t packet_size;
+	size_t packet_len[A2DP_SENDER_QUEUE_SIZE];
+	/* monotonic time of the packet queuing */
+	struct timespec packet_ts[A2DP_SENDER_QUEUE_SIZE];
+
+	/* Time in microseconds for which every packet is held in the queue
+	 * before it is written to the BT socket. It is used for the playback
+	 * synchronization of multiple devices. */
+	unsigned int delay;
+
+	/* Free-running packet counters. The head is modified by the encoder
+	 * (producer) only, the tail by the sender (consumer) only. */
+	unsigned int head;
+	unsigned int tail;
+
+	/* the number of bytes waiting in the queue */
+	size_t queued;
+	/* the number of bytes waiting in the BT socket */
+	int coutq;
+	/* sticky socket error reported by the sender thread */
+	int error;
+	/* free-running counter of write stalls and packet drops */
+	unsigned int stalls;
+
+	/* new packet notification */
+	int event_fd;
+
+	pthread_t thread;
+
+#if ENABLE_LIBURING
+	/* ring with the queue buffer registered as the fixed buffer */
+	struct io_uring ring;
+	bool uring;
+#endif
+
+};
+
+int a2dp_sender_init(
+		struct a2dp_sender *sender,
+		int bt_fd,
+		int bt_fd_coutq_init,
+		size_t packet_size);
+
+void a2dp_sender_free(
+		struct a2dp_sender *sender);
+
+ssize_t a2dp_sender_send(
+		struct a2dp_sender *sender,
+		const void *buffer,
+		size_t len,
+		int *coutq);
+
+void a2dp_sender_set_delay(
+		struct a2dp_sender *sender,
+		unsigned int delay);
+
+int a2dp_sender_get_coutq(
+		const struct a2dp_sender *sender);
+
+unsigned int a2dp_sender_get_stalls(
+		const struct a2dp_sender *sender);
+
+#endif
@@ -560,6 +560,8 @@ static const struct a2dp_codec a2dp_codec_sink_ldac = {
 static const struct a2dp_codec a2dp_codec_source_usac = {
 	.dir = A2DP_SOURCE,
 	.codec_id = A2DP_CODEC_MPEGD,
+	/* FDK AAC library does not provide USAC encoder */
+	.encoded_only = true,
 	.capabilities = &a2dp_usac,
 	.capabilities_size = sizeof(a2dp_usac),
 	.channels[0] = a2dp_usac_channels,
@@ -592,9 +594,15 @@ const struct a2dp_codec *a2dp_codecs[] = {
 #endif
 #if ENABLE_APTX_HD
 	&a2dp_codec_source_aptx_hd,
+# if HAVE_APTX_HD_DECODE
+	&a2dp_codec_sink_aptx_hd,
+# endif
 #endif
 #if ENABLE_APTX
 	&a2dp_codec_source_aptx,
+# if HAVE_APTX_DECODE
+	&a2dp_codec_sink_aptx,
+# endif
 #endif
 #if ENABLE_FASTSTREAM
 	&a2dp_codec_source_faststream,
@@ -628,11 +636,24 @@ const struct a2dp_codec *a2dp_codec_lookup(uint16_t codec_id, enum a2dp_dir dir)
 	size_t i;
 	for (i = 0; i < ARRAYSIZE(a2dp_codecs) - 1; i++)
 		if (a2dp_codecs[i]->dir == dir &&
-				a2dp_codecs[i]->codec_id == codec_id)
+				a2dp_codecs[i]->codec_id == codec_id &&
+				a2dp_codec_is_usable(a2dp_codecs[i]))
 			return a2dp_codecs[i];
 	return NULL;
 }
 
+/**
+ * Check whether codec can be used with the current configuration.
+ *
+ * @param codec Address of the codec configuration structure.
+ * @return This function returns true if the IO thread for the codec can be
+ *   created, hence its stream end-point might be registered in BlueZ. */
+bool a2dp_codec_is_usable(const struct a2dp_codec *codec) {
+	if (codec->encoded_only)
+		return config.a2dp.skip_encoding;
+	return true;
+}
+
 /**
  * Get A2DP 16-bit vendor codec ID - BlueALSA extension.
  *
@@ -58,6 +58,9 @@ struct a2dp_codec {
 	uint16_t codec_id;
 	/* support for A2DP back-channel */
 	bool backchannel;
+	/* there is no encoder, so the codec can be used for streaming
+	 * pre-encoded audio (with the encoding skipped) only */
+	bool encoded_only;
 	/* capabilities configuration element */
 	const void *capabilities;
 	size_t capabilities_size;
@@ -90,6 +93,9 @@ const struct a2dp_codec *a2dp_codec_lookup(
 		uint16_t codec_id,
 		enum a2dp_dir dir);
 
+bool a2dp_codec_is_usable(
+		const struct a2dp_codec *codec);
+
 uint16_t a2dp_get_vendor_codec_id(
 		const void *capabilities,
 		size_t size);
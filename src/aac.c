@@ -0,0 +1,100 @@
+/*
+ * BlueALSA - aac.c
+ * Copyright (c) 2016-2020 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#include "aac.h"
+
+#if ENABLE_AAC
+
+#include <stdbool.h>
+#include <glib.h>
+
+#include "shared/log.h"
+
+/**
+ * Initialize AAC adaptive bit rate controller.
+ *
+ * @param abr Address of the ABR structure.
+ * @param param Encoder parameter controlled by the ABR.
+ * @param value_min The lowest allowed value.
+ * @param value_max The target (negotiated) value.
+ * @param step The adjustment step. */
+void aac_abr_init(struct aac_abr *abr, AACENC_PARAM param,
+		unsigned int value_min, unsigned int value_max, unsigned int step) {
+	abr->param = param;
+	abr->value = value_max;
+	abr->value_min = MIN(value_min, value_max);
+	abr->value_max = value_max;
+	abr->step = step;
+	abr->stalls = 0;
+	abr->holdoff = 0;
+	abr->drained = 0;
+}
+
+/**
+ * Update AAC encoder bit rate based on the BT link state.
+ *
+ * The link is considered congested when the BT write stalled since the last
+ * update or when on average more than two packets are waiting for the
+ * transmission. In such case the value is lowered by one step. When the
+ * queue is (almost) empty for four full history periods, the value is
+ * raised by one step. After every adjustment, the controller waits until
+ * the whole history is refreshed.
+ *
+ * @param abr Address of the initialized ABR structure.
+ * @param coutq The history of the queued bytes.
+ * @param coutq_len The number of elements in the history.
+ * @param packet_size The size of a single BT packet (writing MTU).
+ * @param stalls The current value of the sender stall counter.
+ * @return If the controlled value has been changed, this function returns 1.
+ *   Otherwise, 0 is returned. */
+int aac_abr_update(struct aac_abr *abr, const int *coutq, size_t coutq_len,
+		size_t packet_size, unsigned int stalls) {
+
+	const bool stalled = stalls != abr->stalls;
+	abr->stalls = stalls;
+
+	if (abr->holdoff > 0) {
+		abr->holdoff--;
+		return 0;
+	}
+
+	size_t i;
+	unsigned long sum = 0;
+	for (i = 0; i < coutq_len; i++)
+		sum += coutq[i];
+
+	const unsigned int value = abr->value;
+	const size_t avg = sum / coutq_len;
+
+	if (stalled || avg > 2 * packet_size) {
+		abr->value = value > abr->value_min + abr->step ?
+			value - abr->step : abr->value_min;
+		abr->drained = 0;
+	}
+	else if (avg < packet_size / 2) {
+		if (++abr->drained >= 4 * coutq_len) {
+			abr->value = MIN(value + abr->step, abr->value_max);
+			abr->drained = 0;
+		}
+	}
+	else
+		abr->drained = 0;
+
+	if (abr->value == value)
+		return 0;
+
+	abr->holdoff = coutq_len;
+	info("AAC %s adjusted: %u -> %u (queued bytes: %zu, stalled: %s)",
+			abr->param == AACENC_BITRATE ? "bitrate" : "VBR mode",
+			value, abr->value, avg, stalled ? "yes" : "no");
+	return 1;
+}
+
+#endif
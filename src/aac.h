@@ -0,0 +1,56 @@
+/*
+ * BlueALSA - aac.h
+ * Copyright (c) 2016-2020 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#ifndef BLUEALSA_AAC_H_
+#define BLUEALSA_AAC_H_
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#if ENABLE_AAC
+
+#include <stddef.h>
+#include <fdk-aac/aacenc_lib.h>
+
+/* the range of the bit rate which can be used by the AAC encoder */
+#define AAC_BITRATE_MIN 8000
+#define AAC_BITRATE_MAX 320000
+
+/**
+ * AAC adaptive bit rate controller.
+ *
+ * Depending on the encoder mode, the controlled value is either the CBR
+ * bit rate or the VBR mode of the FDK AAC encoder. */
+struct aac_abr {
+	/* encoder parameter being controlled */
+	AACENC_PARAM param;
+	/* current value and its allowed range */
+	unsigned int value;
+	unsigned int value_min;
+	unsigned int value_max;
+	/* adjustment step */
+	unsigned int step;
+	/* the last seen value of the sender stall counter */
+	unsigned int stalls;
+	/* number of updates to skip before the next adjustment */
+	unsigned int holdoff;
+	/* number of consecutive updates with drained link */
+	unsigned int drained;
+};
+
+void aac_abr_init(struct aac_abr *abr, AACENC_PARAM param,
+		unsigned int value_min, unsigned int value_max, unsigned int step);
+int aac_abr_update(struct aac_abr *abr, const int *coutq, size_t coutq_len,
+		size_t packet_size, unsigned int stalls);
+
+#endif
+
+#endif
@@ -37,6 +37,7 @@
 #include "shared/defs.h"
 #include "shared/log.h"
 #include "shared/rt.h"
+#include "shared/shm-ring.h"
 
 #define BA_PAUSE_STATE_RUNNING 0
 #define BA_PAUSE_STATE_PAUSED  (1 << 0)
@@ -57,6 +58,12 @@ struct bluealsa_pcm {
 	int ba_pcm_fd;
 	int ba_pcm_ctrl_fd;
 
+	/* Shared memory ring buffer used for the PCM transfer. If the ring is
+	 * in use, the PCM FIFO file descriptor is the data notification
+	 * eventfd owned by the ring. */
+	struct shm_ring ba_pcm_shm;
+	bool ba_pcm_shm_enabled;
+
 	/* event file descriptor */
 	int event_fd;
 
@@ -127,6 +134,12 @@ static snd_pcm_uframes_t snd_pcm_ioplug_hw_avail(const snd_pcm_ioplug_t * const
 static int close_transport(struct bluealsa_pcm *pcm) {
 	int rv = 0;
 	pthread_mutex_lock(&pcm->mutex);
+	if (pcm->ba_pcm_shm_enabled) {
+		shm_ring_close(&pcm->ba_pcm_shm);
+		shm_ring_free(&pcm->ba_pcm_shm);
+		pcm->ba_pcm_shm_enabled = false;
+		pcm->ba_pcm_fd = -1;
+	}
 	if (pcm->ba_pcm_fd != -1) {
 		rv |= close(pcm->ba_pcm_fd);
 		pcm->ba_pcm_fd = -1;
@@ -155,7 +168,13 @@ static void io_thread_update_delay(struct bluealsa_pcm *pcm,
 	unsigned int nread = 0;
 
 	gettimestamp(&now);
-	ioctl(pcm->ba_pcm_fd, FIONREAD, &nread);
+	if (pcm->ba_pcm_shm_enabled) {
+		ssize_t avail;
+		if ((avail = shm_ring_avail_read(&pcm->ba_pcm_shm)) != -1)
+			nread = avail;
+	}
+	else
+		ioctl(pcm->ba_pcm_fd, FIONREAD, &nread);
 
 	pthread_mutex_lock(&pcm->mutex);
 
@@ -177,6 +196,120 @@ static void io_thread_update_delay(struct bluealsa_pcm *pcm,
 
 }
 
+/**
+ * Wait for the shared memory ring notification.
+ *
+ * If the server terminates abruptly, the ring is never marked as closed
+ * and none of the ring eventfds is signaled. In order not to block forever,
+ * the control socket is monitored as well. Hang-up on the control socket
+ * closes the ring on our side. */
+static void io_thread_poll_shm(struct bluealsa_pcm *pcm, int fd) {
+
+	struct pollfd pfds[2] = {
+		{ fd, POLLIN, 0 },
+		{ pcm->ba_pcm_ctrl_fd, POLLRDHUP, 0 }};
+
+	if (poll(pfds, ARRAYSIZE(pfds), -1) == -1)
+		return;
+
+	if (pfds[1].revents & (POLLRDHUP | POLLHUP | POLLERR | POLLNVAL)) {
+		debug2("PCM control socket disconnected");
+		shm_ring_close(&pcm->ba_pcm_shm);
+	}
+
+}
+
+/**
+ * Read data from the shared memory ring buffer.
+ *
+ * This function blocks until all requested data is read.
+ *
+ * @return On success this function returns the number of bytes read. If
+ *   the ring has been closed or the server has disconnected, 0 is returned. If the ring is
+ *   corrupted, -1 is returned and errno is set to EBADMSG. */
+static ssize_t io_thread_read_shm(struct bluealsa_pcm *pcm, void *buffer, size_t len) {
+
+	struct shm_ring *shm = &pcm->ba_pcm_shm;
+	uint8_t *head = buffer;
+	size_t total = len;
+	bool waiting = false;
+
+	while (len != 0) {
+
+		ssize_t ret;
+		if ((ret = shm_ring_read(shm, head, len)) == -1)
+			return -1;
+		if (ret == 0) {
+			if (shm_ring_is_closed(shm))
+				return 0;
+			/* The server signals the eventfd only when the ring becomes
+			 * non-empty. Consume pending notification and check the ring
+			 * once more, so the wake-up generated in the meantime will not
+			 * be lost. Wait only if the ring is still empty. */
+			if (!waiting) {
+				eventfd_t tmp;
+				eventfd_read(shm->fd_data, &tmp);
+				waiting = true;
+				continue;
+			}
+			io_thread_poll_shm(pcm, shm->fd_data);
+			waiting = false;
+			continue;
+		}
+
+		head += ret;
+		len -= ret;
+	}
+
+	return total;
+}
+
+/**
+ * Write data to the shared memory ring buffer.
+ *
+ * This function blocks until all given data is written.
+ *
+ * @return On success this function returns the number of bytes written.
+ *   If the ring has been closed or the server has disconnected, -1 is
+ *   returned and errno is set to EPIPE. If the ring is corrupted, -1 is returned and errno is
+ *   set to EBADMSG. */
+static ssize_t io_thread_write_shm(struct bluealsa_pcm *pcm, const void *buffer, size_t len) {
+
+	struct shm_ring *shm = &pcm->ba_pcm_shm;
+	const uint8_t *head = buffer;
+	size_t total = len;
+	bool waiting = false;
+
+	while (len != 0) {
+
+		if (shm_ring_is_closed(shm)) {
+			errno = EPIPE;
+			return -1;
+		}
+
+		ssize_t ret;
+		if ((ret = shm_ring_write(shm, head, len)) == -1)
+			return -1;
+		if (ret == 0) {
+			/* consume pending notification - see the read function */
+			if (!waiting) {
+				eventfd_t tmp;
+				eventfd_read(shm->fd_space, &tmp);
+				waiting = true;
+				continue;
+			}
+			io_thread_poll_shm(pcm, shm->fd_space);
+			waiting = false;
+			continue;
+		}
+
+		head += ret;
+		len -= ret;
+	}
+
+	return total;
+}
+
 /**
  * IO thread, which facilitates ring buffer. */
 static void *io_thread(snd_pcm_ioplug_t *io) {
@@ -286,7 +419,13 @@ static void *io_thread(snd_pcm_ioplug_t *io) {
 
 			/* Read the whole period "atomically". This will assure, that frames
 			 * are not fragmented, so the pointer can be correctly updated. */
-			while (len != 0 && (ret = read(pcm->ba_pcm_fd, head, len)) != 0) {
+			if (pcm->ba_pcm_shm_enabled) {
+				if ((ret = io_thread_read_shm(pcm, head, len)) == -1) {
+					SNDERR("PCM shared memory read error: %s", strerror(errno));
+					goto fail;
+				}
+			}
+			else while (len != 0 && (ret = read(pcm->ba_pcm_fd, head, len)) != 0) {
 				if (ret == -1) {
 					if (errno == EINTR)
 						continue;
@@ -306,7 +445,14 @@ static void *io_thread(snd_pcm_ioplug_t *io) {
 		else {
 
 			/* Perform atomic write - see the explanation above. */
-			do {
+			if (pcm->ba_pcm_shm_enabled) {
+				if (io_thread_write_shm(pcm, head, len) == -1) {
+					if (errno != EPIPE)
+						SNDERR("PCM shared memory write error: %s", strerror(errno));
+					goto fail;
+				}
+			}
+			else do {
 				if ((ret = write(pcm->ba_pcm_fd, head, len)) == -1) {
 					if (errno == EINTR)
 						continue;
@@ -445,6 +591,37 @@ static int bluealsa_hw_params(snd_pcm_ioplug_t *io, snd_pcm_hw_params_t *params)
 	pcm->frame_size = (snd_pcm_format_physical_width(io->format) * io->channels) / 8;
 
 	DBusError err = DBUS_ERROR_INIT;
+	int fd_shm, fd_shm_data, fd_shm_space;
+
+	/* Try to use the shared memory transport first. It saves the read() and
+	 * write() system calls per transferred chunk of data, the eventfd is used
+	 * only when the ring becomes empty or full. Data is still copied between
+	 * the ring and the ALSA buffer. If the server does not support it, or we
+	 * are not able to attach the shared memory, fall back to the PIPE. */
+	if (bluealsa_dbus_open_pcm_shm(&pcm->dbus_ctx, pcm->ba_pcm.pcm_path,
+				&fd_shm, &fd_shm_data, &fd_shm_space, &pcm->ba_pcm_ctrl_fd, &err)) {
+		if (shm_ring_attach(&pcm->ba_pcm_shm, fd_shm, fd_shm_data, fd_shm_space) == 0) {
+			pcm->ba_pcm_shm_enabled = true;
+			pcm->ba_pcm_fd = pcm->ba_pcm_shm.fd_data;
+			pcm->delay_fifo_size = pcm->ba_pcm_shm.size / pcm->frame_size;
+			goto final;
+		}
+		debug2("Couldn't attach shared memory: %s", strerror(errno));
+		/* Closing the control socket releases the PCM on the server side,
+		 * so it can be opened again with the PIPE transport. The server
+		 * releases the PCM upon the Open() call if the hang-up has not
+		 * been processed yet, so there is no need to wait for that. */
+		close(fd_shm);
+		close(fd_shm_data);
+		close(fd_shm_space);
+		close(pcm->ba_pcm_ctrl_fd);
+		pcm->ba_pcm_ctrl_fd = -1;
+	}
+	else {
+		debug2("Couldn't open shared memory PCM: %s", err.message);
+		dbus_error_free(&err);
+	}
+
 	if (!bluealsa_dbus_open_pcm(&pcm->dbus_ctx, pcm->ba_pcm.pcm_path,
 				&pcm->ba_pcm_fd, &pcm->ba_pcm_ctrl_fd, &err)) {
 		debug2("Couldn't open PCM: %s", err.message);
@@ -463,6 +640,7 @@ static int bluealsa_hw_params(snd_pcm_ioplug_t *io, snd_pcm_hw_params_t *params)
 	else
 		pcm->delay_fifo_size = fcntl(pcm->ba_pcm_fd, F_GETPIPE_SZ)  / pcm->frame_size;
 
+final:
 	debug2("FIFO buffer size: %zd frames", pcm->delay_fifo_size);
 
 	/* ALSA default for avail min is one period. */
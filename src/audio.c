@@ -12,11 +12,452 @@
 
 #include <endian.h>
 #include <math.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <string.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+# include <immintrin.h>
+# define AUDIO_KERNELS_X86 1
+#endif
+#if defined(__ARM_NEON) && defined(__aarch64__)
+# include <arm_neon.h>
+# define AUDIO_KERNELS_NEON 1
+#endif
+
 #include <glib.h>
 
+/**
+ * Set of the low-level PCM processing kernels.
+ *
+ * Scaling kernels operate on interleaved samples, where samples with
+ * even index are scaled by the first factor and samples with odd index
+ * are scaled by the second one. Masking kernel applies the bitwise AND
+ * operation on 32-bit words in the same interleaved manner. Scaling is
+ * done in the fixed-point arithmetic and the result is truncated towards
+ * zero, the same way as the integer division does.
+ *
+ * Deinterleaving kernels split stereo frames into separate 32-bit channel
+ * buffers (16-bit samples are sign-extended). Packing kernel stores the
+ * lower 24 bits of every 32-bit word in the big-endian byte order. */
+struct audio_kernels {
+	const char *name;
+	void (*scale_s16_q15)(int16_t *buffer, size_t samples, int16_t ch1, int16_t ch2);
+	void (*scale_s32_q31)(int32_t *buffer, size_t samples, int32_t ch1, int32_t ch2);
+	void (*mask_u32)(uint32_t *buffer, size_t words, uint32_t ch1, uint32_t ch2);
+	void (*deinterleave_s16)(const int16_t *buffer, size_t frames, int32_t *ch1, int32_t *ch2);
+	void (*deinterleave_s32)(const int32_t *buffer, size_t frames, int32_t *ch1, int32_t *ch2);
+	void (*pack_u24be)(const uint32_t *buffer, size_t words, uint8_t *output);
+};
+
+/**
+ * Multiply sample by the Q15 gain, truncating the result towards zero. */
+static inline int16_t audio_mul_q15(int16_t sample, int16_t gain) {
+	const int32_t v = (int32_t)sample * gain;
+	return (v + ((v >> 31) & 0x7FFF)) >> 15;
+}
+
+/**
+ * Multiply sample by the Q31 gain, truncating the result towards zero. */
+static inline int32_t audio_mul_q31(int32_t sample, int32_t gain) {
+	const int64_t v = (int64_t)sample * gain;
+	return (v + ((v >> 63) & 0x7FFFFFFF)) >> 31;
+}
+
+static void audio_scale_s16_q15_generic(int16_t *buffer, size_t samples, int16_t ch1, int16_t ch2) {
+	for (size_t i = 0; i + 1 < samples; i += 2) {
+		buffer[i] = audio_mul_q15(buffer[i], ch1);
+		buffer[i + 1] = audio_mul_q15(buffer[i + 1], ch2);
+	}
+	if (samples % 2)
+		buffer[samples - 1] = audio_mul_q15(buffer[samples - 1], ch1);
+}
+
+static void audio_scale_s32_q31_generic(int32_t *buffer, size_t samples, int32_t ch1, int32_t ch2) {
+	for (size_t i = 0; i + 1 < samples; i += 2) {
+		buffer[i] = audio_mul_q31(buffer[i], ch1);
+		buffer[i + 1] = audio_mul_q31(buffer[i + 1], ch2);
+	}
+	if (samples % 2)
+		buffer[samples - 1] = audio_mul_q31(buffer[samples - 1], ch1);
+}
+
+static void audio_mask_u32_generic(uint32_t *buffer, size_t words, uint32_t ch1, uint32_t ch2) {
+	for (size_t i = 0; i + 1 < words; i += 2) {
+		buffer[i] &= ch1;
+		buffer[i + 1] &= ch2;
+	}
+	if (words % 2)
+		buffer[words - 1] &= ch1;
+}
+
+static void audio_deinterleave_s16_generic(const int16_t *buffer, size_t frames,
+		int32_t *ch1, int32_t *ch2) {
+	for (size_t i = 0; i < frames; i++) {
+		ch1[i] = buffer[i * 2];
+		ch2[i] = buffer[i * 2 + 1];
+	}
+}
+
+static void audio_deinterleave_s32_generic(const int32_t *buffer, size_t frames,
+		int32_t *ch1, int32_t *ch2) {
+	for (size_t i = 0; i < frames; i++) {
+		ch1[i] = buffer[i * 2];
+		ch2[i] = buffer[i * 2 + 1];
+	}
+}
+
+static void audio_pack_u24be_generic(const uint32_t *buffer, size_t words, uint8_t *output) {
+	for (size_t i = 0; i < words; i++) {
+		output[i * 3 + 0] = buffer[i] >> 16;
+		output[i * 3 + 1] = buffer[i] >> 8;
+		output[i * 3 + 2] = buffer[i];
+	}
+}
+
+static const struct audio_kernels audio_kernels_generic = {
+	.name = "generic",
+	.scale_s16_q15 = audio_scale_s16_q15_generic,
+	.scale_s32_q31 = audio_scale_s32_q31_generic,
+	.mask_u32 = audio_mask_u32_generic,
+	.deinterleave_s16 = audio_deinterleave_s16_generic,
+	.deinterleave_s32 = audio_deinterleave_s32_generic,
+	.pack_u24be = audio_pack_u24be_generic,
+};
+
+#if AUDIO_KERNELS_X86
+
+/* All SIMD kernels are bit-exact with the generic code. */
+
+__attribute__ ((target("sse2")))
+static void audio_scale_s16_q15_sse2(int16_t *buffer, size_t samples, int16_t ch1, int16_t ch2) {
+	const __m128i gain = _mm_set_epi16(ch2, ch1, ch2, ch1, ch2, ch1, ch2, ch1);
+	const __m128i bias = _mm_set1_epi32(0x7FFF);
+	size_t i;
+	for (i = 0; i + 8 <= samples; i += 8) {
+		__m128i v = _mm_loadu_si128((__m128i *)&buffer[i]);
+		__m128i plo = _mm_mullo_epi16(v, gain);
+		__m128i phi = _mm_mulhi_epi16(v, gain);
+		__m128i lo = _mm_unpacklo_epi16(plo, phi);
+		__m128i hi = _mm_unpackhi_epi16(plo, phi);
+		/* round negative products towards zero */
+		lo = _mm_add_epi32(lo, _mm_and_si128(_mm_srai_epi32(lo, 31), bias));
+		hi = _mm_add_epi32(hi, _mm_and_si128(_mm_srai_epi32(hi, 31), bias));
+		lo = _mm_srai_epi32(lo, 15);
+		hi = _mm_srai_epi32(hi, 15);
+		_mm_storeu_si128((__m128i *)&buffer[i], _mm_packs_epi32(lo, hi));
+	}
+	audio_scale_s16_q15_generic(&buffer[i], samples - i, ch1, ch2);
+}
+
+__attribute__ ((target("sse2")))
+static void audio_scale_s32_q31_sse2(int32_t *buffer, size_t samples, int32_t ch1, int32_t ch2) {
+	const __m128i gain1 = _mm_set1_epi32(ch1);
+	const __m128i gain2 = _mm_set1_epi32(ch2);
+	const __m128i bias = _mm_set_epi32(0, 0x7FFFFFFF, 0, 0x7FFFFFFF);
+	const __m128i mask = _mm_set_epi32(0, -1, 0, -1);
+	size_t i;
+	for (i = 0; i + 4 <= samples; i += 4) {
+		__m128i v = _mm_loadu_si128((__m128i *)&buffer[i]);
+		__m128i v_odd = _mm_srli_epi64(v, 32);
+		__m128i sign_even = _mm_srai_epi32(v, 31);
+		__m128i sign_odd = _mm_srai_epi32(v_odd, 31);
+		/* SSE2 has the unsigned widening multiplication only, so the high
+		 * part of the product has to be corrected for negative samples
+		 * (gain is never negative) */
+		__m128i even = _mm_sub_epi64(_mm_mul_epu32(v, gain1),
+				_mm_slli_epi64(_mm_and_si128(sign_even, gain1), 32));
+		__m128i odd = _mm_sub_epi64(_mm_mul_epu32(v_odd, gain2),
+				_mm_slli_epi64(_mm_and_si128(sign_odd, gain2), 32));
+		/* round negative products towards zero */
+		even = _mm_add_epi64(even, _mm_and_si128(sign_even, bias));
+		odd = _mm_add_epi64(odd, _mm_and_si128(sign_odd, bias));
+		/* only low 32 bits of shifted 64-bit products are stored */
+		even = _mm_and_si128(_mm_srli_epi64(even, 31), mask);
+		odd = _mm_slli_epi64(_mm_srli_epi64(odd, 31), 32);
+		_mm_storeu_si128((__m128i *)&buffer[i], _mm_or_si128(even, odd));
+	}
+	audio_scale_s32_q31_generic(&buffer[i], samples - i, ch1, ch2);
+}
+
+__attribute__ ((target("sse2")))
+static void audio_mask_u32_sse2(uint32_t *buffer, size_t words, uint32_t ch1, uint32_t ch2) {
+	const __m128i mask = _mm_set_epi32(ch2, ch1, ch2, ch1);
+	size_t i;
+	for (i = 0; i + 4 <= words; i += 4) {
+		__m128i v = _mm_loadu_si128((__m128i *)&buffer[i]);
+		_mm_storeu_si128((__m128i *)&buffer[i], _mm_and_si128(v, mask));
+	}
+	audio_mask_u32_generic(&buffer[i], words - i, ch1, ch2);
+}
+
+__attribute__ ((target("sse2")))
+static void audio_deinterleave_s16_sse2(const int16_t *buffer, size_t frames,
+		int32_t *ch1, int32_t *ch2) {
+	size_t i;
+	for (i = 0; i + 4 <= frames; i += 4) {
+		__m128i v = _mm_loadu_si128((__m128i *)&buffer[i * 2]);
+		_mm_storeu_si128((__m128i *)&ch1[i], _mm_srai_epi32(_mm_slli_epi32(v, 16), 16));
+		_mm_storeu_si128((__m128i *)&ch2[i], _mm_srai_epi32(v, 16));
+	}
+	audio_deinterleave_s16_generic(&buffer[i * 2], frames - i, &ch1[i], &ch2[i]);
+}
+
+__attribute__ ((target("sse2")))
+static void audio_deinterleave_s32_sse2(const int32_t *buffer, size_t frames,
+		int32_t *ch1, int32_t *ch2) {
+	size_t i;
+	for (i = 0; i + 4 <= frames; i += 4) {
+		__m128 lo = _mm_loadu_ps((float *)&buffer[i * 2]);
+		__m128 hi = _mm_loadu_ps((float *)&buffer[i * 2 + 4]);
+		_mm_storeu_ps((float *)&ch1[i], _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0)));
+		_mm_storeu_ps((float *)&ch2[i], _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1)));
+	}
+	audio_deinterleave_s32_generic(&buffer[i * 2], frames - i, &ch1[i], &ch2[i]);
+}
+
+static const struct audio_kernels audio_kernels_sse2 = {
+	.name = "sse2",
+	.scale_s16_q15 = audio_scale_s16_q15_sse2,
+	.scale_s32_q31 = audio_scale_s32_q31_sse2,
+	.mask_u32 = audio_mask_u32_sse2,
+	.deinterleave_s16 = audio_deinterleave_s16_sse2,
+	.deinterleave_s32 = audio_deinterleave_s32_sse2,
+	/* SSE2 lacks byte shuffling */
+	.pack_u24be = audio_pack_u24be_generic,
+};
+
+__attribute__ ((target("avx2")))
+static void audio_scale_s16_q15_avx2(int16_t *buffer, size_t samples, int16_t ch1, int16_t ch2) {
+	const __m256i gain = _mm256_set_epi16(ch2, ch1, ch2, ch1, ch2, ch1, ch2, ch1,
+			ch2, ch1, ch2, ch1, ch2, ch1, ch2, ch1);
+	const __m256i bias = _mm256_set1_epi32(0x7FFF);
+	size_t i;
+	for (i = 0; i + 16 <= samples; i += 16) {
+		__m256i v = _mm256_loadu_si256((__m256i *)&buffer[i]);
+		__m256i plo = _mm256_mullo_epi16(v, gain);
+		__m256i phi = _mm256_mulhi_epi16(v, gain);
+		__m256i lo = _mm256_unpacklo_epi16(plo, phi);
+		__m256i hi = _mm256_unpackhi_epi16(plo, phi);
+		/* round negative products towards zero */
+		lo = _mm256_add_epi32(lo, _mm256_and_si256(_mm256_srai_epi32(lo, 31), bias));
+		hi = _mm256_add_epi32(hi, _mm256_and_si256(_mm256_srai_epi32(hi, 31), bias));
+		lo = _mm256_srai_epi32(lo, 15);
+		hi = _mm256_srai_epi32(hi, 15);
+		_mm256_storeu_si256((__m256i *)&buffer[i], _mm256_packs_epi32(lo, hi));
+	}
+	audio_scale_s16_q15_generic(&buffer[i], samples - i, ch1, ch2);
+}
+
+__attribute__ ((target("avx2")))
+static void audio_scale_s32_q31_avx2(int32_t *buffer, size_t samples, int32_t ch1, int32_t ch2) {
+	const __m256i gain1 = _mm256_set1_epi64x(ch1);
+	const __m256i gain2 = _mm256_set1_epi64x(ch2);
+	const __m256i bias = _mm256_set1_epi64x(0x7FFFFFFF);
+	size_t i;
+	for (i = 0; i + 8 <= samples; i += 8) {
+		__m256i v = _mm256_loadu_si256((__m256i *)&buffer[i]);
+		__m256i v_odd = _mm256_srli_epi64(v, 32);
+		/* gain is never negative, so the sign of the product is the sign
+		 * of the sample, which is used to round towards zero */
+		__m256i even = _mm256_add_epi64(_mm256_mul_epi32(v, gain1),
+				_mm256_and_si256(_mm256_srai_epi32(v, 31), bias));
+		__m256i odd = _mm256_add_epi64(_mm256_mul_epi32(v_odd, gain2),
+				_mm256_and_si256(_mm256_srai_epi32(v_odd, 31), bias));
+		/* only low 32 bits of shifted 64-bit products are stored */
+		even = _mm256_srli_epi64(even, 31);
+		odd = _mm256_srli_epi64(odd, 31);
+		v = _mm256_blend_epi32(even, _mm256_slli_epi64(odd, 32), 0xAA);
+		_mm256_storeu_si256((__m256i *)&buffer[i], v);
+	}
+	audio_scale_s32_q31_generic(&buffer[i], samples - i, ch1, ch2);
+}
+
+__attribute__ ((target("avx2")))
+static void audio_mask_u32_avx2(uint32_t *buffer, size_t words, uint32_t ch1, uint32_t ch2) {
+	const __m256i mask = _mm256_set_epi32(ch2, ch1, ch2, ch1, ch2, ch1, ch2, ch1);
+	size_t i;
+	for (i = 0; i + 8 <= words; i += 8) {
+		__m256i v = _mm256_loadu_si256((__m256i *)&buffer[i]);
+		_mm256_storeu_si256((__m256i *)&buffer[i], _mm256_and_si256(v, mask));
+	}
+	audio_mask_u32_generic(&buffer[i], words - i, ch1, ch2);
+}
+
+__attribute__ ((target("avx2")))
+static void audio_deinterleave_s16_avx2(const int16_t *buffer, size_t frames,
+		int32_t *ch1, int32_t *ch2) {
+	size_t i;
+	for (i = 0; i + 8 <= frames; i += 8) {
+		__m256i v = _mm256_loadu_si256((__m256i *)&buffer[i * 2]);
+		_mm256_storeu_si256((__m256i *)&ch1[i], _mm256_srai_epi32(_mm256_slli_epi32(v, 16), 16));
+		_mm256_storeu_si256((__m256i *)&ch2[i], _mm256_srai_epi32(v, 16));
+	}
+	audio_deinterleave_s16_generic(&buffer[i * 2], frames - i, &ch1[i], &ch2[i]);
+}
+
+__attribute__ ((target("avx2")))
+static void audio_deinterleave_s32_avx2(const int32_t *buffer, size_t frames,
+		int32_t *ch1, int32_t *ch2) {
+	size_t i;
+	for (i = 0; i + 8 <= frames; i += 8) {
+		__m256 lo = _mm256_loadu_ps((float *)&buffer[i * 2]);
+		__m256 hi = _mm256_loadu_ps((float *)&buffer[i * 2 + 8]);
+		/* in-lane shuffle leaves 64-bit pairs in the 0, 2, 1, 3 order */
+		__m256i v1 = _mm256_castps_si256(_mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0)));
+		__m256i v2 = _mm256_castps_si256(_mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1)));
+		_mm256_storeu_si256((__m256i *)&ch1[i], _mm256_permute4x64_epi64(v1, _MM_SHUFFLE(3, 1, 2, 0)));
+		_mm256_storeu_si256((__m256i *)&ch2[i], _mm256_permute4x64_epi64(v2, _MM_SHUFFLE(3, 1, 2, 0)));
+	}
+	audio_deinterleave_s32_generic(&buffer[i * 2], frames - i, &ch1[i], &ch2[i]);
+}
+
+__attribute__ ((target("avx2")))
+static void audio_pack_u24be_avx2(const uint32_t *buffer, size_t words, uint8_t *output) {
+	const __m128i shuffle = _mm_set_epi8(-1, -1, -1, -1,
+			12, 13, 14, 8, 9, 10, 4, 5, 6, 0, 1, 2);
+	size_t i;
+	/* Every store writes 4 bytes past the packed data, so the last
+	 * 2 words are always left for the generic code. */
+	for (i = 0; i + 6 <= words; i += 4) {
+		__m128i v = _mm_loadu_si128((__m128i *)&buffer[i]);
+		_mm_storeu_si128((__m128i *)&output[i * 3], _mm_shuffle_epi8(v, shuffle));
+	}
+	audio_pack_u24be_generic(&buffer[i], words - i, &output[i * 3]);
+}
+
+static const struct audio_kernels audio_kernels_avx2 = {
+	.name = "avx2",
+	.scale_s16_q15 = audio_scale_s16_q15_avx2,
+	.scale_s32_q31 = audio_scale_s32_q31_avx2,
+	.mask_u32 = audio_mask_u32_avx2,
+	.deinterleave_s16 = audio_deinterleave_s16_avx2,
+	.deinterleave_s32 = audio_deinterleave_s32_avx2,
+	.pack_u24be = audio_pack_u24be_avx2,
+};
+
+#endif
+
+#if AUDIO_KERNELS_NEON
+
+static void audio_scale_s16_q15_neon(int16_t *buffer, size_t samples, int16_t ch1, int16_t ch2) {
+	const int16x8_t gain = { ch1, ch2, ch1, ch2, ch1, ch2, ch1, ch2 };
+	const int32x4_t bias = vdupq_n_s32(0x7FFF);
+	size_t i;
+	for (i = 0; i + 8 <= samples; i += 8) {
+		int16x8_t v = vld1q_s16(&buffer[i]);
+		int32x4_t lo = vmull_s16(vget_low_s16(v), vget_low_s16(gain));
+		int32x4_t hi = vmull_high_s16(v, gain);
+		/* round negative products towards zero */
+		lo = vaddq_s32(lo, vandq_s32(vshrq_n_s32(lo, 31), bias));
+		hi = vaddq_s32(hi, vandq_s32(vshrq_n_s32(hi, 31), bias));
+		vst1q_s16(&buffer[i], vcombine_s16(vshrn_n_s32(lo, 15), vshrn_n_s32(hi, 15)));
+	}
+	audio_scale_s16_q15_generic(&buffer[i], samples - i, ch1, ch2);
+}
+
+static void audio_scale_s32_q31_neon(int32_t *buffer, size_t samples, int32_t ch1, int32_t ch2) {
+	const int32x4_t gain = { ch1, ch2, ch1, ch2 };
+	const int64x2_t bias = vdupq_n_s64(0x7FFFFFFF);
+	size_t i;
+	for (i = 0; i + 4 <= samples; i += 4) {
+		int32x4_t v = vld1q_s32(&buffer[i]);
+		int64x2_t lo = vmull_s32(vget_low_s32(v), vget_low_s32(gain));
+		int64x2_t hi = vmull_high_s32(v, gain);
+		/* round negative products towards zero */
+		lo = vaddq_s64(lo, vandq_s64(vshrq_n_s64(lo, 63), bias));
+		hi = vaddq_s64(hi, vandq_s64(vshrq_n_s64(hi, 63), bias));
+		vst1q_s32(&buffer[i], vcombine_s32(vshrn_n_s64(lo, 31), vshrn_n_s64(hi, 31)));
+	}
+	audio_scale_s32_q31_generic(&buffer[i], samples - i, ch1, ch2);
+}
+
+static void audio_mask_u32_neon(uint32_t *buffer, size_t words, uint32_t ch1, uint32_t ch2) {
+	const uint32x4_t mask = { ch1, ch2, ch1, ch2 };
+	size_t i;
+	for (i = 0; i + 4 <= words; i += 4)
+		vst1q_u32(&buffer[i], vandq_u32(vld1q_u32(&buffer[i]), mask));
+	audio_mask_u32_generic(&buffer[i], words - i, ch1, ch2);
+}
+
+static void audio_deinterleave_s16_neon(const int16_t *buffer, size_t frames,
+		int32_t *ch1, int32_t *ch2) {
+	size_t i;
+	for (i = 0; i + 4 <= frames; i += 4) {
+		int16x4x2_t v = vld2_s16(&buffer[i * 2]);
+		vst1q_s32(&ch1[i], vmovl_s16(v.val[0]));
+		vst1q_s32(&ch2[i], vmovl_s16(v.val[1]));
+	}
+	audio_deinterleave_s16_generic(&buffer[i * 2], frames - i, &ch1[i], &ch2[i]);
+}
+
+static void audio_deinterleave_s32_neon(const int32_t *buffer, size_t frames,
+		int32_t *ch1, int32_t *ch2) {
+	size_t i;
+	for (i = 0; i + 4 <= frames; i += 4) {
+		int32x4x2_t v = vld2q_s32(&buffer[i * 2]);
+		vst1q_s32(&ch1[i], v.val[0]);
+		vst1q_s32(&ch2[i], v.val[1]);
+	}
+	audio_deinterleave_s32_generic(&buffer[i * 2], frames - i, &ch1[i], &ch2[i]);
+}
+
+static void audio_pack_u24be_neon(const uint32_t *buffer, size_t words, uint8_t *output) {
+	const uint8x16_t shuffle = { 2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, 255, 255, 255, 255 };
+	size_t i;
+	/* Every store writes 4 bytes past the packed data, so the last
+	 * 2 words are always left for the generic code. */
+	for (i = 0; i + 6 <= words; i += 4) {
+		uint8x16_t v = vreinterpretq_u8_u32(vld1q_u32(&buffer[i]));
+		vst1q_u8(&output[i * 3], vqtbl1q_u8(v, shuffle));
+	}
+	audio_pack_u24be_generic(&buffer[i], words - i, &output[i * 3]);
+}
+
+static const struct audio_kernels audio_kernels_neon = {
+	.name = "neon",
+	.scale_s16_q15 = audio_scale_s16_q15_neon,
+	.scale_s32_q31 = audio_scale_s32_q31_neon,
+	.mask_u32 = audio_mask_u32_neon,
+	.deinterleave_s16 = audio_deinterleave_s16_neon,
+	.deinterleave_s32 = audio_deinterleave_s32_neon,
+	.pack_u24be = audio_pack_u24be_neon,
+};
+
+#endif
+
+static const struct audio_kernels *audio_kernels = &audio_kernels_generic;
+static pthread_once_t audio_kernels_once = PTHREAD_ONCE_INIT;
+
+static void audio_kernels_init(void) {
+#if AUDIO_KERNELS_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		audio_kernels = &audio_kernels_avx2;
+	else if (__builtin_cpu_supports("sse2"))
+		audio_kernels = &audio_kernels_sse2;
+#elif AUDIO_KERNELS_NEON
+	/* NEON is a mandatory part of the AArch64 architecture */
+	audio_kernels = &audio_kernels_neon;
+#endif
+}
+
+/**
+ * Get kernels best suited for the current CPU. */
+static const struct audio_kernels *audio_kernels_get(void) {
+	pthread_once(&audio_kernels_once, audio_kernels_init);
+	return audio_kernels;
+}
+
+/**
+ * Get the name of PCM processing kernels used on this CPU.
+ *
+ * @return This function returns the name of the kernel set which was
+ *   selected for the current CPU, e.g. "generic", "sse2", "avx2". */
+const char *audio_kernels_name(void) {
+	return audio_kernels_get()->name;
+}
+
 /**
  * Convert audio volume change in dB to loudness.
  *
@@ -38,31 +479,18 @@ double audio_loudness_to_decibel(double value) {
 }
 
 /**
- * Scale S16_2LE PCM signal.
- *
- * Neutral value for scaling factor is 1.0. It is possible to increase
- * signal gain by using scaling factor values greater than 1, however,
- * clipping will most certainly occur.
- *
- * @param buffer Address to the buffer where the PCM signal is stored.
- * @param channels The number of channels in the buffer.
- * @param frames The number of PCM frames in the buffer.
- * @param ch1 The scaling factor for 1st channel.
- * @param ch1 The scaling factor for 2nd channel. */
-void audio_scale_s16_2le(int16_t *buffer, int channels, size_t frames, double ch1, double ch2) {
-	audio_silence_s16_2le(buffer, channels, frames, ch1 == 0, ch2 == 0);
+ * Silence S16_2LE PCM signal. */
+void audio_silence_s16_2le(int16_t *buffer, int channels, size_t frames, bool ch1, bool ch2) {
 	switch (channels) {
 	case 1:
-		if (ch1 != 0 && ch1 != 1)
-			while (frames--)
-				buffer[frames] *= ch1;
+		if (ch1)
+			memset(buffer, 0, frames * sizeof(*buffer));
 		break;
 	case 2:
-		if ((ch1 != 0 && ch1 != 1) || (ch2 != 0 && ch2 != 1))
-			while (frames--) {
-				buffer[2 * frames] *= ch1;
-				buffer[2 * frames + 1] *= ch2;
-			}
+		if (ch1 || ch2) {
+			uint32_t mask = be32toh((ch1 ? 0 : 0xFFFF0000) | (ch2 ? 0 : 0xFFFF));
+			audio_kernels_get()->mask_u32((uint32_t *)buffer, frames, mask, mask);
+		}
 		break;
 	default:
 		g_assert_not_reached();
@@ -70,21 +498,19 @@ void audio_scale_s16_2le(int16_t *buffer, int channels, size_t frames, double ch
 }
 
 /**
- * Scale S32_4LE PCM signal. */
-void audio_scale_s32_4le(int32_t *buffer, int channels, size_t frames, double ch1, double ch2) {
-	audio_silence_s32_4le(buffer, channels, frames, ch1 == 0, ch2 == 0);
+ * Silence S32_4LE PCM signal. */
+void audio_silence_s32_4le(int32_t *buffer, int channels, size_t frames, bool ch1, bool ch2) {
 	switch (channels) {
 	case 1:
-		if (ch1 != 0 && ch1 != 1)
-			while (frames--)
-				buffer[frames] *= ch1;
+		if (ch1)
+			memset(buffer, 0, frames * sizeof(*buffer));
 		break;
 	case 2:
-		if ((ch1 != 0 && ch1 != 1) || (ch2 != 0 && ch2 != 1))
-			while (frames--) {
-				buffer[2 * frames] *= ch1;
-				buffer[2 * frames + 1] *= ch2;
-			}
+		if (ch1 || ch2) {
+			uint32_t mask_ch1 = ch1 ? 0 : 0xFFFFFFFF;
+			uint32_t mask_ch2 = ch2 ? 0 : 0xFFFFFFFF;
+			audio_kernels_get()->mask_u32((uint32_t *)buffer, frames * 2, mask_ch1, mask_ch2);
+		}
 		break;
 	default:
 		g_assert_not_reached();
@@ -92,44 +518,190 @@ void audio_scale_s32_4le(int32_t *buffer, int channels, size_t frames, double ch
 }
 
 /**
- * Silence S16_2LE PCM signal. */
-void audio_silence_s16_2le(int16_t *buffer, int channels, size_t frames, bool ch1, bool ch2) {
+ * Deinterleave S16_2LE stereo PCM signal.
+ *
+ * @param buffer Address to the buffer with interleaved stereo PCM frames.
+ * @param frames The number of PCM frames in the buffer.
+ * @param ch1 Address to the buffer for the sign-extended 1st channel.
+ * @param ch2 Address to the buffer for the sign-extended 2nd channel. */
+void audio_deinterleave_s16_2le(const int16_t *buffer, size_t frames,
+		int32_t *ch1, int32_t *ch2) {
+	audio_kernels_get()->deinterleave_s16(buffer, frames, ch1, ch2);
+}
+
+/**
+ * Deinterleave S32_4LE stereo PCM signal. */
+void audio_deinterleave_s32_4le(const int32_t *buffer, size_t frames,
+		int32_t *ch1, int32_t *ch2) {
+	audio_kernels_get()->deinterleave_s32(buffer, frames, ch1, ch2);
+}
+
+/**
+ * Pack 24-bit words in the big-endian byte order.
+ *
+ * @param buffer Address to the buffer with words stored in the lower
+ *   24 bits of 32-bit integers. The upper 8 bits are ignored.
+ * @param words The number of words in the buffer.
+ * @param output Address to the output buffer, which shall be at least
+ *   3 * words bytes long. */
+void audio_pack_u24be(const uint32_t *buffer, size_t words, uint8_t *output) {
+	audio_kernels_get()->pack_u24be(buffer, words, output);
+}
+
+/**
+ * Set the target value of the fixed-point gain.
+ *
+ * This function might be called from a thread other than the one which
+ * performs the scaling. The new gain will be reached gradually.
+ *
+ * @param gain The address to the gain structure.
+ * @param value The linear scaling factor. Values greater than 1.0 are
+ *   truncated to the unity gain. */
+void audio_gain_set(struct audio_gain *gain, double value) {
+	int32_t target = 0;
+	if (value >= 1.0)
+		target = AUDIO_GAIN_UNITY;
+	else if (value > 0)
+		target = lround(value * AUDIO_GAIN_UNITY);
+	__atomic_store_n(&gain->target, target, __ATOMIC_RELAXED);
+}
+
+/**
+ * Start new ramp if the target gain has changed.
+ *
+ * @return This function returns the number of frames which remain to be
+ *   processed with the per-frame gain change. */
+static size_t audio_gain_ramp_update(struct audio_gain *gain, unsigned int ramp) {
+	const int32_t target = __atomic_load_n(&gain->target, __ATOMIC_RELAXED);
+	if (target != gain->ramp_target) {
+		gain->ramp_target = target;
+		gain->ramp = ramp;
+		if (ramp > 0)
+			gain->step = ((int64_t)target - gain->current) / (int64_t)ramp;
+	}
+	if (gain->ramp == 0)
+		gain->current = gain->ramp_target;
+	return gain->ramp;
+}
+
+/**
+ * Apply the next gain value of the ongoing ramp to a single sample. */
+static int32_t audio_gain_ramp_next(struct audio_gain *gain, int32_t sample) {
+	if (gain->ramp > 0 && --gain->ramp > 0)
+		gain->current += gain->step;
+	else
+		gain->current = gain->ramp_target;
+	if (gain->current == AUDIO_GAIN_UNITY)
+		return sample;
+	return audio_mul_q31(sample, gain->current);
+}
+
+/**
+ * Scale S16_2LE PCM signal with the fixed-point gain.
+ *
+ * When the target gain changes, the gain applied to the signal follows
+ * it linearly over the given number of frames, so there are no audible
+ * clicks. Afterwards, the signal is scaled with the integer-only Q15
+ * arithmetic.
+ *
+ * @param buffer Address to the buffer where the PCM signal is stored.
+ * @param channels The number of channels in the buffer.
+ * @param frames The number of PCM frames in the buffer.
+ * @param ch1 The gain for 1st channel.
+ * @param ch2 The gain for 2nd channel.
+ * @param ramp The number of frames used for gain transition. */
+void audio_gain_scale_s16_2le(int16_t *buffer, int channels, size_t frames,
+		struct audio_gain *ch1, struct audio_gain *ch2, unsigned int ramp) {
+
+	size_t i;
+
 	switch (channels) {
 	case 1:
-		if (ch1)
-			memset(buffer, 0, frames * sizeof(*buffer));
+		for (i = 0; i < frames && audio_gain_ramp_update(ch1, ramp) > 0; i++, buffer++)
+			buffer[0] = audio_gain_ramp_next(ch1, buffer[0]);
+		ch2 = ch1;
 		break;
 	case 2:
-		if (ch1 || ch2) {
-			uint32_t mask = be32toh((ch1 ? 0 : 0xFFFF0000) | (ch2 ? 0 : 0xFFFF));
-			while (frames--)
-				((uint32_t *)buffer)[frames] &= mask;
+		for (i = 0; i < frames && (audio_gain_ramp_update(ch1, ramp) |
+					audio_gain_ramp_update(ch2, ramp)) > 0; i++, buffer += 2) {
+			buffer[0] = audio_gain_ramp_next(ch1, buffer[0]);
+			buffer[1] = audio_gain_ramp_next(ch2, buffer[1]);
 		}
 		break;
 	default:
 		g_assert_not_reached();
 	}
+
+	if ((frames -= i) == 0)
+		return;
+	if (ch1->current == AUDIO_GAIN_UNITY && ch2->current == AUDIO_GAIN_UNITY)
+		return;
+	if ((ch1->current == 0 || ch1->current == AUDIO_GAIN_UNITY) &&
+			(ch2->current == 0 || ch2->current == AUDIO_GAIN_UNITY)) {
+		audio_silence_s16_2le(buffer, channels, frames, ch1->current == 0, ch2->current == 0);
+		return;
+	}
+
+	/* Unity gain can not be represented in the Q15 format. In order to
+	 * keep such channel bit-transparent, scale the other one only. */
+	if (ch1->current == AUDIO_GAIN_UNITY || ch2->current == AUDIO_GAIN_UNITY) {
+		i = ch1->current == AUDIO_GAIN_UNITY ? 1 : 0;
+		const int16_t gain = (i == 0 ? ch1 : ch2)->current >> 16;
+		for (; i < frames * 2; i += 2)
+			buffer[i] = audio_mul_q15(buffer[i], gain);
+		return;
+	}
+
+	audio_kernels_get()->scale_s16_q15(buffer, frames * channels,
+			ch1->current >> 16, ch2->current >> 16);
+
 }
 
 /**
- * Silence S32_4LE PCM signal. */
-void audio_silence_s32_4le(int32_t *buffer, int channels, size_t frames, bool ch1, bool ch2) {
+ * Scale S32_4LE PCM signal with the fixed-point gain. */
+void audio_gain_scale_s32_4le(int32_t *buffer, int channels, size_t frames,
+		struct audio_gain *ch1, struct audio_gain *ch2, unsigned int ramp) {
+
+	size_t i;
+
 	switch (channels) {
 	case 1:
-		if (ch1)
-			memset(buffer, 0, frames * sizeof(*buffer));
+		for (i = 0; i < frames && audio_gain_ramp_update(ch1, ramp) > 0; i++, buffer++)
+			buffer[0] = audio_gain_ramp_next(ch1, buffer[0]);
+		ch2 = ch1;
 		break;
 	case 2:
-		if (ch1 || ch2) {
-			uint32_t mask_ch1 = ch1 ? 0 : 0xFFFFFFFF;
-			uint32_t mask_ch2 = ch2 ? 0 : 0xFFFFFFFF;
-			for (size_t i = 0; i < frames * 2; i += 2) {
-				buffer[i + 0] &= mask_ch1;
-				buffer[i + 1] &= mask_ch2;
-			}
+		for (i = 0; i < frames && (audio_gain_ramp_update(ch1, ramp) |
+					audio_gain_ramp_update(ch2, ramp)) > 0; i++, buffer += 2) {
+			buffer[0] = audio_gain_ramp_next(ch1, buffer[0]);
+			buffer[1] = audio_gain_ramp_next(ch2, buffer[1]);
 		}
 		break;
 	default:
 		g_assert_not_reached();
 	}
+
+	if ((frames -= i) == 0)
+		return;
+	if (ch1->current == AUDIO_GAIN_UNITY && ch2->current == AUDIO_GAIN_UNITY)
+		return;
+	if ((ch1->current == 0 || ch1->current == AUDIO_GAIN_UNITY) &&
+			(ch2->current == 0 || ch2->current == AUDIO_GAIN_UNITY)) {
+		audio_silence_s32_4le(buffer, channels, frames, ch1->current == 0, ch2->current == 0);
+		return;
+	}
+
+	/* Unity gain is applied as a pass-through, so it has to be skipped
+	 * explicitly for the channel which is not attenuated. */
+	if (ch1->current == AUDIO_GAIN_UNITY || ch2->current == AUDIO_GAIN_UNITY) {
+		i = ch1->current == AUDIO_GAIN_UNITY ? 1 : 0;
+		const int32_t gain = (i == 0 ? ch1 : ch2)->current;
+		for (; i < frames * 2; i += 2)
+			buffer[i] = audio_mul_q31(buffer[i], gain);
+		return;
+	}
+
+	audio_kernels_get()->scale_s32_q31(buffer, frames * channels,
+			ch1->current, ch2->current);
+
 }
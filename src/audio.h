@@ -19,15 +19,52 @@
 #include <stddef.h>
 #include <stdint.h>
 
+/* Q31 representation of the neutral gain. Strictly speaking, this value
+ * is slightly less than 1.0, however, it is treated as a pass-through. */
+#define AUDIO_GAIN_UNITY INT32_MAX
+
+/**
+ * Fixed-point gain with linear ramping. */
+struct audio_gain {
+	/* requested gain in the Q31 format */
+	int32_t target;
+	/* gain currently applied to the signal */
+	int32_t current;
+	/* state of the ongoing gain transition */
+	int32_t ramp_target;
+	int32_t step;
+	unsigned int ramp;
+};
+
+/**
+ * Initialize gain structure with the given Q31 value, skipping ramp. */
+#define audio_gain_init(g, v) do { \
+		(g)->target = (g)->current = (g)->ramp_target = (v); \
+		(g)->step = 0; (g)->ramp = 0; \
+	} while (0)
+
+const char *audio_kernels_name(void);
+
 double audio_decibel_to_loudness(double value);
 double audio_loudness_to_decibel(double value);
 
-void audio_scale_s16_2le(int16_t *buffer, int channels, size_t frames, double ch1, double ch2);
-void audio_scale_s32_4le(int32_t *buffer, int channels, size_t frames, double ch1, double ch2);
-#define audio_scale_s24_4le audio_scale_s32_4le
-
 void audio_silence_s16_2le(int16_t *buffer, int channels, size_t frames, bool ch1, bool ch2);
 void audio_silence_s32_4le(int32_t *buffer, int channels, size_t frames, bool ch1, bool ch2);
 #define audio_silence_s24_4le audio_silence_s32_4le
 
+void audio_deinterleave_s16_2le(const int16_t *buffer, size_t frames,
+		int32_t *ch1, int32_t *ch2);
+void audio_deinterleave_s32_4le(const int32_t *buffer, size_t frames,
+		int32_t *ch1, int32_t *ch2);
+#define audio_deinterleave_s24_4le audio_deinterleave_s32_4le
+
+void audio_pack_u24be(const uint32_t *buffer, size_t words, uint8_t *output);
+
+void audio_gain_set(struct audio_gain *gain, double value);
+void audio_gain_scale_s16_2le(int16_t *buffer, int channels, size_t frames,
+		struct audio_gain *ch1, struct audio_gain *ch2, unsigned int ramp);
+void audio_gain_scale_s32_4le(int32_t *buffer, int channels, size_t frames,
+		struct audio_gain *ch1, struct audio_gain *ch2, unsigned int ramp);
+#define audio_gain_scale_s24_4le audio_gain_scale_s32_4le
+
 #endif
@@ -365,6 +365,7 @@ static int rfcomm_handler_vgm_set_cb(struct ba_rfcomm *r, const struct bt_at *at
 	if (rfcomm_write_at(fd, AT_TYPE_RESP, NULL, "OK") == -1)
 		return -1;
 
+	ba_transport_pcm_volume_update_gain(&t_sco->sco.mic_pcm);
 	bluealsa_dbus_pcm_update(&t_sco->sco.mic_pcm, BA_DBUS_PCM_UPDATE_VOLUME);
 	return 0;
 }
@@ -377,6 +378,7 @@ static int rfcomm_handler_vgm_resp_cb(struct ba_rfcomm *r, const struct bt_at *a
 
 	t_sco->sco.mic_pcm.volume[0].level = ba_transport_pcm_volume_bt_to_level(
 			&t_sco->sco.mic_pcm, r->gain_mic = atoi(at->value));
+	ba_transport_pcm_volume_update_gain(&t_sco->sco.mic_pcm);
 	bluealsa_dbus_pcm_update(&t_sco->sco.mic_pcm, BA_DBUS_PCM_UPDATE_VOLUME);
 	return 0;
 }
@@ -397,6 +399,7 @@ static int rfcomm_handler_vgs_set_cb(struct ba_rfcomm *r, const struct bt_at *at
 	if (rfcomm_write_at(fd, AT_TYPE_RESP, NULL, "OK") == -1)
 		return -1;
 
+	ba_transport_pcm_volume_update_gain(&t_sco->sco.spk_pcm);
 	bluealsa_dbus_pcm_update(&t_sco->sco.spk_pcm, BA_DBUS_PCM_UPDATE_VOLUME);
 	return 0;
 }
@@ -409,6 +412,7 @@ static int rfcomm_handler_vgs_resp_cb(struct ba_rfcomm *r, const struct bt_at *a
 
 	t_sco->sco.spk_pcm.volume[0].level = ba_transport_pcm_volume_bt_to_level(
 			&t_sco->sco.spk_pcm, r->gain_spk = atoi(at->value));
+	ba_transport_pcm_volume_update_gain(&t_sco->sco.spk_pcm);
 	bluealsa_dbus_pcm_update(&t_sco->sco.spk_pcm, BA_DBUS_PCM_UPDATE_VOLUME);
 	return 0;
 }
@@ -11,6 +11,8 @@
 #include "ba-transport.h"
 
 #include <errno.h>
+#include <fcntl.h>
+#include <math.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
@@ -39,11 +41,16 @@
 #include "dbus.h"
 #include "hci.h"
 #include "hfp.h"
+#include "io-engine.h"
+#include "io-sched.h"
 #include "sco.h"
 #include "utils.h"
 #include "shared/defs.h"
 #include "shared/log.h"
 
+/* guards broadcast group fields of all A2DP transports */
+static pthread_mutex_t broadcast_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 static const char *transport_get_dbus_path_type(
 		struct ba_transport_type type) {
 	switch (type.profile) {
@@ -72,9 +79,14 @@ static int transport_pcm_init(
 	pcm->t = t;
 	pcm->mode = mode;
 	pcm->fd = -1;
+	pcm->ctrl_fd = -1;
+
+	audio_gain_init(&pcm->volume[0].gain, AUDIO_GAIN_UNITY);
+	audio_gain_init(&pcm->volume[1].gain, AUDIO_GAIN_UNITY);
 
 	pthread_mutex_init(&pcm->synced_mtx, NULL);
 	pthread_cond_init(&pcm->synced, NULL);
+	pthread_mutex_init(&pcm->shm_mtx, NULL);
 
 	pcm->ba_dbus_path = g_strdup_printf("%s/%s/%s",
 			t->d->ba_dbus_path, transport_get_dbus_path_type(t->type),
@@ -90,6 +102,7 @@ static void transport_pcm_destroy(
 
 	pthread_mutex_destroy(&pcm->synced_mtx);
 	pthread_cond_destroy(&pcm->synced);
+	pthread_mutex_destroy(&pcm->shm_mtx);
 
 	if (pcm->ba_dbus_path != NULL)
 		g_free(pcm->ba_dbus_path);
@@ -157,6 +170,7 @@ static int transport_acquire_bt_a2dp(struct ba_transport *t);
 static int transport_release_bt_a2dp(struct ba_transport *t);
 static int transport_acquire_bt_sco(struct ba_transport *t);
 static int transport_release_bt_sco(struct ba_transport *t);
+static void transport_broadcast_leave(struct ba_transport *t);
 
 struct ba_transport *ba_transport_new_a2dp(
 		struct ba_device *device,
@@ -286,6 +300,12 @@ struct ba_transport *ba_transport_ref(
  * Synchronous transport thread cancellation. */
 static void ba_transport_pthread_cancel(struct ba_transport *t) {
 
+	/* transport hosted by the IO engine has no dedicated thread */
+	if (t->io_task.worker != NULL) {
+		io_engine_task_cancel(&t->io_task);
+		return;
+	}
+
 	if (pthread_equal(t->thread, config.main_thread) ||
 			pthread_equal(t->thread, pthread_self()))
 		return;
@@ -318,6 +338,9 @@ void ba_transport_destroy(struct ba_transport *t) {
 		t->sco.rfcomm = NULL;
 	}
 
+	if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_A2DP)
+		transport_broadcast_leave(t);
+
 	/* If the transport is active, prior to releasing resources, we have to
 	 * terminate the IO thread (or at least make sure it is not running any
 	 * more). Not doing so might result in an undefined behavior or even a
@@ -500,6 +523,12 @@ static void transport_update_format(struct ba_transport *t) {
 			t->a2dp.pcm.format = BA_TRANSPORT_PCM_FORMAT_S24_4LE;
 			break;
 #endif
+#if ENABLE_FASTSTREAM
+		case A2DP_CODEC_VENDOR_FASTSTREAM:
+			t->a2dp.pcm.format = BA_TRANSPORT_PCM_FORMAT_S16_2LE;
+			t->a2dp.pcm_bc.format = BA_TRANSPORT_PCM_FORMAT_S16_2LE;
+			break;
+#endif
 #if ENABLE_LDAC
 		case A2DP_CODEC_VENDOR_LDAC:
 			/* LDAC library internally for encoding uses 31-bit, so
@@ -509,6 +538,32 @@ static void transport_update_format(struct ba_transport *t) {
 #endif
 		}
 
+	/* With the encoding skipped, PCM client provides already encoded audio
+	 * frames, which are only packetized into RTP payloads. */
+	if (t->type.profile & BA_TRANSPORT_PROFILE_A2DP_SOURCE &&
+			config.a2dp.skip_encoding)
+		switch (t->type.codec) {
+		case A2DP_CODEC_SBC:
+		case A2DP_CODEC_MPEG12:
+		case A2DP_CODEC_MPEG24:
+		case A2DP_CODEC_MPEGD:
+			t->a2dp.pcm.format = BA_TRANSPORT_PCM_FORMAT_ENCODED;
+			break;
+		}
+
+	/* With the decoding skipped, received frames are delivered to the PCM
+	 * client as they are, with the frame header prepended. */
+	if (t->type.profile & BA_TRANSPORT_PROFILE_A2DP_SINK &&
+			config.a2dp.skip_decoding)
+		switch (t->type.codec) {
+		case A2DP_CODEC_SBC:
+		case A2DP_CODEC_MPEG12:
+		case A2DP_CODEC_MPEG24:
+		case A2DP_CODEC_MPEGD:
+			t->a2dp.pcm.format = BA_TRANSPORT_PCM_FORMAT_ENCODED;
+			break;
+		}
+
 	if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_SCO) {
 		t->sco.spk_pcm.format = BA_TRANSPORT_PCM_FORMAT_S16_2LE;
 		t->sco.mic_pcm.format = BA_TRANSPORT_PCM_FORMAT_S16_2LE;
@@ -707,7 +762,13 @@ void ba_transport_set_codec(
 
 int ba_transport_start(struct ba_transport *t) {
 
-	if (!pthread_equal(t->thread, config.main_thread))
+	if (!pthread_equal(t->thread, config.main_thread) ||
+			t->io_task.worker != NULL)
+		return 0;
+
+	/* broadcast group member is served by the leader IO thread */
+	if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_A2DP &&
+			t->a2dp.broadcast.leader != NULL)
 		return 0;
 
 	debug("Starting transport: %s", ba_transport_type_to_string(t->type));
@@ -721,9 +782,222 @@ int ba_transport_start(struct ba_transport *t) {
 	return -1;
 }
 
+/**
+ * Notify the broadcast group leader about the member BT link change. */
+static void transport_broadcast_changed(struct ba_transport *t) {
+	pthread_mutex_lock(&broadcast_mutex);
+	if (t->a2dp.broadcast.leader != NULL)
+		t->a2dp.broadcast.leader->a2dp.broadcast.version++;
+	pthread_mutex_unlock(&broadcast_mutex);
+}
+
+/**
+ * Remove transport from the broadcast group.
+ *
+ * If the transport is the group leader, the group is dissolved. Otherwise,
+ * if it is a group member, it is removed from the leader members list. */
+static void transport_broadcast_leave(struct ba_transport *t) {
+
+	struct ba_transport *leader;
+	size_t i;
+
+	if (t->a2dp.broadcast.members_len > 0)
+		ba_transport_broadcast_set(t, NULL, 0);
+
+	pthread_mutex_lock(&broadcast_mutex);
+
+	if ((leader = t->a2dp.broadcast.leader) != NULL) {
+		for (i = 0; i < leader->a2dp.broadcast.members_len; i++)
+			if (leader->a2dp.broadcast.members[i] == t) {
+				memmove(&leader->a2dp.broadcast.members[i], &leader->a2dp.broadcast.members[i + 1],
+						(--leader->a2dp.broadcast.members_len - i) * sizeof(*leader->a2dp.broadcast.members));
+				break;
+			}
+		leader->a2dp.broadcast.version++;
+		t->a2dp.broadcast.leader = NULL;
+	}
+
+	pthread_mutex_unlock(&broadcast_mutex);
+
+	/* release reference taken by the group */
+	if (leader != NULL)
+		ba_transport_unref(t);
+
+}
+
+/**
+ * Set members of the A2DP broadcast group led by the given transport.
+ *
+ * The audio written to the leader PCM is encoded once and the RTP packets
+ * are sent to the leader and to all group members. Hence, all members shall
+ * use the same codec configuration as the leader. Transports which join the
+ * group are acquired right away, and the ones which leave it are released.
+ *
+ * @param t The A2DP source transport of the group leader.
+ * @param members Array with A2DP source transports of group members.
+ * @param len The number of members. If zero, the group is dissolved.
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int ba_transport_broadcast_set(
+		struct ba_transport *t,
+		struct ba_transport * const *members,
+		size_t len) {
+
+	struct ba_transport *joined[BA_TRANSPORT_BROADCAST_MEMBERS_MAX];
+	struct ba_transport *left[BA_TRANSPORT_BROADCAST_MEMBERS_MAX];
+	size_t joined_len = 0, left_len = 0;
+	size_t i, j;
+
+	if (t->type.profile != BA_TRANSPORT_PROFILE_A2DP_SOURCE ||
+			len > BA_TRANSPORT_BROADCAST_MEMBERS_MAX)
+		return errno = EINVAL, -1;
+
+	for (i = 0; i < len; i++) {
+		const struct ba_transport *m = members[i];
+		if (m == t || m->type.profile != BA_TRANSPORT_PROFILE_A2DP_SOURCE)
+			return errno = EINVAL, -1;
+		/* encoded stream has to be decodable by every member */
+		if (m->type.codec != t->type.codec ||
+				memcmp(m->a2dp.configuration, t->a2dp.configuration,
+					t->a2dp.codec->capabilities_size) != 0)
+			return errno = EINVAL, -1;
+		for (j = 0; j < i; j++)
+			if (members[j] == m)
+				return errno = EINVAL, -1;
+	}
+
+	pthread_mutex_lock(&broadcast_mutex);
+
+	if (t->a2dp.broadcast.leader != NULL)
+		goto busy;
+	for (i = 0; i < len; i++) {
+		const struct ba_transport *m = members[i];
+		if (m->a2dp.broadcast.members_len > 0 ||
+				(m->a2dp.broadcast.leader != NULL && m->a2dp.broadcast.leader != t) ||
+				(m->a2dp.broadcast.leader == NULL && m->a2dp.pcm.fd != -1))
+			goto busy;
+	}
+
+	/* Members which leave the group are removed from the members list right
+	 * away, so the leader IO thread will not use their BT links anymore. */
+	for (i = 0; i < t->a2dp.broadcast.members_len; i++) {
+		struct ba_transport *m = t->a2dp.broadcast.members[i];
+		for (j = 0; j < len; j++)
+			if (members[j] == m)
+				break;
+		if (j == len) {
+			m->a2dp.broadcast.leader = NULL;
+			left[left_len++] = m;
+		}
+	}
+
+	/* Members which join the group are added to the members list after the
+	 * acquisition, but they have to be marked as taken by this group now. */
+	t->a2dp.broadcast.members_len = 0;
+	for (i = 0; i < len; i++) {
+		struct ba_transport *m = members[i];
+		if (m->a2dp.broadcast.leader == t)
+			t->a2dp.broadcast.members[t->a2dp.broadcast.members_len++] = m;
+		else {
+			m->a2dp.broadcast.leader = t;
+			joined[joined_len++] = ba_transport_ref(m);
+		}
+	}
+
+	t->a2dp.broadcast.version++;
+	pthread_mutex_unlock(&broadcast_mutex);
+
+	/* BT links of members are acquired and released with the member
+	 * transport lock held, so the leader IO thread can safely duplicate
+	 * the BT socket in the ba_transport_broadcast_get_links(). */
+	for (i = 0; i < left_len; i++) {
+		debug("Leaving broadcast group: %s", left[i]->bluez_dbus_path);
+		pthread_mutex_lock(&left[i]->mutex);
+		left[i]->release(left[i]);
+		pthread_mutex_unlock(&left[i]->mutex);
+		ba_transport_unref(left[i]);
+	}
+
+	for (i = 0; i < joined_len; i++) {
+		debug("Joining broadcast group: %s", joined[i]->bluez_dbus_path);
+		pthread_mutex_lock(&joined[i]->mutex);
+		/* A member, which can not be acquired at the moment, stays in the
+		 * group. Its BT link might be established later by the BlueZ. */
+		if (joined[i]->acquire(joined[i]) == -1)
+			warn("Couldn't acquire broadcast group member: %s", joined[i]->bluez_dbus_path);
+		pthread_mutex_unlock(&joined[i]->mutex);
+	}
+
+	pthread_mutex_lock(&broadcast_mutex);
+	for (i = 0; i < joined_len; i++)
+		if (joined[i]->a2dp.broadcast.leader == t)
+			t->a2dp.broadcast.members[t->a2dp.broadcast.members_len++] = joined[i];
+	t->a2dp.broadcast.version++;
+	pthread_mutex_unlock(&broadcast_mutex);
+
+	return 0;
+
+busy:
+	pthread_mutex_unlock(&broadcast_mutex);
+	return errno = EBUSY, -1;
+}
+
+/**
+ * Get BT links of the broadcast group members.
+ *
+ * This function shall be called by the group leader IO thread. The BT socket
+ * of every returned link is duplicated, so the member transport might be
+ * released at any time without affecting the caller. The caller is
+ * responsible for closing returned sockets and for releasing references
+ * of returned member transports.
+ *
+ * @param t The A2DP source transport of the group leader.
+ * @param links Array with at least BA_TRANSPORT_BROADCAST_MEMBERS_MAX
+ *   elements, where the BT links will be stored.
+ * @param version Address where the group version will be stored.
+ * @return This function returns the number of stored links. */
+size_t ba_transport_broadcast_get_links(
+		struct ba_transport *t,
+		struct ba_transport_broadcast_link *links,
+		unsigned int *version) {
+
+	size_t i, len = 0;
+
+	pthread_mutex_lock(&broadcast_mutex);
+
+	*version = t->a2dp.broadcast.version;
+	for (i = 0; i < t->a2dp.broadcast.members_len; i++) {
+
+		struct ba_transport *m = t->a2dp.broadcast.members[i];
+		int fd = -1;
+
+		/* the member BT socket might be closed by the release
+		 * callback, which is called with the member lock held */
+		pthread_mutex_lock(&m->mutex);
+		if (m->bt_fd != -1 &&
+				(fd = fcntl(m->bt_fd, F_DUPFD_CLOEXEC, 0)) == -1)
+			warn("Couldn't duplicate BT socket: %s", strerror(errno));
+		links[len].bt_fd_coutq_init = m->a2dp.bt_fd_coutq_init;
+		links[len].mtu_write = m->mtu_write;
+		pthread_mutex_unlock(&m->mutex);
+
+		if (fd == -1)
+			continue;
+
+		links[len].t = ba_transport_ref(m);
+		links[len].bt_fd = fd;
+		len++;
+
+	}
+
+	pthread_mutex_unlock(&broadcast_mutex);
+	return len;
+}
+
 int ba_transport_set_a2dp_state(
 		struct ba_transport *t,
 		enum bluez_a2dp_transport_state state) {
+	transport_broadcast_changed(t);
 	switch (t->a2dp.state = state) {
 	case BLUEZ_A2DP_TRANSPORT_STATE_PENDING:
 		/* When transport is marked as pending, try to acquire transport, but only
@@ -764,10 +1038,33 @@ int ba_transport_pcm_volume_bt_to_level(
 	return MIN(MAX(level, -96.0), 96.0) * 100;
 }
 
+/**
+ * Update fixed-point gain according to the volume configuration.
+ *
+ * This function shall be called whenever the volume level, the mute switch
+ * or the software volume setting is changed. The IO thread will apply new
+ * gain with a short ramp. */
+void ba_transport_pcm_volume_update_gain(struct ba_transport_pcm *pcm) {
+	for (size_t i = 0; i < ARRAYSIZE(pcm->volume); i++) {
+		double value = 1.0;
+		/* In case of hardware volume control we will perform mute operation,
+		 * because hardware muting is an equivalent of gain=0 which with some
+		 * headsets does not entirely silence audio. */
+		if (pcm->volume[i].muted)
+			value = 0;
+		else if (pcm->soft_volume)
+			/* scaling based on the decibel formula pow(10, dB / 20) */
+			value = pow(10, (0.01 * pcm->volume[i].level) / 20);
+		audio_gain_set(&pcm->volume[i].gain, value);
+	}
+}
+
 int ba_transport_pcm_volume_update(struct ba_transport_pcm *pcm) {
 
 	const struct ba_transport *t = pcm->t;
 
+	ba_transport_pcm_volume_update_gain(pcm);
+
 	/* In case of A2DP Source or HSP/HFP Audio Gateway skip notifying Bluetooth
 	 * device if we are using software volume control. This will prevent volume
 	 * double scaling - firstly by us and then by Bluetooth headset/speaker. */
@@ -1030,13 +1327,82 @@ int ba_transport_pcm_release(struct ba_transport_pcm *pcm) {
 	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &oldstate);
 
 	debug("Closing PCM: %d", pcm->fd);
-	close(pcm->fd);
+
+	if (pcm->shm != NULL) {
+		/* The FIFO file descriptor is owned by the shared memory ring, so
+		 * it will be closed when freeing the ring. Before that, we have to
+		 * notify the client that the ring is no longer in use. */
+		pthread_mutex_lock(&pcm->shm_mtx);
+		shm_ring_close(pcm->shm);
+		shm_ring_free(pcm->shm);
+		free(pcm->shm);
+		pcm->shm = NULL;
+		pthread_mutex_unlock(&pcm->shm_mtx);
+	}
+	else
+		close(pcm->fd);
+
 	pcm->fd = -1;
+	pcm->ctrl_fd = -1;
 
 	pthread_setcancelstate(oldstate, NULL);
 	return 0;
 }
 
+/**
+ * Notify D-Bus clients about the IO thread scheduling change. */
+static void ba_transport_io_sched_update(struct ba_transport *t) {
+
+	struct ba_transport_pcm *pcms[2] = { NULL };
+	size_t i;
+
+	if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_A2DP) {
+		pcms[0] = &t->a2dp.pcm;
+		pcms[1] = &t->a2dp.pcm_bc;
+	}
+	else if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_SCO) {
+		pcms[0] = &t->sco.spk_pcm;
+		pcms[1] = &t->sco.mic_pcm;
+	}
+
+	for (i = 0; i < ARRAYSIZE(pcms); i++)
+		if (pcms[i] != NULL && pcms[i]->ba_dbus_id != 0)
+			bluealsa_dbus_pcm_update(pcms[i], BA_DBUS_PCM_UPDATE_IO_SCHED);
+
+}
+
+struct ba_transport_pthread_start {
+	void *(*routine)(struct ba_transport *);
+	struct ba_transport *t;
+};
+
+/**
+ * Transport thread entry point.
+ *
+ * Scheduling policy has to be applied by the IO thread itself, because
+ * the RealtimeKit fallback requires the kernel thread ID. */
+static void *ba_transport_pthread_start(struct ba_transport_pthread_start *start) {
+
+	void *(*routine)(struct ba_transport *) = start->routine;
+	struct ba_transport *t = start->t;
+	free(start);
+
+	if (config.io_mlock)
+		io_sched_prefault_stack();
+
+	if (io_sched_requested(&config.io_sched)) {
+		/* The RealtimeKit call is a cancellation point, however the
+		 * transport reference is not guarded by the cleanup handler yet. */
+		int oldstate;
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &oldstate);
+		io_sched_apply(&config.io_sched, &t->io_sched);
+		ba_transport_io_sched_update(t);
+		pthread_setcancelstate(oldstate, NULL);
+	}
+
+	return routine(t);
+}
+
 /**
  * Create transport thread. */
 int ba_transport_pthread_create(
@@ -1044,13 +1410,23 @@ int ba_transport_pthread_create(
 		void *(*routine)(struct ba_transport *),
 		const char *name) {
 
+	struct ba_transport_pthread_start *start;
 	int ret;
 
+	if ((start = malloc(sizeof(*start))) == NULL) {
+		error("Couldn't create transport thread: %s", strerror(errno));
+		return -1;
+	}
+
+	start->routine = routine;
+	start->t = ba_transport_ref(t);
+
 	if ((ret = pthread_create(&t->thread, NULL,
-					PTHREAD_ROUTINE(routine), ba_transport_ref(t))) != 0) {
+					PTHREAD_ROUTINE(ba_transport_pthread_start), start)) != 0) {
 		error("Couldn't create transport thread: %s", strerror(ret));
 		t->thread = config.main_thread;
 		ba_transport_unref(t);
+		free(start);
 		return -1;
 	}
 
@@ -1079,10 +1455,67 @@ void ba_transport_pthread_cleanup(struct ba_transport *t) {
 	 *      indicate the end of the IO/RFCOMM thread. */
 	debug("Exiting IO thread: %s", ba_transport_type_to_string(t->type));
 
+	if (io_sched_requested(&config.io_sched)) {
+		memset(&t->io_sched, 0, sizeof(t->io_sched));
+		t->io_sched.policy = SCHED_OTHER;
+		ba_transport_io_sched_update(t);
+	}
+
 	/* Remove reference which was taken by the io_thread_create(). */
 	ba_transport_unref(t);
 }
 
+/**
+ * Create transport IO task on the IO engine worker.
+ *
+ * The IO task is an event-driven counterpart of the transport IO thread.
+ * It holds the transport reference until the task has been terminated.
+ *
+ * @param t Transport structure.
+ * @param init The task initialization callback.
+ * @param cleanup The task cleanup callback, which shall call the
+ *   ba_transport_io_task_cleanup() function.
+ * @param data The task private data.
+ * @param name The task name used for logging.
+ * @return On success this function returns 0. Otherwise, -1 is returned. */
+int ba_transport_io_task_create(
+		struct ba_transport *t,
+		int (*init)(struct io_engine_task *),
+		void (*cleanup)(struct io_engine_task *),
+		void *data,
+		const char *name) {
+
+	t->io_task.init = init;
+	t->io_task.cleanup = cleanup;
+	t->io_task.destroy = (void (*)(void *))ba_transport_unref;
+	t->io_task.userdata = ba_transport_ref(t);
+	t->io_task.data = data;
+
+	if (io_engine_task_start(&t->io_task) == -1) {
+		error("Couldn't create transport IO task: %s", strerror(errno));
+		ba_transport_unref(t);
+		return -1;
+	}
+
+	debug("Created new IO task [%s]: %s", name, ba_transport_type_to_string(t->type));
+	return 0;
+}
+
+/**
+ * Wrapper for release callback, which can be used by the IO task cleanup.
+ *
+ * Contrary to the ba_transport_pthread_cleanup(), the transport reference
+ * is removed by the IO engine, after the task termination is reported. */
+void ba_transport_io_task_cleanup(struct ba_transport *t) {
+
+	if (t->release != NULL)
+		t->release(t);
+
+	ba_transport_pthread_cleanup_unlock(t);
+
+	debug("Exiting IO task: %s", ba_transport_type_to_string(t->type));
+}
+
 int ba_transport_pthread_cleanup_lock(struct ba_transport *t) {
 	int ret = pthread_mutex_lock(&t->mutex);
 	t->cleanup_lock = true;
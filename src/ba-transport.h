@@ -21,9 +21,16 @@
 #include <stdint.h>
 
 #include "a2dp.h"
+#include "audio.h"
 #include "ba-device.h"
 #include "ba-rfcomm.h"
 #include "bluez.h"
+#include "io-engine.h"
+#include "io-sched.h"
+#include "shared/shm-ring.h"
+
+/* the maximal number of A2DP broadcast group members */
+#define BA_TRANSPORT_BROADCAST_MEMBERS_MAX 8
 
 #define BA_TRANSPORT_PROFILE_NONE        (0)
 #define BA_TRANSPORT_PROFILE_A2DP_SOURCE (1 << 0)
@@ -88,6 +95,18 @@ enum ba_transport_pcm_mode {
 #define BA_TRANSPORT_PCM_FORMAT_S24_3LE BA_TRANSPORT_PCM_FORMAT(1, 24, 3, 0)
 #define BA_TRANSPORT_PCM_FORMAT_S24_4LE BA_TRANSPORT_PCM_FORMAT(1, 24, 4, 0)
 #define BA_TRANSPORT_PCM_FORMAT_S32_4LE BA_TRANSPORT_PCM_FORMAT(1, 32, 4, 0)
+/* pre-encoded bitstream of the transport codec (passed as bytes) */
+#define BA_TRANSPORT_PCM_FORMAT_ENCODED BA_TRANSPORT_PCM_FORMAT(0, 0, 1, 0)
+
+/**
+ * Header of the frame of the encoded bitstream delivered by the A2DP sink
+ * PCM. All fields are in the little-endian byte order. */
+struct ba_transport_pcm_frame_header {
+	/* RTP timestamp of the frame */
+	uint32_t timestamp;
+	/* the length of the frame following the header */
+	uint32_t length;
+} __attribute__ ((packed));
 
 struct ba_transport_pcm {
 
@@ -99,6 +118,13 @@ struct ba_transport_pcm {
 
 	/* FIFO file descriptor */
 	int fd;
+	/* our end of the PCM control socket */
+	int ctrl_fd;
+
+	/* Shared memory ring buffer used instead of the FIFO. In such case,
+	 * the FIFO file descriptor is the data notification eventfd. */
+	struct shm_ring *shm;
+	pthread_mutex_t shm_mtx;
 
 	/* 16-bit stream format identifier */
 	uint16_t format;
@@ -107,8 +133,9 @@ struct ba_transport_pcm {
 	/* PCM sampling frequency */
 	unsigned int sampling;
 
-	/* Overall PCM delay in 1/10 of millisecond, caused by
-	 * audio encoding or decoding and data transfer. */
+	/* Overall PCM delay in 1/10 of millisecond, caused by audio encoding
+	 * or decoding (including codec algorithmic delay) and data transfer
+	 * (including data queued for the BT link). */
 	unsigned int delay;
 
 	/* internal software volume control */
@@ -124,6 +151,9 @@ struct ba_transport_pcm {
 		int level;
 		/* audio signal mute switch */
 		bool muted;
+		/* fixed-point gain derived from the
+		 * volume level and the mute switch */
+		struct audio_gain gain;
 	} volume[2];
 
 	/* data synchronization */
@@ -156,6 +186,11 @@ struct ba_transport {
 
 	/* IO thread - actual transport layer */
 	pthread_t thread;
+	/* IO engine task - replacement for the IO thread, if the transport
+	 * layer is hosted by the IO engine worker pool */
+	struct io_engine_task io_task;
+	/* scheduling policy applied to the IO thread */
+	struct io_sched io_sched;
 
 	/* This field stores a file descriptor (socket) associated with the BlueZ
 	 * side of the transport. The role of this socket depends on the transport
@@ -200,6 +235,23 @@ struct ba_transport {
 			 * subsequent ioctl() calls. */
 			int bt_fd_coutq_init;
 
+			/* Broadcast group. The PCM of the group leader is encoded once
+			 * and RTP packets are replicated by the leader IO thread to all
+			 * group members, which do not run IO threads on their own. */
+			struct {
+				/* leader of the group this transport is a member of */
+				struct ba_transport *leader;
+				/* members of the group led by this transport */
+				struct ba_transport *members[BA_TRANSPORT_BROADCAST_MEMBERS_MAX];
+				size_t members_len;
+				/* incremented whenever the set of members or their BT
+				 * links change, guarded by the broadcast group mutex */
+				unsigned int version;
+				/* residual playback skew between the leader and group
+				 * members in 1/10 of millisecond - see the SyncSkew */
+				unsigned int skew;
+			} broadcast;
+
 		} a2dp;
 
 		struct {
@@ -229,6 +281,17 @@ struct ba_transport {
 
 };
 
+/**
+ * BT link of the broadcast group member. */
+struct ba_transport_broadcast_link {
+	/* referenced member transport */
+	struct ba_transport *t;
+	/* duplicated BT socket of the member */
+	int bt_fd;
+	int bt_fd_coutq_init;
+	size_t mtu_write;
+};
+
 struct ba_transport *ba_transport_new_a2dp(
 		struct ba_device *device,
 		struct ba_transport_type type,
@@ -271,6 +334,15 @@ void ba_transport_set_codec(
 
 int ba_transport_start(struct ba_transport *t);
 
+int ba_transport_broadcast_set(
+		struct ba_transport *t,
+		struct ba_transport * const *members,
+		size_t len);
+size_t ba_transport_broadcast_get_links(
+		struct ba_transport *t,
+		struct ba_transport_broadcast_link *links,
+		unsigned int *version);
+
 int ba_transport_set_a2dp_state(
 		struct ba_transport *t,
 		enum bluez_a2dp_transport_state state);
@@ -285,6 +357,8 @@ int ba_transport_pcm_volume_bt_to_level(
 		const struct ba_transport_pcm *pcm,
 		unsigned int value);
 
+void ba_transport_pcm_volume_update_gain(
+		struct ba_transport_pcm *pcm);
 int ba_transport_pcm_volume_update(
 		struct ba_transport_pcm *pcm);
 
@@ -301,6 +375,15 @@ int ba_transport_pthread_create(
 		const char *name);
 
 void ba_transport_pthread_cleanup(struct ba_transport *t);
+
+int ba_transport_io_task_create(
+		struct ba_transport *t,
+		int (*init)(struct io_engine_task *),
+		void (*cleanup)(struct io_engine_task *),
+		void *data,
+		const char *name);
+
+void ba_transport_io_task_cleanup(struct ba_transport *t);
 int ba_transport_pthread_cleanup_lock(struct ba_transport *t);
 int ba_transport_pthread_cleanup_unlock(struct ba_transport *t);
 
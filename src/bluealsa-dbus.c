@@ -12,9 +12,11 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <unistd.h>
@@ -34,9 +36,11 @@
 #include "bluealsa.h"
 #include "dbus.h"
 #include "hfp.h"
+#include "io-sched.h"
 #include "utils.h"
 #include "shared/defs.h"
 #include "shared/log.h"
+#include "shared/shm-ring.h"
 
 static GVariant *ba_variant_new_device_path(const struct ba_device *d) {
 	return g_variant_new_object_path(d->bluez_dbus_path);
@@ -117,6 +121,26 @@ static GVariant *ba_variant_new_pcm_volume(const struct ba_transport_pcm *pcm) {
 	return g_variant_new_uint16((ch1 << 8) | (pcm->channels == 1 ? 0 : ch2));
 }
 
+static GVariant *ba_variant_new_pcm_io_sched_policy(const struct ba_transport_pcm *pcm) {
+	return g_variant_new_string(io_sched_policy_to_string(pcm->t->io_sched.policy));
+}
+
+static GVariant *ba_variant_new_pcm_io_sched_priority(const struct ba_transport_pcm *pcm) {
+	return g_variant_new_byte(pcm->t->io_sched.priority);
+}
+
+static GVariant *ba_variant_new_pcm_io_cpu_affinity(const struct ba_transport_pcm *pcm) {
+	char tmp[256];
+	return g_variant_new_string(io_sched_cpus_to_string(&pcm->t->io_sched.cpus, tmp, sizeof(tmp)));
+}
+
+static GVariant *ba_variant_new_pcm_sync_skew(const struct ba_transport_pcm *pcm) {
+	const struct ba_transport *t = pcm->t;
+	if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_A2DP)
+		return g_variant_new_uint16(t->a2dp.broadcast.skew);
+	return g_variant_new_uint16(0);
+}
+
 static void ba_variant_populate_pcm(GVariantBuilder *props, const struct ba_transport_pcm *pcm) {
 	g_variant_builder_init(props, G_VARIANT_TYPE("a{sv}"));
 	g_variant_builder_add(props, "{sv}", "Device", ba_variant_new_device_path(pcm->t->d));
@@ -129,6 +153,10 @@ static void ba_variant_populate_pcm(GVariantBuilder *props, const struct ba_tran
 	g_variant_builder_add(props, "{sv}", "Delay", ba_variant_new_pcm_delay(pcm));
 	g_variant_builder_add(props, "{sv}", "SoftVolume", ba_variant_new_pcm_soft_volume(pcm));
 	g_variant_builder_add(props, "{sv}", "Volume", ba_variant_new_pcm_volume(pcm));
+	g_variant_builder_add(props, "{sv}", "IOSchedPolicy", ba_variant_new_pcm_io_sched_policy(pcm));
+	g_variant_builder_add(props, "{sv}", "IOSchedPriority", ba_variant_new_pcm_io_sched_priority(pcm));
+	g_variant_builder_add(props, "{sv}", "IOCPUAffinity", ba_variant_new_pcm_io_cpu_affinity(pcm));
+	g_variant_builder_add(props, "{sv}", "SyncSkew", ba_variant_new_pcm_sync_skew(pcm));
 }
 
 static bool ba_variant_populate_sep(GVariantBuilder *props, const struct a2dp_sep *sep) {
@@ -229,6 +257,12 @@ static void bluealsa_manager_get_pcms(GDBusMethodInvocation *inv) {
 					g_variant_builder_add(&pcms, "{oa{sv}}", t->a2dp.pcm.ba_dbus_path, &props);
 					g_variant_builder_clear(&props);
 
+					if (t->a2dp.codec->backchannel) {
+						ba_variant_populate_pcm(&props, &t->a2dp.pcm_bc);
+						g_variant_builder_add(&pcms, "{oa{sv}}", t->a2dp.pcm_bc.ba_dbus_path, &props);
+						g_variant_builder_clear(&props);
+					}
+
 				}
 				else if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_SCO) {
 
@@ -324,8 +358,12 @@ static gboolean bluealsa_pcm_controller(GIOChannel *ch, GIOCondition condition,
 	case G_IO_STATUS_AGAIN:
 		return TRUE;
 	case G_IO_STATUS_EOF:
-		ba_transport_pcm_release(pcm);
-		ba_transport_send_signal(t, BA_TRANSPORT_SIGNAL_PCM_CLOSE);
+		/* The PCM might have been already released and opened again by
+		 * a new client, in which case it is not controlled by us anymore. */
+		if (pcm->ctrl_fd == g_io_channel_unix_get_fd(ch)) {
+			ba_transport_pcm_release(pcm);
+			ba_transport_send_signal(t, BA_TRANSPORT_SIGNAL_PCM_CLOSE);
+		}
 		/* remove channel from watch */
 		return FALSE;
 	}
@@ -333,6 +371,30 @@ static gboolean bluealsa_pcm_controller(GIOChannel *ch, GIOCondition condition,
 	return TRUE;
 }
 
+/**
+ * Release PCM abandoned by the client.
+ *
+ * When the client closes the control socket, the PCM is released by the
+ * controller watch, which is dispatched asynchronously. If the client opens
+ * the PCM again right away (e.g. the ALSA plugin which falls back from the
+ * shared memory to the PIPE transport), the release might still be pending.
+ * In such case, the PCM is released here, so it can be opened again. */
+static void bluealsa_pcm_release_abandoned(struct ba_transport_pcm *pcm) {
+
+	struct pollfd pfd = { pcm->ctrl_fd, POLLRDHUP, 0 };
+
+	if (pcm->fd == -1 || pcm->ctrl_fd == -1)
+		return;
+	if (poll(&pfd, 1, 0) <= 0 ||
+			!(pfd.revents & (POLLRDHUP | POLLHUP | POLLERR)))
+		return;
+
+	debug("Releasing abandoned PCM: %d", pcm->fd);
+	ba_transport_pcm_release(pcm);
+	ba_transport_send_signal(pcm->t, BA_TRANSPORT_SIGNAL_PCM_CLOSE);
+
+}
+
 static void bluealsa_pcm_open(GDBusMethodInvocation *inv) {
 
 	void *userdata = g_dbus_method_invocation_get_user_data(inv);
@@ -357,7 +419,12 @@ static void bluealsa_pcm_open(GDBusMethodInvocation *inv) {
 	ba_transport_pthread_cleanup_lock(t);
 	locked = true;
 
-	if (pcm->fd != -1) {
+	bluealsa_pcm_release_abandoned(pcm);
+
+	/* PCM of the broadcast group member is fed by the group leader */
+	if (pcm->fd != -1 ||
+			(t->type.profile & BA_TRANSPORT_PROFILE_MASK_A2DP &&
+			 t->a2dp.broadcast.leader != NULL)) {
 		g_dbus_method_invocation_return_error(inv, G_DBUS_ERROR,
 				G_DBUS_ERROR_FAILED, "%s", strerror(EBUSY));
 		goto fail;
@@ -393,6 +460,7 @@ static void bluealsa_pcm_open(GDBusMethodInvocation *inv) {
 
 	/* get correct PIPE endpoint - PIPE is unidirectional */
 	pcm->fd = pcm_fds[is_sink ? 0 : 1];
+	pcm->ctrl_fd = pcm_fds[2];
 
 	GIOChannel *ch = g_io_channel_unix_new(pcm_fds[2]);
 	g_io_add_watch_full(ch, G_PRIORITY_DEFAULT, G_IO_IN,
@@ -426,6 +494,117 @@ fail:
 			close(pcm_fds[i]);
 }
 
+static void bluealsa_pcm_open_shm(GDBusMethodInvocation *inv) {
+
+	void *userdata = g_dbus_method_invocation_get_user_data(inv);
+	struct ba_transport_pcm *pcm = (struct ba_transport_pcm *)userdata;
+	const bool is_sink = pcm->mode == BA_TRANSPORT_PCM_MODE_SINK;
+	struct ba_transport *t = pcm->t;
+	struct shm_ring *shm = NULL;
+	int pcm_fds[5] = { -1, -1, -1, -1, -1 };
+	bool locked = false;
+	size_t i;
+
+	/* preliminary check whether HFP codes is selected */
+	if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_SCO &&
+			t->type.codec == HFP_CODEC_UNDEFINED) {
+		g_dbus_method_invocation_return_error(inv, G_DBUS_ERROR,
+				G_DBUS_ERROR_FAILED, "HFP audio codec not selected");
+		goto fail;
+	}
+
+	ba_transport_pthread_cleanup_lock(t);
+	locked = true;
+
+	bluealsa_pcm_release_abandoned(pcm);
+
+	if (pcm->fd != -1 ||
+			(t->type.profile & BA_TRANSPORT_PROFILE_MASK_A2DP &&
+			 t->a2dp.broadcast.leader != NULL)) {
+		g_dbus_method_invocation_return_error(inv, G_DBUS_ERROR,
+				G_DBUS_ERROR_FAILED, "%s", strerror(EBUSY));
+		goto fail;
+	}
+
+	/* For the playback, keep the ring as small as the PIPE set up by the
+	 * ALSA plugin (it will be rounded up to the page size), otherwise the
+	 * PCM delay would increase noticeably. For the capture, use the default
+	 * PIPE capacity. */
+	const size_t size = is_sink ? 2048 : 1024 * 64;
+
+	/* create PCM stream shared memory ring and PCM control socket */
+	if ((shm = malloc(sizeof(*shm))) == NULL ||
+			shm_ring_create(shm, size) == -1) {
+		g_dbus_method_invocation_return_error(inv, G_DBUS_ERROR,
+				G_DBUS_ERROR_NOT_SUPPORTED, "Create shared memory: %s", strerror(errno));
+		free(shm);
+		shm = NULL;
+		goto fail;
+	}
+
+	if ((pcm_fds[0] = dup(shm->fd)) == -1 ||
+			(pcm_fds[1] = dup(shm->fd_data)) == -1 ||
+			(pcm_fds[2] = dup(shm->fd_space)) == -1 ||
+			socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0, &pcm_fds[3]) == -1) {
+		g_dbus_method_invocation_return_error(inv, G_DBUS_ERROR,
+				G_DBUS_ERROR_FAILED, "Create shared memory: %s", strerror(errno));
+		goto fail;
+	}
+
+	/* see the bluealsa_pcm_open() function for explanation */
+	if (t->type.profile & BA_TRANSPORT_PROFILE_A2DP_SOURCE ||
+			t->type.profile & BA_TRANSPORT_PROFILE_MASK_AG)
+		if (t->acquire(t) == -1) {
+			g_dbus_method_invocation_return_error(inv, G_DBUS_ERROR,
+					G_DBUS_ERROR_FAILED, "Acquire transport: %s", strerror(errno));
+			goto fail;
+		}
+
+	/* Regardless of the PCM mode, our IO thread is notified about new data
+	 * in the ring (sink) or is always ready to write (source). */
+	pthread_mutex_lock(&pcm->shm_mtx);
+	pcm->shm = shm;
+	pcm->fd = shm->fd_data;
+	pthread_mutex_unlock(&pcm->shm_mtx);
+	pcm->ctrl_fd = pcm_fds[3];
+	shm = NULL;
+
+	GIOChannel *ch = g_io_channel_unix_new(pcm_fds[3]);
+	g_io_add_watch_full(ch, G_PRIORITY_DEFAULT, G_IO_IN,
+			bluealsa_pcm_controller, ba_transport_pcm_ref(pcm),
+			(GDestroyNotify)ba_transport_pcm_unref);
+	g_io_channel_set_close_on_unref(ch, TRUE);
+	g_io_channel_set_encoding(ch, NULL, NULL);
+	g_io_channel_unref(ch);
+
+	/* notify our IO thread that the FIFO is ready */
+	ba_transport_send_signal(t, BA_TRANSPORT_SIGNAL_PCM_OPEN);
+
+	ba_transport_pthread_cleanup_unlock(t);
+	ba_transport_pcm_unref(pcm);
+
+	int fds[4] = { pcm_fds[0], pcm_fds[1], pcm_fds[2], pcm_fds[4] };
+	GUnixFDList *fd_list = g_unix_fd_list_new_from_array(fds, 4);
+	g_dbus_method_invocation_return_value_with_unix_fd_list(inv,
+			g_variant_new("(hhhh)", 0, 1, 2, 3), fd_list);
+	g_object_unref(fd_list);
+
+	return;
+
+fail:
+	if (locked)
+		ba_transport_pthread_cleanup_unlock(t);
+	ba_transport_pcm_unref(pcm);
+	if (shm != NULL) {
+		shm_ring_free(shm);
+		free(shm);
+	}
+	/* clean up created file descriptors */
+	for (i = 0; i < ARRAYSIZE(pcm_fds); i++)
+		if (pcm_fds[i] != -1)
+			close(pcm_fds[i]);
+}
+
 static void bluealsa_pcm_get_codecs(GDBusMethodInvocation *inv) {
 
 	void *userdata = g_dbus_method_invocation_get_user_data(inv);
@@ -583,6 +762,106 @@ final:
 		g_variant_unref(value);
 }
 
+/**
+ * Lookup A2DP transport by the BlueALSA PCM D-Bus object path.
+ *
+ * @return On success this function returns referenced transport structure.
+ *   Otherwise, NULL is returned. */
+static struct ba_transport *bluealsa_transport_lookup_pcm_path(const char *path) {
+
+	struct ba_transport *t = NULL;
+	struct ba_adapter *a;
+	struct ba_device *d;
+	bdaddr_t addr;
+
+	if ((a = ba_adapter_lookup(g_dbus_bluez_object_path_to_hci_dev_id(path))) == NULL)
+		return NULL;
+	if (g_dbus_bluez_object_path_to_bdaddr(path, &addr) == NULL ||
+			(d = ba_device_lookup(a, &addr)) == NULL)
+		goto final;
+
+	GHashTableIter iter;
+	struct ba_transport *tmp;
+
+	pthread_mutex_lock(&d->transports_mutex);
+	g_hash_table_iter_init(&iter, d->transports);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer)&tmp))
+		if (tmp->type.profile & BA_TRANSPORT_PROFILE_MASK_A2DP &&
+				strcmp(tmp->a2dp.pcm.ba_dbus_path, path) == 0) {
+			t = tmp;
+			t->ref_count++;
+			break;
+		}
+	pthread_mutex_unlock(&d->transports_mutex);
+
+	ba_device_unref(d);
+
+final:
+	ba_adapter_unref(a);
+	return t;
+}
+
+static void bluealsa_pcm_set_broadcast_members(GDBusMethodInvocation *inv) {
+
+	GVariant *params = g_dbus_method_invocation_get_parameters(inv);
+	void *userdata = g_dbus_method_invocation_get_user_data(inv);
+	struct ba_transport_pcm *pcm = (struct ba_transport_pcm *)userdata;
+	struct ba_transport *members[BA_TRANSPORT_BROADCAST_MEMBERS_MAX];
+	struct ba_transport *t = pcm->t;
+	GDBusError err = G_DBUS_ERROR_INVALID_ARGS;
+	const char *errmsg = NULL;
+	GVariantIter *paths;
+	const char *path;
+	size_t i, len = 0;
+
+	g_variant_get(params, "(ao)", &paths);
+	while (g_variant_iter_next(paths, "&o", &path)) {
+
+		if (len == ARRAYSIZE(members)) {
+			errmsg = "Too many broadcast members";
+			goto fail;
+		}
+
+		if ((members[len] = bluealsa_transport_lookup_pcm_path(path)) == NULL) {
+			errmsg = "Broadcast member PCM not found";
+			goto fail;
+		}
+
+		len++;
+	}
+
+	/* only the main PCM of the A2DP source can lead the group */
+	if (t->type.profile != BA_TRANSPORT_PROFILE_A2DP_SOURCE ||
+			pcm != &t->a2dp.pcm) {
+		err = G_DBUS_ERROR_NOT_SUPPORTED;
+		errmsg = "Broadcast not supported";
+		goto fail;
+	}
+
+	if (ba_transport_broadcast_set(t, members, len) == -1) {
+		/* EINVAL is returned for members which can not join the group,
+		 * e.g. due to the codec or its configuration mismatch */
+		if (errno != EINVAL)
+			err = G_DBUS_ERROR_FAILED;
+		goto fail;
+	}
+
+	g_dbus_method_invocation_return_value(inv, NULL);
+	goto final;
+
+fail:
+	if (errmsg == NULL)
+		errmsg = strerror(errno);
+	error("Couldn't set broadcast members: %s", errmsg);
+	g_dbus_method_invocation_return_error(inv, G_DBUS_ERROR, err, "%s", errmsg);
+
+final:
+	for (i = 0; i < len; i++)
+		ba_transport_unref(members[i]);
+	ba_transport_pcm_unref(pcm);
+	g_variant_iter_free(paths);
+}
+
 static void bluealsa_pcm_method_call(GDBusConnection *conn, const char *sender,
 		const char *path, const char *interface, const char *method, GVariant *params,
 		GDBusMethodInvocation *invocation, void *userdata) {
@@ -593,12 +872,18 @@ static void bluealsa_pcm_method_call(GDBusConnection *conn, const char *sender,
 		{ .method = "Open",
 			.handler = bluealsa_pcm_open,
 			.asynchronous_call = true },
+		{ .method = "OpenSharedMemory",
+			.handler = bluealsa_pcm_open_shm,
+			.asynchronous_call = true },
 		{ .method = "GetCodecs",
 			.handler = bluealsa_pcm_get_codecs,
 			.asynchronous_call = true },
 		{ .method = "SelectCodec",
 			.handler = bluealsa_pcm_select_codec,
 			.asynchronous_call = true },
+		{ .method = "SetBroadcastMembers",
+			.handler = bluealsa_pcm_set_broadcast_members,
+			.asynchronous_call = true },
 		{ NULL },
 	};
 
@@ -688,6 +973,14 @@ static GVariant *bluealsa_pcm_get_property(GDBusConnection *conn,
 		return ba_variant_new_pcm_soft_volume(pcm);
 	if (strcmp(property, "Volume") == 0)
 		return ba_variant_new_pcm_volume(pcm);
+	if (strcmp(property, "IOSchedPolicy") == 0)
+		return ba_variant_new_pcm_io_sched_policy(pcm);
+	if (strcmp(property, "IOSchedPriority") == 0)
+		return ba_variant_new_pcm_io_sched_priority(pcm);
+	if (strcmp(property, "IOCPUAffinity") == 0)
+		return ba_variant_new_pcm_io_cpu_affinity(pcm);
+	if (strcmp(property, "SyncSkew") == 0)
+		return ba_variant_new_pcm_sync_skew(pcm);
 
 	*error = g_error_new(G_DBUS_ERROR, G_DBUS_ERROR_NOT_SUPPORTED,
 			"Property not supported '%s'", property);
@@ -730,6 +1023,7 @@ static gboolean bluealsa_pcm_set_property(GDBusConnection *conn,
 
 	if (strcmp(property, "SoftVolume") == 0) {
 		pcm->soft_volume = g_variant_get_boolean(value);
+		ba_transport_pcm_volume_update_gain(pcm);
 		bluealsa_dbus_pcm_update(pcm, BA_DBUS_PCM_UPDATE_SOFT_VOLUME);
 		return TRUE;
 	}
@@ -805,6 +1099,13 @@ void bluealsa_dbus_pcm_update(struct ba_transport_pcm *pcm, unsigned int mask) {
 		g_variant_builder_add(&props, "{sv}", "SoftVolume", ba_variant_new_pcm_soft_volume(pcm));
 	if (mask & BA_DBUS_PCM_UPDATE_VOLUME)
 		g_variant_builder_add(&props, "{sv}", "Volume", ba_variant_new_pcm_volume(pcm));
+	if (mask & BA_DBUS_PCM_UPDATE_IO_SCHED) {
+		g_variant_builder_add(&props, "{sv}", "IOSchedPolicy", ba_variant_new_pcm_io_sched_policy(pcm));
+		g_variant_builder_add(&props, "{sv}", "IOSchedPriority", ba_variant_new_pcm_io_sched_priority(pcm));
+		g_variant_builder_add(&props, "{sv}", "IOCPUAffinity", ba_variant_new_pcm_io_cpu_affinity(pcm));
+	}
+	if (mask & BA_DBUS_PCM_UPDATE_SYNC_SKEW)
+		g_variant_builder_add(&props, "{sv}", "SyncSkew", ba_variant_new_pcm_sync_skew(pcm));
 
 	g_dbus_connection_emit_signal(config.dbus, NULL, pcm->ba_dbus_path,
 			DBUS_IFACE_PROPERTIES, "PropertiesChanged",
@@ -27,6 +27,8 @@
 #define BA_DBUS_PCM_UPDATE_DELAY       (1 << 4)
 #define BA_DBUS_PCM_UPDATE_SOFT_VOLUME (1 << 5)
 #define BA_DBUS_PCM_UPDATE_VOLUME      (1 << 6)
+#define BA_DBUS_PCM_UPDATE_IO_SCHED    (1 << 7)
+#define BA_DBUS_PCM_UPDATE_SYNC_SKEW   (1 << 8)
 
 #define BA_DBUS_RFCOMM_UPDATE_FEATURES (1 << 0)
 #define BA_DBUS_RFCOMM_UPDATE_BATTERY  (1 << 1)
@@ -32,6 +32,10 @@ static const GDBusArgInfo arg_PCMs = {
 	-1, "PCMs", "a{oa{sv}}", NULL
 };
 
+static const GDBusArgInfo arg_members = {
+	-1, "members", "ao", NULL
+};
+
 static const GDBusArgInfo arg_props = {
 	-1, "props", "a{sv}", NULL
 };
@@ -88,6 +92,14 @@ static const GDBusArgInfo *pcm_Open_out[] = {
 	NULL,
 };
 
+static const GDBusArgInfo *pcm_OpenSharedMemory_out[] = {
+	&arg_fd,
+	&arg_fd,
+	&arg_fd,
+	&arg_fd,
+	NULL,
+};
+
 static const GDBusArgInfo *pcm_GetCodecs_out[] = {
 	&arg_codecs,
 	NULL,
@@ -99,6 +111,11 @@ static const GDBusArgInfo *pcm_SelectCodec_in[] = {
 	NULL,
 };
 
+static const GDBusArgInfo *pcm_SetBroadcastMembers_in[] = {
+	&arg_members,
+	NULL,
+};
+
 static const GDBusMethodInfo bluealsa_iface_pcm_Open = {
 	-1, "Open",
 	NULL,
@@ -106,6 +123,13 @@ static const GDBusMethodInfo bluealsa_iface_pcm_Open = {
 	NULL,
 };
 
+static const GDBusMethodInfo bluealsa_iface_pcm_OpenSharedMemory = {
+	-1, "OpenSharedMemory",
+	NULL,
+	(GDBusArgInfo **)pcm_OpenSharedMemory_out,
+	NULL,
+};
+
 static const GDBusMethodInfo bluealsa_iface_pcm_GetCodecs = {
 	-1, "GetCodecs",
 	NULL,
@@ -120,10 +144,19 @@ static const GDBusMethodInfo bluealsa_iface_pcm_SelectCodec = {
 	NULL,
 };
 
+static const GDBusMethodInfo bluealsa_iface_pcm_SetBroadcastMembers = {
+	-1, "SetBroadcastMembers",
+	(GDBusArgInfo **)pcm_SetBroadcastMembers_in,
+	NULL,
+	NULL,
+};
+
 static const GDBusMethodInfo *bluealsa_iface_pcm_methods[] = {
 	&bluealsa_iface_pcm_Open,
+	&bluealsa_iface_pcm_OpenSharedMemory,
 	&bluealsa_iface_pcm_GetCodecs,
 	&bluealsa_iface_pcm_SelectCodec,
+	&bluealsa_iface_pcm_SetBroadcastMembers,
 	NULL,
 };
 
@@ -173,6 +206,22 @@ static const GDBusPropertyInfo bluealsa_iface_pcm_Volume = {
 	NULL
 };
 
+static const GDBusPropertyInfo bluealsa_iface_pcm_IOSchedPolicy = {
+	-1, "IOSchedPolicy", "s", G_DBUS_PROPERTY_INFO_FLAGS_READABLE, NULL
+};
+
+static const GDBusPropertyInfo bluealsa_iface_pcm_IOSchedPriority = {
+	-1, "IOSchedPriority", "y", G_DBUS_PROPERTY_INFO_FLAGS_READABLE, NULL
+};
+
+static const GDBusPropertyInfo bluealsa_iface_pcm_IOCPUAffinity = {
+	-1, "IOCPUAffinity", "s", G_DBUS_PROPERTY_INFO_FLAGS_READABLE, NULL
+};
+
+static const GDBusPropertyInfo bluealsa_iface_pcm_SyncSkew = {
+	-1, "SyncSkew", "q", G_DBUS_PROPERTY_INFO_FLAGS_READABLE, NULL
+};
+
 static const GDBusPropertyInfo *bluealsa_iface_pcm_properties[] = {
 	&bluealsa_iface_pcm_Device,
 	&bluealsa_iface_pcm_Transport,
@@ -184,6 +233,10 @@ static const GDBusPropertyInfo *bluealsa_iface_pcm_properties[] = {
 	&bluealsa_iface_pcm_Delay,
 	&bluealsa_iface_pcm_SoftVolume,
 	&bluealsa_iface_pcm_Volume,
+	&bluealsa_iface_pcm_IOSchedPolicy,
+	&bluealsa_iface_pcm_IOSchedPriority,
+	&bluealsa_iface_pcm_IOCPUAffinity,
+	&bluealsa_iface_pcm_SyncSkew,
 	NULL,
 };
 
@@ -74,7 +74,10 @@ struct ba_config config = {
 	.a2dp.force_mono = false,
 	.a2dp.force_44100 = false,
 	.a2dp.keep_alive = 0,
+	.a2dp.jitter_buffer = 0,
+	.a2dp.drift_compensation = false,
 	.a2dp.skip_encoding = false,
+	.a2dp.skip_decoding = false,
 #if CODEC_CONFIG_PARAMETERS_INTEROP_TESTING
 	.a2dp.samplingFrequency = 48000,
 	.a2dp.samplingFrequencyIsSet = false,
@@ -91,6 +94,8 @@ struct ba_config config = {
 #endif
 	/* Try to use high SBC encoding quality as a default. */
 	.sbc_quality = SBC_QUALITY_HIGH,
+	.sbc_abr = false,
+	.sbc_abr_min_bitpool = 0,
 
 #if ENABLE_AAC
 	/* There are two issues with the afterburner: a) it uses a LOT of power,
@@ -102,6 +107,9 @@ struct ba_config config = {
 	 * required to use LATM version 0 (ISO-IEC 14496-3 (2001)). */
 	.aac_latm_version = 1,
 	.aac_vbr_mode = 4,
+	.aac_abr = false,
+	/* Do not go below the bit rate of the low quality VBR mode. */
+	.aac_abr_min_bitrate = 64000,
 #endif
 
 #if ENABLE_MP3LAME
@@ -25,6 +25,8 @@
 #include <gio/gio.h>
 #include <glib.h>
 
+#include "io-sched.h"
+
 struct ba_config {
 
 	/* set of enabled profiles */
@@ -55,6 +57,16 @@ struct ba_config {
 	/* opened null device */
 	int null_fd;
 
+	/* The number of IO engine worker threads. If zero, every transport
+	 * has its own dedicated IO thread. */
+	unsigned int io_workers;
+
+	/* Scheduling policy and CPU affinity of transport IO threads. */
+	struct io_sched io_sched;
+	/* Lock all memory pages of the process and pre-fault IO thread stacks,
+	 * so the IO threads will not be delayed by page faults. */
+	bool io_mlock;
+
 	struct {
 		/* set of features exposed via Service Discovery */
 		unsigned int features_sdp_hf;
@@ -98,9 +110,22 @@ struct ba_config {
 		 * time. This option applies for the source profile only. */
 		int keep_alive;
 
-		/* Skip the encoding if you want to use pre-encoded audio bitstreams as
-		 * input files. */
+		/* Target depth of the RTP jitter buffer in milliseconds. Received
+		 * packets are delayed by this amount of time before decoding, so the
+		 * network jitter can be absorbed. This option applies for the sink
+		 * profile only. */
+		unsigned int jitter_buffer;
+		/* Compensate the clock drift between the remote device and the local
+		 * system by resampling decoded audio. This option applies for the
+		 * sink profile only. */
+		bool drift_compensation;
+
+		/* Skip the encoding, so the A2DP source PCM accepts pre-encoded
+		 * audio bitstream, which is only packetized into RTP payloads. */
 		bool skip_encoding;
+		/* Skip the decoding, so the A2DP sink PCM delivers received frames
+		 * of the encoded audio bitstream, each preceded by a frame header. */
+		bool skip_decoding;
 #if CODEC_CONFIG_PARAMETERS_INTEROP_TESTING
 		unsigned int samplingFrequency;
 		bool samplingFrequencyIsSet;
@@ -124,11 +149,18 @@ struct ba_config {
 	 * in frame, 8 frequency bands and allocation method Loudness, which is also
 	 * known as SBC XQ Dual Channel HD. */
 	uint8_t sbc_quality;
+	/* SBC adaptive bit rate and the lowest bit-pool value it can use, where
+	 * the value 0 denotes the bit-pool of the low SBC quality */
+	bool sbc_abr;
+	uint8_t sbc_abr_min_bitpool;
 
 #if ENABLE_AAC
 	bool aac_afterburner;
 	uint8_t aac_latm_version;
 	uint8_t aac_vbr_mode;
+	/* AAC adaptive bit rate and the lowest CBR bit rate it can use */
+	bool aac_abr;
+	unsigned int aac_abr_min_bitrate;
 #endif
 
 #if ENABLE_MP3LAME
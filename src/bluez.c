@@ -325,6 +325,7 @@ static void bluez_endpoint_set_configuration(GDBusMethodInvocation *inv) {
 		int level = ba_transport_pcm_volume_bt_to_level(&t->a2dp.pcm, volume);
 		t->a2dp.pcm.volume[0].level = level;
 		t->a2dp.pcm.volume[1].level = level;
+		ba_transport_pcm_volume_update_gain(&t->a2dp.pcm);
 	}
 
 	t->a2dp.bluez_dbus_sep_path = dbus_obj->path;
@@ -635,6 +636,8 @@ static void bluez_register_a2dp_all(struct ba_adapter *adapter) {
 	while (*cc != NULL) {
 		const struct a2dp_codec *c = *cc++;
 		debug("DEEB RegisterEndpoint: ########## A2DP codec #%d ##########", numCodecs++);
+		if (!a2dp_codec_is_usable(c))
+			continue;
 #if CODEC_CONFIG_PARAMETERS_INTEROP_TESTING
 		if((config.a2dp.objectTypeIsSet == false) || (c->codec_id == A2DP_CODEC_SBC || c->codec_id == codec_id_local )){
 #endif
@@ -1225,6 +1228,7 @@ static void bluez_signal_transport_changed(GDBusConnection *conn, const char *se
 				int level = ba_transport_pcm_volume_bt_to_level(&t->a2dp.pcm, volume);
 				debug("Updating A2DP volume: %u [%.2f dB]", volume, 0.01 * level);
 				t->a2dp.pcm.volume[0].level = t->a2dp.pcm.volume[1].level = level;
+				ba_transport_pcm_volume_update_gain(&t->a2dp.pcm);
 				bluealsa_dbus_pcm_update(&t->a2dp.pcm, BA_DBUS_PCM_UPDATE_VOLUME);
 			}
 		}
@@ -0,0 +1,425 @@
+/*
+ * BlueALSA - io-engine.c
+ * Copyright (c) 2016-2020 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#include "io-engine.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "shared/defs.h"
+#include "shared/log.h"
+
+/**
+ * IO engine worker.
+ *
+ * Every worker runs an epoll loop, which multiplexes file descriptors of
+ * all tasks assigned to it. Task start and cancellation requests are passed
+ * to the worker via the pending list, guarded by the worker mutex. */
+struct io_engine_worker {
+
+	pthread_t thread;
+	int epoll_fd;
+	int event_fd;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t changed;
+
+	/* tasks waiting for the start or cancellation */
+	struct io_engine_task *pending;
+	/* tasks finished during the current loop iteration - this list is
+	 * accessed by the worker thread only */
+	struct io_engine_task *finished;
+
+	/* the number of tasks assigned to this worker */
+	unsigned int tasks;
+	bool quit;
+
+};
+
+static struct {
+	struct io_engine_worker *workers;
+	unsigned int count;
+	pthread_mutex_t mutex;
+} engine = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/**
+ * Finish the task and release its resources.
+ *
+ * This function shall be called on the worker thread. Upon return, the task
+ * structure might not be valid anymore. */
+static void io_engine_task_terminate(struct io_engine_worker *w,
+		struct io_engine_task *task) {
+
+	struct io_engine_source *src;
+	for (src = task->sources; src != NULL; src = src->next)
+		epoll_ctl(w->epoll_fd, EPOLL_CTL_DEL, src->fd, NULL);
+	task->sources = NULL;
+
+	task->cleanup(task);
+
+	void (*destroy)(void *) = task->destroy;
+	void *userdata = task->userdata;
+
+	pthread_mutex_lock(&w->mutex);
+
+	/* Make sure that the task is not referenced by the pending list. It
+	 * might have been added there by the cancellation request, after the
+	 * list had been processed. */
+	if (task->pending) {
+		struct io_engine_task **tmp = &w->pending;
+		while (*tmp != task)
+			tmp = &(*tmp)->next;
+		*tmp = task->next;
+		task->pending = false;
+	}
+
+	task->state = IO_ENGINE_TASK_DONE;
+	pthread_cond_broadcast(&w->changed);
+
+	pthread_mutex_unlock(&w->mutex);
+
+	pthread_mutex_lock(&engine.mutex);
+	w->tasks--;
+	pthread_mutex_unlock(&engine.mutex);
+
+	if (destroy != NULL)
+		destroy(userdata);
+
+}
+
+/**
+ * Process start and cancellation requests and terminate finished tasks.
+ *
+ * @return If the worker shall quit, this function returns true. */
+static bool io_engine_worker_dispatch(struct io_engine_worker *w) {
+
+	struct io_engine_task *task;
+
+	pthread_mutex_lock(&w->mutex);
+
+	while ((task = w->pending) != NULL) {
+
+		w->pending = task->next;
+		task->pending = false;
+
+		const bool start = task->state == IO_ENGINE_TASK_QUEUED;
+		const bool cancel = task->cancel;
+		if (start)
+			task->state = IO_ENGINE_TASK_RUNNING;
+
+		pthread_mutex_unlock(&w->mutex);
+
+		if (start && !cancel && task->init(task) == -1)
+			io_engine_task_finish(task);
+		if (cancel)
+			io_engine_task_finish(task);
+
+		pthread_mutex_lock(&w->mutex);
+
+	}
+
+	const bool quit = w->quit;
+	pthread_mutex_unlock(&w->mutex);
+
+	while ((task = w->finished) != NULL) {
+		w->finished = task->next_finished;
+		io_engine_task_terminate(w, task);
+	}
+
+	return quit;
+}
+
+/**
+ * IO engine worker thread. */
+static void *io_engine_worker_thread(struct io_engine_worker *w) {
+
+	struct epoll_event events[32];
+
+	do {
+
+		int i, count;
+		if ((count = epoll_wait(w->epoll_fd, events, ARRAYSIZE(events), -1)) == -1) {
+			if (errno == EINTR)
+				continue;
+			error("IO engine poll error: %s", strerror(errno));
+			break;
+		}
+
+		for (i = 0; i < count; i++) {
+
+			struct io_engine_source *src = events[i].data.ptr;
+
+			if (src == NULL) {
+				eventfd_t tmp;
+				eventfd_read(w->event_fd, &tmp);
+				continue;
+			}
+
+			/* Events of the task finished in this iteration might still be
+			 * pending in the events array, so skip them. Sources of such task
+			 * will be removed from the epoll set during the termination. */
+			if (!src->task->finish)
+				src->callback(src, events[i].events);
+
+		}
+
+	} while (!io_engine_worker_dispatch(w));
+
+	return NULL;
+}
+
+/**
+ * Initialize IO engine worker pool.
+ *
+ * @param workers The number of worker threads.
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int io_engine_init(unsigned int workers) {
+
+	if (workers == 0 || workers > IO_ENGINE_WORKERS_MAX)
+		return errno = EINVAL, -1;
+
+	if ((engine.workers = calloc(workers, sizeof(*engine.workers))) == NULL)
+		return -1;
+
+	for (engine.count = 0; engine.count < workers; engine.count++) {
+
+		struct io_engine_worker *w = &engine.workers[engine.count];
+		struct epoll_event event = { .events = EPOLLIN, .data.ptr = NULL };
+		char name[16];
+		int err;
+
+		pthread_mutex_init(&w->mutex, NULL);
+		pthread_cond_init(&w->changed, NULL);
+		w->epoll_fd = -1;
+		w->event_fd = -1;
+
+		if ((w->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) == -1 ||
+				(w->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) == -1 ||
+				epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, w->event_fd, &event) == -1)
+			goto fail;
+
+		if ((err = pthread_create(&w->thread, NULL,
+						PTHREAD_ROUTINE(io_engine_worker_thread), w)) != 0) {
+			errno = err;
+			goto fail;
+		}
+
+		sprintf(name, "ba-io-%u", engine.count);
+		pthread_setname_np(w->thread, name);
+
+		continue;
+
+fail:
+		if (w->epoll_fd != -1)
+			close(w->epoll_fd);
+		if (w->event_fd != -1)
+			close(w->event_fd);
+		pthread_cond_destroy(&w->changed);
+		pthread_mutex_destroy(&w->mutex);
+		err = errno;
+		io_engine_destroy();
+		errno = err;
+		return -1;
+
+	}
+
+	debug("Created IO engine workers: %u", engine.count);
+	return 0;
+}
+
+/**
+ * Terminate IO engine worker threads.
+ *
+ * Tasks which are still running are abandoned without the cleanup. */
+void io_engine_destroy(void) {
+
+	unsigned int i;
+
+	for (i = 0; i < engine.count; i++) {
+		struct io_engine_worker *w = &engine.workers[i];
+		pthread_mutex_lock(&w->mutex);
+		w->quit = true;
+		pthread_mutex_unlock(&w->mutex);
+		eventfd_write(w->event_fd, 1);
+	}
+
+	for (i = 0; i < engine.count; i++) {
+		struct io_engine_worker *w = &engine.workers[i];
+		pthread_join(w->thread, NULL);
+		close(w->epoll_fd);
+		close(w->event_fd);
+		pthread_cond_destroy(&w->changed);
+		pthread_mutex_destroy(&w->mutex);
+	}
+
+	free(engine.workers);
+	engine.workers = NULL;
+	engine.count = 0;
+
+}
+
+/**
+ * Check whether the IO engine is used instead of the IO threads. */
+bool io_engine_enabled(void) {
+	return engine.count > 0;
+}
+
+/**
+ * Schedule the task on the least loaded worker.
+ *
+ * The task initialization callback is called asynchronously by the worker
+ * thread. Every started task shall be stopped with io_engine_task_cancel()
+ * before the task structure can be reused or freed.
+ *
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int io_engine_task_start(struct io_engine_task *task) {
+
+	if (engine.count == 0)
+		return errno = ENOTSUP, -1;
+
+	struct io_engine_worker *w = &engine.workers[0];
+	unsigned int i;
+
+	pthread_mutex_lock(&engine.mutex);
+	for (i = 1; i < engine.count; i++)
+		if (engine.workers[i].tasks < w->tasks)
+			w = &engine.workers[i];
+	w->tasks++;
+	pthread_mutex_unlock(&engine.mutex);
+
+	task->worker = w;
+	task->sources = NULL;
+	task->cancel = false;
+	task->finish = false;
+
+	pthread_mutex_lock(&w->mutex);
+	task->state = IO_ENGINE_TASK_QUEUED;
+	task->next = w->pending;
+	task->pending = true;
+	w->pending = task;
+	pthread_mutex_unlock(&w->mutex);
+
+	eventfd_write(w->event_fd, 1);
+	return 0;
+}
+
+/**
+ * Finish the task from within its own callback.
+ *
+ * Remaining events of the task are discarded and the task is terminated
+ * at the end of the current worker loop iteration. */
+void io_engine_task_finish(struct io_engine_task *task) {
+
+	if (task->finish)
+		return;
+
+	struct io_engine_worker *w = task->worker;
+
+	task->finish = true;
+	task->next_finished = w->finished;
+	w->finished = task;
+
+}
+
+/**
+ * Synchronous task cancellation.
+ *
+ * When called from a thread other than the task worker, this function waits
+ * until the task cleanup is finished. Otherwise, the cleanup is deferred to
+ * the end of the current worker loop iteration. */
+void io_engine_task_cancel(struct io_engine_task *task) {
+
+	struct io_engine_worker *w = task->worker;
+
+	if (w == NULL)
+		return;
+
+	if (pthread_equal(w->thread, pthread_self())) {
+		io_engine_task_finish(task);
+		return;
+	}
+
+	pthread_mutex_lock(&w->mutex);
+
+	if (task->state != IO_ENGINE_TASK_DONE) {
+
+		task->cancel = true;
+		if (!task->pending) {
+			task->next = w->pending;
+			task->pending = true;
+			w->pending = task;
+		}
+
+		eventfd_write(w->event_fd, 1);
+
+		while (task->state != IO_ENGINE_TASK_DONE)
+			pthread_cond_wait(&w->changed, &w->mutex);
+
+	}
+
+	task->worker = NULL;
+	pthread_mutex_unlock(&w->mutex);
+
+}
+
+/**
+ * Add file descriptor to the task epoll set.
+ *
+ * This function shall be called on the task worker thread, i.e. from the
+ * task initialization callback or any source callback.
+ *
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int io_engine_source_add(
+		struct io_engine_task *task,
+		struct io_engine_source *src) {
+
+	struct epoll_event event = { .events = src->events, .data.ptr = src };
+
+	if (epoll_ctl(task->worker->epoll_fd, EPOLL_CTL_ADD, src->fd, &event) == -1)
+		return -1;
+
+	src->task = task;
+	src->next = task->sources;
+	task->sources = src;
+
+	return 0;
+}
+
+/**
+ * Change the set of events watched on the source file descriptor.
+ *
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int io_engine_source_modify(
+		struct io_engine_source *src,
+		uint32_t events) {
+
+	struct epoll_event event = { .events = events, .data.ptr = src };
+
+	if (src->events == events)
+		return 0;
+
+	if (epoll_ctl(src->task->worker->epoll_fd, EPOLL_CTL_MOD, src->fd, &event) == -1)
+		return -1;
+
+	src->events = events;
+	return 0;
+}
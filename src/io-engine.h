@@ -0,0 +1,114 @@
+/*
+ * BlueALSA - io-engine.h
+ * Copyright (c) 2016-2020 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#ifndef BLUEALSA_IOENGINE_H_
+#define BLUEALSA_IOENGINE_H_
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+
+/* the maximal number of IO engine workers */
+#define IO_ENGINE_WORKERS_MAX 64
+
+struct io_engine_worker;
+struct io_engine_task;
+
+enum io_engine_task_state {
+	IO_ENGINE_TASK_IDLE = 0,
+	IO_ENGINE_TASK_QUEUED,
+	IO_ENGINE_TASK_RUNNING,
+	IO_ENGINE_TASK_DONE,
+};
+
+/**
+ * File descriptor watched by the IO engine worker.
+ *
+ * The callback is invoked on the worker thread whenever requested events
+ * (e.g. EPOLLIN) are signaled on the file descriptor. Events are level
+ * triggered, so the callback does not have to drain the file. */
+struct io_engine_source {
+
+	int fd;
+	uint32_t events;
+	void (*callback)(struct io_engine_source *src, uint32_t revents);
+
+	/* task which owns this source */
+	struct io_engine_task *task;
+	struct io_engine_source *next;
+
+};
+
+/**
+ * Unit of work scheduled on the IO engine worker.
+ *
+ * The task is an event-driven replacement for the transport IO thread. All
+ * callbacks of the task are called on the same worker thread, so the task
+ * state does not require any locking. At the moment, only the A2DP sink IO
+ * is implemented as a task, all other transports use IO threads. */
+struct io_engine_task {
+
+	/**
+	 * Initialize the task on the worker thread. This callback shall add
+	 * task sources with the io_engine_source_add() function.
+	 *
+	 * @return On success this function shall return 0. Otherwise, -1 shall
+	 *   be returned, in which case the task is finished right away. */
+	int (*init)(struct io_engine_task *task);
+
+	/**
+	 * Release resources allocated by the task. This function is called on
+	 * the worker thread, even if the initialization has failed or has not
+	 * been called at all (task cancelled before it was started). */
+	void (*cleanup)(struct io_engine_task *task);
+
+	/**
+	 * Optional callback called when the task termination has been reported
+	 * to the io_engine_task_cancel() caller. After this call the task shall
+	 * not be accessed by the IO engine. */
+	void (*destroy)(void *userdata);
+	void *userdata;
+
+	/* task private data */
+	void *data;
+
+	/* fields below are private to the IO engine */
+
+	enum io_engine_task_state state;
+	struct io_engine_worker *worker;
+	struct io_engine_source *sources;
+	struct io_engine_task *next;
+	struct io_engine_task *next_finished;
+	bool pending;
+	bool cancel;
+	bool finish;
+
+};
+
+int io_engine_init(unsigned int workers);
+void io_engine_destroy(void);
+bool io_engine_enabled(void);
+
+int io_engine_task_start(struct io_engine_task *task);
+void io_engine_task_finish(struct io_engine_task *task);
+void io_engine_task_cancel(struct io_engine_task *task);
+
+int io_engine_source_add(
+		struct io_engine_task *task,
+		struct io_engine_source *src);
+int io_engine_source_modify(
+		struct io_engine_source *src,
+		uint32_t events);
+
+#endif
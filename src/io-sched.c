@@ -0,0 +1,258 @@
+/*
+ * BlueALSA - io-sched.c
+ * Copyright (c) 2016-2020 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#include "io-sched.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <gio/gio.h>
+#include <glib.h>
+
+#include "bluealsa.h"
+#include "dbus.h"
+#include "shared/log.h"
+
+#define RTKIT_SERVICE "org.freedesktop.RealtimeKit1"
+#define RTKIT_PATH    "/org/freedesktop/RealtimeKit1"
+#define RTKIT_IFACE   RTKIT_SERVICE
+
+/* RealtimeKit refuses to grant real-time scheduling to processes without
+ * the RLIMIT_RTTIME limit. This is the default maximum accepted by it. */
+#define RTKIT_RTTIME_USEC 200000
+
+/**
+ * Request real-time scheduling for the calling thread via RealtimeKit.
+ *
+ * RealtimeKit always grants the SCHED_RR policy, and the priority might be
+ * clamped to the maximum allowed by the RealtimeKit configuration.
+ *
+ * @param priority Requested real-time priority.
+ * @return On success this function returns granted priority. Otherwise,
+ *   -1 is returned. */
+static int io_sched_rtkit_make_realtime(int priority) {
+
+	GVariant *value;
+	GError *err = NULL;
+	struct rlimit rl;
+
+	if (config.dbus == NULL)
+		return -1;
+
+	if ((value = g_dbus_get_property(config.dbus, RTKIT_SERVICE, RTKIT_PATH,
+					RTKIT_IFACE, "MaxRealtimePriority", &err)) == NULL)
+		goto fail;
+	const int max = g_variant_get_int32(value);
+	g_variant_unref(value);
+
+	if (priority > max)
+		priority = max;
+
+	if (getrlimit(RLIMIT_RTTIME, &rl) == 0 &&
+			(rl.rlim_max == RLIM_INFINITY || rl.rlim_max > RTKIT_RTTIME_USEC)) {
+		rl.rlim_cur = rl.rlim_max = RTKIT_RTTIME_USEC;
+		setrlimit(RLIMIT_RTTIME, &rl);
+	}
+
+	const uint64_t tid = syscall(SYS_gettid);
+	if ((value = g_dbus_connection_call_sync(config.dbus, RTKIT_SERVICE, RTKIT_PATH,
+					RTKIT_IFACE, "MakeThreadRealtime", g_variant_new("(tu)", tid, priority),
+					NULL, G_DBUS_CALL_FLAGS_NONE, -1, NULL, &err)) == NULL)
+		goto fail;
+	g_variant_unref(value);
+
+	return priority;
+
+fail:
+	warn("Couldn't get real-time scheduling via RealtimeKit: %s", err->message);
+	g_error_free(err);
+	return -1;
+}
+
+/**
+ * Check whether any IO thread scheduling setting has been requested. */
+bool io_sched_requested(const struct io_sched *req) {
+	return req->policy != SCHED_OTHER || CPU_COUNT(&req->cpus) > 0;
+}
+
+/**
+ * Apply scheduling policy to the calling thread.
+ *
+ * If the process lacks privileges for setting the real-time scheduling
+ * policy, this function falls back to the RealtimeKit service. Failures
+ * are not fatal - the thread runs with the default policy in such case.
+ *
+ * @param req Requested scheduling policy.
+ * @param sched Address where the actually applied policy will be stored. */
+void io_sched_apply(const struct io_sched *req, struct io_sched *sched) {
+
+	memset(sched, 0, sizeof(*sched));
+	sched->policy = SCHED_OTHER;
+
+	pthread_t thread = pthread_self();
+	int err;
+
+	if (CPU_COUNT(&req->cpus) > 0) {
+		if ((err = pthread_setaffinity_np(thread, sizeof(req->cpus), &req->cpus)) != 0)
+			warn("Couldn't set IO thread CPU affinity: %s", strerror(err));
+		else
+			sched->cpus = req->cpus;
+	}
+
+	if (req->policy == SCHED_OTHER)
+		return;
+
+	struct sched_param param = { .sched_priority = req->priority };
+	if ((err = pthread_setschedparam(thread, req->policy, &param)) == 0) {
+		sched->policy = req->policy;
+		sched->priority = req->priority;
+		debug("IO thread scheduling: %s:%d",
+				io_sched_policy_to_string(sched->policy), sched->priority);
+		return;
+	}
+
+	if (err != EPERM) {
+		warn("Couldn't set IO thread scheduling policy: %s", strerror(err));
+		return;
+	}
+
+	int priority;
+	if ((priority = io_sched_rtkit_make_realtime(req->priority)) != -1) {
+		sched->policy = SCHED_RR;
+		sched->priority = priority;
+		sched->rtkit = true;
+		debug("IO thread scheduling via RealtimeKit: %s:%d",
+				io_sched_policy_to_string(sched->policy), sched->priority);
+	}
+
+}
+
+/**
+ * Pre-fault the stack of the calling thread.
+ *
+ * With all memory locked by the mlockall(MCL_FUTURE), the stack pages which
+ * are touched here will stay resident, so the IO thread will not hit page
+ * faults on its first deep call chains (e.g. codec initialization). */
+void io_sched_prefault_stack(void) {
+	volatile uint8_t stack[IO_SCHED_PREFAULT_STACK_SIZE];
+	size_t i;
+	for (i = 0; i < sizeof(stack); i += 1024)
+		stack[i] = 0;
+}
+
+/**
+ * Convert scheduling policy name into the policy identifier.
+ *
+ * @return On success this function returns SCHED_OTHER, SCHED_FIFO or
+ *   SCHED_RR identifier. Otherwise, -1 is returned. */
+int io_sched_policy_from_string(const char *str) {
+	if (strcasecmp(str, "other") == 0)
+		return SCHED_OTHER;
+	if (strcasecmp(str, "fifo") == 0)
+		return SCHED_FIFO;
+	if (strcasecmp(str, "rr") == 0)
+		return SCHED_RR;
+	return -1;
+}
+
+/**
+ * Convert scheduling policy identifier into a human-readable string. */
+const char *io_sched_policy_to_string(int policy) {
+	switch (policy) {
+	case SCHED_FIFO:
+		return "fifo";
+	case SCHED_RR:
+		return "rr";
+	default:
+		return "other";
+	}
+}
+
+/**
+ * Parse the list of CPUs.
+ *
+ * The list is a comma-separated list of CPU numbers or ranges of CPU
+ * numbers, e.g. "0,2-3".
+ *
+ * @return On success this function returns 0. Otherwise, -1 is returned. */
+int io_sched_cpus_from_string(const char *str, cpu_set_t *cpus) {
+
+	CPU_ZERO(cpus);
+
+	do {
+
+		char *tmp;
+		unsigned long first, last;
+
+		first = last = strtoul(str, &tmp, 10);
+		if (tmp == str)
+			return -1;
+		if (*tmp == '-') {
+			str = tmp + 1;
+			last = strtoul(str, &tmp, 10);
+			if (tmp == str)
+				return -1;
+		}
+
+		if (first > last || last >= CPU_SETSIZE)
+			return -1;
+		for (; first <= last; first++)
+			CPU_SET(first, cpus);
+
+		if (*tmp != ',' && *tmp != '\0')
+			return -1;
+		str = tmp + 1;
+
+	} while (str[-1] != '\0');
+
+	return 0;
+}
+
+/**
+ * Convert the set of CPUs into the list of CPUs.
+ *
+ * @return This function returns the buffer address, which will contain the
+ *   list in the format accepted by the io_sched_cpus_from_string(). If the
+ *   set is empty, the buffer will contain an empty string. */
+char *io_sched_cpus_to_string(const cpu_set_t *cpus, char *buffer, size_t size) {
+
+	size_t len = 0;
+	int i, j;
+
+	buffer[0] = '\0';
+
+	for (i = 0; i < CPU_SETSIZE && len < size; i = j) {
+
+		if (!CPU_ISSET(i, cpus)) {
+			j = i + 1;
+			continue;
+		}
+
+		for (j = i + 1; j < CPU_SETSIZE && CPU_ISSET(j, cpus); j++)
+			continue;
+
+		const char *sep = len > 0 ? "," : "";
+		if (j - 1 == i)
+			len += snprintf(&buffer[len], size - len, "%s%d", sep, i);
+		else
+			len += snprintf(&buffer[len], size - len, "%s%d-%d", sep, i, j - 1);
+
+	}
+
+	return buffer;
+}
@@ -0,0 +1,59 @@
+/*
+ * BlueALSA - io-sched.h
+ * Copyright (c) 2016-2020 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#ifndef BLUEALSA_IOSCHED_H_
+#define BLUEALSA_IOSCHED_H_
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <sched.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* default real-time priority of IO threads */
+#define IO_SCHED_PRIORITY_DEFAULT 10
+
+/* the size of the IO thread stack touched by the pre-faulting */
+#define IO_SCHED_PREFAULT_STACK_SIZE (64 * 1024)
+
+/**
+ * Scheduling policy of the transport IO thread.
+ *
+ * The same structure is used for the requested (configured) policy and
+ * for the policy which has been actually applied to the IO thread. */
+struct io_sched {
+
+	/* SCHED_OTHER, SCHED_FIFO or SCHED_RR */
+	int policy;
+	/* real-time priority, ignored for SCHED_OTHER */
+	int priority;
+
+	/* CPUs to which the thread is pinned - if the
+	 * set is empty, the thread can run on any CPU */
+	cpu_set_t cpus;
+
+	/* real-time scheduling granted by the RealtimeKit */
+	bool rtkit;
+
+};
+
+bool io_sched_requested(const struct io_sched *req);
+void io_sched_apply(const struct io_sched *req, struct io_sched *sched);
+void io_sched_prefault_stack(void);
+
+int io_sched_policy_from_string(const char *str);
+const char *io_sched_policy_to_string(int policy);
+
+int io_sched_cpus_from_string(const char *str, cpu_set_t *cpus);
+char *io_sched_cpus_to_string(const cpu_set_t *cpus, char *buffer, size_t size);
+
+#endif
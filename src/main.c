@@ -12,6 +12,7 @@
 # include <config.h>
 #endif
 
+#include <errno.h>
 #include <getopt.h>
 #include <signal.h>
 #include <stdbool.h>
@@ -19,6 +20,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <sys/mman.h>
 #include <time.h>
 
 #include <gio/gio.h>
@@ -30,10 +32,13 @@
 #endif
 
 #include "a2dp.h"
+#include "aac.h"
 #include "bluealsa.h"
 #include "bluealsa-dbus.h"
 #include "bluealsa-iface.h"
 #include "bluez.h"
+#include "io-engine.h"
+#include "io-sched.h"
 #if ENABLE_OFONO
 # include "ofono.h"
 #endif
@@ -97,11 +102,19 @@ int main(int argc, char **argv) {
 		{ "syslog", no_argument, NULL, 'S' },
 		{ "device", required_argument, NULL, 'i' },
 		{ "profile", required_argument, NULL, 'p' },
+		{ "io-workers", required_argument, NULL, 30 },
+		{ "io-sched-policy", required_argument, NULL, 31 },
+		{ "io-sched-priority", required_argument, NULL, 32 },
+		{ "io-cpu-affinity", required_argument, NULL, 33 },
+		{ "io-mlock", no_argument, NULL, 34 },
 		{ "a2dp-force-mono", no_argument, NULL, 6 },
 		{ "a2dp-force-audio-cd", no_argument, NULL, 7 },
 		{ "a2dp-keep-alive", required_argument, NULL, 8 },
 		{ "a2dp-volume", no_argument, NULL, 9 },
+		{ "a2dp-jitter-buffer", required_argument, NULL, 27 },
+		{ "a2dp-drift-compensation", no_argument, NULL, 28 },
 		{ "a2dp-skip-encoding", no_argument, NULL, 20},
+		{ "a2dp-skip-decoding", no_argument, NULL, 29 },
 #if CODEC_CONFIG_PARAMETERS_INTEROP_TESTING
 		{ "a2dp-samplingFrequency", required_argument, NULL, 21},
 		{ "a2dp-bitRate", required_argument, NULL, 22},
@@ -111,10 +124,14 @@ int main(int argc, char **argv) {
 		{ "a2dp-objectType", required_argument, NULL, 26},
 #endif	
 		{ "sbc-quality", required_argument, NULL, 14 },
+		{ "sbc-abr", no_argument, NULL, 16 },
+		{ "sbc-abr-min-bitpool", required_argument, NULL, 17 },
 #if ENABLE_AAC
 		{ "aac-afterburner", no_argument, NULL, 4 },
 		{ "aac-latm-version", required_argument, NULL, 15 },
 		{ "aac-vbr-mode", required_argument, NULL, 5 },
+		{ "aac-abr", no_argument, NULL, 18 },
+		{ "aac-abr-min-bitrate", required_argument, NULL, 19 },
 #endif
 #if ENABLE_LDAC
 		{ "ldac-abr", no_argument, NULL, 10 },
@@ -167,16 +184,28 @@ int main(int argc, char **argv) {
 					"  -S, --syslog\t\tsend output to syslog\n"
 					"  -i, --device=hciX\tHCI device(s) to use\n"
 					"  -p, --profile=NAME\tenable BT profile\n"
+					"  --io-workers=NUM\trun A2DP sink IO on NUM engine workers (experimental)\n"
+					"  --io-sched-policy=NAME\tset IO threads scheduling policy\n"
+					"  --io-sched-priority=NB\tset IO threads real-time priority\n"
+					"  --io-cpu-affinity=LIST\tpin IO threads to given CPUs\n"
+					"  --io-mlock\t\tlock memory and pre-fault IO threads\n"
 					"  --a2dp-force-mono\tforce monophonic sound\n"
 					"  --a2dp-force-audio-cd\tforce 44.1 kHz sampling\n"
 					"  --a2dp-keep-alive=SEC\tkeep A2DP transport alive\n"
 					"  --a2dp-volume\t\tnative volume control by default\n"
+					"  --a2dp-jitter-buffer=MS\tset sink jitter buffer depth\n"
+					"  --a2dp-drift-compensation\tcompensate sink clock drift\n"
 					"  --a2dp-skip-encoding\t\tskip encoding when using pre-encoded audio bitstreams\n"
+					"  --a2dp-skip-decoding\t\tdeliver received encoded frames to sink PCM\n"
 					"  --sbc-quality=NB\tset SBC encoder quality\n"
+					"  --sbc-abr\t\tenable SBC adaptive bit rate\n"
+					"  --sbc-abr-min-bitpool=NB\tset SBC ABR lowest bit-pool\n"
 #if ENABLE_AAC
 					"  --aac-afterburner\tenable FDK AAC afterburner\n"
 					"  --aac-latm-version=NB\tselect LATM syntax version\n"
 					"  --aac-vbr-mode=NB\tselect FDK AAC encoder VBR mode\n"
+					"  --aac-abr\t\tenable AAC adaptive bit rate\n"
+					"  --aac-abr-min-bitrate=BPS\tset AAC ABR lowest bit rate\n"
 #endif
 #if ENABLE_LDAC
 					"  --ldac-abr\t\tenable LDAC adaptive bit rate\n"
@@ -270,6 +299,36 @@ int main(int argc, char **argv) {
 			break;
 		}
 
+		case 30 /* --io-workers=NUM */ :
+			config.io_workers = atoi(optarg);
+			if (config.io_workers > IO_ENGINE_WORKERS_MAX) {
+				error("Invalid number of IO workers [0, %d]: %s", IO_ENGINE_WORKERS_MAX, optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 31 /* --io-sched-policy=NAME */ :
+			if ((config.io_sched.policy = io_sched_policy_from_string(optarg)) == -1) {
+				error("Invalid scheduling policy {other, fifo, rr}: %s", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 32 /* --io-sched-priority=NB */ :
+			config.io_sched.priority = atoi(optarg);
+			if (config.io_sched.priority < 1 || config.io_sched.priority > 99) {
+				error("Invalid real-time priority [1, 99]: %s", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 33 /* --io-cpu-affinity=LIST */ :
+			if (io_sched_cpus_from_string(optarg, &config.io_sched.cpus) == -1) {
+				error("Invalid list of CPUs: %s", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 34 /* --io-mlock */ :
+			config.io_mlock = true;
+			break;
+
 		case 6 /* --a2dp-force-mono */ :
 			config.a2dp.force_mono = true;
 			break;
@@ -282,9 +341,22 @@ int main(int argc, char **argv) {
 		case 9 /* --a2dp-volume */ :
 			config.a2dp.volume = true;
 			break;
+		case 27 /* --a2dp-jitter-buffer=MS */ :
+			config.a2dp.jitter_buffer = atoi(optarg);
+			if (config.a2dp.jitter_buffer > 500) {
+				error("Invalid jitter buffer depth [0, 500]: %s", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 28 /* --a2dp-drift-compensation */ :
+			config.a2dp.drift_compensation = true;
+			break;
 		case 20 /* --a2dp-skip-encoding */ :
 			config.a2dp.skip_encoding = true;
 			break;
+		case 29 /* --a2dp-skip-decoding */ :
+			config.a2dp.skip_decoding = true;
+			break;
 #if CODEC_CONFIG_PARAMETERS_INTEROP_TESTING
 		case 21 /* --a2dp-samplingFrequency */ :
 			config.a2dp.samplingFrequency = atoi(optarg);
@@ -322,6 +394,18 @@ int main(int argc, char **argv) {
 				config.a2dp.force_44100 = true;
 			}
 			break;
+		case 16 /* --sbc-abr */ :
+			config.sbc_abr = true;
+			break;
+		case 17 /* --sbc-abr-min-bitpool=NB */ : {
+			const int bitpool = atoi(optarg);
+			if (bitpool < SBC_MIN_BITPOOL || bitpool > SBC_MAX_BITPOOL) {
+				error("Invalid bit-pool value [%d, %d]: %s", SBC_MIN_BITPOOL, SBC_MAX_BITPOOL, optarg);
+				return EXIT_FAILURE;
+			}
+			config.sbc_abr_min_bitpool = bitpool;
+			break;
+		}
 
 #if ENABLE_AAC
 		case 4 /* --aac-afterburner */ :
@@ -341,6 +425,18 @@ int main(int argc, char **argv) {
 				return EXIT_FAILURE;
 			}
 			break;
+		case 18 /* --aac-abr */ :
+			config.aac_abr = true;
+			break;
+		case 19 /* --aac-abr-min-bitrate=BPS */ : {
+			const int bitrate = atoi(optarg);
+			if (bitrate < AAC_BITRATE_MIN || bitrate > AAC_BITRATE_MAX) {
+				error("Invalid bit rate value [%d, %d]: %s", AAC_BITRATE_MIN, AAC_BITRATE_MAX, optarg);
+				return EXIT_FAILURE;
+			}
+			config.aac_abr_min_bitrate = bitrate;
+			break;
+		}
 #endif
 
 #if ENABLE_LDAC
@@ -386,6 +482,28 @@ int main(int argc, char **argv) {
 	}
 #endif
 
+	/* Real-time priority without the real-time policy implies the FIFO
+	 * policy, and vice versa, the real-time policy gets default priority. */
+	if (config.io_sched.policy == SCHED_OTHER && config.io_sched.priority != 0)
+		config.io_sched.policy = SCHED_FIFO;
+	if (config.io_sched.policy != SCHED_OTHER && config.io_sched.priority == 0)
+		config.io_sched.priority = IO_SCHED_PRIORITY_DEFAULT;
+
+	if (config.io_mlock &&
+			mlockall(MCL_CURRENT | MCL_FUTURE) == -1) {
+		warn("Couldn't lock memory: %s", strerror(errno));
+		config.io_mlock = false;
+	}
+
+	if (config.io_workers > 0) {
+		if (io_engine_init(config.io_workers) == -1) {
+			error("Couldn't create IO engine workers: %s", strerror(errno));
+			return EXIT_FAILURE;
+		}
+		info("IO engine hosts A2DP sink transports only, "
+				"decoded audio is discarded upon PCM overrun");
+	}
+
 	/* initialize random number generator */
 	srandom(time(NULL));
 
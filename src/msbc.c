@@ -100,13 +100,18 @@ int msbc_init(struct esco_msbc *msbc) {
 #endif
 
 	if (!msbc->initialized) {
-		if (ffb_init_uint8_t(&msbc->dec_data, sizeof(esco_msbc_frame_t) * 3) == -1)
+		if (ffb_init_ring_uint8_t(&msbc->dec_data, sizeof(esco_msbc_frame_t) * 3) == -1)
 			goto fail;
-		if (ffb_init_int16_t(&msbc->dec_pcm, MSBC_CODESAMPLES * 2) == -1)
+		/* Make room for the decoded frame preceded by up to three concealed
+		 * ones - the maximum gap which can be detected with the 2-bit H2
+		 * sequence number. */
+		if (ffb_init_ring_int16_t(&msbc->dec_pcm, MSBC_CODESAMPLES * 4) == -1)
 			goto fail;
-		if (ffb_init_uint8_t(&msbc->enc_data, sizeof(esco_msbc_frame_t) * 3) == -1)
+		if (plc_init(&msbc->dec_plc, 1, 16000) == -1)
 			goto fail;
-		if (ffb_init_int16_t(&msbc->enc_pcm, MSBC_CODESAMPLES * 2) == -1)
+		if (ffb_init_ring_uint8_t(&msbc->enc_data, sizeof(esco_msbc_frame_t) * 3) == -1)
+			goto fail;
+		if (ffb_init_ring_int16_t(&msbc->enc_pcm, MSBC_CODESAMPLES * 2) == -1)
 			goto fail;
 	}
 
@@ -114,6 +119,7 @@ int msbc_init(struct esco_msbc *msbc) {
 	ffb_rewind(&msbc->dec_pcm);
 	ffb_rewind(&msbc->enc_data);
 	ffb_rewind(&msbc->enc_pcm);
+	plc_reset(&msbc->dec_plc);
 
 	msbc->dec_seq_initialized = false;
 	msbc->enc_seq_number = 0;
@@ -142,6 +148,10 @@ void msbc_finish(struct esco_msbc *msbc) {
 	ffb_free(&msbc->enc_data);
 	ffb_free(&msbc->enc_pcm);
 
+	if (msbc->dec_plc.concealed > 0)
+		debug("mSBC PLC concealed frames: %u", msbc->dec_plc.concealed);
+	plc_free(&msbc->dec_plc);
+
 }
 
 /**
@@ -176,18 +186,30 @@ int msbc_decode(struct esco_msbc *msbc) {
 	}
 	else if (_seq != ++msbc->dec_seq_number) {
 		warn("Missing mSBC packet: %u != %u", _seq, msbc->dec_seq_number);
+		/* Synthesize lost frames, as long as there is a room for them and
+		 * for the frame which is about to be decoded. */
+		unsigned int missing = (_seq - msbc->dec_seq_number) & 0x3;
+		for (; missing > 0 && output_len >= MSBC_CODESIZE * 2; missing--) {
+			plc_conceal(&msbc->dec_plc, output, MSBC_CODESAMPLES);
+			ffb_seek(&msbc->dec_pcm, MSBC_CODESAMPLES);
+			output += MSBC_CODESAMPLES;
+			output_len -= MSBC_CODESIZE;
+		}
 		msbc->dec_seq_number = _seq;
-		/* TODO: Implement PLC. */
 	}
 
 	ssize_t len;
 	if ((len = sbc_decode(&msbc->dec_sbc, frame->payload, sizeof(frame->payload),
 					output, output_len, NULL)) < 0) {
 		errno = -len, rv = -1;
+		/* Corrupted frame will be concealed when the next frame arrives,
+		 * because its sequence number will not match the expected one. */
+		msbc->dec_seq_number--;
 		input += 1;
 		goto final;
 	}
 
+	plc_good(&msbc->dec_plc, output, MSBC_CODESAMPLES);
 	ffb_seek(&msbc->dec_pcm, MSBC_CODESAMPLES);
 	input += sizeof(*frame);
 	rv = 1;
@@ -21,6 +21,7 @@
 
 #include <sbc/sbc.h>
 
+#include "plc.h"
 #include "shared/ffb.h"
 
 /* HFP uses SBC encoding with precisely defined parameters. Hence, the size
@@ -56,6 +57,8 @@ struct esco_msbc {
 	ffb_t dec_data;
 	/* buffer for outgoing PCM samples */
 	ffb_t dec_pcm;
+	/* concealment of lost and corrupted frames */
+	struct plc dec_plc;
 
 	/* buffer for incoming PCM samples */
 	ffb_t enc_pcm;
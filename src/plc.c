@@ -0,0 +1,253 @@
+/*
+ * BlueALSA - plc.c
+ * Copyright (c) 2016-2020 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#include "plc.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Append PCM frames to the history buffer. */
+static void plc_hist_push(struct plc *plc, const int16_t *pcm, size_t frames) {
+
+	const size_t channels = plc->channels;
+
+	if (frames >= plc->hist_len) {
+		memcpy(plc->hist, pcm + (frames - plc->hist_len) * channels,
+				plc->hist_len * channels * sizeof(*pcm));
+		return;
+	}
+
+	memmove(plc->hist, plc->hist + frames * channels,
+			(plc->hist_len - frames) * channels * sizeof(*pcm));
+	memcpy(plc->hist + (plc->hist_len - frames) * channels, pcm,
+			frames * channels * sizeof(*pcm));
+
+}
+
+/**
+ * Get the channels sum of the history frame. */
+static int32_t plc_hist_sample(const struct plc *plc, size_t frame) {
+	const int16_t *hist = plc->hist + frame * plc->channels;
+	int32_t sample = 0;
+	for (size_t c = 0; c < plc->channels; c++)
+		sample += hist[c];
+	return sample;
+}
+
+/**
+ * Select the period for the signal extension.
+ *
+ * The last frames of the history are used as a template, which is compared
+ * with the history shifted by every possible lag. The lag with the highest
+ * normalized cross-correlation wins. */
+static void plc_find_lag(struct plc *plc) {
+
+	const size_t tmpl = plc->hist_len - plc->tmpl_len;
+	double tmpl_energy = 0;
+	double best_score = 0;
+	double best_energy = 0;
+	size_t best_lag = plc->lag_max;
+
+	for (size_t i = 0; i < plc->tmpl_len; i++) {
+		const double s = plc_hist_sample(plc, tmpl + i);
+		tmpl_energy += s * s;
+	}
+
+	for (size_t lag = plc->lag_min; lag <= plc->lag_max; lag++) {
+
+		double corr = 0;
+		double energy = 0;
+
+		for (size_t i = 0; i < plc->tmpl_len; i++) {
+			const double s = plc_hist_sample(plc, tmpl - lag + i);
+			corr += s * plc_hist_sample(plc, tmpl + i);
+			energy += s * s;
+		}
+
+		if (corr <= 0 || energy == 0)
+			continue;
+
+		const double score = corr / sqrt(energy);
+		if (score > best_score) {
+			best_score = score;
+			best_energy = energy;
+			best_lag = lag;
+		}
+
+	}
+
+	plc->lag = best_lag;
+	plc->pos = 0;
+
+	/* match the amplitude of the template, but never amplify */
+	plc->scale = 1.0;
+	if (best_energy > 0 && tmpl_energy < best_energy)
+		plc->scale = sqrt(tmpl_energy / best_energy);
+
+}
+
+/**
+ * Synthesize PCM frames by the periodic extension of the history.
+ *
+ * @param plc The PLC structure.
+ * @param pcm Destination buffer for the interleaved PCM frames.
+ * @param frames The number of frames to synthesize.
+ * @param commit If false, the synthesis state is not updated. */
+static void plc_synthesize(struct plc *plc, int16_t *pcm, size_t frames, bool commit) {
+
+	/* Keep the first 10 ms intact, then fade out to silence within 50 ms,
+	 * since repeating the same period for a long time sounds artificial. */
+	const size_t fade_start = plc->samplerate / 100;
+	const size_t fade_len = plc->samplerate / 20;
+	const size_t channels = plc->channels;
+
+	size_t pos = plc->pos;
+	size_t synth = plc->synth;
+
+	for (size_t i = 0; i < frames; i++) {
+
+		float gain = plc->scale;
+		if (synth > fade_start)
+			gain *= synth - fade_start < fade_len ?
+				1.0 - (float)(synth - fade_start) / fade_len : 0.0;
+
+		const int16_t *src = plc->hist + (plc->hist_len - plc->lag + pos) * channels;
+		for (size_t c = 0; c < channels; c++)
+			pcm[i * channels + c] = src[c] * gain;
+
+		if (++pos == plc->lag)
+			pos = 0;
+		synth++;
+
+	}
+
+	if (commit) {
+		plc->pos = pos;
+		plc->synth = synth;
+	}
+
+}
+
+/**
+ * Initialize packet loss concealment.
+ *
+ * @param plc The PLC structure.
+ * @param channels The number of channels of the interleaved PCM stream.
+ * @param samplerate The PCM sampling frequency.
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int plc_init(
+		struct plc *plc,
+		unsigned int channels,
+		unsigned int samplerate) {
+
+	memset(plc, 0, sizeof(*plc));
+	plc->channels = channels;
+	plc->samplerate = samplerate;
+
+	/* Search for the period in the range of the human voice pitch, from
+	 * 2.5 ms (400 Hz) up to 20 ms (50 Hz), using 4 ms long template. */
+	plc->lag_min = samplerate / 400;
+	plc->lag_max = samplerate / 50;
+	plc->tmpl_len = samplerate / 250;
+	plc->ola_len = samplerate / 500;
+	plc->hist_len = plc->lag_max + plc->tmpl_len;
+
+	if ((plc->hist = calloc(plc->hist_len * channels, sizeof(*plc->hist))) == NULL ||
+			(plc->ola = calloc(plc->ola_len * channels, sizeof(*plc->ola))) == NULL) {
+		plc_free(plc);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Release resources allocated by the PLC.
+ *
+ * It is safe to call this function on a zero-initialized structure. */
+void plc_free(
+		struct plc *plc) {
+	free(plc->hist);
+	plc->hist = NULL;
+	free(plc->ola);
+	plc->ola = NULL;
+}
+
+/**
+ * Forget the signal history, e.g. upon the stream restart. */
+void plc_reset(
+		struct plc *plc) {
+	memset(plc->hist, 0, plc->hist_len * plc->channels * sizeof(*plc->hist));
+	plc->lag = 0;
+	plc->synth = 0;
+}
+
+/**
+ * Process correctly received PCM frames.
+ *
+ * If the preceding frames were concealed, the beginning of the given PCM
+ * frames will be overlap-added with the synthesized signal, so there will
+ * be no discontinuity.
+ *
+ * @param plc The PLC structure.
+ * @param pcm Interleaved PCM frames, which might be modified in place.
+ * @param frames The number of PCM frames. */
+void plc_good(
+		struct plc *plc,
+		int16_t *pcm,
+		size_t frames) {
+
+	if (plc->lag != 0) {
+
+		const size_t channels = plc->channels;
+		const size_t len = plc->ola_len < frames ? plc->ola_len : frames;
+
+		for (size_t i = 0; i < len; i++) {
+			const float w = (float)(i + 1) / (plc->ola_len + 1);
+			for (size_t c = 0; c < channels; c++) {
+				const size_t ii = i * channels + c;
+				pcm[ii] = plc->ola[ii] * (1.0 - w) + pcm[ii] * w;
+			}
+		}
+
+		plc->lag = 0;
+		plc->synth = 0;
+
+	}
+
+	plc_hist_push(plc, pcm, frames);
+
+}
+
+/**
+ * Synthesize PCM frames in place of the lost codec frame.
+ *
+ * @param plc The PLC structure.
+ * @param pcm Destination buffer for the interleaved PCM frames.
+ * @param frames The number of PCM frames in the lost codec frame. */
+void plc_conceal(
+		struct plc *plc,
+		int16_t *pcm,
+		size_t frames) {
+
+	if (plc->lag == 0)
+		plc_find_lag(plc);
+
+	plc_synthesize(plc, pcm, frames, true);
+	/* prepare continuation for the overlap-add with the next good frame */
+	plc_synthesize(plc, plc->ola, plc->ola_len, false);
+
+	plc->concealed++;
+
+}
@@ -0,0 +1,79 @@
+/*
+ * BlueALSA - plc.h
+ * Copyright (c) 2016-2020 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#ifndef BLUEALSA_PLC_H_
+#define BLUEALSA_PLC_H_
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Packet loss concealment.
+ *
+ * Missing audio is synthesized by the periodic extension of the recently
+ * received signal. The period is selected by the waveform similarity search
+ * and the synthesized signal is overlap-added with the first good frame
+ * received after the loss. Long losses are faded out to silence. */
+struct plc {
+
+	/* interleaved PCM stream layout */
+	unsigned int channels;
+	unsigned int samplerate;
+
+	/* similarity search parameters (in PCM frames) */
+	size_t lag_min;
+	size_t lag_max;
+	size_t tmpl_len;
+	size_t ola_len;
+
+	/* history of the good signal */
+	int16_t *hist;
+	size_t hist_len;
+	/* continuation of the synthesized signal */
+	int16_t *ola;
+
+	/* selected period and the current position within it */
+	size_t lag;
+	size_t pos;
+	float scale;
+	/* number of PCM frames synthesized during the current loss */
+	size_t synth;
+
+	/* the number of concealed codec frames */
+	unsigned int concealed;
+
+};
+
+int plc_init(
+		struct plc *plc,
+		unsigned int channels,
+		unsigned int samplerate);
+
+void plc_free(
+		struct plc *plc);
+
+void plc_reset(
+		struct plc *plc);
+
+void plc_good(
+		struct plc *plc,
+		int16_t *pcm,
+		size_t frames);
+
+void plc_conceal(
+		struct plc *plc,
+		int16_t *pcm,
+		size_t frames);
+
+#endif
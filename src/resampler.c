@@ -0,0 +1,185 @@
+/*
+ * BlueALSA - resampler.c
+ * Copyright (c) 2016-2020 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#include "resampler.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RESAMPLER_TAPS (2 * RESAMPLER_ZEROS)
+
+/**
+ * Compute windowed sinc filter coefficients for all phases.
+ *
+ * Since the conversion ratio is expected to be close to 1, the filter cut-off
+ * frequency is not adjusted for the downsampling. Thanks to that, the zero
+ * phase filter passes the input signal intact. */
+static void resampler_init_filter(float *filter) {
+
+	for (size_t p = 0; p <= RESAMPLER_PHASES; p++) {
+
+		float *h = &filter[p * RESAMPLER_TAPS];
+		const double frac = (double)p / RESAMPLER_PHASES;
+		double sum = 0;
+
+		for (size_t k = 0; k < RESAMPLER_TAPS; k++) {
+			const double x = (double)k - (RESAMPLER_ZEROS - 1) - frac;
+			const double xc = M_PI * x;
+			const double sinc = xc == 0 ? 1.0 : sin(xc) / xc;
+			/* Blackman window */
+			const double wx = M_PI * x / RESAMPLER_ZEROS;
+			const double w = fabs(x) >= RESAMPLER_ZEROS ? 0.0 :
+				0.42 + 0.5 * cos(wx) + 0.08 * cos(2 * wx);
+			sum += h[k] = sinc * w;
+		}
+
+		/* normalize DC gain of every phase */
+		for (size_t k = 0; k < RESAMPLER_TAPS; k++)
+			h[k] /= sum;
+
+	}
+
+}
+
+/**
+ * Initialize resampler.
+ *
+ * @param rs The resampler structure.
+ * @param channels The number of channels of the interleaved PCM stream.
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int resampler_init(
+		struct resampler *rs,
+		unsigned int channels) {
+
+	memset(rs, 0, sizeof(*rs));
+	rs->channels = channels;
+	rs->ratio = 1.0;
+
+	if ((rs->filter = malloc((RESAMPLER_PHASES + 1) * RESAMPLER_TAPS *
+					sizeof(*rs->filter))) == NULL ||
+			(rs->buffer = malloc((RESAMPLER_TAPS + RESAMPLER_BLOCK) * channels *
+					sizeof(*rs->buffer))) == NULL) {
+		resampler_free(rs);
+		return -1;
+	}
+
+	resampler_init_filter(rs->filter);
+	resampler_reset(rs);
+
+	return 0;
+}
+
+/**
+ * Release resources allocated by the resampler.
+ *
+ * It is safe to call this function on a zero-initialized structure. */
+void resampler_free(
+		struct resampler *rs) {
+	free(rs->filter);
+	rs->filter = NULL;
+	free(rs->buffer);
+	rs->buffer = NULL;
+}
+
+/**
+ * Forget the signal history, e.g. upon the stream restart. */
+void resampler_reset(
+		struct resampler *rs) {
+	/* prepend silence, so the first output frame can be interpolated */
+	rs->buffer_len = RESAMPLER_ZEROS - 1;
+	memset(rs->buffer, 0, rs->buffer_len * rs->channels * sizeof(*rs->buffer));
+	rs->pos = RESAMPLER_ZEROS - 1;
+}
+
+/**
+ * Set the output rate to the input rate ratio. */
+void resampler_set_ratio(
+		struct resampler *rs,
+		double ratio) {
+	rs->ratio = ratio;
+}
+
+/**
+ * Resample interleaved PCM frames.
+ *
+ * Due to the filter delay, the output is RESAMPLER_ZEROS frames behind the
+ * input. The output buffer shall be big enough to hold all frames generated
+ * from the given input, otherwise superfluous input frames are discarded.
+ *
+ * @param rs The initialized resampler structure.
+ * @param in Input PCM frames.
+ * @param in_frames The number of input PCM frames.
+ * @param out Output buffer.
+ * @param out_frames The capacity of the output buffer in PCM frames.
+ * @return This function returns the number of generated PCM frames. */
+size_t resampler_process(
+		struct resampler *rs,
+		const int16_t *in,
+		size_t in_frames,
+		int16_t *out,
+		size_t out_frames) {
+
+	const size_t channels = rs->channels;
+	const double step = 1.0 / rs->ratio;
+	size_t frames = 0;
+
+	for (;;) {
+
+		const size_t len = RESAMPLER_TAPS + RESAMPLER_BLOCK - rs->buffer_len;
+		const size_t samples = (in_frames < len ? in_frames : len) * channels;
+		float *tail = rs->buffer + rs->buffer_len * channels;
+
+		for (size_t i = 0; i < samples; i++)
+			tail[i] = in[i];
+		rs->buffer_len += samples / channels;
+		in_frames -= samples / channels;
+		in += samples;
+
+		while (frames < out_frames && (size_t)rs->pos + RESAMPLER_ZEROS < rs->buffer_len) {
+
+			const size_t i0 = rs->pos;
+			const double phase = (rs->pos - i0) * RESAMPLER_PHASES;
+			const size_t p = phase;
+			const float w = phase - p;
+
+			const float *h0 = &rs->filter[p * RESAMPLER_TAPS];
+			const float *h1 = h0 + RESAMPLER_TAPS;
+			const float *x = rs->buffer + (i0 - (RESAMPLER_ZEROS - 1)) * channels;
+
+			for (size_t c = 0; c < channels; c++) {
+				float sample = 0;
+				for (size_t k = 0; k < RESAMPLER_TAPS; k++)
+					sample += (h0[k] + (h1[k] - h0[k]) * w) * x[k * channels + c];
+				sample = lrintf(sample);
+				out[frames * channels + c] =
+					sample > INT16_MAX ? INT16_MAX : sample < INT16_MIN ? INT16_MIN : sample;
+			}
+
+			rs->pos += step;
+			frames++;
+
+		}
+
+		/* discard consumed frames, but keep the filter history */
+		const size_t drop = (size_t)rs->pos - (RESAMPLER_ZEROS - 1);
+		memmove(rs->buffer, rs->buffer + drop * channels,
+				(rs->buffer_len - drop) * channels * sizeof(*rs->buffer));
+		rs->buffer_len -= drop;
+		rs->pos -= drop;
+
+		if (in_frames == 0 || frames == out_frames)
+			break;
+
+	}
+
+	return frames;
+}
@@ -0,0 +1,75 @@
+/*
+ * BlueALSA - resampler.h
+ * Copyright (c) 2016-2020 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#ifndef BLUEALSA_RESAMPLER_H_
+#define BLUEALSA_RESAMPLER_H_
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* number of sinc zero crossings on each side of the filter */
+#define RESAMPLER_ZEROS 8
+/* number of filter phases between two input frames */
+#define RESAMPLER_PHASES 128
+/* number of input frames processed in one go */
+#define RESAMPLER_BLOCK 1024
+
+/**
+ * Variable-ratio resampler.
+ *
+ * This resampler is intended for small conversion ratio adjustments, e.g.
+ * the clock drift compensation. Output frames are interpolated with the
+ * windowed sinc filter, which coefficients are linearly interpolated between
+ * precomputed filter phases. */
+struct resampler {
+
+	/* interleaved PCM stream layout */
+	unsigned int channels;
+
+	/* output rate to input rate ratio */
+	double ratio;
+
+	/* filter coefficients for every phase */
+	float *filter;
+
+	/* input frames history */
+	float *buffer;
+	size_t buffer_len;
+	/* position of the next output frame within the history */
+	double pos;
+
+};
+
+int resampler_init(
+		struct resampler *rs,
+		unsigned int channels);
+
+void resampler_free(
+		struct resampler *rs);
+
+void resampler_reset(
+		struct resampler *rs);
+
+void resampler_set_ratio(
+		struct resampler *rs,
+		double ratio);
+
+size_t resampler_process(
+		struct resampler *rs,
+		const int16_t *in,
+		size_t in_frames,
+		int16_t *out,
+		size_t out_frames);
+
+#endif
@@ -102,6 +102,79 @@ uint8_t sbc_a2dp_get_bitpool(const a2dp_sbc_t *conf, unsigned int quality) {
 	return MIN(MAX(conf->min_bitpool, bitpool), conf->max_bitpool);
 }
 
+/**
+ * Initialize SBC adaptive bit rate controller.
+ *
+ * @param abr Address of the ABR structure.
+ * @param bitpool_min The lowest bit-pool which can be used.
+ * @param bitpool_max The target bit-pool value, which is also the initial
+ *   one. It will never be exceeded. */
+void sbc_abr_init(struct sbc_abr *abr, uint8_t bitpool_min, uint8_t bitpool_max) {
+	abr->bitpool = bitpool_max;
+	abr->bitpool_min = MIN(bitpool_min, bitpool_max);
+	abr->bitpool_max = bitpool_max;
+	abr->holdoff = 0;
+	abr->drained = 0;
+}
+
+/**
+ * Update SBC bit-pool based on the BT socket queue history.
+ *
+ * The queue is considered congested when on average more than two packets
+ * are waiting for the transmission. In such case the bit-pool is lowered by
+ * one eighth. When the queue is (almost) empty for a longer period of time,
+ * the bit-pool is raised by a small step. After every adjustment, the
+ * controller waits until the whole history is refreshed, so the next
+ * decision is based on the new bit rate.
+ *
+ * @param abr Address of the initialized ABR structure.
+ * @param coutq The history of the queued bytes.
+ * @param coutq_len The number of elements in the history.
+ * @param packet_size The size of a single BT packet (writing MTU).
+ * @return If the bit-pool has been changed, this function returns 1.
+ *   Otherwise, 0 is returned. */
+int sbc_abr_update(struct sbc_abr *abr, const int *coutq, size_t coutq_len,
+		size_t packet_size) {
+
+	if (abr->holdoff > 0) {
+		abr->holdoff--;
+		return 0;
+	}
+
+	size_t i;
+	unsigned long sum = 0;
+	for (i = 0; i < coutq_len; i++)
+		sum += coutq[i];
+
+	const uint8_t bitpool = abr->bitpool;
+	const size_t avg = sum / coutq_len;
+
+	if (avg > 2 * packet_size) {
+		/* BT link is congested - quickly reduce bit rate */
+		const uint8_t step = MAX(bitpool / 8, 2);
+		abr->bitpool = MAX(bitpool - step, abr->bitpool_min);
+		abr->drained = 0;
+	}
+	else if (avg < packet_size / 2) {
+		/* Raise bit rate if the link was drained for at least four full
+		 * history periods. Such hysteresis prevents bit-pool oscillation. */
+		if (++abr->drained >= 4 * coutq_len) {
+			abr->bitpool = MIN(bitpool + 2, abr->bitpool_max);
+			abr->drained = 0;
+		}
+	}
+	else
+		abr->drained = 0;
+
+	if (abr->bitpool == bitpool)
+		return 0;
+
+	abr->holdoff = coutq_len;
+	info("SBC bit-pool adjusted: %u -> %u (queued bytes: %zu)",
+			bitpool, abr->bitpool, avg);
+	return 1;
+}
+
 #if DEBUG
 void sbc_print_internals(const sbc_t *sbc) {
 
@@ -15,6 +15,7 @@
 # include <config.h>
 #endif
 
+#include <stddef.h>
 #include <stdint.h>
 #include <sbc/sbc.h>
 #include "a2dp-codecs.h"
@@ -26,6 +27,28 @@
 
 uint8_t sbc_a2dp_get_bitpool(const a2dp_sbc_t *conf, unsigned int quality);
 
+/**
+ * SBC adaptive bit rate controller.
+ *
+ * The bit-pool is lowered when the BT link can not keep up with the data
+ * rate (queued bytes grow), and it is slowly raised back toward the target
+ * value when the link drains. */
+struct sbc_abr {
+	/* current bit-pool value */
+	uint8_t bitpool;
+	/* allowed bit-pool range */
+	uint8_t bitpool_min;
+	uint8_t bitpool_max;
+	/* number of updates to skip before the next adjustment */
+	unsigned int holdoff;
+	/* number of consecutive updates with drained link */
+	unsigned int drained;
+};
+
+void sbc_abr_init(struct sbc_abr *abr, uint8_t bitpool_min, uint8_t bitpool_max);
+int sbc_abr_update(struct sbc_abr *abr, const int *coutq, size_t coutq_len,
+		size_t packet_size);
+
 #if DEBUG
 void sbc_print_internals(const sbc_t *sbc);
 #endif
@@ -220,14 +220,16 @@ void *sco_thread(struct ba_transport *t) {
 #endif
 
 	/* these buffers shall be bigger than the SCO MTU */
-	if (ffb_init_uint8_t(&bt_in, 128) == -1 ||
-			ffb_init_uint8_t(&bt_out, 128) == -1) {
+	if (ffb_init_ring_uint8_t(&bt_in, 128) == -1 ||
+			ffb_init_ring_uint8_t(&bt_out, 128) == -1) {
 		error("Couldn't create data buffer: %s", strerror(errno));
 		goto fail_ffb;
 	}
 
 	int poll_timeout = -1;
 	struct asrsync asrs = { .frames = 0 };
+	/* CVSD speaker frames (mono) read since the last timer arming */
+	size_t cvsd_frames = 0;
 	struct pollfd pfds[] = {
 		{ t->sig_fd[0], POLLIN, 0 },
 		/* SCO socket */
@@ -236,8 +238,17 @@ void *sco_thread(struct ba_transport *t) {
 		/* PCM FIFO */
 		{ -1, POLLIN, 0 },
 		{ -1, POLLOUT, 0 },
+		/* pacing timer */
+		{ -1, POLLIN, 0 },
 	};
 
+	if (asrsync_timer_create(&asrs) == -1) {
+		error("Couldn't create pacing timer: %s", strerror(errno));
+		goto fail_ffb;
+	}
+
+	pthread_cleanup_push(PTHREAD_CLEANUP(asrsync_timer_free), &asrs);
+
 	debug("Starting SCO loop: %s", ba_transport_type_to_string(t->type));
 	for (;;) {
 
@@ -247,6 +258,7 @@ void *sco_thread(struct ba_transport *t) {
 		/* fresh-start for file descriptors polling */
 		pfds[1].fd = pfds[2].fd = -1;
 		pfds[3].fd = pfds[4].fd = -1;
+		pfds[5].fd = asrs.timer_armed ? asrs.timer_fd : -1;
 
 #if ENABLE_MSBC
 		if (initialize_msbc && codec == HFP_CODEC_MSBC) {
@@ -265,7 +277,8 @@ void *sco_thread(struct ba_transport *t) {
 				pfds[1].fd = t->bt_fd;
 			if (ffb_len_out(&bt_out) >= t->mtu_write)
 				pfds[2].fd = t->bt_fd;
-			if (t->bt_fd != -1 && ffb_len_in(&bt_out) >= t->mtu_write)
+			if (t->bt_fd != -1 && ffb_len_in(&bt_out) >= t->mtu_write &&
+					!asrs.timer_armed)
 				pfds[3].fd = t->sco.spk_pcm.fd;
 			if (ffb_len_out(&bt_in) > 0)
 				pfds[4].fd = t->sco.mic_pcm.fd;
@@ -280,7 +293,8 @@ void *sco_thread(struct ba_transport *t) {
 				pfds[1].fd = t->bt_fd;
 			if (ffb_blen_out(&msbc.enc_data) >= t->mtu_write)
 				pfds[2].fd = t->bt_fd;
-			if (t->bt_fd != -1 && ffb_blen_in(&msbc.enc_pcm) >= t->mtu_write)
+			if (t->bt_fd != -1 && ffb_blen_in(&msbc.enc_pcm) >= t->mtu_write &&
+					!asrs.timer_armed)
 				pfds[3].fd = t->sco.spk_pcm.fd;
 			if (ffb_blen_out(&msbc.dec_pcm) > 0)
 				pfds[4].fd = t->sco.mic_pcm.fd;
@@ -309,6 +323,9 @@ void *sco_thread(struct ba_transport *t) {
 
 		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
 
+		if (pfds[5].revents & POLLIN)
+			asrsync_timer_ack(&asrs);
+
 		if (pfds[0].revents & POLLIN) {
 			/* dispatch incoming event */
 			switch (ba_transport_recv_signal(t)) {
@@ -494,6 +511,7 @@ retry_sco_write:
 			case HFP_CODEC_CVSD:
 			default:
 				ffb_seek(&bt_out, samples * sizeof(int16_t));
+				cvsd_frames += samples;
 				break;
 #if ENABLE_MSBC
 			case HFP_CODEC_MSBC:
@@ -550,20 +568,26 @@ retry_sco_write:
 
 		}
 
-		/* keep data transfer at a constant bit rate */
-		switch (codec) {
-		case HFP_CODEC_CVSD:
-		default:
-			asrsync_sync(&asrs, t->mtu_write / sizeof(int16_t));
-			break;
+		/* Keep data transfer at a constant bit rate. Instead of sleeping, the
+		 * pacing timer is armed, so incoming SCO data can still be processed
+		 * while the speaker PCM is throttled. */
+		if (!asrs.timer_armed)
+			switch (codec) {
+			case HFP_CODEC_CVSD:
+			default:
+				if (cvsd_frames > 0) {
+					asrsync_timer_arm(&asrs, cvsd_frames);
+					cvsd_frames = 0;
+				}
+				break;
 #if ENABLE_MSBC
-		case HFP_CODEC_MSBC:
-			if (msbc.enc_frames > 0) {
-				asrsync_sync(&asrs, msbc.enc_frames * MSBC_CODESAMPLES);
-				msbc.enc_frames = 0;
-			}
+			case HFP_CODEC_MSBC:
+				if (msbc.enc_frames > 0) {
+					asrsync_timer_arm(&asrs, msbc.enc_frames * MSBC_CODESAMPLES);
+					msbc.enc_frames = 0;
+				}
 #endif
-		}
+			}
 
 		/* update busy delay (encoding overhead) */
 		const unsigned int delay = asrsync_get_busy_usec(&asrs) / 100;
@@ -573,6 +597,7 @@ retry_sco_write:
 
 fail:
 	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	pthread_cleanup_pop(1);
 fail_ffb:
 #if ENABLE_MSBC
 	pthread_cleanup_pop(1);
@@ -359,6 +359,44 @@ dbus_bool_t bluealsa_dbus_open_pcm(
 	return rv;
 }
 
+/**
+ * Open BlueALSA PCM stream using shared memory transport. */
+dbus_bool_t bluealsa_dbus_open_pcm_shm(
+		struct ba_dbus_ctx *ctx,
+		const char *pcm_path,
+		int *fd_shm,
+		int *fd_shm_data,
+		int *fd_shm_space,
+		int *fd_pcm_ctrl,
+		DBusError *error) {
+
+	DBusMessage *msg;
+	if ((msg = dbus_message_new_method_call(ctx->ba_service, pcm_path,
+					BLUEALSA_INTERFACE_PCM, "OpenSharedMemory")) == NULL) {
+		dbus_set_error(error, DBUS_ERROR_NO_MEMORY, NULL);
+		return FALSE;
+	}
+
+	DBusMessage *rep;
+	if ((rep = dbus_connection_send_with_reply_and_block(ctx->conn,
+					msg, DBUS_TIMEOUT_USE_DEFAULT, error)) == NULL) {
+		dbus_message_unref(msg);
+		return FALSE;
+	}
+
+	dbus_bool_t rv;
+	rv = dbus_message_get_args(rep, error,
+			DBUS_TYPE_UNIX_FD, fd_shm,
+			DBUS_TYPE_UNIX_FD, fd_shm_data,
+			DBUS_TYPE_UNIX_FD, fd_shm_space,
+			DBUS_TYPE_UNIX_FD, fd_pcm_ctrl,
+			DBUS_TYPE_INVALID);
+
+	dbus_message_unref(rep);
+	dbus_message_unref(msg);
+	return rv;
+}
+
 /**
  * Open BlueALSA RFCOMM socket for dispatching AT commands. */
 dbus_bool_t bluealsa_dbus_open_rfcomm(
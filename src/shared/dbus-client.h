@@ -141,6 +141,15 @@ dbus_bool_t bluealsa_dbus_open_pcm(
 		int *fd_pcm_ctrl,
 		DBusError *error);
 
+dbus_bool_t bluealsa_dbus_open_pcm_shm(
+		struct ba_dbus_ctx *ctx,
+		const char *pcm_path,
+		int *fd_shm,
+		int *fd_shm_data,
+		int *fd_shm_space,
+		int *fd_pcm_ctrl,
+		DBusError *error);
+
 dbus_bool_t bluealsa_dbus_open_rfcomm(
 		struct ba_dbus_ctx *ctx,
 		const char *rfcomm_path,
@@ -12,6 +12,8 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 /**
  * Allocate/reallocate resources for the FIFO-like buffer.
@@ -22,6 +24,10 @@
  * @return On success this function returns 0, otherwise -1. */
 int ffb_init(ffb_t *ffb, size_t nmemb, size_t size) {
 
+	/* release ring mapping, if any */
+	if (ffb->ring_size != 0)
+		ffb_free(ffb);
+
 	void *ptr;
 	if ((ptr = realloc(ffb->data, nmemb * size)) == NULL)
 		return -1;
@@ -34,10 +40,81 @@ int ffb_init(ffb_t *ffb, size_t nmemb, size_t size) {
 }
 
 /**
- * Free resources allocated with the ffb_init().
+ * Allocate/reallocate resources for the ring buffer.
+ *
+ * The ring buffer memory is mapped twice into consecutive virtual address
+ * space regions, so the data stored in the buffer is always available as
+ * a contiguous memory block, even if it wraps around the end of the ring.
+ * With such layout, the ffb_shift() function does not need to move data.
+ *
+ * The ring memory size is rounded up to the page size, however, number of
+ * elements available for writing is limited by the nmemb parameter. If the
+ * mirrored mapping can not be created, the linear buffer is used instead.
+ *
+ * @param ffb Pointer to the buffer structure.
+ * @param nmemb Number of elements in the buffer.
+ * @param size The size of the element.
+ * @return On success this function returns 0, otherwise -1. */
+int ffb_init_ring(ffb_t *ffb, size_t nmemb, size_t size) {
+
+#if HAVE_MEMFD_CREATE
+
+	const size_t page_size = sysconf(_SC_PAGESIZE);
+	const size_t ring_size = (nmemb * size + page_size - 1) / page_size * page_size;
+	uint8_t *ptr = MAP_FAILED;
+	int fd = -1;
+
+	/* wrapping must not break the elements alignment */
+	if (ring_size == 0 || ring_size % size != 0)
+		goto fallback;
+
+	if ((fd = memfd_create("ffb", MFD_CLOEXEC)) == -1 ||
+			ftruncate(fd, ring_size) == -1)
+		goto fallback;
+
+	/* reserve address space for both ring copies */
+	if ((ptr = mmap(NULL, ring_size * 2, PROT_NONE,
+					MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+		goto fallback;
+
+	if (mmap(ptr, ring_size, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+			mmap(ptr + ring_size, ring_size, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+		goto fallback;
+
+	close(fd);
+	ffb_free(ffb);
+
+	ffb->data = ffb->tail = ffb->ring = ptr;
+	ffb->ring_size = ring_size;
+	ffb->nmemb = nmemb;
+	ffb->size = size;
+
+	return 0;
+
+fallback:
+	if (ptr != MAP_FAILED)
+		munmap(ptr, ring_size * 2);
+	if (fd != -1)
+		close(fd);
+
+#endif
+
+	return ffb_init(ffb, nmemb, size);
+}
+
+/**
+ * Free resources allocated with the ffb_init() or ffb_init_ring().
  *
  * @param ffb Pointer to initialized buffer structure. */
 void ffb_free(ffb_t *ffb) {
+	if (ffb->ring_size != 0) {
+		munmap(ffb->ring, ffb->ring_size * 2);
+		ffb->ring = ffb->data = NULL;
+		ffb->ring_size = 0;
+		return;
+	}
 	if (ffb->data == NULL)
 		return;
 	free(ffb->data);
@@ -59,6 +136,18 @@ int ffb_shift(ffb_t *ffb, size_t nmemb) {
 	if (blen_shift > blen_out)
 		blen_shift = blen_out;
 
+	if (ffb->ring_size != 0) {
+		/* In case of the ring buffer, simply advance the head pointer. Since
+		 * the memory is mirrored, we can move both pointers back by the ring
+		 * size when the head leaves the first copy of the ring. */
+		ffb->data = (uint8_t *)ffb->data + blen_shift;
+		if ((uint8_t *)ffb->data >= (uint8_t *)ffb->ring + ffb->ring_size) {
+			ffb->data = (uint8_t *)ffb->data - ffb->ring_size;
+			ffb->tail = (uint8_t *)ffb->tail - ffb->ring_size;
+		}
+		return blen_shift / ffb->size;
+	}
+
 	const size_t blen_move = blen_out - blen_shift;
 	memmove(ffb->data, (uint8_t *)ffb->data + blen_shift, blen_move);
 	ffb->tail = (uint8_t *)ffb->tail - blen_shift;
@@ -11,6 +11,10 @@
 #ifndef BLUEALSA_SHARED_FFB_H_
 #define BLUEALSA_SHARED_FFB_H_
 
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
 #include <stddef.h>
 #include <stdint.h>
 
@@ -25,15 +29,25 @@ typedef struct {
 	size_t nmemb;
 	/* the size of each element */
 	size_t size;
+	/* pointer to the mirrored memory mapping */
+	void *ring;
+	/* size of the single ring mapping in bytes,
+	 * zero in case of the linear buffer */
+	size_t ring_size;
 } ffb_t;
 
 int ffb_init(ffb_t *ffb, size_t nmemb, size_t size);
+int ffb_init_ring(ffb_t *ffb, size_t nmemb, size_t size);
 void ffb_free(ffb_t *ffb);
 
 #define ffb_init_uint8_t(p, n) ffb_init(p, n, sizeof(uint8_t))
 #define ffb_init_int16_t(p, n) ffb_init(p, n, sizeof(int16_t))
 #define ffb_init_int32_t(p, n) ffb_init(p, n, sizeof(int32_t))
 
+#define ffb_init_ring_uint8_t(p, n) ffb_init_ring(p, n, sizeof(uint8_t))
+#define ffb_init_ring_int16_t(p, n) ffb_init_ring(p, n, sizeof(int16_t))
+#define ffb_init_ring_int32_t(p, n) ffb_init_ring(p, n, sizeof(int32_t))
+
 /**
  * Get number of unite blocks available for writing. */
 #define ffb_len_in(p) (ffb_blen_in(p) / (p)->size)
@@ -10,8 +10,68 @@
 
 #include "shared/rt.h"
 
+#include <errno.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
 
+/**
+ * Calculate the absolute deadline for the current frame counter. */
+static void asrsync_update_deadline(struct asrsync *asrs) {
+
+	const unsigned int rate = asrs->rate;
+	const uint32_t frames = asrs->frames;
+
+	asrs->ts_deadline.tv_sec = asrs->ts0.tv_sec + frames / rate;
+	asrs->ts_deadline.tv_nsec = asrs->ts0.tv_nsec +
+		(uint64_t)(frames % rate) * 1000000000 / rate;
+
+	if (asrs->ts_deadline.tv_nsec >= 1000000000) {
+		asrs->ts_deadline.tv_sec++;
+		asrs->ts_deadline.tv_nsec -= 1000000000;
+	}
+
+}
+
+/**
+ * Account lateness of the current cycle.
+ *
+ * The wake-up time is taken from the sync time-stamp, so it has to be
+ * updated before calling this function. */
+static void asrsync_update_lateness(struct asrsync *asrs, bool missed) {
+
+	struct timespec ts;
+	uint64_t lateness = 0;
+
+	/* 64-bit arithmetic, so it will not overflow on 32-bit targets */
+	if (difftimespec(&asrs->ts_deadline, &asrs->ts, &ts) > 0)
+		lateness = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+
+	asrs->lateness.cycles++;
+	asrs->lateness.missed += missed;
+	asrs->lateness.last = lateness;
+	asrs->lateness.total += lateness;
+	if (lateness > asrs->lateness.max)
+		asrs->lateness.max = lateness;
+
+}
+
+/**
+ * Start (initialize) time synchronization.
+ *
+ * This function resets the frame counter and the lateness statistics. The
+ * pacing timer (if created) is left intact.
+ *
+ * @param asrs Pointer to the time synchronization structure.
+ * @param rate Synchronization sampling rate. */
+void asrsync_init(struct asrsync *asrs, unsigned int rate) {
+	asrs->rate = rate;
+	clock_gettime(ASRSYNC_CLOCK, &asrs->ts0);
+	asrs->ts = asrs->ts0;
+	asrs->frames = 0;
+	memset(&asrs->lateness, 0, sizeof(asrs->lateness));
+}
 
 /**
  * Synchronize time with the sampling rate.
@@ -21,6 +81,8 @@
  * 2. In order to prevent frame counter overflow (for more information see
  *   the asrsync structure definition), this counter should be initialized
  *   (zeroed) upon every transfer stop.
+ * 3. This function sleeps until the absolute deadline, so the wake-up
+ *   latency does not accumulate over consecutive calls.
  *
  * @param asrs Pointer to the time synchronization structure.
  * @param frames Number of frames since the last call to this function.
@@ -30,30 +92,126 @@
  *   set to indicate the error. */
 int asrsync_sync(struct asrsync *asrs, unsigned int frames) {
 
-	const unsigned int rate = asrs->rate;
-	struct timespec ts_rate;
 	struct timespec ts;
-	int rv = 0;
+	int err;
 
 	asrs->frames += frames;
-	frames = asrs->frames;
+	asrsync_update_deadline(asrs);
 
-	ts_rate.tv_sec = frames / rate;
-	ts_rate.tv_nsec = 1000000000 / rate * (frames % rate);
-
-	gettimestamp(&ts);
+	clock_gettime(ASRSYNC_CLOCK, &ts);
 	/* calculate delay since the last sync */
 	difftimespec(&asrs->ts, &ts, &asrs->ts_busy);
 
 	/* maintain constant rate */
-	difftimespec(&asrs->ts0, &ts, &ts);
-	if (difftimespec(&ts, &ts_rate, &asrs->ts_idle) > 0) {
-		nanosleep(&asrs->ts_idle, NULL);
-		rv = 1;
+	if (difftimespec(&ts, &asrs->ts_deadline, &asrs->ts_idle) <= 0) {
+		asrs->ts = ts;
+		asrsync_update_lateness(asrs, true);
+		return 0;
+	}
+
+	while ((err = clock_nanosleep(ASRSYNC_CLOCK, TIMER_ABSTIME,
+					&asrs->ts_deadline, NULL)) == EINTR)
+		continue;
+
+	clock_gettime(ASRSYNC_CLOCK, &asrs->ts);
+	asrsync_update_lateness(asrs, false);
+
+	if (err != 0) {
+		errno = err;
+		return -1;
+	}
+
+	return 1;
+}
+
+/**
+ * Create timer for the poll() based synchronization.
+ *
+ * @param asrs Pointer to the time synchronization structure.
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int asrsync_timer_create(struct asrsync *asrs) {
+	asrs->timer_armed = false;
+	if ((asrs->timer_fd = timerfd_create(ASRSYNC_CLOCK, TFD_CLOEXEC | TFD_NONBLOCK)) == -1)
+		return -1;
+	return 0;
+}
+
+/**
+ * Release timer created by the asrsync_timer_create(). */
+void asrsync_timer_free(struct asrsync *asrs) {
+	if (asrs->timer_fd != -1) {
+		close(asrs->timer_fd);
+		asrs->timer_fd = -1;
+	}
+}
+
+/**
+ * Synchronize time with the sampling rate without blocking.
+ *
+ * This function is a non-blocking counterpart of the asrsync_sync(). If
+ * the synchronization is required, the timer is armed with the absolute
+ * deadline and the caller shall wait for the timer file descriptor to
+ * become readable (e.g. by adding it to the poll() set). Afterwards, the
+ * asrsync_timer_ack() function shall be called.
+ *
+ * @param asrs Pointer to the time synchronization structure.
+ * @param frames Number of frames since the last call to this function.
+ * @return This function returns a positive value or zero respectively for
+ *   the case, when the timer has been armed or when waiting is not
+ *   necessary. If an error has occurred, -1 is returned and errno is set
+ *   to indicate the error. */
+int asrsync_timer_arm(struct asrsync *asrs, unsigned int frames) {
+
+	struct itimerspec its = { 0 };
+	struct timespec ts;
+
+	asrs->frames += frames;
+	asrsync_update_deadline(asrs);
+
+	clock_gettime(ASRSYNC_CLOCK, &ts);
+	difftimespec(&asrs->ts, &ts, &asrs->ts_busy);
+
+	if (difftimespec(&ts, &asrs->ts_deadline, &asrs->ts_idle) > 0) {
+		its.it_value = asrs->ts_deadline;
+		if (timerfd_settime(asrs->timer_fd, TFD_TIMER_ABSTIME, &its, NULL) == -1)
+			return -1;
+		asrs->timer_armed = true;
+		return 1;
+	}
+
+	/* Deadline has been missed, so there is no need to wait. Disarm the
+	 * timer, which will also clear pending expiration (if any). */
+	if (asrs->timer_armed) {
+		timerfd_settime(asrs->timer_fd, 0, &its, NULL);
+		asrs->timer_armed = false;
+	}
+
+	asrs->ts = ts;
+	asrsync_update_lateness(asrs, true);
+	return 0;
+}
+
+/**
+ * Acknowledge the timer expiration.
+ *
+ * @param asrs Pointer to the time synchronization structure.
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int asrsync_timer_ack(struct asrsync *asrs) {
+
+	uint64_t expirations;
+	if (read(asrs->timer_fd, &expirations, sizeof(expirations)) == -1 &&
+			errno != EAGAIN)
+		return -1;
+
+	if (asrs->timer_armed) {
+		asrs->timer_armed = false;
+		clock_gettime(ASRSYNC_CLOCK, &asrs->ts);
+		asrsync_update_lateness(asrs, false);
 	}
 
-	gettimestamp(&asrs->ts);
-	return rv;
+	return 0;
 }
 
 /**
@@ -11,10 +11,18 @@
 #ifndef BLUEALSA_SHARED_RT_H_
 #define BLUEALSA_SHARED_RT_H_
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <sys/time.h>
 #include <time.h>
 
+/**
+ * Clock used for the transfer pacing.
+ *
+ * Absolute deadlines are passed to the clock_nanosleep() and timerfd API,
+ * which do not support the CLOCK_MONOTONIC_RAW clock. */
+#define ASRSYNC_CLOCK CLOCK_MONOTONIC
+
 /**
  * Structure used for time synchronization.
  *
@@ -41,27 +49,51 @@ struct asrsync {
 	 * too much time spent outside of the sync function. */
 	struct timespec ts_idle;
 
-};
+	/* absolute deadline of the current cycle */
+	struct timespec ts_deadline;
 
-/**
- * Start (initialize) time synchronization.
- *
- * @param asrs Pointer to the time synchronization structure.
- * @param sr Synchronization sampling rate. */
-#define asrsync_init(asrs, sr) do { \
-		(asrs)->rate = sr; \
-		gettimestamp(&(asrs)->ts0); \
-		(asrs)->ts = (asrs)->ts0; \
-		(asrs)->frames = 0; \
-	} while (0)
+	/* Timer file descriptor, which can be added to the poll() set. It is
+	 * readable when the deadline of the armed cycle has passed. */
+	int timer_fd;
+	bool timer_armed;
+
+	/* Per-cycle lateness statistics in nanoseconds. The lateness is the
+	 * difference between the actual wake-up time and the deadline. */
+	struct {
+		unsigned int cycles;
+		/* cycles for which the deadline was missed before waiting */
+		unsigned int missed;
+		uint64_t last;
+		uint64_t max;
+		uint64_t total;
+	} lateness;
 
+};
+
+void asrsync_init(struct asrsync *asrs, unsigned int rate);
 int asrsync_sync(struct asrsync *asrs, unsigned int frames);
 
+int asrsync_timer_create(struct asrsync *asrs);
+void asrsync_timer_free(struct asrsync *asrs);
+int asrsync_timer_arm(struct asrsync *asrs, unsigned int frames);
+int asrsync_timer_ack(struct asrsync *asrs);
+
 /**
  * Get the number of microseconds spent outside of the sync function. */
 #define asrsync_get_busy_usec(asrs) \
 	((asrs)->ts_busy.tv_nsec / 1000)
 
+/**
+ * Get the average cycle lateness in microseconds. */
+#define asrsync_get_lateness_avg_usec(asrs) \
+	((asrs)->lateness.cycles == 0 ? 0 : \
+		(unsigned int)((asrs)->lateness.total / (asrs)->lateness.cycles / 1000))
+
+/**
+ * Get the maximal cycle lateness in microseconds. */
+#define asrsync_get_lateness_max_usec(asrs) \
+	((unsigned int)((asrs)->lateness.max / 1000))
+
 /**
  * Get system monotonic time-stamp.
  *
@@ -0,0 +1,306 @@
+/*
+ * BlueALSA - shm-ring.c
+ * Copyright (c) 2016-2020 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#include "shared/shm-ring.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * Map shared memory ring described by the given memory file descriptor. */
+static int shm_ring_map(struct shm_ring *ring, size_t size) {
+
+	const size_t page_size = sysconf(_SC_PAGESIZE);
+	uint8_t *ptr;
+
+	/* Reserve address space for the header page and two copies of the data
+	 * area. Then, replace reserved regions with the shared memory mappings. */
+	if ((ptr = mmap(NULL, page_size + size * 2, PROT_NONE,
+					MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+		return -1;
+
+	if (mmap(ptr, page_size, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_FIXED, ring->fd, 0) == MAP_FAILED ||
+			mmap(ptr + page_size, size, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_FIXED, ring->fd, page_size) == MAP_FAILED ||
+			mmap(ptr + page_size + size, size, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_FIXED, ring->fd, page_size) == MAP_FAILED) {
+		const int err = errno;
+		munmap(ptr, page_size + size * 2);
+		errno = err;
+		return -1;
+	}
+
+	ring->hdr = (struct shm_ring_header *)ptr;
+	ring->data = ptr + page_size;
+	ring->size = size;
+
+	return 0;
+}
+
+/**
+ * Create new shared memory ring buffer.
+ *
+ * @param ring Pointer to the ring structure.
+ * @param size The size of the ring data area in bytes. This value will
+ *   be rounded up to the page size.
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int shm_ring_create(struct shm_ring *ring, size_t size) {
+
+	const size_t page_size = sysconf(_SC_PAGESIZE);
+	size = (size + page_size - 1) / page_size * page_size;
+
+	ring->hdr = NULL;
+	ring->fd = ring->fd_data = ring->fd_space = -1;
+
+#if HAVE_MEMFD_CREATE
+	if ((ring->fd = memfd_create("bluealsa-pcm", MFD_CLOEXEC)) == -1)
+		goto fail;
+#else
+	errno = ENOTSUP;
+	goto fail;
+#endif
+
+	if (ftruncate(ring->fd, page_size + size) == -1)
+		goto fail;
+	if ((ring->fd_data = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) == -1 ||
+			(ring->fd_space = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) == -1)
+		goto fail;
+	if (shm_ring_map(ring, size) == -1)
+		goto fail;
+
+	ring->hdr->magic = SHM_RING_MAGIC;
+	ring->hdr->size = size;
+
+	return 0;
+
+fail:
+	shm_ring_free(ring);
+	return -1;
+}
+
+/**
+ * Attach to the shared memory ring buffer created by the other process.
+ *
+ * On success, the ring structure takes ownership of given descriptors.
+ *
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int shm_ring_attach(struct shm_ring *ring, int fd, int fd_data, int fd_space) {
+
+	const size_t page_size = sysconf(_SC_PAGESIZE);
+	struct shm_ring_header hdr;
+	struct stat st;
+
+	ring->hdr = NULL;
+	ring->fd = fd;
+	ring->fd_data = fd_data;
+	ring->fd_space = fd_space;
+
+	if (fstat(fd, &st) == -1 ||
+			pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+		goto fail;
+
+	if (hdr.magic != SHM_RING_MAGIC ||
+			hdr.size == 0 || hdr.size % page_size != 0 ||
+			(size_t)st.st_size < page_size + hdr.size) {
+		errno = EINVAL;
+		goto fail;
+	}
+
+	if (shm_ring_map(ring, hdr.size) == -1)
+		goto fail;
+
+	return 0;
+
+fail:
+	ring->fd = ring->fd_data = ring->fd_space = -1;
+	return -1;
+}
+
+/**
+ * Release resources associated with the ring buffer. */
+void shm_ring_free(struct shm_ring *ring) {
+	if (ring->hdr != NULL) {
+		munmap(ring->hdr, sysconf(_SC_PAGESIZE) + ring->size * 2);
+		ring->hdr = NULL;
+	}
+	if (ring->fd != -1) {
+		close(ring->fd);
+		ring->fd = -1;
+	}
+	if (ring->fd_data != -1) {
+		close(ring->fd_data);
+		ring->fd_data = -1;
+	}
+	if (ring->fd_space != -1) {
+		close(ring->fd_space);
+		ring->fd_space = -1;
+	}
+}
+
+/**
+ * Mark ring as closed and wake up the other side. */
+void shm_ring_close(struct shm_ring *ring) {
+	__atomic_store_n(&ring->hdr->closed, 1, __ATOMIC_RELEASE);
+	eventfd_write(ring->fd_data, 1);
+	eventfd_write(ring->fd_space, 1);
+}
+
+bool shm_ring_is_closed(const struct shm_ring *ring) {
+	return __atomic_load_n(&ring->hdr->closed, __ATOMIC_ACQUIRE) != 0;
+}
+
+/**
+ * Get consistent snapshot of ring indices.
+ *
+ * Both indices are stored in the shared memory, so either of them might be
+ * modified by the other process at any time. Indices are accessed with the
+ * sequentially consistent ordering, so the peer which is about to wait for
+ * a notification will either see the update, or it will be notified - see
+ * the shm_ring_notify_data() and shm_ring_notify_space() functions. If the distance between them
+ * exceeds the data area size, the ring is corrupted - using such indices
+ * would result in accessing memory outside of the ring mapping.
+ *
+ * @return On success this function returns 0. If the ring is corrupted,
+ *   -1 is returned and errno is set to EBADMSG. */
+static int shm_ring_get_indices(const struct shm_ring *ring, uint64_t *w, uint64_t *r) {
+	*w = __atomic_load_n(&ring->hdr->write_idx, __ATOMIC_SEQ_CST);
+	*r = __atomic_load_n(&ring->hdr->read_idx, __ATOMIC_SEQ_CST);
+	if (*w - *r > ring->size)
+		return errno = EBADMSG, -1;
+	return 0;
+}
+
+/**
+ * Notify the consumer about new data.
+ *
+ * The consumer waits for the notification only if it has drained the ring,
+ * so the eventfd is signaled only upon the empty to non-empty transition.
+ *
+ * @param ring Pointer to the ring structure.
+ * @param w The write index before the update. */
+static void shm_ring_notify_data(struct shm_ring *ring, uint64_t w) {
+	if (__atomic_load_n(&ring->hdr->read_idx, __ATOMIC_SEQ_CST) == w)
+		eventfd_write(ring->fd_data, 1);
+}
+
+/**
+ * Notify the producer about free space.
+ *
+ * The producer waits for the notification only if it has filled the ring,
+ * so the eventfd is signaled only upon the full to non-full transition.
+ *
+ * @param ring Pointer to the ring structure.
+ * @param r The read index before the update. */
+static void shm_ring_notify_space(struct shm_ring *ring, uint64_t r) {
+	if (__atomic_load_n(&ring->hdr->write_idx, __ATOMIC_SEQ_CST) - r == ring->size)
+		eventfd_write(ring->fd_space, 1);
+}
+
+/**
+ * Get the number of bytes available for reading.
+ *
+ * @return On success this function returns the number of bytes. If the ring
+ *   is corrupted, -1 is returned and errno is set to EBADMSG. */
+ssize_t shm_ring_avail_read(const struct shm_ring *ring) {
+	uint64_t w, r;
+	if (shm_ring_get_indices(ring, &w, &r) == -1)
+		return -1;
+	return w - r;
+}
+
+/**
+ * Get the number of bytes available for writing.
+ *
+ * @return On success this function returns the number of bytes. If the ring
+ *   is corrupted, -1 is returned and errno is set to EBADMSG. */
+ssize_t shm_ring_avail_write(const struct shm_ring *ring) {
+	uint64_t w, r;
+	if (shm_ring_get_indices(ring, &w, &r) == -1)
+		return -1;
+	return ring->size - (w - r);
+}
+
+/**
+ * Read data from the ring buffer.
+ *
+ * If the ring was full, the producer is notified about the free space.
+ *
+ * @return On success this function returns the number of bytes read, which
+ *   might be less than requested. If the ring is corrupted, -1 is returned
+ *   and errno is set to EBADMSG. This function does not block. */
+ssize_t shm_ring_read(struct shm_ring *ring, void *buffer, size_t len) {
+
+	uint64_t w, r;
+	if (shm_ring_get_indices(ring, &w, &r) == -1)
+		return -1;
+
+	if (len > w - r)
+		len = w - r;
+	if (len == 0)
+		return 0;
+
+	memcpy(buffer, ring->data + r % ring->size, len);
+	__atomic_store_n(&ring->hdr->read_idx, r + len, __ATOMIC_SEQ_CST);
+	shm_ring_notify_space(ring, r);
+
+	return len;
+}
+
+/**
+ * Write data to the ring buffer.
+ *
+ * If the ring was empty, the consumer is notified about the new data.
+ *
+ * @return On success this function returns the number of bytes written,
+ *   which might be less than requested. If the ring is corrupted, -1 is
+ *   returned and errno is set to EBADMSG. This function does not block. */
+ssize_t shm_ring_write(struct shm_ring *ring, const void *buffer, size_t len) {
+
+	uint64_t w, r;
+	if (shm_ring_get_indices(ring, &w, &r) == -1)
+		return -1;
+
+	if (len > ring->size - (w - r))
+		len = ring->size - (w - r);
+	if (len == 0)
+		return 0;
+
+	memcpy(ring->data + w % ring->size, buffer, len);
+	__atomic_store_n(&ring->hdr->write_idx, w + len, __ATOMIC_SEQ_CST);
+	shm_ring_notify_data(ring, w);
+
+	return len;
+}
+
+/**
+ * Drop all data available for reading.
+ *
+ * @return On success this function returns the number of dropped bytes. If
+ *   the ring is corrupted, -1 is returned and errno is set to EBADMSG. */
+ssize_t shm_ring_drop(struct shm_ring *ring) {
+
+	uint64_t w, r;
+	if (shm_ring_get_indices(ring, &w, &r) == -1)
+		return -1;
+
+	if (w != r) {
+		__atomic_store_n(&ring->hdr->read_idx, w, __ATOMIC_SEQ_CST);
+		shm_ring_notify_space(ring, r);
+	}
+
+	return w - r;
+}
@@ -0,0 +1,80 @@
+/*
+ * BlueALSA - shm-ring.h
+ * Copyright (c) 2016-2020 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#ifndef BLUEALSA_SHARED_SHMRING_H_
+#define BLUEALSA_SHARED_SHMRING_H_
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define SHM_RING_MAGIC 0x42414C52
+
+/**
+ * Layout of the shared memory ring header.
+ *
+ * Indices are free-running byte counters. The write index is modified by
+ * the producer only and the read index is modified by the consumer only,
+ * so no locking is required. Indices are placed in separate cache lines
+ * in order to prevent false sharing. The distance between indices shall
+ * never exceed the data area size, otherwise the ring is corrupted. */
+struct shm_ring_header {
+	uint32_t magic;
+	/* size of the data area in bytes */
+	uint32_t size;
+	/* set by either side upon closing */
+	uint32_t closed;
+	uint64_t write_idx __attribute__ ((aligned(64)));
+	uint64_t read_idx __attribute__ ((aligned(64)));
+};
+
+/**
+ * Shared memory ring buffer with eventfd notifications.
+ *
+ * Data area is mapped twice into consecutive virtual memory regions, so
+ * both readable and writable parts of the ring are always contiguous. Data
+ * is copied into and out of the ring, i.e. every side does a single copy.
+ *
+ * Notifications are edge-triggered: the data eventfd is signaled when the
+ * ring becomes non-empty and the space eventfd is signaled when the ring
+ * becomes non-full. Hence, the side which is about to wait shall consume
+ * the notification and check the ring again before polling the eventfd. */
+struct shm_ring {
+	struct shm_ring_header *hdr;
+	uint8_t *data;
+	size_t size;
+	/* memory file descriptor */
+	int fd;
+	/* eventfd signaled by the producer when the ring becomes non-empty */
+	int fd_data;
+	/* eventfd signaled by the consumer when the ring becomes non-full */
+	int fd_space;
+};
+
+int shm_ring_create(struct shm_ring *ring, size_t size);
+int shm_ring_attach(struct shm_ring *ring, int fd, int fd_data, int fd_space);
+void shm_ring_free(struct shm_ring *ring);
+
+void shm_ring_close(struct shm_ring *ring);
+bool shm_ring_is_closed(const struct shm_ring *ring);
+
+ssize_t shm_ring_avail_read(const struct shm_ring *ring);
+ssize_t shm_ring_avail_write(const struct shm_ring *ring);
+
+ssize_t shm_ring_read(struct shm_ring *ring, void *buffer, size_t len);
+ssize_t shm_ring_write(struct shm_ring *ring, const void *buffer, size_t len);
+ssize_t shm_ring_drop(struct shm_ring *ring);
+
+#endif
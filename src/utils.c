@@ -490,7 +490,7 @@ const char *lame_encode_strerror(int err) {
 }
 #endif
 
-#if ENABLE_AAC
+#if ENABLE_AAC || ENABLE_USAC
 /**
  * Get string representation of the FDK-AAC decoder error code.
  *
@@ -616,6 +616,18 @@ void aptxbtenc_destroy_free(APTXENC enc) {
 		aptxbtenc_destroy(enc);
 	free(enc);
 }
+
+# if HAVE_APTX_DECODE
+/**
+ * Destroy apt-X decoder and free handler.
+ *
+ * @param dec Initialized decoder handler. */
+void aptxbtdec_destroy_free(APTXDEC dec) {
+	if (aptxbtdec_destroy != NULL)
+		aptxbtdec_destroy(dec);
+	free(dec);
+}
+# endif
 #endif
 
 #if ENABLE_APTX_HD
@@ -628,6 +640,18 @@ void aptxhdbtenc_destroy_free(APTXENC enc) {
 		aptxhdbtenc_destroy(enc);
 	free(enc);
 }
+
+# if HAVE_APTX_HD_DECODE
+/**
+ * Destroy apt-X HD decoder and free handler.
+ *
+ * @param dec Initialized decoder handler. */
+void aptxhdbtdec_destroy_free(APTXDEC dec) {
+	if (aptxhdbtdec_destroy != NULL)
+		aptxhdbtdec_destroy(dec);
+	free(dec);
+}
+# endif
 #endif
 
 #if ENABLE_LDAC
@@ -47,7 +47,7 @@ int a2dp_mpeg1_mp3_get_max_bitrate(uint16_t mask);
 const char *lame_encode_strerror(int err);
 #endif
 
-#if ENABLE_AAC
+#if ENABLE_AAC || ENABLE_USAC
 # include <fdk-aac/aacdecoder_lib.h>
 # include <fdk-aac/aacenc_lib.h>
 const char *aacdec_strerror(AAC_DECODER_ERROR err);
@@ -58,6 +58,12 @@ const char *aacenc_strerror(AACENC_ERROR err);
 # include <openaptx.h>
 void aptxbtenc_destroy_free(APTXENC enc);
 void aptxhdbtenc_destroy_free(APTXENC enc);
+# if HAVE_APTX_DECODE
+void aptxbtdec_destroy_free(APTXDEC dec);
+# endif
+# if HAVE_APTX_HD_DECODE
+void aptxhdbtdec_destroy_free(APTXDEC dec);
+# endif
 #endif
 
 #if ENABLE_LDAC
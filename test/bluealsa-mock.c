@@ -37,6 +37,10 @@
 
 #include "../src/a2dp.c"
 #include "../src/a2dp-audio.c"
+#include "../src/a2dp-bitstream.c"
+#include "../src/a2dp-jbuf.c"
+#include "../src/a2dp-sender.c"
+#include "../src/aac.c"
 #include "../src/at.c"
 #include "../src/audio.c"
 #include "../src/ba-adapter.c"
@@ -48,13 +52,18 @@
 #include "../src/bluealsa.c"
 #include "../src/dbus.c"
 #include "../src/hci.c"
+#include "../src/io-engine.c"
+#include "../src/io-sched.c"
 #include "../src/msbc.c"
+#include "../src/plc.c"
+#include "../src/resampler.c"
 #include "../src/sbc.c"
 #include "../src/sco.c"
 #include "../src/utils.c"
 #include "../src/shared/ffb.c"
 #include "../src/shared/log.c"
 #include "../src/shared/rt.c"
+#include "../src/shared/shm-ring.c"
 
 static const a2dp_sbc_t config_sbc_44100_stereo = {
 	.frequency = SBC_SAMPLING_FREQ_44100,
@@ -11,6 +11,7 @@
 #include <check.h>
 
 #include "../src/a2dp.c"
+#include "../src/a2dp-bitstream.c"
 #include "../src/bluealsa.c"
 #include "../src/shared/log.c"
 
@@ -22,6 +23,14 @@ START_TEST(test_a2dp_dir) {
 START_TEST(test_a2dp_codec_lookup) {
 	ck_assert_ptr_eq(a2dp_codec_lookup(A2DP_CODEC_SBC, A2DP_SOURCE), &a2dp_codec_source_sbc);
 	ck_assert_ptr_eq(a2dp_codec_lookup(0xFFFF, A2DP_SOURCE), NULL);
+#if ENABLE_USAC
+	/* there is no USAC encoder, so the source requires encoding to be skipped */
+	ck_assert_ptr_eq(a2dp_codec_lookup(A2DP_CODEC_MPEGD, A2DP_SOURCE), NULL);
+	ck_assert_ptr_eq(a2dp_codec_lookup(A2DP_CODEC_MPEGD, A2DP_SINK), &a2dp_codec_sink_usac);
+	config.a2dp.skip_encoding = true;
+	ck_assert_ptr_eq(a2dp_codec_lookup(A2DP_CODEC_MPEGD, A2DP_SOURCE), &a2dp_codec_source_usac);
+	config.a2dp.skip_encoding = false;
+#endif
 } END_TEST
 
 START_TEST(test_a2dp_get_vendor_codec_id) {
@@ -134,6 +143,151 @@ START_TEST(test_a2dp_select_configuration) {
 
 } END_TEST
 
+START_TEST(test_a2dp_bitstream_sbc) {
+
+	/* 44.1 kHz, 16 blocks, joint stereo, 8 subbands, bitpool 53 */
+	uint8_t buffer[3 + 119 + 10] = { 0x9C, 0x00, 0x00, 0x9C, 0x7D, 0x35 };
+	buffer[3 + 119] = 0x9C;
+	buffer[3 + 119 + 1] = 0x7D;
+	buffer[3 + 119 + 2] = 0x35;
+
+	struct a2dp_bitstream bs;
+	struct a2dp_bitstream_frame frame;
+	a2dp_bitstream_init(&bs, A2DP_BITSTREAM_SBC);
+
+	/* garbage (with invalid bitpool) before the frame shall be skipped */
+	ck_assert_int_eq(a2dp_bitstream_parse(&bs, buffer, sizeof(buffer), &frame), 3 + 119);
+	ck_assert_ptr_eq(frame.data, &buffer[3]);
+	ck_assert_int_eq(frame.len, 119);
+	ck_assert_int_eq(frame.pcm_frames, 16 * 8);
+
+	uint8_t payload[128];
+	ck_assert_int_eq(a2dp_bitstream_payload(&frame, payload, sizeof(payload)), 119);
+	ck_assert_int_eq(memcmp(payload, &buffer[3], 119), 0);
+
+	/* incomplete frame */
+	ck_assert_int_eq(a2dp_bitstream_parse(&bs, &buffer[3 + 119], 10, &frame), 0);
+	ck_assert_int_eq(frame.len, 0);
+
+} END_TEST
+
+START_TEST(test_a2dp_bitstream_mpeg) {
+
+	/* MPEG-1 Layer III, 128 kbps, 44.1 kHz, padding */
+	uint8_t buffer[418 + 4] = { 0xFF, 0xFB, 0x92, 0x00 };
+
+	struct a2dp_bitstream bs;
+	struct a2dp_bitstream_frame frame;
+	a2dp_bitstream_init(&bs, A2DP_BITSTREAM_MPEG);
+
+	ck_assert_int_eq(a2dp_bitstream_parse(&bs, buffer, sizeof(buffer), &frame), 418);
+	ck_assert_int_eq(frame.len, 418);
+	ck_assert_int_eq(frame.pcm_frames, 1152);
+
+	uint8_t payload[2048];
+	ck_assert_int_eq(a2dp_bitstream_payload(&frame, payload, 100), -1);
+	ck_assert_int_eq(a2dp_bitstream_payload(&frame, payload, sizeof(payload)), 418);
+	ck_assert_int_eq(memcmp(payload, buffer, 418), 0);
+
+	/* MPEG-2 Layer III, 64 kbps, 22.05 kHz */
+	uint8_t buffer2[208 + 4] = { 0xFF, 0xF3, 0x80, 0x00 };
+	ck_assert_int_eq(a2dp_bitstream_parse(&bs, buffer2, sizeof(buffer2), &frame), 208);
+	ck_assert_int_eq(frame.pcm_frames, 576);
+
+	/* free format is not supported */
+	const uint8_t free_format[] = { 0xFF, 0xFB, 0x02, 0x00, 0x00 };
+	ck_assert_int_eq(a2dp_bitstream_parse(&bs, free_format, sizeof(free_format), &frame), 2);
+	ck_assert_int_eq(frame.len, 0);
+
+} END_TEST
+
+START_TEST(test_a2dp_bitstream_latm) {
+
+	/* ADTS: MPEG-4 AAC LC, 44.1 kHz, stereo, 10 bytes of raw data */
+	const uint8_t adts[7 + 10] = {
+		0xFF, 0xF1, 0x50, 0x80, 0x02, 0x3F, 0xFC,
+		0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09 };
+
+	struct a2dp_bitstream bs;
+	struct a2dp_bitstream_frame frame;
+	uint8_t payload[64];
+	uint8_t loas[64];
+	ssize_t len;
+
+	a2dp_bitstream_init(&bs, A2DP_BITSTREAM_LATM);
+	ck_assert_int_eq(a2dp_bitstream_parse(&bs, adts, sizeof(adts), &frame), sizeof(adts));
+	ck_assert_int_eq(frame.len, sizeof(adts));
+	ck_assert_int_eq(frame.pcm_frames, 1024);
+	ck_assert_int_eq(frame.adts, true);
+
+	/* audioMuxElement with StreamMuxConfig: 0x40 0x00 0x24 0x20 (shifted by
+	 * the useSameStreamMux bit), followed by the payload length and data */
+	ck_assert_int_eq(len = a2dp_bitstream_payload(&frame, payload, sizeof(payload)), 17);
+	const uint8_t mux[] = { 0x20, 0x00, 0x12, 0x10 };
+	ck_assert_int_eq(memcmp(payload, mux, sizeof(mux)), 0);
+
+	/* converted frame shall be parsed back from the LOAS framing */
+	loas[0] = 0x56;
+	loas[1] = 0xE0 | len >> 8;
+	loas[2] = len & 0xFF;
+	memcpy(&loas[3], payload, len);
+
+	a2dp_bitstream_init(&bs, A2DP_BITSTREAM_LATM);
+	ck_assert_int_eq(a2dp_bitstream_parse(&bs, loas, 3 + len, &frame), 3 + len);
+	ck_assert_int_eq(frame.len, 3 + len);
+	ck_assert_int_eq(frame.pcm_frames, 1024);
+	ck_assert_int_eq(frame.adts, false);
+	ck_assert_int_eq(a2dp_bitstream_latm_pcm_frames(&bs, payload, len), 1024);
+
+	uint8_t payload2[64];
+	ck_assert_int_eq(a2dp_bitstream_payload(&frame, payload2, sizeof(payload2)), len);
+	ck_assert_int_eq(memcmp(payload, payload2, len), 0);
+
+	/* ADTS frame with multiple raw data blocks shall be dropped */
+	uint8_t adts_rdb[sizeof(adts)];
+	memcpy(adts_rdb, adts, sizeof(adts));
+	adts_rdb[6] |= 0x01;
+	ck_assert_int_eq(a2dp_bitstream_parse(&bs, adts_rdb, sizeof(adts_rdb), &frame), sizeof(adts_rdb));
+	ck_assert_int_eq(frame.len, 0);
+
+} END_TEST
+
+START_TEST(test_a2dp_bitstream_latm_usac) {
+
+	uint8_t loas[16] = { 0x56, 0xE0, sizeof(loas) - 3 };
+	struct bit_writer bw = { .data = &loas[3], .len = sizeof(loas) - 3 };
+
+	bit_writer_put(&bw, 0, 1 /* useSameStreamMux */);
+	bit_writer_put(&bw, 1, 1 /* audioMuxVersion */);
+	bit_writer_put(&bw, 0, 1 /* audioMuxVersionA */);
+	bit_writer_put(&bw, 0, 2 /* taraBufferFullness */);
+	bit_writer_put(&bw, 0xFF, 8);
+	bit_writer_put(&bw, 1, 1 /* allStreamsSameTimeFraming */);
+	bit_writer_put(&bw, 0, 6 /* numSubFrames */);
+	bit_writer_put(&bw, 0, 4 /* numProgram */);
+	bit_writer_put(&bw, 0, 3 /* numLayer */);
+	bit_writer_put(&bw, 0, 2 /* ascLen */);
+	bit_writer_put(&bw, 4, 8);
+	bit_writer_put(&bw, 31, 5 /* audioObjectType: USAC */);
+	bit_writer_put(&bw, 42 - 32, 6);
+	bit_writer_put(&bw, 3, 4 /* samplingFrequencyIndex */);
+	bit_writer_put(&bw, 2, 4 /* channelConfiguration */);
+	bit_writer_put(&bw, 3, 5 /* usacSamplingFrequencyIndex */);
+	bit_writer_put(&bw, 2, 3 /* coreSbrFrameLengthIndex */);
+	ck_assert_int_eq(bw.overrun, false);
+
+	struct a2dp_bitstream bs;
+	struct a2dp_bitstream_frame frame;
+	a2dp_bitstream_init(&bs, A2DP_BITSTREAM_LATM);
+
+	ck_assert_int_eq(a2dp_bitstream_parse(&bs, loas, sizeof(loas), &frame), sizeof(loas));
+	ck_assert_int_eq(frame.pcm_frames, 2048);
+
+	uint8_t payload[32];
+	ck_assert_int_eq(a2dp_bitstream_payload(&frame, payload, sizeof(payload)), sizeof(loas) - 3);
+
+} END_TEST
+
 int main(void) {
 
 	Suite *s = suite_create(__FILE__);
@@ -148,6 +302,10 @@ int main(void) {
 	tcase_add_test(tc, test_a2dp_check_configuration);
 	tcase_add_test(tc, test_a2dp_filter_capabilities);
 	tcase_add_test(tc, test_a2dp_select_configuration);
+	tcase_add_test(tc, test_a2dp_bitstream_sbc);
+	tcase_add_test(tc, test_a2dp_bitstream_mpeg);
+	tcase_add_test(tc, test_a2dp_bitstream_latm);
+	tcase_add_test(tc, test_a2dp_bitstream_latm_usac);
 
 	srunner_run_all(sr, CK_ENV);
 	int nf = srunner_ntests_failed(sr);
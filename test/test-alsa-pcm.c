@@ -408,6 +408,44 @@ START_TEST(test_capture_poll) {
 
 } END_TEST
 
+START_TEST(ba_test_capture_server_kill) {
+
+	if (pcm_device != NULL)
+		return;
+
+	fprintf(stderr, "\nSTART TEST: %s (%s:%d)\n", __func__, __FILE__, __LINE__);
+
+	unsigned int buffer_time = 200000;
+	unsigned int period_time = 25000;
+	snd_pcm_uframes_t buffer_size;
+	snd_pcm_uframes_t period_size;
+	snd_pcm_sframes_t frames = 0;
+	snd_pcm_t *pcm = NULL;
+	pid_t pid = -1;
+
+	ck_assert_int_eq(test_pcm_open(&pid, &pcm, SND_PCM_STREAM_CAPTURE), 0);
+	ck_assert_int_eq(set_hw_params(pcm, pcm_format, pcm_channels, pcm_sampling,
+				&buffer_time, &period_time), 0);
+	ck_assert_int_eq(snd_pcm_get_params(pcm, &buffer_size, &period_size), 0);
+	ck_assert_int_eq(snd_pcm_prepare(pcm), 0);
+	ck_assert_int_eq(snd_pcm_start(pcm), 0);
+
+	/* make sure that the transfer is running */
+	ck_assert_int_eq(snd_pcm_readi(pcm, buffer, period_size), period_size);
+
+	/* Kill the server without giving it a chance to close the PCM. The
+	 * IO thread shall not wait for new data forever. */
+	kill(pid, SIGKILL);
+	waitpid(pid, NULL, 0);
+
+	/* read samples until disconnection is detected */
+	while (frames >= 0)
+		frames = snd_pcm_readi(pcm, buffer, period_size);
+
+	ck_assert_int_eq(test_pcm_close(-1, pcm), 0);
+
+} END_TEST
+
 START_TEST(dump_playback) {
 	fprintf(stderr, "\nSTART TEST: %s (%s:%d)\n", __func__, __FILE__, __LINE__);
 
@@ -784,6 +822,45 @@ START_TEST(test_playback_underrun) {
  * - snd_pcm_wait(pcm, 10) = -19
  * - snd_pcm_close(pcm) = 0
  */
+START_TEST(ba_test_playback_server_kill) {
+
+	if (pcm_device != NULL)
+		return;
+
+	fprintf(stderr, "\nSTART TEST: %s (%s:%d)\n", __func__, __FILE__, __LINE__);
+
+	unsigned int buffer_time = 200000;
+	unsigned int period_time = 25000;
+	snd_pcm_uframes_t buffer_size;
+	snd_pcm_uframes_t period_size;
+	snd_pcm_sframes_t frames = 0;
+	snd_pcm_t *pcm = NULL;
+	pid_t pid = -1;
+	size_t i;
+
+	ck_assert_int_eq(test_pcm_open(&pid, &pcm, SND_PCM_STREAM_PLAYBACK), 0);
+	ck_assert_int_eq(set_hw_params(pcm, pcm_format, pcm_channels, pcm_sampling,
+				&buffer_time, &period_time), 0);
+	ck_assert_int_eq(snd_pcm_get_params(pcm, &buffer_size, &period_size), 0);
+	ck_assert_int_eq(snd_pcm_prepare(pcm), 0);
+
+	/* fill-in entire PCM buffer, so the transfer is started */
+	for (i = 0; i <= buffer_size / period_size; i++)
+		ck_assert_int_eq(snd_pcm_writei(pcm, test_sine_s16le(period_size), period_size), period_size);
+
+	/* Kill the server without giving it a chance to close the PCM. The
+	 * IO thread shall not wait for the free space forever. */
+	kill(pid, SIGKILL);
+	waitpid(pid, NULL, 0);
+
+	/* write samples until disconnection is detected */
+	while (frames >= 0)
+		frames = snd_pcm_writei(pcm, test_sine_s16le(period_size), period_size);
+
+	ck_assert_int_eq(test_pcm_close(-1, pcm), 0);
+
+} END_TEST
+
 START_TEST(reference_playback_device_unplug) {
 	fprintf(stderr, "\nSTART TEST: %s (%s:%d)\n", __func__, __FILE__, __LINE__);
 
@@ -929,6 +1006,7 @@ int main(int argc, char *argv[]) {
 	tcase_add_test(tc_capture, test_capture_pause);
 	tcase_add_test(tc_capture, test_capture_overrun);
 	tcase_add_test(tc_capture, test_capture_poll);
+	tcase_add_test(tc_capture, ba_test_capture_server_kill);
 
 	TCase *tc_playback = tcase_create("playback");
 	tcase_add_test(tc_playback, dump_playback);
@@ -939,6 +1017,7 @@ int main(int argc, char *argv[]) {
 	tcase_add_test(tc_playback, test_playback_reset);
 	tcase_add_test(tc_playback, test_playback_underrun);
 	tcase_add_test(tc_playback, ba_test_playback_device_unplug);
+	tcase_add_test(tc_playback, ba_test_playback_server_kill);
 
 	TCase *tc_unplug = tcase_create("unplug");
 	tcase_add_test(tc_unplug, reference_playback_device_unplug);
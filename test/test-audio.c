@@ -9,10 +9,43 @@
  */
 
 #include <check.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
 
 #include "../src/audio.c"
+#include "../src/resampler.c"
 #include "../src/shared/defs.h"
 
+static bool benchmark = false;
+
+/**
+ * Get all kernel sets which can be used on the current CPU. */
+static size_t get_audio_kernels(const struct audio_kernels *kernels[], size_t size) {
+	size_t n = 0;
+	kernels[n++] = &audio_kernels_generic;
+#if AUDIO_KERNELS_X86
+	__builtin_cpu_init();
+	if (n < size && __builtin_cpu_supports("sse2"))
+		kernels[n++] = &audio_kernels_sse2;
+	if (n < size && __builtin_cpu_supports("avx2"))
+		kernels[n++] = &audio_kernels_avx2;
+#endif
+#if AUDIO_KERNELS_NEON
+	if (n < size)
+		kernels[n++] = &audio_kernels_neon;
+#endif
+	return n;
+}
+
+static double get_elapsed_usec(const struct timespec *ts0) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec - ts0->tv_sec) * 1e6 + (ts.tv_nsec - ts0->tv_nsec) / 1e3;
+}
+
 START_TEST(test_audio_scale_s16_2le) {
 
 	const int16_t mute[] = { 0x0000, 0x0000, 0x0000, 0x0000 };
@@ -22,34 +55,39 @@ START_TEST(test_audio_scale_s16_2le) {
 	const int16_t half_l[] = { 0x1234 / 2, 0x2345, (int16_t)0xBCDE / 2, (int16_t)0xCDEF };
 	const int16_t half_r[] = { 0x1234, 0x2345 / 2, (int16_t)0xBCDE, (int16_t)0xCDEF / 2 };
 	const int16_t in[] = { 0x1234, 0x2345, (int16_t)0xBCDE, (int16_t)0xCDEF };
+	struct audio_gain g0, g1, g05;
 	int16_t tmp[ARRAYSIZE(in)];
 
+	audio_gain_init(&g0, 0);
+	audio_gain_init(&g1, AUDIO_GAIN_UNITY);
+	audio_gain_init(&g05, 0x40000000);
+
 	memcpy(tmp, in, sizeof(tmp));
-	audio_scale_s16_2le(tmp, 1, ARRAYSIZE(tmp), 0, 0);
+	audio_gain_scale_s16_2le(tmp, 1, ARRAYSIZE(tmp), &g0, NULL, 0);
 	ck_assert_int_eq(memcmp(tmp, mute, sizeof(mute)), 0);
 
 	memcpy(tmp, in, sizeof(tmp));
-	audio_scale_s16_2le(tmp, 1, ARRAYSIZE(tmp), 1.0, 0);
+	audio_gain_scale_s16_2le(tmp, 1, ARRAYSIZE(tmp), &g1, NULL, 0);
 	ck_assert_int_eq(memcmp(tmp, in, sizeof(in)), 0);
 
 	memcpy(tmp, in, sizeof(tmp));
-	audio_scale_s16_2le(tmp, 1, ARRAYSIZE(tmp), 0.5, 0);
+	audio_gain_scale_s16_2le(tmp, 1, ARRAYSIZE(tmp), &g05, NULL, 0);
 	ck_assert_int_eq(memcmp(tmp, half, sizeof(half)), 0);
 
 	memcpy(tmp, in, sizeof(tmp));
-	audio_scale_s16_2le(tmp, 2, ARRAYSIZE(tmp) / 2, 0, 1.0);
+	audio_gain_scale_s16_2le(tmp, 2, ARRAYSIZE(tmp) / 2, &g0, &g1, 0);
 	ck_assert_int_eq(memcmp(tmp, mute_l, sizeof(mute_l)), 0);
 
 	memcpy(tmp, in, sizeof(tmp));
-	audio_scale_s16_2le(tmp, 2, ARRAYSIZE(tmp) / 2, 1.0, 0);
+	audio_gain_scale_s16_2le(tmp, 2, ARRAYSIZE(tmp) / 2, &g1, &g0, 0);
 	ck_assert_int_eq(memcmp(tmp, mute_r, sizeof(mute_r)), 0);
 
 	memcpy(tmp, in, sizeof(tmp));
-	audio_scale_s16_2le(tmp, 2, ARRAYSIZE(tmp) / 2, 0.5, 1.0);
+	audio_gain_scale_s16_2le(tmp, 2, ARRAYSIZE(tmp) / 2, &g05, &g1, 0);
 	ck_assert_int_eq(memcmp(tmp, half_l, sizeof(half_l)), 0);
 
 	memcpy(tmp, in, sizeof(tmp));
-	audio_scale_s16_2le(tmp, 2, ARRAYSIZE(tmp) / 2, 1.0, 0.5);
+	audio_gain_scale_s16_2le(tmp, 2, ARRAYSIZE(tmp) / 2, &g1, &g05, 0);
 	ck_assert_int_eq(memcmp(tmp, half_r, sizeof(half_r)), 0);
 
 } END_TEST
@@ -61,27 +99,292 @@ START_TEST(test_audio_scale_s32_4le) {
 	const int32_t half[] = { 0x12345678 / 2, 0x23456789 / 2, 0x00123456 / 2, 0x00ABCDEF / 2 };
 	const int32_t half_r[] = { 0x12345678, 0x23456789 / 2, 0x00123456, 0x00ABCDEF / 2 };
 	const int32_t in[] = { 0x12345678, 0x23456789, 0x00123456, 0x00ABCDEF };
+	struct audio_gain g0, g1, g05;
 	int32_t tmp[ARRAYSIZE(in)];
 
+	audio_gain_init(&g0, 0);
+	audio_gain_init(&g1, AUDIO_GAIN_UNITY);
+	audio_gain_init(&g05, 0x40000000);
+
 	memcpy(tmp, in, sizeof(tmp));
-	audio_scale_s32_4le(tmp, 1, ARRAYSIZE(tmp), 0, 0);
+	audio_gain_scale_s32_4le(tmp, 1, ARRAYSIZE(tmp), &g0, NULL, 0);
 	ck_assert_int_eq(memcmp(tmp, mute, sizeof(mute)), 0);
 
 	memcpy(tmp, in, sizeof(tmp));
-	audio_scale_s32_4le(tmp, 2, ARRAYSIZE(tmp) / 2, 0, 1.0);
+	audio_gain_scale_s32_4le(tmp, 2, ARRAYSIZE(tmp) / 2, &g0, &g1, 0);
 	ck_assert_int_eq(memcmp(tmp, mute_l, sizeof(mute_l)), 0);
 
 	memcpy(tmp, in, sizeof(tmp));
-	audio_scale_s32_4le(tmp, 1, ARRAYSIZE(tmp), 0.5, 0);
+	audio_gain_scale_s32_4le(tmp, 1, ARRAYSIZE(tmp), &g05, NULL, 0);
 	ck_assert_int_eq(memcmp(tmp, half, sizeof(half)), 0);
 
 	memcpy(tmp, in, sizeof(tmp));
-	audio_scale_s32_4le(tmp, 2, ARRAYSIZE(tmp) / 2, 1.0, 0.5);
+	audio_gain_scale_s32_4le(tmp, 2, ARRAYSIZE(tmp) / 2, &g1, &g05, 0);
 	ck_assert_int_eq(memcmp(tmp, half_r, sizeof(half_r)), 0);
 
 } END_TEST
 
-int main(void) {
+START_TEST(test_audio_kernels) {
+
+	const struct audio_kernels *kernels[8];
+	size_t count = get_audio_kernels(kernels, ARRAYSIZE(kernels));
+
+	/* use odd number of samples, so the tail handling is covered as well */
+	int16_t in16[1027], ref16[ARRAYSIZE(in16)], tmp16[ARRAYSIZE(in16)];
+	int32_t in32[1027], ref32[ARRAYSIZE(in32)], tmp32[ARRAYSIZE(in32)];
+	size_t i, k;
+
+	srand(0);
+	for (i = 0; i < ARRAYSIZE(in16); i++)
+		in16[i] = rand();
+	for (i = 0; i < ARRAYSIZE(in32); i++)
+		in32[i] = rand() - RAND_MAX / 2;
+
+	const int32_t gains_q31[][2] = { { 0x40000000, 0x20000000 }, { 0x0FBE76C9, 0x7E560418 } };
+	for (size_t g = 0; g < ARRAYSIZE(gains_q31); g++) {
+
+		const int16_t ch1 = gains_q31[g][0] >> 16;
+		const int16_t ch2 = gains_q31[g][1] >> 16;
+
+		memcpy(ref16, in16, sizeof(ref16));
+		audio_scale_s16_q15_generic(ref16, ARRAYSIZE(ref16), ch1, ch2);
+		memcpy(ref32, in32, sizeof(ref32));
+		audio_scale_s32_q31_generic(ref32, ARRAYSIZE(ref32), gains_q31[g][0], gains_q31[g][1]);
+
+		for (k = 1; k < count; k++) {
+
+			memcpy(tmp16, in16, sizeof(tmp16));
+			kernels[k]->scale_s16_q15(tmp16, ARRAYSIZE(tmp16), ch1, ch2);
+			ck_assert_msg(memcmp(tmp16, ref16, sizeof(ref16)) == 0,
+					"S16 Q15 scale mismatch: %s", kernels[k]->name);
+
+			memcpy(tmp32, in32, sizeof(tmp32));
+			kernels[k]->scale_s32_q31(tmp32, ARRAYSIZE(tmp32), gains_q31[g][0], gains_q31[g][1]);
+			ck_assert_msg(memcmp(tmp32, ref32, sizeof(ref32)) == 0,
+					"S32 Q31 scale mismatch: %s", kernels[k]->name);
+
+		}
+
+	}
+
+	memcpy(ref32, in32, sizeof(ref32));
+	audio_mask_u32_generic((uint32_t *)ref32, ARRAYSIZE(ref32), 0xFFFF0000, 0x0000FFFF);
+	for (k = 1; k < count; k++) {
+		memcpy(tmp32, in32, sizeof(tmp32));
+		kernels[k]->mask_u32((uint32_t *)tmp32, ARRAYSIZE(tmp32), 0xFFFF0000, 0x0000FFFF);
+		ck_assert_msg(memcmp(tmp32, ref32, sizeof(ref32)) == 0,
+				"Mask mismatch: %s", kernels[k]->name);
+	}
+
+	/* deinterleave odd number of frames */
+	const size_t frames = ARRAYSIZE(in32) / 2;
+	int32_t ref_ch1[ARRAYSIZE(in32) / 2], ref_ch2[ARRAYSIZE(ref_ch1)];
+	int32_t tmp_ch1[ARRAYSIZE(ref_ch1)], tmp_ch2[ARRAYSIZE(ref_ch1)];
+
+	audio_deinterleave_s16_generic(in16, frames, ref_ch1, ref_ch2);
+	ck_assert_int_eq(ref_ch1[1], in16[2]);
+	ck_assert_int_eq(ref_ch2[1], in16[3]);
+	for (k = 1; k < count; k++) {
+		kernels[k]->deinterleave_s16(in16, frames, tmp_ch1, tmp_ch2);
+		ck_assert_msg(memcmp(tmp_ch1, ref_ch1, sizeof(ref_ch1)) == 0 &&
+				memcmp(tmp_ch2, ref_ch2, sizeof(ref_ch2)) == 0,
+				"S16 deinterleave mismatch: %s", kernels[k]->name);
+	}
+
+	audio_deinterleave_s32_generic(in32, frames, ref_ch1, ref_ch2);
+	ck_assert_int_eq(ref_ch1[1], in32[2]);
+	ck_assert_int_eq(ref_ch2[1], in32[3]);
+	for (k = 1; k < count; k++) {
+		kernels[k]->deinterleave_s32(in32, frames, tmp_ch1, tmp_ch2);
+		ck_assert_msg(memcmp(tmp_ch1, ref_ch1, sizeof(ref_ch1)) == 0 &&
+				memcmp(tmp_ch2, ref_ch2, sizeof(ref_ch2)) == 0,
+				"S32 deinterleave mismatch: %s", kernels[k]->name);
+	}
+
+	/* the last byte of the output buffer shall not be overwritten */
+	uint8_t ref24[ARRAYSIZE(in32) * 3 + 1], tmp24[ARRAYSIZE(ref24)];
+	ref24[ARRAYSIZE(ref24) - 1] = 0xAA;
+	audio_pack_u24be_generic((uint32_t *)in32, ARRAYSIZE(in32), ref24);
+	ck_assert_int_eq(ref24[0], (in32[0] >> 16) & 0xFF);
+	ck_assert_int_eq(ref24[2], in32[0] & 0xFF);
+	for (k = 1; k < count; k++) {
+		tmp24[ARRAYSIZE(tmp24) - 1] = 0xAA;
+		kernels[k]->pack_u24be((uint32_t *)in32, ARRAYSIZE(in32), tmp24);
+		ck_assert_msg(memcmp(tmp24, ref24, sizeof(ref24)) == 0,
+				"U24 pack mismatch: %s", kernels[k]->name);
+	}
+
+} END_TEST
+
+START_TEST(test_audio_gain_scale) {
+
+	struct audio_gain ch1, ch2;
+	int16_t buffer16[2 * 64];
+	int32_t buffer32[64];
+	size_t i;
+
+	audio_gain_init(&ch1, AUDIO_GAIN_UNITY);
+	audio_gain_init(&ch2, AUDIO_GAIN_UNITY);
+
+	/* unity gain shall not modify the signal */
+	for (i = 0; i < ARRAYSIZE(buffer16); i++)
+		buffer16[i] = 10000;
+	audio_gain_scale_s16_2le(buffer16, 2, ARRAYSIZE(buffer16) / 2, &ch1, &ch2, 16);
+	for (i = 0; i < ARRAYSIZE(buffer16); i++)
+		ck_assert_int_eq(buffer16[i], 10000);
+
+	/* muting shall be applied gradually */
+	audio_gain_set(&ch1, 0);
+	audio_gain_scale_s16_2le(buffer16, 2, ARRAYSIZE(buffer16) / 2, &ch1, &ch2, 16);
+	for (i = 2; i < 2 * 16; i += 2) {
+		ck_assert_int_lt(buffer16[i], buffer16[i - 2]);
+		ck_assert_int_eq(buffer16[i + 1], 10000);
+	}
+	for (; i < ARRAYSIZE(buffer16); i += 2) {
+		ck_assert_int_eq(buffer16[i], 0);
+		ck_assert_int_eq(buffer16[i + 1], 10000);
+	}
+
+	/* ramp state shall be preserved between calls */
+	audio_gain_set(&ch1, 0.5);
+	for (i = 0; i < ARRAYSIZE(buffer32); i++)
+		buffer32[i] = 1000000;
+	audio_gain_scale_s32_4le(buffer32, 1, 8, &ch1, NULL, 16);
+	audio_gain_scale_s32_4le(&buffer32[8], 1, ARRAYSIZE(buffer32) - 8, &ch1, NULL, 16);
+	for (i = 1; i < 16; i++)
+		ck_assert_int_gt(buffer32[i], buffer32[i - 1]);
+	for (; i < ARRAYSIZE(buffer32); i++)
+		ck_assert_int_eq(buffer32[i], 500000);
+
+} END_TEST
+
+START_TEST(test_resampler) {
+
+	struct resampler rs;
+	static int16_t in[2 * 4800];
+	static int16_t out[2 * 4900];
+	size_t i, frames;
+
+	ck_assert_int_eq(resampler_init(&rs, 2), 0);
+
+	for (i = 0; i < ARRAYSIZE(in) / 2; i++) {
+		in[i * 2 + 0] = 10000 * sin(2 * M_PI * i / 48);
+		in[i * 2 + 1] = -in[i * 2 + 0];
+	}
+
+	/* unity ratio shall not modify the signal */
+	frames = resampler_process(&rs, in, ARRAYSIZE(in) / 2, out, ARRAYSIZE(out) / 2);
+	ck_assert_int_eq(frames, ARRAYSIZE(in) / 2 - RESAMPLER_ZEROS);
+	ck_assert_int_eq(memcmp(in, out, frames * 2 * sizeof(*out)), 0);
+
+	resampler_reset(&rs);
+	resampler_set_ratio(&rs, 1.01);
+
+	/* stretched signal shall follow the sine with lower frequency */
+	frames = resampler_process(&rs, in, ARRAYSIZE(in) / 2, out, ARRAYSIZE(out) / 2);
+	ck_assert_int_ge(frames, 1.01 * (ARRAYSIZE(in) / 2 - RESAMPLER_ZEROS) - 1);
+	ck_assert_int_le(frames, 1.01 * (ARRAYSIZE(in) / 2 - RESAMPLER_ZEROS) + 1);
+	for (i = 2 * RESAMPLER_ZEROS; i < frames; i++) {
+		const int16_t sample = 10000 * sin(2 * M_PI * i / 48 / 1.01);
+		ck_assert_int_lt(abs(out[i * 2 + 0] - sample), 50);
+		ck_assert_int_lt(abs(out[i * 2 + 1] + sample), 50);
+	}
+
+	resampler_free(&rs);
+
+} END_TEST
+
+START_TEST(test_audio_kernels_benchmark) {
+
+	const struct audio_kernels *kernels[8];
+	size_t count = get_audio_kernels(kernels, ARRAYSIZE(kernels));
+
+	/* 1 second of 48 kHz stereo signal */
+	static int16_t buffer16[48000 * 2];
+	static int32_t buffer32[48000 * 2];
+	static int32_t ch1[48000], ch2[48000];
+	static uint8_t buffer24[48000 * 2 * 3];
+	const size_t loops = 100;
+	double generic[6] = { 0 };
+
+	fprintf(stderr, "Selected audio kernels: %s\n", audio_kernels_name());
+
+	for (size_t k = 0; k < count; k++) {
+
+		struct timespec ts0;
+		double elapsed[6];
+		size_t i;
+
+		clock_gettime(CLOCK_MONOTONIC, &ts0);
+		for (i = 0; i < loops; i++)
+			kernels[k]->mask_u32((uint32_t *)buffer32, ARRAYSIZE(buffer32), 0xFFFFFFFF, 0);
+		elapsed[0] = get_elapsed_usec(&ts0);
+
+		clock_gettime(CLOCK_MONOTONIC, &ts0);
+		for (i = 0; i < loops; i++)
+			kernels[k]->scale_s16_q15(buffer16, ARRAYSIZE(buffer16), 0x7000, 0x6000);
+		elapsed[1] = get_elapsed_usec(&ts0);
+
+		clock_gettime(CLOCK_MONOTONIC, &ts0);
+		for (i = 0; i < loops; i++)
+			kernels[k]->scale_s32_q31(buffer32, ARRAYSIZE(buffer32), 0x70000000, 0x60000000);
+		elapsed[2] = get_elapsed_usec(&ts0);
+
+		clock_gettime(CLOCK_MONOTONIC, &ts0);
+		for (i = 0; i < loops; i++)
+			kernels[k]->deinterleave_s16(buffer16, ARRAYSIZE(buffer16) / 2, ch1, ch2);
+		elapsed[3] = get_elapsed_usec(&ts0);
+
+		clock_gettime(CLOCK_MONOTONIC, &ts0);
+		for (i = 0; i < loops; i++)
+			kernels[k]->deinterleave_s32(buffer32, ARRAYSIZE(buffer32) / 2, ch1, ch2);
+		elapsed[4] = get_elapsed_usec(&ts0);
+
+		clock_gettime(CLOCK_MONOTONIC, &ts0);
+		for (i = 0; i < loops; i++)
+			kernels[k]->pack_u24be((uint32_t *)buffer32, ARRAYSIZE(buffer32), buffer24);
+		elapsed[5] = get_elapsed_usec(&ts0);
+
+		if (k == 0)
+			memcpy(generic, elapsed, sizeof(generic));
+
+		fprintf(stderr, "%-8s scale-s16-q15: %8.0f us (x%.2f) scale-s32-q31: %8.0f us (x%.2f) "
+				"mask-u32: %8.0f us (x%.2f)\n", kernels[k]->name,
+				elapsed[1], generic[1] / elapsed[1],
+				elapsed[2], generic[2] / elapsed[2],
+				elapsed[0], generic[0] / elapsed[0]);
+		fprintf(stderr, "%-8s deinterleave-s16: %8.0f us (x%.2f) deinterleave-s32: %8.0f us (x%.2f) "
+				"pack-u24be: %8.0f us (x%.2f)\n", kernels[k]->name,
+				elapsed[3], generic[3] / elapsed[3],
+				elapsed[4], generic[4] / elapsed[4],
+				elapsed[5], generic[5] / elapsed[5]);
+
+	}
+
+} END_TEST
+
+int main(int argc, char *argv[]) {
+
+	int opt;
+	const char *opts = "hb";
+	struct option longopts[] = {
+		{ "help", no_argument, NULL, 'h' },
+		{ "benchmark", no_argument, NULL, 'b' },
+		{ 0, 0, 0, 0 },
+	};
+
+	while ((opt = getopt_long(argc, argv, opts, longopts, NULL)) != -1)
+		switch (opt) {
+		case 'h' /* --help */ :
+			printf("usage: %s [--benchmark]\n", argv[0]);
+			return 0;
+		case 'b' /* --benchmark */ :
+			benchmark = true;
+			break;
+		default:
+			fprintf(stderr, "Try '%s --help' for more information.\n", argv[0]);
+			return 1;
+		}
 
 	Suite *s = suite_create(__FILE__);
 	TCase *tc = tcase_create(__FILE__);
@@ -91,6 +394,11 @@ int main(void) {
 
 	tcase_add_test(tc, test_audio_scale_s16_2le);
 	tcase_add_test(tc, test_audio_scale_s32_4le);
+	tcase_add_test(tc, test_audio_kernels);
+	tcase_add_test(tc, test_audio_gain_scale);
+	tcase_add_test(tc, test_resampler);
+	if (benchmark)
+		tcase_add_test(tc, test_audio_kernels_benchmark);
 
 	srunner_run_all(sr, CK_ENV);
 	int nf = srunner_ntests_failed(sr);
@@ -22,8 +22,11 @@
 #include "../src/bluealsa.c"
 #include "../src/dbus.c"
 #include "../src/hci.c"
+#include "../src/io-engine.c"
+#include "../src/io-sched.c"
 #include "../src/utils.c"
 #include "../src/shared/log.c"
+#include "../src/shared/shm-ring.c"
 
 int a2dp_audio_thread_create(struct ba_transport *t) { (void)t; return 0; }
 void *ba_rfcomm_thread(struct ba_transport *t) { (void)t; return 0; }
@@ -176,6 +179,134 @@ START_TEST(test_ba_transport_pcm_volume) {
 
 } END_TEST
 
+START_TEST(test_io_sched) {
+
+	struct io_sched req = { .policy = SCHED_OTHER };
+	struct io_sched sched;
+	cpu_set_t cpus;
+	char tmp[64];
+
+	ck_assert_int_eq(io_sched_policy_from_string("FIFO"), SCHED_FIFO);
+	ck_assert_int_eq(io_sched_policy_from_string("rr"), SCHED_RR);
+	ck_assert_int_eq(io_sched_policy_from_string("batch"), -1);
+	ck_assert_str_eq(io_sched_policy_to_string(SCHED_FIFO), "fifo");
+	ck_assert_str_eq(io_sched_policy_to_string(SCHED_OTHER), "other");
+
+	ck_assert_int_eq(io_sched_cpus_from_string("0,2-4,7", &cpus), 0);
+	ck_assert_int_eq(CPU_COUNT(&cpus), 5);
+	ck_assert_int_eq(CPU_ISSET(3, &cpus), 1);
+	ck_assert_str_eq(io_sched_cpus_to_string(&cpus, tmp, sizeof(tmp)), "0,2-4,7");
+	ck_assert_int_eq(io_sched_cpus_from_string("", &cpus), -1);
+	ck_assert_int_eq(io_sched_cpus_from_string("3-1", &cpus), -1);
+	ck_assert_int_eq(io_sched_cpus_from_string("1,", &cpus), -1);
+	ck_assert_int_eq(io_sched_cpus_from_string("1x", &cpus), -1);
+
+	CPU_ZERO(&cpus);
+	ck_assert_str_eq(io_sched_cpus_to_string(&cpus, tmp, sizeof(tmp)), "");
+
+	/* nothing requested - nothing applied */
+	ck_assert_int_eq(io_sched_requested(&req), false);
+	io_sched_apply(&req, &sched);
+	ck_assert_int_eq(sched.policy, SCHED_OTHER);
+	ck_assert_int_eq(CPU_COUNT(&sched.cpus), 0);
+
+	/* pin to the CPU we are running on right now */
+	CPU_SET(sched_getcpu(), &req.cpus);
+	ck_assert_int_eq(io_sched_requested(&req), true);
+	io_sched_apply(&req, &sched);
+	ck_assert_int_eq(CPU_EQUAL(&sched.cpus, &req.cpus), 1);
+	ck_assert_int_eq(sched.rtkit, false);
+
+} END_TEST
+
+static int test_broadcast_acquire(struct ba_transport *t) {
+	/* member shall be acquired with its transport lock held */
+	ck_assert_int_eq(pthread_mutex_trylock(&t->mutex), EBUSY);
+	return t->bt_fd = dup(STDERR_FILENO);
+}
+
+static int test_broadcast_release(struct ba_transport *t) {
+	close(t->bt_fd);
+	return t->bt_fd = -1, 0;
+}
+
+START_TEST(test_ba_transport_broadcast) {
+
+	struct ba_adapter *a;
+	struct ba_device *d;
+	struct ba_transport *t[4];
+	bdaddr_t addr = { 0 };
+	size_t i;
+
+	ck_assert_ptr_ne(a = ba_adapter_new(0), NULL);
+	ck_assert_ptr_ne(d = ba_device_new(a, &addr), NULL);
+
+	struct ba_transport_type ttype = { .profile = BA_TRANSPORT_PROFILE_A2DP_SOURCE };
+	a2dp_sbc_t configuration = { .channel_mode = SBC_CHANNEL_MODE_STEREO };
+	a2dp_sbc_t configuration_mono = { .channel_mode = SBC_CHANNEL_MODE_MONO };
+	ck_assert_ptr_ne(t[0] = ba_transport_new_a2dp(d, ttype,
+				"/owner", "/path/0", &a2dp_codec_source_sbc, &configuration), NULL);
+	ck_assert_ptr_ne(t[1] = ba_transport_new_a2dp(d, ttype,
+				"/owner", "/path/1", &a2dp_codec_source_sbc, &configuration), NULL);
+	ck_assert_ptr_ne(t[2] = ba_transport_new_a2dp(d, ttype,
+				"/owner", "/path/2", &a2dp_codec_source_sbc, &configuration), NULL);
+	ck_assert_ptr_ne(t[3] = ba_transport_new_a2dp(d, ttype,
+				"/owner", "/path/3", &a2dp_codec_source_sbc, &configuration_mono), NULL);
+
+	ba_adapter_unref(a);
+	ba_device_unref(d);
+
+	for (i = 0; i < ARRAYSIZE(t); i++) {
+		t[i]->acquire = test_broadcast_acquire;
+		t[i]->release = test_broadcast_release;
+	}
+
+	/* leader can not be a member of its own group */
+	ck_assert_int_eq(ba_transport_broadcast_set(t[0], &t[0], 1), -1);
+	ck_assert_int_eq(errno, EINVAL);
+	/* member with different codec configuration */
+	ck_assert_int_eq(ba_transport_broadcast_set(t[0], &t[2], 2), -1);
+	ck_assert_int_eq(errno, EINVAL);
+
+	struct ba_transport *members[] = { t[1], t[2] };
+	ck_assert_int_eq(ba_transport_broadcast_set(t[0], members, 2), 0);
+	ck_assert_int_eq(t[0]->a2dp.broadcast.members_len, 2);
+	ck_assert_ptr_eq(t[1]->a2dp.broadcast.leader, t[0]);
+	ck_assert_int_ne(t[1]->bt_fd, -1);
+
+	/* member can not lead another group */
+	ck_assert_int_eq(ba_transport_broadcast_set(t[1], NULL, 0), -1);
+	ck_assert_int_eq(errno, EBUSY);
+
+	struct ba_transport_broadcast_link links[BA_TRANSPORT_BROADCAST_MEMBERS_MAX];
+	unsigned int version;
+	ck_assert_int_eq(ba_transport_broadcast_get_links(t[0], links, &version), 2);
+	ck_assert_uint_eq(version, t[0]->a2dp.broadcast.version);
+	ck_assert_ptr_eq(links[0].t, t[1]);
+	ck_assert_int_ne(links[0].bt_fd, t[1]->bt_fd);
+	for (i = 0; i < 2; i++) {
+		ba_transport_unref(links[i].t);
+		close(links[i].bt_fd);
+	}
+
+	/* leaving member shall be released */
+	ck_assert_int_eq(ba_transport_broadcast_set(t[0], &t[2], 1), 0);
+	ck_assert_int_eq(t[0]->a2dp.broadcast.members_len, 1);
+	ck_assert_ptr_eq(t[1]->a2dp.broadcast.leader, NULL);
+	ck_assert_int_eq(t[1]->bt_fd, -1);
+	ck_assert_int_gt(t[0]->a2dp.broadcast.version, version);
+
+	/* destroyed leader shall dissolve the group */
+	ba_transport_destroy(t[0]);
+	ck_assert_ptr_eq(t[2]->a2dp.broadcast.leader, NULL);
+	ck_assert_int_eq(t[2]->bt_fd, -1);
+
+	ba_transport_unref(t[1]);
+	ba_transport_unref(t[2]);
+	ba_transport_unref(t[3]);
+
+} END_TEST
+
 static int test_cascade_free_transport_unref(struct ba_transport *t) {
 	return ba_transport_unref(t), 0;
 }
@@ -210,6 +341,8 @@ int main(void) {
 	tcase_add_test(tc, test_ba_transport);
 	tcase_add_test(tc, test_ba_transport_pcm_format);
 	tcase_add_test(tc, test_ba_transport_pcm_volume);
+	tcase_add_test(tc, test_ba_transport_broadcast);
+	tcase_add_test(tc, test_io_sched);
 	tcase_add_test(tc, test_cascade_free);
 
 	srunner_run_all(sr, CK_ENV);
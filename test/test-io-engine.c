@@ -0,0 +1,319 @@
+/*
+ * test-io-engine.c
+ * Copyright (c) 2016-2020 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <check.h>
+
+#include "../src/io-engine.c"
+#include "../src/shared/defs.h"
+#include "../src/shared/log.c"
+
+static bool benchmark = false;
+
+struct test_task {
+	struct io_engine_task task;
+	struct io_engine_source src;
+	int fds[2];
+	/* the number of received bytes */
+	unsigned int received;
+	bool initialized;
+	bool cleaned;
+	bool destroyed;
+	/* if true, the initialization callback fails */
+	bool fail;
+	pthread_t worker;
+};
+
+static void test_task_callback(struct io_engine_source *src, uint32_t revents) {
+	(void)revents;
+
+	struct test_task *tt = src->task->data;
+	uint8_t buffer[1024];
+	ssize_t len;
+
+	tt->worker = pthread_self();
+	if ((len = read(src->fd, buffer, sizeof(buffer))) <= 0 || buffer[0] == 0xFF) {
+		io_engine_task_finish(src->task);
+		return;
+	}
+
+	tt->received += len;
+
+}
+
+static int test_task_init(struct io_engine_task *task) {
+	struct test_task *tt = task->data;
+	tt->initialized = true;
+	if (tt->fail)
+		return -1;
+	tt->src.fd = tt->fds[0];
+	tt->src.events = EPOLLIN;
+	tt->src.callback = test_task_callback;
+	return io_engine_source_add(task, &tt->src);
+}
+
+static void test_task_cleanup(struct io_engine_task *task) {
+	struct test_task *tt = task->data;
+	tt->cleaned = true;
+}
+
+static void test_task_destroy(void *userdata) {
+	struct test_task *tt = userdata;
+	tt->destroyed = true;
+}
+
+static void test_task_new(struct test_task *tt) {
+	memset(tt, 0, sizeof(*tt));
+	ck_assert_int_eq(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, tt->fds), 0);
+	tt->task.init = test_task_init;
+	tt->task.cleanup = test_task_cleanup;
+	tt->task.destroy = test_task_destroy;
+	tt->task.userdata = tt;
+	tt->task.data = tt;
+}
+
+static void test_task_free(struct test_task *tt) {
+	close(tt->fds[0]);
+	close(tt->fds[1]);
+}
+
+START_TEST(test_io_engine_task) {
+
+	struct test_task tt1, tt2, tt3;
+	const uint8_t data[32] = { 0 };
+	const uint8_t quit = 0xFF;
+
+	ck_assert_int_eq(io_engine_task_start(&tt1.task), -1);
+	ck_assert_int_eq(io_engine_init(0), -1);
+	ck_assert_int_eq(io_engine_init(2), 0);
+	ck_assert_int_eq(io_engine_enabled(), true);
+
+	test_task_new(&tt1);
+	test_task_new(&tt2);
+	test_task_new(&tt3);
+	tt3.fail = true;
+
+	ck_assert_int_eq(io_engine_task_start(&tt1.task), 0);
+	ck_assert_int_eq(io_engine_task_start(&tt2.task), 0);
+	ck_assert_int_eq(io_engine_task_start(&tt3.task), 0);
+
+	/* tasks shall be distributed among workers */
+	ck_assert_ptr_ne(tt1.task.worker, tt2.task.worker);
+
+	ck_assert_int_eq(write(tt1.fds[1], data, sizeof(data)), sizeof(data));
+	ck_assert_int_eq(write(tt1.fds[1], data, sizeof(data)), sizeof(data));
+	ck_assert_int_eq(write(tt2.fds[1], data, sizeof(data)), sizeof(data));
+	usleep(50000);
+
+	ck_assert_int_eq(tt1.received, 2 * sizeof(data));
+	ck_assert_int_eq(tt2.received, sizeof(data));
+	ck_assert_int_eq(pthread_equal(tt1.worker, tt2.worker), 0);
+
+	/* failed initialization shall terminate the task */
+	ck_assert_int_eq(tt3.initialized, true);
+	ck_assert_int_eq(tt3.cleaned, true);
+	ck_assert_int_eq(tt3.destroyed, true);
+	ck_assert_int_eq(tt3.task.state, IO_ENGINE_TASK_DONE);
+
+	/* self-finished task shall be terminated by the worker */
+	ck_assert_int_eq(write(tt1.fds[1], &quit, sizeof(quit)), sizeof(quit));
+	usleep(50000);
+	ck_assert_int_eq(tt1.cleaned, true);
+	ck_assert_int_eq(tt1.destroyed, true);
+	ck_assert_int_eq(tt1.task.state, IO_ENGINE_TASK_DONE);
+
+	/* cancellation shall wait for the task cleanup */
+	ck_assert_int_eq(tt2.cleaned, false);
+	io_engine_task_cancel(&tt2.task);
+	ck_assert_int_eq(tt2.cleaned, true);
+	ck_assert_int_eq(tt2.destroyed, true);
+	ck_assert_ptr_eq(tt2.task.worker, NULL);
+
+	/* cancellation of the finished task shall be a no-op */
+	io_engine_task_cancel(&tt1.task);
+	io_engine_task_cancel(&tt3.task);
+
+	/* task cancelled before it has been started shall be cleaned up */
+	test_task_free(&tt1);
+	test_task_new(&tt1);
+	ck_assert_int_eq(io_engine_task_start(&tt1.task), 0);
+	io_engine_task_cancel(&tt1.task);
+	ck_assert_int_eq(tt1.cleaned, true);
+
+	io_engine_destroy();
+	ck_assert_int_eq(io_engine_enabled(), false);
+
+	test_task_free(&tt1);
+	test_task_free(&tt2);
+	test_task_free(&tt3);
+
+} END_TEST
+
+/* benchmark streams parameters */
+#define BENCHMARK_STREAMS 64
+#define BENCHMARK_PACKETS 500
+#define BENCHMARK_PACKET_LEN 600
+#define BENCHMARK_INTERVAL_USEC 2000
+
+static void benchmark_callback(struct io_engine_source *src, uint32_t revents) {
+	(void)revents;
+	struct test_task *tt = src->task->data;
+	uint8_t buffer[BENCHMARK_PACKET_LEN];
+	ssize_t len;
+	if ((len = read(src->fd, buffer, sizeof(buffer))) > 0)
+		__atomic_fetch_add(&tt->received, len, __ATOMIC_RELAXED);
+}
+
+static int benchmark_init(struct io_engine_task *task) {
+	struct test_task *tt = task->data;
+	tt->src.fd = tt->fds[0];
+	tt->src.events = EPOLLIN;
+	tt->src.callback = benchmark_callback;
+	return io_engine_source_add(task, &tt->src);
+}
+
+static void *benchmark_thread(struct test_task *tt) {
+	struct pollfd pfd = { tt->fds[0], POLLIN, 0 };
+	uint8_t buffer[BENCHMARK_PACKET_LEN];
+	ssize_t len;
+	while (poll(&pfd, 1, -1) > 0) {
+		if ((len = read(pfd.fd, buffer, sizeof(buffer))) <= 0)
+			break;
+		__atomic_fetch_add(&tt->received, len, __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+/**
+ * Feed all streams with packets at the A2DP-like rate and measure the CPU
+ * time and the number of context switches used for receiving them. */
+static void benchmark_run(unsigned int workers) {
+
+	static struct test_task tt[BENCHMARK_STREAMS];
+	static pthread_t threads[BENCHMARK_STREAMS];
+	const uint8_t packet[BENCHMARK_PACKET_LEN] = { 0 };
+	struct rusage ru0, ru;
+	size_t i, n;
+
+	if (workers > 0)
+		ck_assert_int_eq(io_engine_init(workers), 0);
+
+	for (i = 0; i < ARRAYSIZE(tt); i++) {
+		test_task_new(&tt[i]);
+		tt[i].task.init = benchmark_init;
+		tt[i].task.destroy = NULL;
+		if (workers > 0)
+			ck_assert_int_eq(io_engine_task_start(&tt[i].task), 0);
+		else
+			ck_assert_int_eq(pthread_create(&threads[i], NULL,
+						PTHREAD_ROUTINE(benchmark_thread), &tt[i]), 0);
+	}
+
+	getrusage(RUSAGE_SELF, &ru0);
+
+	for (n = 0; n < BENCHMARK_PACKETS; n++) {
+		for (i = 0; i < ARRAYSIZE(tt); i++)
+			ck_assert_int_eq(write(tt[i].fds[1], packet, sizeof(packet)), sizeof(packet));
+		usleep(BENCHMARK_INTERVAL_USEC);
+	}
+
+	/* wait for all packets to be received */
+	for (i = 0; i < ARRAYSIZE(tt); i++)
+		while (__atomic_load_n(&tt[i].received, __ATOMIC_RELAXED) <
+				BENCHMARK_PACKETS * BENCHMARK_PACKET_LEN)
+			usleep(1000);
+
+	getrusage(RUSAGE_SELF, &ru);
+
+	for (i = 0; i < ARRAYSIZE(tt); i++) {
+		if (workers > 0)
+			io_engine_task_cancel(&tt[i].task);
+		else {
+			shutdown(tt[i].fds[1], SHUT_RDWR);
+			pthread_join(threads[i], NULL);
+		}
+		test_task_free(&tt[i]);
+	}
+
+	if (workers > 0)
+		io_engine_destroy();
+
+	const double cpu = (ru.ru_utime.tv_sec - ru0.ru_utime.tv_sec) +
+		(ru.ru_stime.tv_sec - ru0.ru_stime.tv_sec) +
+		((ru.ru_utime.tv_usec - ru0.ru_utime.tv_usec) +
+		 (ru.ru_stime.tv_usec - ru0.ru_stime.tv_usec)) / 1e6;
+	const long csw = (ru.ru_nvcsw - ru0.ru_nvcsw) + (ru.ru_nivcsw - ru0.ru_nivcsw);
+
+	char label[32];
+	if (workers > 0)
+		sprintf(label, "IO engine (%u)", workers);
+	else
+		sprintf(label, "IO threads");
+	fprintf(stderr, "%-16s streams: %d CPU: %6.3f s context switches: %7ld\n",
+			label, BENCHMARK_STREAMS, cpu, csw);
+
+}
+
+START_TEST(test_io_engine_benchmark) {
+	benchmark_run(0);
+	benchmark_run(1);
+	benchmark_run(2);
+	benchmark_run(4);
+} END_TEST
+
+int main(int argc, char *argv[]) {
+
+	int opt;
+	const char *opts = "h";
+	struct option longopts[] = {
+		{ "help", no_argument, NULL, 'h' },
+		{ "benchmark", no_argument, NULL, 'b' },
+		{ 0, 0, 0, 0 },
+	};
+
+	while ((opt = getopt_long(argc, argv, opts, longopts, NULL)) != -1)
+		switch (opt) {
+		case 'h' /* --help */ :
+			printf("usage: %s [--benchmark]\n", argv[0]);
+			return 0;
+		case 'b' /* --benchmark */ :
+			benchmark = true;
+			break;
+		default:
+			fprintf(stderr, "Try '%s --help' for more information.\n", argv[0]);
+			return 1;
+		}
+
+	Suite *s = suite_create(__FILE__);
+	TCase *tc = tcase_create(__FILE__);
+	SRunner *sr = srunner_create(s);
+
+	suite_add_tcase(s, tc);
+	tcase_set_timeout(tc, 30);
+
+	tcase_add_test(tc, test_io_engine_task);
+	if (benchmark)
+		tcase_add_test(tc, test_io_engine_benchmark);
+
+	srunner_run_all(sr, CK_ENV);
+	int nf = srunner_ntests_failed(sr);
+	srunner_free(sr);
+
+	return nf == 0 ? 0 : 1;
+}
@@ -20,6 +20,10 @@
 #include "inc/sine.inc"
 #include "../src/a2dp.c"
 #include "../src/a2dp-audio.c"
+#include "../src/a2dp-bitstream.c"
+#include "../src/a2dp-jbuf.c"
+#include "../src/a2dp-sender.c"
+#include "../src/aac.c"
 #include "../src/at.c"
 #include "../src/audio.c"
 #include "../src/ba-adapter.c"
@@ -28,13 +32,18 @@
 #include "../src/bluealsa.c"
 #include "../src/dbus.c"
 #include "../src/hci.c"
+#include "../src/io-engine.c"
+#include "../src/io-sched.c"
 #include "../src/msbc.c"
+#include "../src/plc.c"
+#include "../src/resampler.c"
 #include "../src/sbc.c"
 #include "../src/sco.c"
 #include "../src/utils.c"
 #include "../src/shared/ffb.c"
 #include "../src/shared/log.c"
 #include "../src/shared/rt.c"
+#include "../src/shared/shm-ring.c"
 
 unsigned int bluealsa_dbus_pcm_register(struct ba_transport_pcm *pcm, GError **error) {
 	debug("%s: %p", __func__, (void *)pcm); (void)error; return 0; }
@@ -79,6 +88,14 @@ static const a2dp_aac_t config_aac_44100_stereo = {
 	AAC_INIT_BITRATE(0xFFFF)
 };
 
+static const a2dp_usac_t config_usac_44100_stereo = {
+	.object_type = USAC_OBJECT_TYPE_MPEGD_USAC_WITH_DRC,
+	USAC_INIT_FREQUENCY(USAC_SAMPLING_FREQ_44100)
+	.channels = USAC_CHANNELS_2,
+	.vbr = 1,
+	USAC_INIT_BITRATE(0xFFFF)
+};
+
 static const a2dp_aptx_t config_aptx_44100_stereo = {
 	.info = A2DP_SET_VENDOR_ID_CODEC_ID(APTX_VENDOR_ID, APTX_CODEC_ID),
 	.frequency = APTX_SAMPLING_FREQ_44100,
@@ -91,6 +108,13 @@ static const a2dp_aptx_hd_t config_aptx_hd_44100_stereo = {
 	.aptx.channel_mode = APTX_CHANNEL_MODE_STEREO,
 };
 
+static const a2dp_faststream_t config_faststream_44100_16000 = {
+	.info = A2DP_SET_VENDOR_ID_CODEC_ID(FASTSTREAM_VENDOR_ID, FASTSTREAM_CODEC_ID),
+	.direction = FASTSTREAM_DIRECTION_MUSIC | FASTSTREAM_DIRECTION_VOICE,
+	.frequency_music = FASTSTREAM_SAMPLING_FREQ_MUSIC_44100,
+	.frequency_voice = FASTSTREAM_SAMPLING_FREQ_VOICE_16000,
+};
+
 static const a2dp_ldac_t config_ldac_44100_stereo = {
 	.info = A2DP_SET_VENDOR_ID_CODEC_ID(LDAC_VENDOR_ID, LDAC_CODEC_ID),
 	.frequency = LDAC_SAMPLING_FREQ_44100,
@@ -102,6 +126,7 @@ static struct ba_device *device1 = NULL;
 static struct ba_device *device2 = NULL;
 static const char *input_pcm_file = NULL;
 static unsigned int aging_duration = 0;
+static bool benchmark = false;
 static bool dump_data = false;
 
 /**
@@ -174,6 +199,19 @@ static void bt_data_push(uint8_t *data, size_t len) {
 	bt_data_end = bt_data_end->next;
 }
 
+#if HAVE_APTX_DECODE || HAVE_APTX_HD_DECODE
+/**
+ * Prepend a garbage byte to the payload of the first BT packet, so the
+ * decoder will lose the synchronization with the code word boundary. */
+static void test_bt_data_misalign(void) {
+	struct bt_data *head = &bt_data;
+	if (head == bt_data_end || head->len + 1 > sizeof(head->data))
+		return;
+	memmove(&head->data[1], head->data, head->len++);
+	head->data[0] = 0xAA;
+}
+#endif
+
 /**
  * Helper function for timed thread join.
  *
@@ -256,6 +294,16 @@ static void *test_io_thread_a2dp_dump_pcm(struct ba_transport *t) {
 			continue;
 		}
 
+		/* the first encoded frame shall be preceded by the frame header */
+		if (t->a2dp.pcm.format == BA_TRANSPORT_PCM_FORMAT_ENCODED &&
+				decoded_samples_total == 0) {
+			const struct ba_transport_pcm_frame_header *header = (void *)buffer;
+			ck_assert_int_gt(len, sizeof(*header));
+			ck_assert_int_gt(le32toh(header->length), 0);
+			if (t->type.codec == A2DP_CODEC_SBC)
+				ck_assert_int_eq(((uint8_t *)(header + 1))[0], 0x9C);
+		}
+
 		size_t sample_size = BA_TRANSPORT_PCM_FORMAT_BYTES(t->a2dp.pcm.format);
 		debug("Decoded samples: %zd", len / sample_size);
 		decoded_samples_total += len / sample_size;
@@ -327,7 +375,257 @@ static void test_a2dp(struct ba_transport *t1, struct ba_transport *t2,
 
 }
 
-static void test_sco(struct ba_transport *t, void *(*cb)(struct ba_transport *)) {
+/**
+ * Decode recorded BT data with the A2DP sink hosted by the IO engine.
+ *
+ * @param drop If not NULL, this BT packet will not be delivered to the sink,
+ *   so the packet loss can be simulated.
+ * @return The number of decoded PCM samples. */
+static size_t test_a2dp_sink_io_engine(struct ba_transport *t,
+		const struct a2dp_sink_codec *codec, const struct bt_data *drop) {
+
+	int bt_fds[2];
+	int pcm_fds[2];
+
+	ck_assert_int_eq(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0, bt_fds), 0);
+	ck_assert_int_eq(pipe2(pcm_fds, O_NONBLOCK), 0);
+
+	t->type.profile = BA_TRANSPORT_PROFILE_A2DP_SINK;
+	t->bt_fd = bt_fds[0];
+	t->a2dp.pcm.fd = pcm_fds[1];
+
+	ck_assert_int_eq(io_engine_init(1), 0);
+	ck_assert_int_eq(a2dp_sink_task_create(t, codec, "test"), 0);
+
+	struct bt_data *bt_data_head = &bt_data;
+	for (; bt_data_head != bt_data_end; bt_data_head = bt_data_head->next)
+		if (bt_data_head != drop)
+			ck_assert_int_eq(write(bt_fds[1], bt_data_head->data, bt_data_head->len), bt_data_head->len);
+
+	struct pollfd pfds[] = {{ pcm_fds[0], POLLIN, 0 }};
+	size_t decoded_samples_total = 0;
+	int16_t buffer[2048];
+	ssize_t len;
+
+	while (poll(pfds, ARRAYSIZE(pfds), 500) > 0)
+		if ((len = read(pfds[0].fd, buffer, sizeof(buffer))) > 0)
+			decoded_samples_total += len / sizeof(int16_t);
+
+	debug("Decoded samples total: %zd", decoded_samples_total);
+	ck_assert_int_gt(decoded_samples_total, 0);
+
+	/* cancellation shall release the transport */
+	ba_transport_pthread_cancel(t);
+	ck_assert_ptr_eq(t->io_task.worker, NULL);
+	ck_assert_int_eq(t->bt_fd, -1);
+
+	io_engine_destroy();
+	t->a2dp.pcm.fd = -1;
+	close(bt_fds[1]);
+	close(pcm_fds[0]);
+	close(pcm_fds[1]);
+
+	return decoded_samples_total;
+}
+
+/**
+ * Deliver recorded BT data to the encoded bitstream tap.
+ *
+ * Frames received from the tap are compared with the frames transmitted in
+ * the recorded RTP payloads. Fragmented MPEG audio payloads are joined with
+ * the RFC 2250 fragment offset. The first frame of every payload shall be
+ * stamped with the RTP timestamp of that payload. */
+static void test_a2dp_sink_tap(struct ba_transport *t, enum a2dp_bitstream_type type) {
+
+	const uint16_t format = t->a2dp.pcm.format;
+	int bt_fds[2];
+	int pcm_fds[2];
+
+	ck_assert_int_eq(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0, bt_fds), 0);
+	ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pcm_fds), 0);
+
+	t->type.profile = BA_TRANSPORT_PROFILE_A2DP_SINK;
+	t->bt_fd = bt_fds[0];
+	t->a2dp.pcm.fd = pcm_fds[1];
+	t->a2dp.pcm.format = BA_TRANSPORT_PCM_FORMAT_ENCODED;
+
+	pthread_t thread;
+	pthread_create(&thread, NULL, PTHREAD_ROUTINE(a2dp_sink_tap), ba_transport_ref(t));
+
+	struct bt_data *bt_data_head = &bt_data;
+	for (; bt_data_head != bt_data_end; bt_data_head = bt_data_head->next)
+		ck_assert_int_eq(write(bt_fds[1], bt_data_head->data, bt_data_head->len), bt_data_head->len);
+
+	struct pollfd pfds[] = {{ pcm_fds[0], POLLIN, 0 }};
+	uint8_t *output = NULL;
+	size_t output_len = 0;
+	ssize_t len;
+
+	while (poll(pfds, ARRAYSIZE(pfds), 500) > 0) {
+		ck_assert_ptr_ne(output = realloc(output, output_len + 4096), NULL);
+		if ((len = read(pfds[0].fd, output + output_len, 4096)) > 0)
+			output_len += len;
+	}
+
+	ck_assert_int_eq(pthread_cancel(thread), 0);
+	ck_assert_int_eq(pthread_timedjoin(thread, NULL, 1e6), 0);
+	close(bt_fds[1]);
+	close(pcm_fds[0]);
+	t->a2dp.pcm.format = format;
+
+	debug("Tapped bitstream length: %zu", output_len);
+	ck_assert_uint_gt(output_len, 0);
+
+	struct a2dp_bitstream bs;
+	a2dp_bitstream_init(&bs, type);
+
+	uint8_t payload[4096];
+	size_t payload_len = 0;
+	size_t payload_offset = 0;
+	uint32_t payload_timestamp = 0;
+	bool payload_first_frame = false;
+	size_t i = 0;
+
+	for (bt_data_head = &bt_data; bt_data_head != bt_data_end; bt_data_head = bt_data_head->next) {
+
+		const rtp_header_t *rtp_header = (rtp_header_t *)bt_data_head->data;
+		const uint8_t *rtp_phdr = (uint8_t *)&rtp_header->csrc[rtp_header->cc];
+		const uint8_t *rtp_payload = rtp_phdr;
+		unsigned int rtp_payload_frames = 0;
+		size_t offset = 0;
+
+		if (type == A2DP_BITSTREAM_MPEG) {
+			const rtp_mpeg_audio_header_t *rtp_mpeg_audio_header = (void *)rtp_phdr;
+			offset = be16toh(rtp_mpeg_audio_header->offset);
+			rtp_payload += sizeof(*rtp_mpeg_audio_header);
+		}
+		else
+			rtp_payload += sizeof(rtp_media_header_t);
+
+		const size_t rtp_payload_len = bt_data_head->len - (rtp_payload - bt_data_head->data);
+
+		if (offset == 0) {
+			/* previous payload shall consist of complete frames only */
+			ck_assert_uint_eq(payload_len, 0);
+			payload_timestamp = be32toh(rtp_header->timestamp);
+			payload_first_frame = true;
+		}
+		else
+			ck_assert_uint_eq(offset, payload_offset);
+
+		ck_assert_uint_le(payload_len + rtp_payload_len, sizeof(payload));
+		memcpy(&payload[payload_len], rtp_payload, rtp_payload_len);
+		payload_len += rtp_payload_len;
+		payload_offset = offset + rtp_payload_len;
+
+		struct a2dp_bitstream_frame frame;
+		size_t ret;
+
+		while ((ret = a2dp_bitstream_parse(&bs, payload, payload_len, &frame)) > 0) {
+
+			ck_assert_uint_eq(ret, frame.len);
+
+			const struct ba_transport_pcm_frame_header *header = (void *)&output[i];
+			ck_assert_uint_le(i + sizeof(*header) + frame.len, output_len);
+			ck_assert_uint_eq(le32toh(header->length), frame.len);
+			ck_assert_int_eq(memcmp(header + 1, frame.data, frame.len), 0);
+
+			const uint32_t timestamp = le32toh(header->timestamp);
+			if (payload_first_frame)
+				ck_assert_uint_eq(timestamp, payload_timestamp);
+			else
+				ck_assert_int_ge((int32_t)(timestamp - payload_timestamp), 0);
+
+			i += sizeof(*header) + frame.len;
+			payload_first_frame = false;
+			rtp_payload_frames++;
+
+			memmove(payload, &payload[ret], payload_len -= ret);
+
+		}
+
+		if (type == A2DP_BITSTREAM_SBC) {
+			const rtp_media_header_t *rtp_media_header = (void *)rtp_phdr;
+			ck_assert_uint_eq(rtp_payload_frames, rtp_media_header->frame_count);
+		}
+
+	}
+
+	/* every transmitted frame shall be delivered exactly once */
+	ck_assert_uint_eq(payload_len, 0);
+	ck_assert_uint_eq(i, output_len);
+
+	free(output);
+}
+
+#if ENABLE_APTX || ENABLE_APTX_HD
+/**
+ * Measure the encoding speed of the A2DP source codec.
+ *
+ * The PCM signal is encoded directly with the codec callbacks, so only
+ * the PCM conversion and the encoding itself is accounted. The result is
+ * reported as the duration of encoded signal per the CPU time used. */
+static void test_a2dp_source_benchmark(struct ba_transport *t,
+		const struct a2dp_source_codec *codec, unsigned int seconds) {
+
+	const size_t headers_len = codec->rtp ? RTP_HEADER_LEN + codec->rtp_phdr_size : 0;
+	const size_t sample_size = BA_TRANSPORT_PCM_FORMAT_BYTES(t->a2dp.pcm.format);
+	const unsigned int channels = t->a2dp.pcm.channels;
+	struct a2dp_source s = {
+		.t = t,
+		.codec = codec,
+		.payload_size = t->mtu_write - headers_len };
+
+	ck_assert_ptr_ne(s.priv = calloc(1, codec->priv_size), NULL);
+	ck_assert_int_eq(codec->init(&s), 0);
+
+	/* 1 second of sine wave in the transport PCM format */
+	const size_t samples = t->a2dp.pcm.sampling * channels;
+	int16_t *pcm16 = malloc(samples * sizeof(int16_t));
+	uint8_t *pcm = malloc(samples * sample_size);
+	uint8_t *payload = malloc(s.payload_size);
+	snd_pcm_sine_s16le(pcm16, samples, channels, 0, 1.0 / 128);
+	for (size_t i = 0; i < samples; i++)
+		if (sample_size == sizeof(int16_t))
+			((int16_t *)pcm)[i] = pcm16[i];
+		else
+			((int32_t *)pcm)[i] = pcm16[i] << 8;
+
+	struct timespec ts0, ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts0);
+
+	for (unsigned int n = 0; n < seconds; n++) {
+		size_t offset = 0;
+		while (samples - offset >= s.pcm_samples) {
+			size_t consumed = 0;
+			const size_t len = MIN(samples - offset, s.pcm_buffer_samples);
+			ck_assert_int_gt(codec->encode(&s, pcm + offset * sample_size, len,
+						&consumed, payload, s.payload_size), 0);
+			offset += consumed;
+		}
+	}
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	const double elapsed = (ts.tv_sec - ts0.tv_sec) + (ts.tv_nsec - ts0.tv_nsec) / 1e9;
+	fprintf(stderr, "%s encoding: %u s of signal in %.3f s of CPU time (x%.1f)\n",
+			ba_transport_codecs_a2dp_to_string(t->type.codec), seconds, elapsed,
+			seconds / elapsed);
+
+	free(pcm16);
+	free(pcm);
+	free(payload);
+	codec->free(&s);
+	free(s.priv);
+
+}
+#endif
+
+/**
+ * Run SCO IO thread with BT socket loopback.
+ *
+ * @return This function returns the number of bytes written by the IO
+ *   thread to the BT socket. */
+static size_t test_sco(struct ba_transport *t, void *(*cb)(struct ba_transport *)) {
 
 	int sco_fds[2];
 	int pcm_mic_fds[2];
@@ -349,6 +647,7 @@ static void test_sco(struct ba_transport *t, void *(*cb)(struct ba_transport *))
 		{ sco_fds[0], POLLIN, 0 },
 		{ pcm_mic_fds[0], POLLIN, 0 }};
 	size_t decoded_samples_total = 0;
+	size_t bt_bytes_total = 0;
 	uint8_t buffer[1024];
 	ssize_t len;
 
@@ -358,6 +657,7 @@ static void test_sco(struct ba_transport *t, void *(*cb)(struct ba_transport *))
 
 			ck_assert_int_gt(len = read(sco_fds[0], buffer, t->mtu_write), 0);
 			ck_assert_int_gt(write(sco_fds[0], buffer, len), 0);
+			bt_bytes_total += len;
 
 			char label[35];
 			sprintf(label, "BT data [len: %3zd]", len);
@@ -382,6 +682,8 @@ static void test_sco(struct ba_transport *t, void *(*cb)(struct ba_transport *))
 	close(pcm_spk_fds[0]);
 	close(pcm_mic_fds[0]);
 	close(sco_fds[0]);
+
+	return bt_bytes_total;
 }
 
 static int test_transport_acquire(struct ba_transport *t) {
@@ -394,6 +696,218 @@ static int test_transport_release_bt_a2dp(struct ba_transport *t) {
 	return transport_release_bt_a2dp(t);
 }
 
+static void test_jbuf_packet(uint8_t *buffer, uint16_t seq, uint32_t ts) {
+	rtp_header_t *rtp_header = (rtp_header_t *)buffer;
+	memset(buffer, 0, RTP_HEADER_LEN);
+	rtp_header->version = 2;
+	rtp_header->seq_number = htobe16(seq);
+	rtp_header->timestamp = htobe32(ts);
+}
+
+START_TEST(test_a2dp_jbuf) {
+
+	struct a2dp_jbuf jb = { 0 };
+	struct timespec now = { 0 };
+	uint8_t packet[RTP_HEADER_LEN + 8];
+	const void *p;
+	unsigned int lost;
+
+	/* 20 ms of target depth, timestamps in PCM frames (48 kHz) */
+	ck_assert_int_eq(a2dp_jbuf_init(&jb, sizeof(packet), 48000, 20), 0);
+
+	/* packets 0 and 1 arrive in reversed order */
+	test_jbuf_packet(packet, 0xFFFF, 1000);
+	ck_assert_int_eq(a2dp_jbuf_put(&jb, &now, packet, sizeof(packet)), 1);
+	test_jbuf_packet(packet, 1, 1000 + 2 * 480);
+	ck_assert_int_eq(a2dp_jbuf_put(&jb, &now, packet, sizeof(packet)), 1);
+	test_jbuf_packet(packet, 0, 1000 + 480);
+	ck_assert_int_eq(a2dp_jbuf_put(&jb, &now, packet, sizeof(packet)), 1);
+	/* duplicated packet shall be dropped */
+	ck_assert_int_eq(a2dp_jbuf_put(&jb, &now, packet, sizeof(packet)), 0);
+
+	/* nothing is due before the target depth */
+	ck_assert_int_eq(a2dp_jbuf_get(&jb, &now, &p, &lost), 0);
+	ck_assert_int_eq(a2dp_jbuf_timeout(&jb, &now), 20);
+	ck_assert_int_eq(a2dp_jbuf_get_fill_usec(&jb), 20000);
+
+	now.tv_nsec = 20 * 1000000;
+	ck_assert_int_eq(a2dp_jbuf_get(&jb, &now, &p, &lost), sizeof(packet));
+	ck_assert_int_eq(be16toh(((rtp_header_t *)p)->seq_number), 0xFFFF);
+	a2dp_jbuf_played(&jb, 480);
+	ck_assert_int_eq(a2dp_jbuf_get(&jb, &now, &p, &lost), 0);
+	ck_assert_int_eq(a2dp_jbuf_timeout(&jb, &now), 10);
+
+	now.tv_nsec = 30 * 1000000;
+	ck_assert_int_eq(a2dp_jbuf_get(&jb, &now, &p, &lost), sizeof(packet));
+	ck_assert_int_eq(be16toh(((rtp_header_t *)p)->seq_number), 0);
+	ck_assert_int_eq(lost, 0);
+	ck_assert_int_eq(a2dp_jbuf_get_lost_frames(&jb), 0);
+	a2dp_jbuf_played(&jb, 480);
+
+	/* packet 3 is lost, packet 2 arrives late */
+	test_jbuf_packet(packet, 3, 1000 + 4 * 480);
+	ck_assert_int_eq(a2dp_jbuf_put(&jb, &now, packet, sizeof(packet)), 1);
+	now.tv_nsec = 40 * 1000000;
+	ck_assert_int_eq(a2dp_jbuf_get(&jb, &now, &p, &lost), sizeof(packet));
+	ck_assert_int_eq(be16toh(((rtp_header_t *)p)->seq_number), 1);
+	a2dp_jbuf_played(&jb, 480);
+	ck_assert_int_eq(a2dp_jbuf_get(&jb, &now, &p, &lost), 0);
+	now.tv_nsec = 60 * 1000000;
+	ck_assert_int_eq(a2dp_jbuf_get(&jb, &now, &p, &lost), sizeof(packet));
+	ck_assert_int_eq(be16toh(((rtp_header_t *)p)->seq_number), 3);
+	ck_assert_int_eq(lost, 1);
+	/* duration of the lost packet shall be concealed */
+	ck_assert_int_eq(a2dp_jbuf_get_lost_frames(&jb), 480);
+	test_jbuf_packet(packet, 2, 1000 + 3 * 480);
+	ck_assert_int_eq(a2dp_jbuf_put(&jb, &now, packet, sizeof(packet)), 0);
+	ck_assert_int_eq(jb.stats.late, 1);
+	ck_assert_int_eq(jb.stats.lost, 1);
+
+	/* large backward jump (sender restart) shall resync the buffer */
+	test_jbuf_packet(packet, 3 - 1000, 1000);
+	ck_assert_int_eq(a2dp_jbuf_put(&jb, &now, packet, sizeof(packet)), 1);
+	ck_assert_int_eq(jb.stats.late, 1);
+	ck_assert_int_eq(jb.stats.resyncs, 1);
+
+	a2dp_jbuf_free(&jb);
+
+} END_TEST
+
+START_TEST(test_a2dp_jbuf_drift) {
+
+	struct a2dp_jbuf jb = { 0 };
+	struct timespec now;
+	uint8_t packet[RTP_HEADER_LEN + 8];
+	const void *p;
+	unsigned int lost;
+	int64_t time = 0;
+	size_t i;
+
+	/* remote clock is 100 ppm faster than our clock */
+	ck_assert_int_eq(a2dp_jbuf_init(&jb, sizeof(packet), 48000, 20), 0);
+
+	for (i = 0; i < 30000; i++) {
+
+		/* packets are sent every 10 ms with up to 3 ms of jitter */
+		const int64_t arrival = i * 10000 / 1.0001 + rand() % 3000;
+
+		/* release all packets which are due before the next arrival */
+		for (;;) {
+			now.tv_sec = time / 1000000;
+			now.tv_nsec = time % 1000000 * 1000;
+			const int timeout = a2dp_jbuf_timeout(&jb, &now);
+			if (timeout == -1 || time + timeout * 1000 > arrival)
+				break;
+			time += timeout * 1000;
+			now.tv_sec = time / 1000000;
+			now.tv_nsec = time % 1000000 * 1000;
+			while (a2dp_jbuf_get(&jb, &now, &p, &lost) > 0)
+				a2dp_jbuf_played(&jb, 480);
+			time += 100;
+		}
+
+		time = arrival;
+		now.tv_sec = time / 1000000;
+		now.tv_nsec = time % 1000000 * 1000;
+		test_jbuf_packet(packet, i, i * 480);
+		ck_assert_int_eq(a2dp_jbuf_put(&jb, &now, packet, sizeof(packet)), 1);
+
+	}
+
+	const int ppm = (a2dp_jbuf_get_drift(&jb) - 1.0) * 1000000;
+	ck_assert_int_lt(abs(ppm - 100), 20);
+	ck_assert_int_eq(jb.stats.resyncs, 0);
+
+	a2dp_jbuf_free(&jb);
+
+} END_TEST
+
+START_TEST(test_a2dp_sender_delay) {
+
+	struct a2dp_sender sender;
+	const uint8_t packet[32] = { 0 };
+	uint8_t buffer[sizeof(packet)];
+	struct timespec ts0, ts, diff;
+	int fds[2];
+
+	ck_assert_int_eq(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds), 0);
+	ck_assert_int_eq(a2dp_sender_init(&sender, fds[0], 0, sizeof(packet)), 0);
+
+	/* packets shall be held in the queue for the given time */
+	a2dp_sender_set_delay(&sender, 50000);
+	clock_gettime(CLOCK_MONOTONIC, &ts0);
+	ck_assert_int_eq(a2dp_sender_send(&sender, packet, sizeof(packet), NULL), sizeof(packet));
+	ck_assert_int_eq(a2dp_sender_send(&sender, packet, sizeof(packet), NULL), sizeof(packet));
+
+	struct pollfd pfd = { fds[1], POLLIN, 0 };
+	ck_assert_int_eq(poll(&pfd, 1, 20), 0);
+	ck_assert_int_eq(poll(&pfd, 1, 500), 1);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	difftimespec(&ts0, &ts, &diff);
+	ck_assert_int_ge(diff.tv_sec * 1000 + diff.tv_nsec / 1000000, 50);
+
+	ck_assert_int_eq(read(fds[1], buffer, sizeof(buffer)), sizeof(buffer));
+	ck_assert_int_eq(read(fds[1], buffer, sizeof(buffer)), sizeof(buffer));
+
+	a2dp_sender_free(&sender);
+	close(fds[0]);
+	close(fds[1]);
+
+} END_TEST
+
+START_TEST(test_a2dp_sbc_abr) {
+
+	struct sbc_abr abr;
+	int coutq[16] = { 0 };
+	size_t i;
+
+	sbc_abr_init(&abr, 20, 53);
+	ck_assert_int_eq(abr.bitpool, 53);
+
+	/* congested link lowers bit-pool once per history period */
+	for (i = 0; i < ARRAYSIZE(coutq); i++)
+		coutq[i] = 3 * 100;
+	ck_assert_int_eq(sbc_abr_update(&abr, coutq, ARRAYSIZE(coutq), 100), 1);
+	ck_assert_int_eq(abr.bitpool, 53 - 53 / 8);
+	for (i = 0; i < ARRAYSIZE(coutq); i++)
+		ck_assert_int_eq(sbc_abr_update(&abr, coutq, ARRAYSIZE(coutq), 100), 0);
+	ck_assert_int_eq(sbc_abr_update(&abr, coutq, ARRAYSIZE(coutq), 100), 1);
+
+	/* bit-pool shall not drop below the lower bound */
+	for (i = 0; i < 100 * ARRAYSIZE(coutq); i++)
+		sbc_abr_update(&abr, coutq, ARRAYSIZE(coutq), 100);
+	ck_assert_int_eq(abr.bitpool, 20);
+
+	/* drained link slowly restores bit-pool up to the target */
+	memset(coutq, 0, sizeof(coutq));
+	for (i = 0; i < 4 * ARRAYSIZE(coutq) - 1; i++)
+		ck_assert_int_eq(sbc_abr_update(&abr, coutq, ARRAYSIZE(coutq), 100), 0);
+	ck_assert_int_eq(sbc_abr_update(&abr, coutq, ARRAYSIZE(coutq), 100), 1);
+	ck_assert_int_eq(abr.bitpool, 22);
+	for (i = 0; i < 100 * ARRAYSIZE(coutq); i++)
+		sbc_abr_update(&abr, coutq, ARRAYSIZE(coutq), 100);
+	ck_assert_int_eq(abr.bitpool, 53);
+
+	struct ba_transport_type ttype = {
+		.profile = BA_TRANSPORT_PROFILE_A2DP_SOURCE,
+		.codec = A2DP_CODEC_SBC };
+	struct ba_transport *t1 = ba_transport_new_a2dp(device1, ttype, ":test", "/path/sbc",
+			&a2dp_codec_source_sbc, &config_sbc_44100_stereo);
+	struct ba_transport *t2 = ba_transport_new_a2dp(device2, ttype, ":test", "/path/sbc",
+			&a2dp_codec_sink_sbc, &config_sbc_44100_stereo);
+
+	t1->acquire = t2->acquire = test_transport_acquire;
+	t1->release = t2->release = test_transport_release_bt_a2dp;
+
+	/* run encoder with enabled ABR */
+	const bool sbc_abr = config.sbc_abr;
+	config.sbc_abr = true;
+	t1->mtu_write = t2->mtu_read = 153 * 3;
+	test_a2dp(t1, t2, a2dp_source_sbc, test_io_thread_a2dp_dump_bt);
+	config.sbc_abr = sbc_abr;
+
+} END_TEST
+
 START_TEST(test_a2dp_sbc) {
 
 	struct ba_transport_type ttype = {
@@ -414,7 +928,18 @@ START_TEST(test_a2dp_sbc) {
 	else {
 		t1->mtu_write = t2->mtu_read = 153 * 3;
 		test_a2dp(t1, t2, a2dp_source_sbc, test_io_thread_a2dp_dump_bt);
+		/* delay shall account at least the SBC algorithmic delay */
+		ck_assert_int_ge(ba_transport_pcm_get_delay(&t1->a2dp.pcm), (128 + 40) * 10000 / 44100);
 		test_a2dp(t1, t2, test_io_thread_a2dp_dump_pcm, a2dp_sink_sbc);
+		/* decode on the IO engine worker instead of the IO thread */
+		const size_t samples = test_a2dp_sink_io_engine(t2, &a2dp_sink_sbc_codec, NULL);
+		/* lost packet shall be concealed with the signal of the same duration,
+		 * up to the RTP timestamp resolution (1 ms tolerance) */
+		const size_t samples_lost = test_a2dp_sink_io_engine(t2, &a2dp_sink_sbc_codec,
+				bt_data.next->next);
+		ck_assert_int_le(labs((long)samples_lost - (long)samples), 44 * 2);
+		/* deliver received SBC frames without decoding */
+		test_a2dp_sink_tap(t2, A2DP_BITSTREAM_SBC);
 	}
 
 } END_TEST
@@ -441,12 +966,84 @@ START_TEST(test_a2dp_mp3) {
 		t1->mtu_write = t2->mtu_read = 250;
 		test_a2dp(t1, t2, a2dp_source_mp3, test_io_thread_a2dp_dump_bt);
 		test_a2dp(t1, t2, test_io_thread_a2dp_dump_pcm, a2dp_sink_mpeg);
+		/* with such a small MTU the MPEG audio frames are fragmented, so
+		 * the tap has to reassemble them before splitting the bitstream */
+		test_a2dp_sink_tap(t2, A2DP_BITSTREAM_MPEG);
 	}
 
 } END_TEST
 #endif
 
 #if ENABLE_AAC
+START_TEST(test_a2dp_aac_abr) {
+
+	struct aac_abr abr;
+	int coutq[16] = { 0 };
+	size_t i;
+
+	aac_abr_init(&abr, AACENC_BITRATE, 64000, 256000, 32000);
+	ck_assert_int_eq(abr.value, 256000);
+
+	/* single write stall shall lower bit rate */
+	ck_assert_int_eq(aac_abr_update(&abr, coutq, ARRAYSIZE(coutq), 100, 1), 1);
+	ck_assert_int_eq(abr.value, 256000 - 32000);
+	for (i = 0; i < ARRAYSIZE(coutq); i++)
+		ck_assert_int_eq(aac_abr_update(&abr, coutq, ARRAYSIZE(coutq), 100, 2 + i), 0);
+
+	/* persistent congestion shall not go below the floor */
+	for (i = 0; i < ARRAYSIZE(coutq); i++)
+		coutq[i] = 1024 * 16;
+	for (i = 0; i < 100 * ARRAYSIZE(coutq); i++)
+		aac_abr_update(&abr, coutq, ARRAYSIZE(coutq), 100, 100);
+	ck_assert_int_eq(abr.value, 64000);
+
+	/* drained link restores negotiated bit rate */
+	memset(coutq, 0, sizeof(coutq));
+	for (i = 0; i < 4 * ARRAYSIZE(coutq) - 1; i++)
+		ck_assert_int_eq(aac_abr_update(&abr, coutq, ARRAYSIZE(coutq), 100, 100), 0);
+	ck_assert_int_eq(aac_abr_update(&abr, coutq, ARRAYSIZE(coutq), 100, 100), 1);
+	ck_assert_int_eq(abr.value, 64000 + 32000);
+	for (i = 0; i < 100 * ARRAYSIZE(coutq); i++)
+		aac_abr_update(&abr, coutq, ARRAYSIZE(coutq), 100, 100);
+	ck_assert_int_eq(abr.value, 256000);
+
+	struct ba_transport_type ttype = {
+		.profile = BA_TRANSPORT_PROFILE_A2DP_SOURCE,
+		.codec = A2DP_CODEC_MPEG24 };
+	struct ba_transport *t1 = ba_transport_new_a2dp(device1, ttype, ":test", "/path/aac",
+			&a2dp_codec_source_aac, &config_aac_44100_stereo);
+	struct ba_transport *t2 = ba_transport_new_a2dp(device2, ttype, ":test", "/path/aac",
+			&a2dp_codec_sink_aac, &config_aac_44100_stereo);
+
+	t1->acquire = t2->acquire = test_transport_acquire;
+	t1->release = t2->release = test_transport_release_bt_a2dp;
+
+	const bool aac_abr = config.aac_abr;
+	const uint8_t aac_vbr_mode = config.aac_vbr_mode;
+	config.aac_abr = true;
+
+	/* Change of the VBR mode re-initializes the encoder, which results in
+	 * an audible glitch, so ABR shall be enabled in the CBR mode only. */
+	struct a2dp_source_aac_data priv = { 0 };
+	struct a2dp_source s = { .t = t1, .codec = &a2dp_source_aac_codec, .priv = &priv };
+	config.aac_vbr_mode = 4;
+	ck_assert_int_eq(a2dp_source_aac_init(&s), 0);
+	ck_assert_int_eq(priv.abr_enabled, false);
+	a2dp_source_aac_free(&s);
+	config.aac_vbr_mode = 0;
+	ck_assert_int_eq(a2dp_source_aac_init(&s), 0);
+	ck_assert_int_eq(priv.abr_enabled, true);
+	ck_assert_int_eq(priv.abr.param, AACENC_BITRATE);
+	a2dp_source_aac_free(&s);
+
+	/* run encoder with enabled ABR */
+	t1->mtu_write = t2->mtu_read = 64;
+	test_a2dp(t1, t2, a2dp_source_aac, test_io_thread_a2dp_dump_bt);
+	config.aac_vbr_mode = aac_vbr_mode;
+	config.aac_abr = aac_abr;
+
+} END_TEST
+
 START_TEST(test_a2dp_aac) {
 
 	struct ba_transport_type ttype = {
@@ -473,6 +1070,43 @@ START_TEST(test_a2dp_aac) {
 } END_TEST
 #endif
 
+#if ENABLE_AAC && ENABLE_USAC
+START_TEST(test_a2dp_usac) {
+
+	struct ba_transport_type ttype_aac = {
+		.profile = BA_TRANSPORT_PROFILE_A2DP_SOURCE,
+		.codec = A2DP_CODEC_MPEG24 };
+	struct ba_transport_type ttype_usac = {
+		.profile = BA_TRANSPORT_PROFILE_A2DP_SINK,
+		.codec = A2DP_CODEC_MPEGD };
+	struct ba_transport *t1 = ba_transport_new_a2dp(device1, ttype_aac, ":test", "/path/aac",
+			&a2dp_codec_source_aac, &config_aac_44100_stereo);
+	struct ba_transport *t2 = ba_transport_new_a2dp(device2, ttype_usac, ":test", "/path/usac",
+			&a2dp_codec_sink_usac, &config_usac_44100_stereo);
+
+	t1->acquire = t2->acquire = test_transport_acquire;
+	t1->release = t2->release = test_transport_release_bt_a2dp;
+
+	/* FDK AAC library does not provide USAC encoder, so the sink is fed with
+	 * the AAC LC stream. The LATM stream mux configuration is transmitted
+	 * in-band, so the decoder is configured by the stream itself. Hence,
+	 * this test covers the USAC sink pipeline (RTP reassembly, buffering
+	 * and LATM decoding), but NOT the USAC decoding itself. */
+
+	if (aging_duration) {
+		t1->mtu_write = t2->mtu_read = 450;
+		test_a2dp(t1, t2, a2dp_source_aac, a2dp_sink_usac);
+	}
+	else {
+		t1->mtu_write = t2->mtu_read = 64;
+		test_a2dp(t1, t2, a2dp_source_aac, test_io_thread_a2dp_dump_bt);
+		test_a2dp(t1, t2, test_io_thread_a2dp_dump_pcm, a2dp_sink_usac);
+		ck_assert_int_gt(test_a2dp_sink_io_engine(t2, &a2dp_sink_usac_codec, NULL), 0);
+	}
+
+} END_TEST
+#endif
+
 #if ENABLE_APTX
 START_TEST(test_a2dp_aptx) {
 
@@ -488,10 +1122,25 @@ START_TEST(test_a2dp_aptx) {
 	t1->release = t2->release = test_transport_release_bt_a2dp;
 
 	if (aging_duration) {
+#if HAVE_APTX_DECODE
+		t1->mtu_write = t2->mtu_read = 40;
+		test_a2dp(t1, t2, a2dp_source_aptx, a2dp_sink_aptx);
+#endif
 	}
 	else {
 		t1->mtu_write = t2->mtu_read = 40;
 		test_a2dp(t1, t2, a2dp_source_aptx, test_io_thread_a2dp_dump_bt);
+#if HAVE_APTX_DECODE
+		test_a2dp(t1, t2, test_io_thread_a2dp_dump_pcm, a2dp_sink_aptx);
+		/* decoder shall recover from the code word misalignment */
+		test_bt_data_misalign();
+		test_a2dp(t1, t2, test_io_thread_a2dp_dump_pcm, a2dp_sink_aptx);
+#endif
+		if (benchmark) {
+			/* benchmark with the default L2CAP MTU */
+			t1->mtu_write = 672;
+			test_a2dp_source_benchmark(t1, &a2dp_source_aptx_codec, 10);
+		}
 	};
 
 } END_TEST
@@ -512,15 +1161,98 @@ START_TEST(test_a2dp_aptx_hd) {
 	t1->release = t2->release = test_transport_release_bt_a2dp;
 
 	if (aging_duration) {
+#if HAVE_APTX_HD_DECODE
+		t1->mtu_write = t2->mtu_read = 60;
+		test_a2dp(t1, t2, a2dp_source_aptx_hd, a2dp_sink_aptx_hd);
+#endif
 	}
 	else {
 		t1->mtu_write = t2->mtu_read = 60;
 		test_a2dp(t1, t2, a2dp_source_aptx_hd, test_io_thread_a2dp_dump_bt);
+#if HAVE_APTX_HD_DECODE
+		test_a2dp(t1, t2, test_io_thread_a2dp_dump_pcm, a2dp_sink_aptx_hd);
+		/* decoder shall recover from the code word misalignment */
+		test_bt_data_misalign();
+		test_a2dp(t1, t2, test_io_thread_a2dp_dump_pcm, a2dp_sink_aptx_hd);
+#endif
+		if (benchmark) {
+			/* benchmark with the default L2CAP MTU */
+			t1->mtu_write = 672;
+			test_a2dp_source_benchmark(t1, &a2dp_source_aptx_hd_codec, 10);
+		}
 	};
 
 } END_TEST
 #endif
 
+#if ENABLE_FASTSTREAM
+START_TEST(test_a2dp_faststream) {
+
+	struct ba_transport_type ttype = {
+		.profile = BA_TRANSPORT_PROFILE_A2DP_SOURCE,
+		.codec = A2DP_CODEC_VENDOR_FASTSTREAM };
+	struct ba_transport *t1 = ba_transport_new_a2dp(device1, ttype, ":test", "/path/faststream",
+			&a2dp_codec_source_faststream, &config_faststream_44100_16000);
+	struct ba_transport *t2 = ba_transport_new_a2dp(device2, ttype, ":test", "/path/faststream",
+			&a2dp_codec_sink_faststream, &config_faststream_44100_16000);
+
+	t1->acquire = t2->acquire = test_transport_acquire;
+	t1->release = t2->release = test_transport_release_bt_a2dp;
+
+	/* room for 3 SBC frames padded to 72 bytes */
+	t1->mtu_write = t1->mtu_read = 216;
+	test_a2dp(t1, t2, a2dp_source_faststream, test_io_thread_a2dp_dump_bt);
+
+	ck_assert_int_eq(bt_data.len, 216);
+	ck_assert_int_eq(bt_data.data[0], 0x9C);
+	ck_assert_int_eq(bt_data.data[72], 0x9C);
+
+	/* voice back-channel shall be decoded into the back-channel PCM */
+
+	int bt_fds[2];
+	int pcm_fds[2];
+
+	ck_assert_int_eq(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0, bt_fds), 0);
+	ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pcm_fds), 0);
+
+	t1->bt_fd = bt_fds[1];
+	t1->a2dp.pcm.fd = -1;
+	t1->a2dp.pcm_bc.fd = pcm_fds[1];
+
+	sbc_t sbc;
+	sbc_init(&sbc, 0);
+	sbc.frequency = SBC_FREQ_16000;
+	sbc.mode = SBC_MODE_MONO;
+	sbc.subbands = SBC_SB_8;
+	sbc.blocks = SBC_BLK_16;
+	sbc.allocation = SBC_AM_LOUDNESS;
+	sbc.bitpool = 32;
+
+	int16_t pcm[128] = { 0 };
+	uint8_t packet[216];
+	ssize_t len;
+
+	ck_assert_int_eq(sbc_encode(&sbc, pcm, sizeof(pcm), packet, sizeof(packet), &len), sizeof(pcm));
+	ck_assert_int_eq(sbc_encode(&sbc, pcm, sizeof(pcm), packet + len, sizeof(packet) - len, &len), sizeof(pcm));
+	sbc_finish(&sbc);
+
+	pthread_t thread;
+	pthread_create(&thread, NULL, PTHREAD_ROUTINE(a2dp_source_faststream), ba_transport_ref(t1));
+	ck_assert_int_eq(write(bt_fds[0], packet, 2 * len), 2 * len);
+
+	struct pollfd pfds[] = {{ pcm_fds[0], POLLIN, 0 }};
+	size_t decoded = 0;
+	while (poll(pfds, ARRAYSIZE(pfds), 500) > 0 &&
+			(len = read(pfds[0].fd, pcm, sizeof(pcm))) > 0)
+		decoded += len;
+	ck_assert_int_eq(decoded, 2 * sizeof(pcm));
+
+	ck_assert_int_eq(pthread_cancel(thread), 0);
+	ck_assert_int_eq(pthread_timedjoin(thread, NULL, 1e6), 0);
+
+} END_TEST
+#endif
+
 #if ENABLE_LDAC
 START_TEST(test_a2dp_ldac) {
 
@@ -558,6 +1290,26 @@ START_TEST(test_sco_cvsd) {
 
 } END_TEST
 
+START_TEST(test_sco_cvsd_loopback) {
+
+	struct ba_transport_type ttype = { .profile = BA_TRANSPORT_PROFILE_HSP_AG };
+	struct ba_transport *t = ba_transport_new_sco(device1, ttype, ":test", "/path/sco/cvsd", -1);
+
+	t->mtu_read = t->mtu_write = 48;
+	t->acquire = test_transport_acquire;
+
+	ba_transport_send_signal(t, BA_TRANSPORT_SIGNAL_PING);
+	const size_t len = test_sco(t, sco_thread);
+
+	/* whole speaker signal (except the last incomplete
+	 * packet) shall be transferred to the BT socket */
+	if (input_pcm_file == NULL)
+		ck_assert_int_ge(len, 5 * 1024 * sizeof(int16_t) - t->mtu_write);
+	else
+		ck_assert_int_gt(len, 0);
+
+} END_TEST
+
 #if ENABLE_MSBC
 START_TEST(test_sco_msbc) {
 
@@ -582,6 +1334,7 @@ int main(int argc, char *argv[]) {
 	struct option longopts[] = {
 		{ "help", no_argument, NULL, 'h' },
 		{ "aging", required_argument, NULL, 'a' },
+		{ "benchmark", no_argument, NULL, 'b' },
 		{ "dump", no_argument, NULL, 'd' },
 		{ "input", required_argument, NULL, 'i' },
 		{ 0, 0, 0, 0 },
@@ -607,16 +1360,23 @@ int main(int argc, char *argv[]) {
 		{ ba_transport_codecs_hfp_to_string(HFP_CODEC_CVSD), TEST_CODEC_CVSD },
 #define TEST_CODEC_MSBC (1 << 7)
 		{ ba_transport_codecs_hfp_to_string(HFP_CODEC_MSBC), TEST_CODEC_MSBC },
+#define TEST_CODEC_FASTSTREAM (1 << 8)
+		{ ba_transport_codecs_a2dp_to_string(A2DP_CODEC_VENDOR_FASTSTREAM), TEST_CODEC_FASTSTREAM },
+#define TEST_CODEC_USAC (1 << 9)
+		{ ba_transport_codecs_a2dp_to_string(A2DP_CODEC_MPEGD), TEST_CODEC_USAC },
 	};
 
 	while ((opt = getopt_long(argc, argv, opts, longopts, NULL)) != -1)
 		switch (opt) {
 		case 'h' /* --help */ :
-			printf("usage: %s [--aging=SEC] [--dump] [--input=FILE] [codec ...]\n", argv[0]);
+			printf("usage: %s [--aging=SEC] [--benchmark] [--dump] [--input=FILE] [codec ...]\n", argv[0]);
 			return 0;
 		case 'a' /* --aging=SEC */ :
 			aging_duration = atoi(optarg);
 			break;
+		case 'b' /* --benchmark */ :
+			benchmark = true;
+			break;
 		case 'd' /* --dump */ :
 			dump_data = true;
 			break;
@@ -649,8 +1409,12 @@ int main(int argc, char *argv[]) {
 	SRunner *sr = srunner_create(s);
 
 	suite_add_tcase(s, tc);
-	tcase_set_timeout(tc, aging_duration + 5);
+	tcase_set_timeout(tc, aging_duration + (benchmark ? 30 : 5));
 
+	tcase_add_test(tc, test_a2dp_jbuf);
+	tcase_add_test(tc, test_a2dp_jbuf_drift);
+	tcase_add_test(tc, test_a2dp_sender_delay);
+	tcase_add_test(tc, test_a2dp_sbc_abr);
 	if (enabled_codecs & TEST_CODEC_SBC)
 		tcase_add_test(tc, test_a2dp_sbc);
 #if ENABLE_MP3LAME
@@ -659,9 +1423,14 @@ int main(int argc, char *argv[]) {
 #endif
 #if ENABLE_AAC
 	config.aac_afterburner = true;
+	tcase_add_test(tc, test_a2dp_aac_abr);
 	if (enabled_codecs & TEST_CODEC_AAC)
 		tcase_add_test(tc, test_a2dp_aac);
 #endif
+#if ENABLE_AAC && ENABLE_USAC
+	if (enabled_codecs & TEST_CODEC_USAC)
+		tcase_add_test(tc, test_a2dp_usac);
+#endif
 #if ENABLE_APTX
 	if (enabled_codecs & TEST_CODEC_APTX)
 		tcase_add_test(tc, test_a2dp_aptx);
@@ -670,14 +1439,20 @@ int main(int argc, char *argv[]) {
 	if (enabled_codecs & TEST_CODEC_APTX_HD)
 		tcase_add_test(tc, test_a2dp_aptx_hd);
 #endif
+#if ENABLE_FASTSTREAM
+	if (enabled_codecs & TEST_CODEC_FASTSTREAM)
+		tcase_add_test(tc, test_a2dp_faststream);
+#endif
 #if ENABLE_LDAC
 	config.ldac_abr = true;
 	config.ldac_eqmid = LDACBT_EQMID_HQ;
 	if (enabled_codecs & TEST_CODEC_LDAC)
 		tcase_add_test(tc, test_a2dp_ldac);
 #endif
-	if (enabled_codecs & TEST_CODEC_CVSD)
+	if (enabled_codecs & TEST_CODEC_CVSD) {
 		tcase_add_test(tc, test_sco_cvsd);
+		tcase_add_test(tc, test_sco_cvsd_loopback);
+	}
 #if ENABLE_MSBC
 	if (enabled_codecs & TEST_CODEC_MSBC)
 		tcase_add_test(tc, test_sco_msbc);
@@ -12,6 +12,7 @@
 
 #include "inc/sine.inc"
 #include "../src/msbc.c"
+#include "../src/plc.c"
 #include "../src/shared/defs.h"
 #include "../src/shared/ffb.c"
 #include "../src/shared/log.c"
@@ -137,6 +138,100 @@ START_TEST(test_msbc_encode_decode) {
 
 } END_TEST
 
+START_TEST(test_msbc_plc) {
+
+	struct plc plc = { 0 };
+	int16_t sine[MSBC_CODESAMPLES * 6];
+	int16_t pcm[MSBC_CODESAMPLES];
+	size_t i;
+
+	ck_assert_int_eq(plc_init(&plc, 1, 16000), 0);
+	snd_pcm_sine_s16le(sine, ARRAYSIZE(sine), 1, 0, 1.0 / 128);
+
+	for (i = 0; i < 4; i++) {
+		memcpy(pcm, &sine[i * MSBC_CODESAMPLES], sizeof(pcm));
+		plc_good(&plc, pcm, MSBC_CODESAMPLES);
+		ck_assert_int_eq(memcmp(pcm, &sine[i * MSBC_CODESAMPLES], sizeof(pcm)), 0);
+	}
+
+	/* concealed frame shall continue the periodic signal */
+	plc_conceal(&plc, pcm, MSBC_CODESAMPLES);
+	for (i = 0; i < MSBC_CODESAMPLES; i++)
+		ck_assert_int_lt(abs(pcm[i] - sine[4 * MSBC_CODESAMPLES + i]), 1000);
+	ck_assert_int_eq(plc.concealed, 1);
+
+	/* first good frame after the loss is overlap-added */
+	memcpy(pcm, &sine[5 * MSBC_CODESAMPLES], sizeof(pcm));
+	plc_good(&plc, pcm, MSBC_CODESAMPLES);
+	for (i = 0; i < MSBC_CODESAMPLES; i++)
+		ck_assert_int_lt(abs(pcm[i] - sine[5 * MSBC_CODESAMPLES + i]), 1000);
+
+	plc_free(&plc);
+
+} END_TEST
+
+START_TEST(test_msbc_decode_plc) {
+
+	struct esco_msbc msbc = { .initialized = false };
+	int16_t sine[1024];
+	size_t len;
+	size_t i;
+	int rv;
+
+	ck_assert_int_eq(msbc_init(&msbc), 0);
+	snd_pcm_sine_s16le(sine, ARRAYSIZE(sine), 1, 0, 1.0 / 128);
+
+	uint8_t data[sizeof(sine)];
+	uint8_t *data_tail = data;
+
+	for (rv = 1, i = 0; rv == 1;) {
+
+		len = MIN(ARRAYSIZE(sine) - i, ffb_len_in(&msbc.enc_pcm));
+		memcpy(msbc.enc_pcm.tail, &sine[i], len * msbc.enc_pcm.size);
+		ffb_seek(&msbc.enc_pcm, len);
+		i += len;
+
+		rv = msbc_encode(&msbc);
+
+		len = ffb_blen_out(&msbc.enc_data);
+		memcpy(data_tail, msbc.enc_data.data, len);
+		ffb_shift(&msbc.enc_data, len);
+		data_tail += len;
+
+	}
+
+	/* drop the 4th eSCO mSBC frame */
+	const size_t frame_len = sizeof(esco_msbc_frame_t);
+	memmove(&data[3 * frame_len], &data[4 * frame_len], (data_tail - data) - 4 * frame_len);
+	data_tail -= frame_len;
+
+	int16_t pcm[sizeof(sine)];
+	int16_t *pcm_tail = pcm;
+
+	for (rv = 1, i = 0; rv == 1; ) {
+
+		len = MIN((data_tail - data) - i, ffb_blen_in(&msbc.dec_data));
+		memcpy(msbc.dec_data.tail, &data[i], len);
+		ffb_seek(&msbc.dec_data, len);
+		i += len;
+
+		rv = msbc_decode(&msbc);
+
+		len = ffb_len_out(&msbc.dec_pcm);
+		memcpy(pcm_tail, msbc.dec_pcm.data, len * msbc.dec_pcm.size);
+		ffb_shift(&msbc.dec_pcm, len);
+		pcm_tail += len;
+
+	}
+
+	/* lost frame shall be replaced with the synthesized one */
+	ck_assert_int_eq(pcm_tail - pcm, 960);
+	ck_assert_int_eq(msbc.dec_plc.concealed, 1);
+
+	msbc_finish(&msbc);
+
+} END_TEST
+
 int main(void) {
 
 	Suite *s = suite_create(__FILE__);
@@ -148,6 +243,8 @@ int main(void) {
 	tcase_add_test(tc, test_msbc_init);
 	tcase_add_test(tc, test_msbc_find_h2_header);
 	tcase_add_test(tc, test_msbc_encode_decode);
+	tcase_add_test(tc, test_msbc_plc);
+	tcase_add_test(tc, test_msbc_decode_plc);
 
 	srunner_run_all(sr, CK_ENV);
 	int nf = srunner_ntests_failed(sr);
@@ -27,8 +27,11 @@
 #include "../src/dbus.c"
 #include "../src/at.c"
 #include "../src/hci.c"
+#include "../src/io-engine.c"
+#include "../src/io-sched.c"
 #include "../src/utils.c"
 #include "../src/shared/log.c"
+#include "../src/shared/shm-ring.c"
 
 static struct ba_adapter *adapter = NULL;
 static struct ba_device *device = NULL;
@@ -8,6 +8,9 @@
  *
  */
 
+#include <poll.h>
+#include <unistd.h>
+
 #include <check.h>
 
 #include "../src/hci.c"
@@ -16,6 +19,7 @@
 #include "../src/shared/ffb.c"
 #include "../src/shared/log.c"
 #include "../src/shared/rt.c"
+#include "../src/shared/shm-ring.c"
 
 START_TEST(test_g_dbus_bluez_object_path_to_hci_dev_id) {
 
@@ -178,6 +182,56 @@ START_TEST(test_difftimespec) {
 
 } END_TEST
 
+START_TEST(test_asrsync) {
+
+	struct asrsync asrs = { .timer_fd = -1 };
+	struct timespec ts0, ts;
+
+	ck_assert_int_eq(asrsync_timer_create(&asrs), 0);
+	asrsync_init(&asrs, 1000);
+	clock_gettime(ASRSYNC_CLOCK, &ts0);
+
+	/* blocking synchronization: 20 ms ahead of time */
+	ck_assert_int_eq(asrsync_sync(&asrs, 20), 1);
+	clock_gettime(ASRSYNC_CLOCK, &ts);
+	difftimespec(&ts0, &ts, &ts);
+	ck_assert_int_ge((int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec, 20000000);
+	ck_assert_int_eq(asrs.lateness.cycles, 1);
+	ck_assert_int_eq(asrs.lateness.missed, 0);
+
+	/* timer based synchronization: another 20 ms ahead of time */
+	ck_assert_int_eq(asrsync_timer_arm(&asrs, 20), 1);
+	ck_assert_int_eq(asrs.timer_armed, true);
+	struct pollfd pfd = { asrs.timer_fd, POLLIN, 0 };
+	ck_assert_int_eq(poll(&pfd, 1, 0), 0);
+	ck_assert_int_eq(poll(&pfd, 1, 1000), 1);
+	ck_assert_int_eq(asrsync_timer_ack(&asrs), 0);
+	ck_assert_int_eq(asrs.timer_armed, false);
+	clock_gettime(ASRSYNC_CLOCK, &ts);
+	difftimespec(&ts0, &ts, &ts);
+	ck_assert_int_ge((int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec, 40000000);
+	ck_assert_int_eq(asrs.lateness.cycles, 2);
+
+	/* deadline missed - no need to wait */
+	usleep(10000);
+	ck_assert_int_eq(asrsync_timer_arm(&asrs, 5), 0);
+	ck_assert_int_eq(asrs.timer_armed, false);
+	ck_assert_int_eq(asrs.lateness.missed, 1);
+	ck_assert_uint_ge(asrs.lateness.last, 5000000);
+	ck_assert_int_ge(asrsync_get_lateness_max_usec(&asrs), 5000);
+
+	/* lateness longer than 2^31 ns shall not overflow */
+	asrs.ts_deadline = asrs.ts;
+	asrs.ts_deadline.tv_sec -= 3;
+	asrsync_update_lateness(&asrs, true);
+	ck_assert_uint_eq(asrs.lateness.last, 3000000000);
+	ck_assert_uint_eq(asrsync_get_lateness_max_usec(&asrs), 3000000);
+
+	asrsync_timer_free(&asrs);
+	ck_assert_int_eq(asrs.timer_fd, -1);
+
+} END_TEST
+
 START_TEST(test_fifo_buffer) {
 
 	ffb_t ffb_u8 = { 0 };
@@ -236,6 +290,135 @@ START_TEST(test_fifo_buffer) {
 
 } END_TEST
 
+START_TEST(test_fifo_buffer_ring) {
+
+	ffb_t ffb = { 0 };
+	size_t i, j;
+
+	ck_assert_int_eq(ffb_init_ring_uint8_t(&ffb, 3000), 0);
+	ck_assert_ptr_eq(ffb.data, ffb.tail);
+	ck_assert_int_eq(ffb.nmemb, 3000);
+	ck_assert_int_eq(ffb_len_in(&ffb), 3000);
+
+	/* write and consume data in chunks which are not aligned with the
+	 * ring size, so the data will wrap around the end of the ring */
+	uint8_t counter = 0;
+	for (i = 0; i < 20; i++) {
+
+		uint8_t *tail = ffb.tail;
+		for (j = 0; j < 1777; j++)
+			tail[j] = counter + j;
+		ffb_seek(&ffb, 1777);
+
+		ck_assert_int_eq(ffb_len_out(&ffb), 1777);
+		for (j = 0; j < 1777; j++)
+			ck_assert_int_eq(((uint8_t *)ffb.data)[j], (uint8_t)(counter + j));
+
+		ck_assert_int_eq(ffb_shift(&ffb, 1500), 1500);
+		ck_assert_int_eq(ffb_len_out(&ffb), 277);
+		ck_assert_int_eq(((uint8_t *)ffb.data)[0], (uint8_t)(counter + 1500));
+		ck_assert_int_eq(ffb_shift(&ffb, 277), 277);
+		counter += 1777;
+
+		/* head pointer shall always stay within the first copy of the ring */
+		ck_assert_int_ge((uint8_t *)ffb.data - (uint8_t *)ffb.ring, 0);
+		ck_assert_int_lt((uint8_t *)ffb.data - (uint8_t *)ffb.ring, ffb.ring_size);
+
+	}
+
+	ffb_rewind(&ffb);
+	ck_assert_int_eq(ffb_len_in(&ffb), 3000);
+
+	/* re-initialization as a linear buffer shall release the ring */
+	ck_assert_int_eq(ffb_init_uint8_t(&ffb, 64), 0);
+	ck_assert_int_eq(ffb.ring_size, 0);
+	ck_assert_int_eq(ffb_len_in(&ffb), 64);
+
+	ffb_free(&ffb);
+	ck_assert_ptr_eq(ffb.data, NULL);
+
+} END_TEST
+
+START_TEST(test_shm_ring) {
+
+	struct shm_ring producer;
+	struct shm_ring consumer;
+	uint8_t buffer[3000];
+	eventfd_t tmp;
+	size_t i, j;
+
+	ck_assert_int_eq(shm_ring_create(&producer, 3000), 0);
+	ck_assert_int_eq(producer.size % sysconf(_SC_PAGESIZE), 0);
+	ck_assert_int_eq(shm_ring_avail_write(&producer), producer.size);
+
+	/* attach to the ring using duplicated descriptors - the same way as
+	 * it would be done by the client which received them via D-Bus */
+	ck_assert_int_eq(shm_ring_attach(&consumer, dup(producer.fd),
+				dup(producer.fd_data), dup(producer.fd_space)), 0);
+	ck_assert_int_eq(consumer.size, producer.size);
+	ck_assert_int_eq(shm_ring_avail_read(&consumer), 0);
+
+	uint8_t counter = 0;
+	for (i = 0; i < 20; i++) {
+
+		for (j = 0; j < 1777; j++)
+			buffer[j] = counter + j;
+		ck_assert_int_eq(shm_ring_write(&producer, buffer, 1777), 1777);
+		ck_assert_int_eq(eventfd_read(consumer.fd_data, &tmp), 0);
+
+		ck_assert_int_eq(shm_ring_avail_read(&consumer), 1777);
+		memset(buffer, 0, sizeof(buffer));
+		ck_assert_int_eq(shm_ring_read(&consumer, buffer, sizeof(buffer)), 1777);
+		/* the ring was not full, so the producer is not notified */
+		ck_assert_int_eq(eventfd_read(producer.fd_space, &tmp), -1);
+		for (j = 0; j < 1777; j++)
+			ck_assert_int_eq(buffer[j], (uint8_t)(counter + j));
+
+		counter += 1777;
+	}
+
+	/* writing to the full ring shall not overwrite unread data */
+	ck_assert_int_eq(shm_ring_write(&producer, buffer, sizeof(buffer)), sizeof(buffer));
+	ck_assert_int_eq(shm_ring_write(&producer, buffer, producer.size),
+			producer.size - sizeof(buffer));
+	ck_assert_int_eq(shm_ring_avail_write(&producer), 0);
+
+	/* consumer is notified only upon the empty to non-empty transition */
+	ck_assert_int_eq(eventfd_read(consumer.fd_data, &tmp), 0);
+	ck_assert_int_eq(tmp, 1);
+
+	/* producer is notified only upon the full to non-full transition */
+	ck_assert_int_eq(shm_ring_read(&consumer, buffer, 1000), 1000);
+	ck_assert_int_eq(eventfd_read(producer.fd_space, &tmp), 0);
+	ck_assert_int_eq(shm_ring_read(&consumer, buffer, 1000), 1000);
+	ck_assert_int_eq(eventfd_read(producer.fd_space, &tmp), -1);
+	ck_assert_int_eq(shm_ring_write(&producer, buffer, 2000), 2000);
+	ck_assert_int_eq(eventfd_read(consumer.fd_data, &tmp), -1);
+
+	ck_assert_int_eq(shm_ring_drop(&consumer), producer.size);
+	ck_assert_int_eq(shm_ring_avail_read(&consumer), 0);
+	ck_assert_int_eq(eventfd_read(producer.fd_space, &tmp), 0);
+
+	/* indices set by the misbehaving peer shall not be trusted */
+	const uint64_t write_idx = producer.hdr->write_idx;
+	producer.hdr->write_idx += producer.size + 1;
+	ck_assert_int_eq(shm_ring_avail_read(&consumer), -1);
+	ck_assert_int_eq(errno, EBADMSG);
+	ck_assert_int_eq(shm_ring_read(&consumer, buffer, sizeof(buffer)), -1);
+	ck_assert_int_eq(shm_ring_write(&producer, buffer, sizeof(buffer)), -1);
+	ck_assert_int_eq(shm_ring_drop(&consumer), -1);
+	producer.hdr->write_idx = write_idx;
+
+	ck_assert_int_eq(shm_ring_is_closed(&consumer), false);
+	shm_ring_close(&producer);
+	ck_assert_int_eq(shm_ring_is_closed(&consumer), true);
+
+	shm_ring_free(&consumer);
+	shm_ring_free(&producer);
+	ck_assert_int_eq(producer.fd, -1);
+
+} END_TEST
+
 int main(void) {
 
 	Suite *s = suite_create(__FILE__);
@@ -250,7 +433,10 @@ int main(void) {
 	tcase_add_test(tc, test_g_variant_sanitize_object_path);
 	tcase_add_test(tc, test_batostr_);
 	tcase_add_test(tc, test_difftimespec);
+	tcase_add_test(tc, test_asrsync);
 	tcase_add_test(tc, test_fifo_buffer);
+	tcase_add_test(tc, test_fifo_buffer_ring);
+	tcase_add_test(tc, test_shm_ring);
 
 	srunner_run_all(sr, CK_ENV);
 	int nf = srunner_ntests_failed(sr);